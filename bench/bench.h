@@ -0,0 +1,59 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GOODRV_BENCH_H
+#define GOODRV_BENCH_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Seconds since the time, read from the monotonic clock.
+ */
+static inline double bench_elapsed_sec(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+/*
+ * Print a result line, as read by bench_compare.sh: the benchmark and its
+ * parameters from the format, followed by the operations, the time they took
+ * and ns_per_op. Other metrics of the line go in the format too.
+ */
+static inline void bench_report(unsigned long ops, double seconds, const char *format, ...)
+		__attribute__ ((format(printf, 3, 4)));
+
+static inline void bench_report(unsigned long ops, double seconds, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+	printf(" ops=%lu seconds=%.3f ns_per_op=%.1f\n", ops, seconds, seconds * 1e9 / ops);
+	fflush(stdout);
+}
+
+#endif /* GOODRV_BENCH_H */
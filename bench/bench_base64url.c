@@ -0,0 +1,75 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "base64url.h"
+#include "bench.h"
+
+/* Minimum time each size is run for */
+#define MIN_SECONDS 0.2
+
+/* Time the encoding of inputs of the size, and print the throughput */
+static void run(size_t size);
+
+/*
+ * Throughput of base64url_encode, from the size of a JWT claim set to that
+ * of a large signature block.
+ */
+int main() {
+	size_t sizes[] = { 64, 256, 4096, 65536, 1024 * 1024 };
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		run(sizes[i]);
+	}
+	return 0;
+}
+
+static void run(size_t size) {
+	unsigned char *input = malloc(size);
+	unsigned int seed = 1;
+	for (size_t i = 0; i < size; i++) {
+		input[i] = rand_r(&seed);
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long ops = 0;
+	double seconds;
+	do {
+		/* A batch between the clock reads, so that small sizes are not dominated by them */
+		for (int i = 0; i < 64; i++) {
+			size_t output_len;
+			free(base64url_encode(input, size, &output_len));
+		}
+		ops += 64;
+	} while ((seconds = bench_elapsed_sec(&start)) < MIN_SECONDS);
+
+	bench_report(ops, seconds, "base64url_encode size=%zu mb_per_s=%.1f", size,
+			(double) size * ops / seconds / (1024 * 1024));
+	free(input);
+}
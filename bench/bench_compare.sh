@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Compare two result files of "make bench".
+#
+# Every result line is "<benchmark> key=value...". Lines of the two files are
+# matched by the benchmark name and all their parameters; the measurements
+# (counts like ops and events, and values with a unit like seconds, ns_per_op,
+# mb_per_s or p99_us) are left out of the match.
+# A case whose ns_per_op grew by more than the threshold is a regression.
+#
+# Usage: bench_compare.sh BASELINE CURRENT [THRESHOLD_PERCENT]
+#
+# Exits with 1 if there is a regression, 2 on bad usage.
+#
+
+if [ $# -lt 2 ] || [ ! -r "$1" ] || [ ! -r "$2" ]; then
+	echo "Usage: $0 BASELINE CURRENT [THRESHOLD_PERCENT]" >&2
+	exit 2
+fi
+
+awk -v threshold="${3:-10}" '
+function is_metric(field) {
+	return field ~ /^(seconds|ops|events|detected|overflows|changes)=/ \
+		|| field ~ /_(per_op|per_entry|per_s|ns|us|ms)=/
+}
+
+# Key of the result line, and its ns_per_op in "value"
+function parse(    i, key) {
+	key = $1
+	value = ""
+	for (i = 2; i <= NF; i++) {
+		if ($i ~ /^ns_per_op=/) {
+			value = substr($i, 11)
+		} else if (!is_metric($i)) {
+			key = key " " $i
+		}
+	}
+	return key
+}
+
+FNR == 1 { file++ }
+file == 1 {
+	key = parse()
+	if (value != "") {
+		baseline[key] = value
+	}
+	next
+}
+{
+	key = parse()
+	if (value == "") {
+		next
+	}
+	if (!(key in baseline)) {
+		printf "%-50s %14s %14.1f %8s\n", key, "-", value, "new"
+		next
+	}
+	change = (baseline[key] > 0) ? (value - baseline[key]) * 100 / baseline[key] : 0
+	mark = ""
+	if (change > threshold) {
+		mark = "REGRESSION"
+		regressions++
+	}
+	printf "%-50s %14.1f %14.1f %+7.1f%% %s\n", key, baseline[key], value, change, mark
+}
+END {
+	if (regressions > 0) {
+		printf "%d case(s) slower by more than %s%%\n", regressions, threshold
+		exit 1
+	}
+}' "$1" "$2"
@@ -0,0 +1,131 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "compress.h"
+#include "loopback.h"
+#include "upload.h"
+
+/* Number of text files, and of files that are already compressed */
+#define NUM_TEXT_FILES 8
+#define NUM_MEDIA_FILES 2
+#define FILE_SIZE (4 * 1024 * 1024)
+/* Default bandwidth of the loopback link, in bytes per second */
+#define DEFAULT_BANDWIDTH (20 * 1024 * 1024)
+
+/* Create the files of the tree */
+static void make_tree(char *dir, char **paths);
+/* Upload the tree over a capped link, and print the effective throughput */
+static void run(const char *mode, char **paths, char *state_dir, unsigned long long bandwidth,
+		struct compress_options *compress);
+
+/*
+ * Effective throughput of uploads with and without compression, over a
+ * loopback transport capped to the bandwidth (bytes per second) given as the
+ * argument. The tree is text heavy, with a few incompressible files.
+ */
+int main(int argc, char **argv) {
+	unsigned long long bandwidth = (argc > 1) ? strtoull(argv[1], NULL, 10) : DEFAULT_BANDWIDTH;
+	char dir[] = "/tmp/goodrive_bench_XXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	char state_dir[64];
+	snprintf(state_dir, sizeof(state_dir), "%s/state", dir);
+
+	char *paths[NUM_TEXT_FILES + NUM_MEDIA_FILES];
+	make_tree(dir, paths);
+
+	run("plain", paths, state_dir, bandwidth, NULL);
+	enum compress_codec codecs[] = { COMPRESS_ZSTD, COMPRESS_GZIP };
+	const char *modes[] = { "zstd", "gzip" };
+	for (int i = 0; i < 2; i++) {
+		if (compress_codec_available(codecs[i])) {
+			struct compress_options compress;
+			compress_default_options(&compress);
+			compress.codec = codecs[i];
+			run(modes[i], paths, state_dir, bandwidth, &compress);
+		}
+	}
+
+	for (int i = 0; i < NUM_TEXT_FILES + NUM_MEDIA_FILES; i++) {
+		free(paths[i]);
+	}
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	return system(command);
+}
+
+static void make_tree(char *dir, char **paths) {
+	unsigned int seed = 1;
+	for (int i = 0; i < NUM_TEXT_FILES + NUM_MEDIA_FILES; i++) {
+		paths[i] = malloc(strlen(dir) + 32);
+		int is_text = (i < NUM_TEXT_FILES);
+		sprintf(paths[i], "%s/file%d.%s", dir, i, is_text ? "log" : "jpg");
+		FILE *file = fopen(paths[i], "w");
+		assert(file != NULL);
+		long size = 0;
+		while (size < FILE_SIZE) {
+			if (is_text) {
+				size += fprintf(file, "2018-03-%02d %02d:%02d:%02d.%03d INFO [watcher-%d] event %d on /home/user/%x/%x\n",
+						1 + rand_r(&seed) % 28, rand_r(&seed) % 24, rand_r(&seed) % 60,
+						rand_r(&seed) % 60, rand_r(&seed) % 1000, rand_r(&seed) % 8,
+						rand_r(&seed) % 4096, rand_r(&seed) % 256, rand_r(&seed));
+			} else {
+				fputc(rand_r(&seed) >> 7, file);
+				size++;
+			}
+		}
+		fclose(file);
+	}
+}
+
+static void run(const char *mode, char **paths, char *state_dir, unsigned long long bandwidth,
+		struct compress_options *compress) {
+	struct loopback_options lb_options = { 0, 0, -1, 0, bandwidth };
+	struct transport *transport = loopback_create(&lb_options);
+	struct upload_options options;
+	upload_default_options(&options);
+	options.state_dir = state_dir;
+	options.compress = compress;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct upload_stats stats;
+	int failed = upload_files(transport, paths, NUM_TEXT_FILES + NUM_MEDIA_FILES, &options, &stats);
+	double seconds = bench_elapsed_sec(&start);
+	assert(failed == 0);
+
+	unsigned long long file_bytes = stats.bytes_sent - stats.bytes_compressed + stats.bytes_uncompressed;
+	bench_report(stats.files_done, seconds, "compress_upload mode=%s bandwidth=%llu compressed=%lu"
+			" file_bytes=%llu sent_bytes=%llu mb_per_s=%.1f", mode, bandwidth, stats.files_compressed,
+			file_bytes, stats.bytes_sent, file_bytes / seconds / (1024 * 1024));
+	transport->destroy(transport);
+}
@@ -0,0 +1,130 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "hashtable.h"
+
+#define DEFAULT_MAX_ENTRIES 1000000
+#define MIN_ENTRIES 1000
+/* Operations of each kind timed per size; small tables are filled and emptied repeatedly */
+#define MIN_OPS 1000000
+
+/* Generate n keys shaped like the paths in a synced tree */
+static char **make_keys(unsigned long n, const char *prefix);
+/* Free the keys */
+static void free_keys(char **keys, unsigned long n);
+/* Time put, get (hits and misses) and remove on a table of n entries */
+static void run(unsigned long n);
+/* Print a result line, for the number of operations in the time */
+static void report(const char *op, unsigned long n, unsigned long ops, double seconds);
+
+/*
+ * Hashtable operations with string path keys, from 1K entries up to the
+ * number of entries given as the argument, by factors of 10.
+ */
+int main(int argc, char **argv) {
+	unsigned long max_entries = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_ENTRIES;
+	for (unsigned long n = MIN_ENTRIES; n <= max_entries; n *= 10) {
+		run(n);
+	}
+	return 0;
+}
+
+static char **make_keys(unsigned long n, const char *prefix) {
+	char **keys = malloc(n * sizeof(char *));
+	char buf[128];
+	for (unsigned long i = 0; i < n; i++) {
+		snprintf(buf, sizeof(buf), "%s/Documents/project%03lu/src/module%03lu/file%07lu.c", prefix,
+				i % 997, (i / 997) % 211, i);
+		keys[i] = strdup(buf);
+	}
+	return keys;
+}
+
+static void free_keys(char **keys, unsigned long n) {
+	for (unsigned long i = 0; i < n; i++) {
+		free(keys[i]);
+	}
+	free(keys);
+}
+
+static void run(unsigned long n) {
+	char **keys = make_keys(n, "/home/user");
+	char **missing = make_keys(n, "/home/other");
+	unsigned long rounds = (n < MIN_OPS) ? MIN_OPS / n : 1;
+	double put_sec = 0, hit_sec = 0, miss_sec = 0, remove_sec = 0;
+	struct timespec start;
+
+	for (unsigned long round = 0; round < rounds; round++) {
+		hashtable table = ht_create(NULL);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < n; i++) {
+			ht_put(table, keys[i], keys[i]);
+		}
+		put_sec += bench_elapsed_sec(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		unsigned long found = 0;
+		for (unsigned long i = 0; i < n; i++) {
+			found += (ht_get(table, keys[i]) != NULL);
+		}
+		hit_sec += bench_elapsed_sec(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < n; i++) {
+			found += (ht_get(table, missing[i]) != NULL);
+		}
+		miss_sec += bench_elapsed_sec(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < n; i++) {
+			ht_remove(table, keys[i]);
+		}
+		remove_sec += bench_elapsed_sec(&start);
+
+		if (found != n || ht_num_entries(table) != 0) {
+			fprintf(stderr, "hashtable: %lu of %lu keys found\n", found, n);
+			exit(1);
+		}
+		ht_destroy(table);
+	}
+
+	report("put", n, n * rounds, put_sec);
+	report("get_hit", n, n * rounds, hit_sec);
+	report("get_miss", n, n * rounds, miss_sec);
+	report("remove", n, n * rounds, remove_sec);
+	free_keys(keys, n);
+	free_keys(missing, n);
+}
+
+static void report(const char *op, unsigned long n, unsigned long ops, double seconds) {
+	bench_report(ops, seconds, "hashtable op=%s entries=%lu", op, n);
+}
@@ -0,0 +1,111 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+
+#include "bench.h"
+#include "jwt.h"
+
+/* Minimum time the signing is run for */
+#define MIN_SECONDS 1.0
+
+/* Write a service account key file with a fresh RSA-2048 key, as the Drive console does */
+static int write_key_file(const char *path);
+
+/*
+ * Latency of building a signed JWT from a service account key file, which is
+ * paid on every token refresh of every account.
+ */
+int main() {
+	char path[] = "/tmp/goodrive_bench_jwt_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd == -1) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	if (write_key_file(path) != 0) {
+		fprintf(stderr, "build_jwt: cannot create the key file\n");
+		unlink(path);
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long ops = 0;
+	double seconds;
+	do {
+		char *jwt;
+		if (build_jwt_from_file(path, &jwt, NULL) != 0) {
+			fprintf(stderr, "build_jwt: signing failed\n");
+			unlink(path);
+			return 1;
+		}
+		free(jwt);
+		ops++;
+	} while ((seconds = bench_elapsed_sec(&start)) < MIN_SECONDS);
+
+	bench_report(ops, seconds, "build_jwt key=rsa2048");
+	unlink(path);
+	return 0;
+}
+
+static int write_key_file(const char *path) {
+	EVP_PKEY *pkey = EVP_RSA_gen(2048);
+	if (pkey == NULL) {
+		return -1;
+	}
+	BIO *bio = BIO_new(BIO_s_mem());
+	PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL);
+	char *pem;
+	long pem_len = BIO_get_mem_data(bio, &pem);
+
+	FILE *file = fopen(path, "w");
+	int ret = -1;
+	if (file != NULL) {
+		fprintf(file, "{\"client_email\": \"bench@goodrive.iam.gserviceaccount.com\", \"private_key\": \"");
+		/* The newlines of the PEM block are escaped in the JSON string */
+		for (long i = 0; i < pem_len; i++) {
+			if (pem[i] == '\n') {
+				fputs("\\n", file);
+			} else {
+				fputc(pem[i], file);
+			}
+		}
+		fprintf(file, "\"}\n");
+		ret = (fclose(file) == 0) ? 0 : -1;
+	}
+
+	BIO_free(bio);
+	EVP_PKEY_free(pkey);
+	return ret;
+}
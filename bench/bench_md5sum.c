@@ -0,0 +1,142 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "linux-api.h"
+
+#define DEFAULT_TREE_ENTRIES 10000
+/* Files in each directory of the synthetic tree */
+#define FILES_PER_DIR 50
+/* Minimum time each case is run for */
+#define MIN_SECONDS 0.5
+
+/* Write a file of the size with pseudo-random contents */
+static void write_file(const char *path, size_t size);
+/* Create a tree of about the number of entries, in directories of FILES_PER_DIR files */
+static unsigned long make_tree(const char *root, unsigned long entries);
+/* Time md5sum_file on a file of the size, and print the throughput */
+static void run_file(const char *dir, size_t size);
+/* Time md5sum_fsh on the tree */
+static void run_fsh(const char *root, unsigned long entries);
+
+/*
+ * md5sum_file over a range of file sizes, and md5sum_fsh over a synthetic
+ * tree with the number of entries given as the argument.
+ */
+int main(int argc, char **argv) {
+	unsigned long tree_entries = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_TREE_ENTRIES;
+	char dir[] = "/tmp/goodrive_bench_md5_XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	size_t sizes[] = { 4096, 1024 * 1024, 16 * 1024 * 1024 };
+	for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		run_file(dir, sizes[i]);
+	}
+
+	char root[64];
+	snprintf(root, sizeof(root), "%s/tree", dir);
+	unsigned long entries = make_tree(root, tree_entries);
+	run_fsh(root, entries);
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	return system(command) == 0 ? 0 : 1;
+}
+
+static void write_file(const char *path, size_t size) {
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		perror(path);
+		exit(1);
+	}
+	unsigned int seed = size;
+	for (size_t i = 0; i < size; i++) {
+		fputc(rand_r(&seed) & 0xff, file);
+	}
+	fclose(file);
+}
+
+static unsigned long make_tree(const char *root, unsigned long entries) {
+	char path[256];
+	unsigned long made = 0;
+	mkdir(root, 0755);
+	for (unsigned long d = 0; made < entries; d++) {
+		snprintf(path, sizeof(path), "%s/dir%05lu", root, d);
+		mkdir(path, 0755);
+		made++;
+		for (int f = 0; f < FILES_PER_DIR && made < entries; f++) {
+			snprintf(path, sizeof(path), "%s/dir%05lu/file%03d.txt", root, d, f);
+			write_file(path, 0);
+			made++;
+		}
+	}
+	return made;
+}
+
+static void run_file(const char *dir, size_t size) {
+	char path[128];
+	snprintf(path, sizeof(path), "%s/file%zu", dir, size);
+	write_file(path, size);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long ops = 0;
+	double seconds;
+	do {
+		free(md5sum_file(path));
+		ops++;
+	} while ((seconds = bench_elapsed_sec(&start)) < MIN_SECONDS);
+
+	bench_report(ops, seconds, "md5sum_file size=%zu mb_per_s=%.1f", size,
+			(double) size * ops / seconds / (1024 * 1024));
+	unlink(path);
+}
+
+static void run_fsh(const char *root, unsigned long entries) {
+	/* Warm the dentry and inode caches, so that the runs are comparable */
+	free(md5sum_fsh((char *) root));
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long ops = 0;
+	double seconds;
+	do {
+		free(md5sum_fsh((char *) root));
+		ops++;
+	} while ((seconds = bench_elapsed_sec(&start)) < MIN_SECONDS);
+
+	bench_report(ops, seconds, "md5sum_fsh entries=%lu ns_per_entry=%.1f", entries,
+			seconds * 1e9 / ops / entries);
+}
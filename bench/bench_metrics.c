@@ -0,0 +1,77 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+#include "metrics.h"
+
+#define DEFAULT_EVENTS 10000000
+#define NUM_THREADS 4
+
+/* Record the events in the calling thread */
+static void *record_events(void *arg);
+/* Time the recording of the events by the threads, and print the cost of an event */
+static void run(unsigned int num_threads, long num_events);
+
+/*
+ * Cost of recording a counter and a latency, in one thread and in several
+ * threads at once. The latencies are recorded without reading the clock, to
+ * time the recording alone.
+ */
+int main(int argc, char **argv) {
+	long num_events = (argc > 1) ? strtol(argv[1], NULL, 10) : DEFAULT_EVENTS;
+	run(1, num_events);
+	run(NUM_THREADS, num_events);
+	return 0;
+}
+
+static void *record_events(void *arg) {
+	long num_events = *(long *) arg;
+	for (long i = 0; i < num_events; i++) {
+		metrics_add(METRIC_ENTRIES_SCANNED, 1);
+		metrics_record(METRIC_DIR_LIST, i & 0xffff);
+	}
+	return NULL;
+}
+
+static void run(unsigned int num_threads, long num_events) {
+	pthread_t threads[NUM_THREADS];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < num_threads; i++) {
+		pthread_create(&threads[i], NULL, &record_events, &num_events);
+	}
+	for (unsigned int i = 0; i < num_threads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	double seconds = bench_elapsed_sec(&start);
+
+	/* A counter and a latency per iteration, each an operation */
+	bench_report(2 * num_events * num_threads, seconds, "metrics_record threads=%u", num_threads);
+}
@@ -0,0 +1,274 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bqueue.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "ring.h"
+
+#define DEFAULT_ITEMS 10000000
+#define RING_CAPACITY 1024
+#define MAX_PRODUCERS 4
+#define MAX_BATCH 32
+#define ROUND_TRIPS 100000
+
+enum queue_kind {
+	QUEUE_SPSC,
+	QUEUE_MPSC,
+	/* The mutex and condition variable queue, as the baseline */
+	QUEUE_BQUEUE
+};
+
+/*
+ * One of the queues, with the same interface for all
+ */
+struct bench_queue {
+	enum queue_kind kind;
+	spsc_ring spsc;
+	mpsc_ring mpsc;
+	bqueue bq;
+	/* Consumer spins on an empty ring, instead of sleeping on the eventfd */
+	int spin;
+};
+
+/*
+ * A throughput run, shared by its producers
+ */
+struct throughput_run {
+	struct bench_queue *queue;
+	long items_per_producer;
+	unsigned int batch;
+};
+
+/*
+ * The two queues of a ping-pong
+ */
+struct ping_pong {
+	struct bench_queue *ping;
+	struct bench_queue *pong;
+};
+
+static const char *queue_names[] = { "spsc", "mpsc", "bqueue" };
+
+/* Create a queue of the kind */
+static struct bench_queue *queue_create(enum queue_kind kind, int spin);
+/* Free the queue */
+static void queue_destroy(struct bench_queue *queue);
+/* Push all the items, retrying while the queue is full */
+static void queue_push(struct bench_queue *queue, void **items, unsigned int count);
+/* Pop up to max items, waiting (or spinning) while the queue is empty */
+static unsigned int queue_pop(struct bench_queue *queue, void **items, unsigned int max);
+/* Push the items of a producer, in batches */
+static void *produce(void *arg);
+/* Send back every item received, till a NULL one */
+static void *echo(void *arg);
+/* Time the handoff of the items from the producers to a consumer */
+static void run_throughput(enum queue_kind kind, unsigned int num_producers, unsigned int batch, long items);
+/* Time the round trips of an item between two threads, and print the one way latencies */
+static void run_latency(enum queue_kind kind, int spin);
+
+/*
+ * Throughput of the SPSC and MPSC rings, with single items and batches, and
+ * with the bqueue as the baseline; then the latency of a handoff between two
+ * threads, with the consumer spinning (given more than one CPU) or sleeping
+ * on the eventfd.
+ */
+int main(int argc, char **argv) {
+	long items = (argc > 1) ? strtol(argv[1], NULL, 10) : DEFAULT_ITEMS;
+	unsigned int batches[] = { 1, MAX_BATCH };
+	for (int i = 0; i < 2; i++) {
+		run_throughput(QUEUE_SPSC, 1, batches[i], items);
+		for (unsigned int producers = 1; producers <= MAX_PRODUCERS; producers *= 2) {
+			run_throughput(QUEUE_MPSC, producers, batches[i], items);
+		}
+	}
+	run_throughput(QUEUE_BQUEUE, 1, 1, items / 10);
+	run_throughput(QUEUE_BQUEUE, MAX_PRODUCERS, 1, items / 10);
+
+	/* A spinning consumer holds the only CPU till it is preempted */
+	int spin = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+	if (!spin) {
+		fprintf(stderr, "ring_bench: a single CPU, skipping the spinning consumers\n");
+	}
+	for (enum queue_kind kind = QUEUE_SPSC; kind <= QUEUE_MPSC; kind++) {
+		if (spin) {
+			run_latency(kind, 1);
+		}
+		run_latency(kind, 0);
+	}
+	run_latency(QUEUE_BQUEUE, 0);
+	return 0;
+}
+
+static struct bench_queue *queue_create(enum queue_kind kind, int spin) {
+	struct bench_queue *queue = calloc(1, sizeof(struct bench_queue));
+	queue->kind = kind;
+	queue->spin = spin;
+	if (kind == QUEUE_SPSC) {
+		queue->spsc = spsc_create(RING_CAPACITY);
+	} else if (kind == QUEUE_MPSC) {
+		queue->mpsc = mpsc_create(RING_CAPACITY);
+	} else {
+		queue->bq = bq_create(RING_CAPACITY);
+	}
+	return queue;
+}
+
+static void queue_destroy(struct bench_queue *queue) {
+	spsc_destroy(queue->spsc);
+	mpsc_destroy(queue->mpsc);
+	bq_destroy(queue->bq);
+	free(queue);
+}
+
+static void queue_push(struct bench_queue *queue, void **items, unsigned int count) {
+	while (count > 0) {
+		unsigned int pushed;
+		if (queue->kind == QUEUE_SPSC) {
+			pushed = spsc_push_batch(queue->spsc, items, count);
+		} else if (queue->kind == QUEUE_MPSC) {
+			pushed = mpsc_push_batch(queue->mpsc, items, count);
+		} else {
+			bq_push(queue->bq, items[0]);
+			pushed = 1;
+		}
+		if (pushed == 0) {
+			sched_yield();
+		}
+		items += pushed;
+		count -= pushed;
+	}
+}
+
+static unsigned int queue_pop(struct bench_queue *queue, void **items, unsigned int max) {
+	unsigned int popped;
+	if (queue->kind == QUEUE_SPSC) {
+		while ((popped = spsc_pop_batch(queue->spsc, items, max)) == 0) {
+			if (!queue->spin) {
+				spsc_wait(queue->spsc);
+			}
+		}
+	} else if (queue->kind == QUEUE_MPSC) {
+		while ((popped = mpsc_pop_batch(queue->mpsc, items, max)) == 0) {
+			if (!queue->spin) {
+				mpsc_wait(queue->mpsc);
+			}
+		}
+	} else {
+		bq_pop(queue->bq, items);
+		popped = 1;
+	}
+	return popped;
+}
+
+static void *produce(void *arg) {
+	struct throughput_run *run = arg;
+	void *items[MAX_BATCH];
+	for (unsigned int i = 0; i < run->batch; i++) {
+		items[i] = &items[i];
+	}
+	for (long sent = 0; sent < run->items_per_producer; sent += run->batch) {
+		long count = run->items_per_producer - sent;
+		queue_push(run->queue, items, (count < run->batch) ? count : run->batch);
+	}
+	return NULL;
+}
+
+static void *echo(void *arg) {
+	struct ping_pong *ping_pong = arg;
+	void *item;
+	do {
+		queue_pop(ping_pong->ping, &item, 1);
+		queue_push(ping_pong->pong, &item, 1);
+	} while (item != NULL);
+	return NULL;
+}
+
+static void run_throughput(enum queue_kind kind, unsigned int num_producers, unsigned int batch, long items) {
+	struct throughput_run run;
+	run.queue = queue_create(kind, 0);
+	run.items_per_producer = items / num_producers;
+	run.batch = batch;
+	long total = run.items_per_producer * num_producers;
+
+	pthread_t threads[MAX_PRODUCERS];
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < num_producers; i++) {
+		pthread_create(&threads[i], NULL, &produce, &run);
+	}
+	void *received[MAX_BATCH];
+	for (long count = 0; count < total;) {
+		count += queue_pop(run.queue, received, batch);
+	}
+	double seconds = bench_elapsed_sec(&start);
+	for (unsigned int i = 0; i < num_producers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	queue_destroy(run.queue);
+
+	bench_report(total, seconds, "ring queue=%s producers=%u batch=%u ops_per_s=%.0f", queue_names[kind],
+			num_producers, batch, total / seconds);
+}
+
+static void run_latency(enum queue_kind kind, int spin) {
+	struct ping_pong ping_pong;
+	ping_pong.ping = queue_create(kind, spin);
+	ping_pong.pong = queue_create(kind, spin);
+	pthread_t thread;
+	pthread_create(&thread, NULL, &echo, &ping_pong);
+
+	struct histogram hist;
+	hist_init(&hist);
+	void *item = &hist;
+	struct timespec loop_start;
+	clock_gettime(CLOCK_MONOTONIC, &loop_start);
+	for (int i = 0; i < ROUND_TRIPS; i++) {
+		uint64_t start = metrics_now();
+		queue_push(ping_pong.ping, &item, 1);
+		queue_pop(ping_pong.pong, &item, 1);
+		hist_record(&hist, (metrics_now() - start) / 2);
+	}
+	double seconds = bench_elapsed_sec(&loop_start);
+	item = NULL;
+	queue_push(ping_pong.ping, &item, 1);
+	pthread_join(thread, NULL);
+	queue_destroy(ping_pong.ping);
+	queue_destroy(ping_pong.pong);
+
+	/* Each round trip is two handoffs */
+	bench_report(2 * ROUND_TRIPS, seconds, "ring_handoff queue=%s mode=%s p50_ns=%llu p99_ns=%llu mean_ns=%.0f",
+			queue_names[kind], spin ? "spin" : "wait", (unsigned long long) hist_percentile(&hist, 50),
+			(unsigned long long) hist_percentile(&hist, 99), hist_mean(&hist));
+}
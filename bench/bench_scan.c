@@ -0,0 +1,322 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "hashtable.h"
+#include "histogram.h"
+#include "linux-api.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "treediff.h"
+#include "treegen.h"
+
+#define DEFAULT_ENTRIES 20000
+#define DEFAULT_OPS 1000
+/* Data written into a generated tree; the files beyond it are sparse */
+#define MAX_TREE_BYTES (64 * 1024 * 1024)
+/* Minimum time each scan is repeated for */
+#define MIN_SECONDS 0.5
+/* Time without events after which the undetected mutations are given up on */
+#define IDLE_TIMEOUT_MS 1000
+#define EVENT_BUF_SIZE 65536
+
+/*
+ * A mutation waiting to be seen through inotify
+ */
+struct pending_op {
+	char *name;
+	uint64_t start;
+	int detected;
+};
+
+/*
+ * State of a workload replay, shared by the mutating thread and the reader
+ */
+struct replay {
+	struct treegen_files files;
+	enum treegen_workload workload;
+	uint64_t seed;
+	unsigned long max_ops;
+	pthread_mutex_t lock;
+	/* Name of the mutation -> struct pending_op */
+	hashtable pending;
+	struct pending_op *ops;
+	unsigned long num_ops;
+	int mutations_done;
+};
+
+/* Generate a tree of the profile, and run the scans and workloads on it */
+static void run_profile(const struct treegen_profile *profile, unsigned long entries, unsigned long ops);
+/* Time a scan of the tree, repeating it for MIN_SECONDS */
+static void run_scan(const char *op, const char *profile, unsigned long entries, const char *root);
+/* Replay the workload while reading the inotify events, and print the detection latencies */
+static void run_workload(const char *profile, unsigned long entries, const char *root, int fd,
+		enum treegen_workload workload, unsigned long ops);
+/* Scan once with the function named by op */
+static void scan_once(const char *op, const char *root);
+/* Hook of treegen_mutate: note the start of a mutation */
+static void before_op(const char *name, void *arg);
+/* Thread replaying the workload */
+static void *mutate_thread(void *arg);
+/* Change handler counting nothing, as tdiff_compare returns the count */
+static void ignore_change(struct tdiff_change *change, void *arg);
+
+/*
+ * End-to-end cost of keeping a tree in sync: the scans at startup, and the
+ * latency from a mutation to its inotify event being read, for edit bursts,
+ * mass renames and checkout storms, followed by the rescan that finds the
+ * changes.
+ *
+ * scan_bench [ENTRIES] [OPS] [PROFILE]...
+ */
+int main(int argc, char **argv) {
+	unsigned long entries = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_ENTRIES;
+	unsigned long ops = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_OPS;
+	if (argc > 3) {
+		for (int i = 3; i < argc; i++) {
+			const struct treegen_profile *profile = treegen_find_profile(argv[i]);
+			if (profile == NULL) {
+				fprintf(stderr, "scan_bench: no profile named %s\n", argv[i]);
+				return 2;
+			}
+			run_profile(profile, entries, ops);
+		}
+	} else {
+		for (const struct treegen_profile *profile = treegen_profiles; profile->name != NULL; profile++) {
+			run_profile(profile, entries, ops);
+		}
+	}
+	return 0;
+}
+
+static void run_profile(const struct treegen_profile *profile, unsigned long entries, unsigned long ops) {
+	char dir[] = "/tmp/goodrive_bench_scan_XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	char root[64];
+	snprintf(root, sizeof(root), "%s/tree", dir);
+
+	struct treegen_options options;
+	options.seed = 1;
+	options.max_entries = entries;
+	options.max_bytes = MAX_TREE_BYTES;
+	struct treegen_stats stats;
+	uint64_t start = metrics_now();
+	if (treegen_create(root, profile, &options, &stats) != 0) {
+		perror(root);
+		exit(1);
+	}
+	/* The depth of the profile may cap the tree below the requested size */
+	entries = stats.dirs + stats.files;
+	printf("treegen profile=%s entries=%lu dirs=%lu files=%lu seconds=%.3f\n", profile->name, entries,
+			stats.dirs, stats.files, (metrics_now() - start) / 1e9);
+	fflush(stdout);
+
+	run_scan("md5sum_fsh", profile->name, entries, root);
+	run_scan("snap_scan", profile->name, entries, root);
+	run_scan("watch", profile->name, entries, root);
+
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	char *md5sum;
+	watch_md5sum_fsh(fd, &md5sum, root);
+	free(md5sum);
+	run_workload(profile->name, entries, root, fd, TREEGEN_EDIT_BURST, ops);
+	run_workload(profile->name, entries, root, fd, TREEGEN_MASS_RENAME, ops);
+	run_workload(profile->name, entries, root, fd, TREEGEN_CHECKOUT_STORM, ops);
+	close(fd);
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	if (system(command) != 0) {
+		fprintf(stderr, "scan_bench: cannot remove %s\n", dir);
+	}
+}
+
+static void run_scan(const char *op, const char *profile, unsigned long entries, const char *root) {
+	/* Warm the dentry and inode caches, so that the runs are comparable */
+	scan_once(op, root);
+
+	uint64_t start = metrics_now();
+	unsigned long ops = 0;
+	double seconds;
+	do {
+		scan_once(op, root);
+		ops++;
+	} while ((seconds = (metrics_now() - start) / 1e9) < MIN_SECONDS);
+
+	bench_report(ops, seconds, "scan op=%s profile=%s entries=%lu ns_per_entry=%.1f", op, profile,
+			entries, seconds * 1e9 / ops / entries);
+}
+
+static void scan_once(const char *op, const char *root) {
+	if (strcmp(op, "md5sum_fsh") == 0) {
+		free(md5sum_fsh((char *) root));
+	} else if (strcmp(op, "snap_scan") == 0) {
+		snap_destroy(snap_scan((char *) root, 0));
+	} else {
+		/* A new inotify instance each time, as adding a watch again is cheaper */
+		char *md5sum;
+		int fd = watch_md5sum_fsh(-1, &md5sum, (char *) root);
+		free(md5sum);
+		close(fd);
+	}
+}
+
+static void run_workload(const char *profile, unsigned long entries, const char *root, int fd,
+		enum treegen_workload workload, unsigned long ops) {
+	snapshot before = snap_scan((char *) root, 0);
+
+	struct replay replay;
+	if (treegen_list(root, &replay.files) != 0) {
+		perror(root);
+		exit(1);
+	}
+	replay.workload = workload;
+	replay.seed = workload + 1;
+	replay.max_ops = ops;
+	pthread_mutex_init(&replay.lock, NULL);
+	ht_options options = default_ht_options();
+	replay.pending = ht_create(options);
+	free(options);
+	replay.ops = malloc(ops * sizeof(struct pending_op));
+	replay.num_ops = 0;
+	replay.mutations_done = 0;
+
+	struct histogram latency_us;
+	hist_init(&latency_us);
+	unsigned long events = 0, overflows = 0, detected = 0;
+	char *buf = malloc(EVENT_BUF_SIZE);
+	/* Drop the events of the scan and the listing, like the directories being opened */
+	while (read(fd, buf, EVENT_BUF_SIZE) > 0);
+	uint64_t start = metrics_now(), last_event = start, last_detected = start;
+
+	pthread_t mutator;
+	pthread_create(&mutator, NULL, &mutate_thread, &replay);
+	for (;;) {
+		pthread_mutex_lock(&replay.lock);
+		int finished = replay.mutations_done && detected == replay.num_ops;
+		int idle = replay.mutations_done && (metrics_now() - last_event) / 1000000 >= IDLE_TIMEOUT_MS;
+		pthread_mutex_unlock(&replay.lock);
+		if (finished || idle) {
+			break;
+		}
+
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;
+		}
+		ssize_t len;
+		while ((len = read(fd, buf, EVENT_BUF_SIZE)) > 0) {
+			uint64_t now = metrics_now();
+			last_event = now;
+			for (char *ptr = buf; ptr < buf + len;) {
+				struct inotify_event *event = (struct inotify_event *) ptr;
+				ptr += sizeof(struct inotify_event) + event->len;
+				events++;
+				if (event->mask & IN_Q_OVERFLOW) {
+					overflows++;
+				}
+				if (event->len == 0) {
+					continue;
+				}
+				pthread_mutex_lock(&replay.lock);
+				struct pending_op *op = ht_get(replay.pending, event->name);
+				if (op != NULL && !op->detected) {
+					op->detected = 1;
+					detected++;
+					hist_record(&latency_us, (now - op->start) / 1000);
+					last_detected = now;
+				}
+				pthread_mutex_unlock(&replay.lock);
+			}
+		}
+	}
+	pthread_join(mutator, NULL);
+	double seconds = (last_detected - start) / 1e9;
+
+	/* What a sync does next: find the changes by a rescan */
+	uint64_t rescan_start = metrics_now();
+	snapshot after = snap_scan((char *) root, 0);
+	long changes = tdiff_compare(before, after, &ignore_change, NULL);
+	double rescan_ms = (metrics_now() - rescan_start) / 1e6;
+
+	/* The daemon watches the new directories after a sync, and so does the next workload */
+	char *md5sum;
+	watch_md5sum_fsh(fd, &md5sum, (char *) root);
+	free(md5sum);
+
+	printf("watch profile=%s entries=%lu workload=%s ops=%lu detected=%lu events=%lu overflows=%lu "
+			"seconds=%.3f ns_per_op=%.1f p50_us=%llu p99_us=%llu max_us=%llu rescan_ms=%.1f changes=%ld\n",
+			profile, entries, treegen_workload_name(workload), replay.num_ops, detected, events, overflows,
+			seconds, replay.num_ops ? seconds * 1e9 / replay.num_ops : 0.0,
+			(unsigned long long) hist_percentile(&latency_us, 50),
+			(unsigned long long) hist_percentile(&latency_us, 99), (unsigned long long) latency_us.max,
+			rescan_ms, changes);
+	fflush(stdout);
+
+	for (unsigned long i = 0; i < replay.num_ops; i++) {
+		free(replay.ops[i].name);
+	}
+	free(replay.ops);
+	treegen_free_files(&replay.files);
+	ht_destroy(replay.pending);
+	pthread_mutex_destroy(&replay.lock);
+	free(buf);
+	snap_destroy(before);
+	snap_destroy(after);
+}
+
+static void before_op(const char *name, void *arg) {
+	struct replay *replay = arg;
+	pthread_mutex_lock(&replay->lock);
+	struct pending_op *op = &replay->ops[replay->num_ops++];
+	op->name = strdup(name);
+	op->detected = 0;
+	op->start = metrics_now();
+	ht_put(replay->pending, op->name, op);
+	pthread_mutex_unlock(&replay->lock);
+}
+
+static void *mutate_thread(void *arg) {
+	struct replay *replay = arg;
+	treegen_mutate(&replay->files, replay->workload, replay->seed, replay->max_ops, &before_op, replay);
+	pthread_mutex_lock(&replay->lock);
+	replay->mutations_done = 1;
+	pthread_mutex_unlock(&replay->lock);
+	return NULL;
+}
+
+static void ignore_change(struct tdiff_change *change, void *arg) {
+}
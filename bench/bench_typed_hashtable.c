@@ -0,0 +1,198 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bench.h"
+#include "hashtable.h"
+#include "typed_hashtable.h"
+
+#define DEFAULT_MAX_ENTRIES 1000000
+#define MIN_ENTRIES 1000
+/* Operations of each kind timed per size; small tables are filled and emptied repeatedly */
+#define MIN_OPS 1000000
+
+/*
+ * Times of the operations of one implementation, summed over the rounds
+ */
+struct timings {
+	double put_sec;
+	double hit_sec;
+	double miss_sec;
+	double remove_sec;
+};
+
+/* Generate n inode numbers, spread like the ones of a large file system */
+static uint64_t *make_keys(unsigned long n, uint64_t seed);
+/* Hash code of a boxed inode number, for hashtable.h */
+static int hash_fn_u64(void *key);
+/* Check whether two boxed inode numbers are equal, for hashtable.h */
+static int equals_u64(void *value1, void *value2);
+/* Time one round of the operations on hashtable.h */
+static void run_generic(uint64_t *keys, uint64_t *missing, unsigned long n, struct timings *timings);
+/* Time one round of the operations on inode_map */
+static void run_typed(uint64_t *keys, uint64_t *missing, unsigned long n, struct timings *timings);
+/* Time both tables with n entries */
+static void run(unsigned long n);
+/* Print the result lines of an implementation */
+static void report(const char *impl, unsigned long n, unsigned long ops, struct timings *timings);
+
+/*
+ * Inode number to path id maps, the generic hashtable against the one
+ * specialized by typed_hashtable.h, from 1K entries up to the number of
+ * entries given as the argument, by factors of 10.
+ */
+int main(int argc, char **argv) {
+	unsigned long max_entries = (argc > 1) ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_ENTRIES;
+	for (unsigned long n = MIN_ENTRIES; n <= max_entries; n *= 10) {
+		run(n);
+	}
+	return 0;
+}
+
+static uint64_t *make_keys(unsigned long n, uint64_t seed) {
+	uint64_t *keys = malloc(n * sizeof(uint64_t));
+	for (unsigned long i = 0; i < n; i++) {
+		/* Runs of consecutive inodes, as allocated in a directory, in scattered groups */
+		keys[i] = ((typed_ht_hash_u64(seed + i / 64) & 0xffffffffULL) << 6) + (i % 64) + 1;
+	}
+	return keys;
+}
+
+static int hash_fn_u64(void *key) {
+	return (int) typed_ht_hash_u64(*(uint64_t *) key);
+}
+
+static int equals_u64(void *value1, void *value2) {
+	return *(uint64_t *) value1 == *(uint64_t *) value2;
+}
+
+static void run_generic(uint64_t *keys, uint64_t *missing, unsigned long n, struct timings *timings) {
+	ht_options options = default_ht_options();
+	options->hash_fn = &hash_fn_u64;
+	options->equals = &equals_u64;
+	hashtable table = ht_create(options);
+	free(options);
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		ht_put(table, &keys[i], (void *) (uintptr_t) (i + 1));
+	}
+	timings->put_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long found = 0;
+	for (unsigned long i = 0; i < n; i++) {
+		found += (ht_get(table, &keys[i]) != NULL);
+	}
+	timings->hit_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		found += (ht_get(table, &missing[i]) != NULL);
+	}
+	timings->miss_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		ht_remove(table, &keys[i]);
+	}
+	timings->remove_sec += bench_elapsed_sec(&start);
+
+	if (found != n || ht_num_entries(table) != 0) {
+		fprintf(stderr, "hashtable: %lu of %lu keys found\n", found, n);
+		exit(1);
+	}
+	ht_destroy(table);
+}
+
+static void run_typed(uint64_t *keys, uint64_t *missing, unsigned long n, struct timings *timings) {
+	inode_map map = inode_map_create(0);
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		inode_map_put(map, keys[i], (path_id) (i + 1));
+	}
+	timings->put_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long found = 0;
+	for (unsigned long i = 0; i < n; i++) {
+		found += (inode_map_get(map, keys[i]) != NULL);
+	}
+	timings->hit_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		found += (inode_map_get(map, missing[i]) != NULL);
+	}
+	timings->miss_sec += bench_elapsed_sec(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned long i = 0; i < n; i++) {
+		inode_map_remove(map, keys[i], NULL);
+	}
+	timings->remove_sec += bench_elapsed_sec(&start);
+
+	if (found != n || inode_map_num_entries(map) != 0) {
+		fprintf(stderr, "inode_map: %lu of %lu keys found\n", found, n);
+		exit(1);
+	}
+	inode_map_destroy(map);
+}
+
+static void run(unsigned long n) {
+	uint64_t *keys = make_keys(n, 1);
+	/* Above every key, so none of them is found */
+	uint64_t *missing = make_keys(n, 2);
+	for (unsigned long i = 0; i < n; i++) {
+		missing[i] |= 1ULL << 40;
+	}
+	unsigned long rounds = (n < MIN_OPS) ? MIN_OPS / n : 1;
+	struct timings generic = { 0 }, typed = { 0 };
+
+	for (unsigned long round = 0; round < rounds; round++) {
+		run_generic(keys, missing, n, &generic);
+		run_typed(keys, missing, n, &typed);
+	}
+
+	report("generic", n, n * rounds, &generic);
+	report("typed", n, n * rounds, &typed);
+	free(keys);
+	free(missing);
+}
+
+static void report(const char *impl, unsigned long n, unsigned long ops, struct timings *timings) {
+	const char *names[] = { "put", "get_hit", "get_miss", "remove" };
+	double seconds[] = { timings->put_sec, timings->hit_sec, timings->miss_sec, timings->remove_sec };
+	for (int i = 0; i < 4; i++) {
+		bench_report(ops, seconds[i], "typed_hashtable impl=%s op=%s entries=%lu", impl, names[i], n);
+	}
+}
@@ -0,0 +1,385 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "treegen.h"
+
+/* Size of the block of random bytes that the file contents are made of */
+#define CONTENT_BLOCK_SIZE 65536
+/* Bytes appended to a file by an edit, or written to a new file */
+#define EDIT_SIZE 4096
+
+static const char *const source_extensions[] = { ".c", ".h", ".txt", ".md", ".json", ".py", NULL };
+static const char *const media_extensions[] = { ".jpg", ".png", ".mp4", ".mov", ".mp3", NULL };
+static const char *const monorepo_extensions[] = { ".c", ".h", ".go", ".java", ".proto", ".md", NULL };
+
+const struct treegen_profile treegen_profiles[] = {
+	{ "small", 4, 2, 6, 5, 40, 64, 64 * 1024, 5, 256 * 1024, 4 * 1024 * 1024, source_extensions },
+	{ "media", 2, 2, 8, 10, 200, 256 * 1024, 8 * 1024 * 1024, 50, 32 * 1024 * 1024, 512 * 1024 * 1024,
+			media_extensions },
+	{ "monorepo", 12, 1, 3, 2, 16, 256, 32 * 1024, 2, 128 * 1024, 2 * 1024 * 1024, monorepo_extensions },
+	{ NULL, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL }
+};
+
+static const char *const workload_names[] = { "edit_burst", "mass_rename", "checkout_storm" };
+
+/*
+ * A directory waiting for its children to be generated
+ */
+struct pending_dir {
+	char *path;
+	unsigned int level;
+};
+
+/*
+ * State of a generation
+ */
+struct treegen_ctx {
+	const struct treegen_profile *profile;
+	const struct treegen_options *options;
+	uint64_t rand_state;
+	unsigned char *content;
+	/* Number of entries created, which also makes the names unique */
+	unsigned long entries;
+	/* Bytes actually written, excluding the holes of sparse files */
+	uint64_t written;
+	struct treegen_stats stats;
+};
+
+/* Next number of the SplitMix64 sequence */
+static uint64_t next_rand(uint64_t *state);
+/* Random number in [min, max] */
+static uint64_t rand_between(uint64_t *state, uint64_t min, uint64_t max);
+/* Random file size as per the profile */
+static uint64_t rand_file_size(struct treegen_ctx *ctx);
+/* Fill a block with random bytes */
+static unsigned char *make_content(uint64_t *state);
+/* Write a file of the size; the first bytes are unique to the file, so that no two files are duplicates */
+static int write_file(const char *path, int flags, uint64_t size, unsigned char *content, uint64_t *state);
+/* Generate the files and subdirectories of the directory, adding the subdirectories to the pending list */
+static int fill_dir(struct treegen_ctx *ctx, struct pending_dir *dir, struct pending_dir **pending,
+		unsigned long *num_pending, unsigned long *capacity);
+/* Check whether the entry limit of the generation is reached */
+static int limit_reached(struct treegen_ctx *ctx);
+/* Do one mutation of the workload on the file */
+static void mutate(enum treegen_workload workload, const char *path, uint64_t seed, unsigned long op,
+		unsigned char *content, uint64_t *state, void (*before_op)(const char *name, void *arg), void *arg);
+
+const struct treegen_profile *treegen_find_profile(const char *name) {
+	for (const struct treegen_profile *profile = treegen_profiles; profile->name != NULL; profile++) {
+		if (strcmp(profile->name, name) == 0) {
+			return profile;
+		}
+	}
+	return NULL;
+}
+
+const char *treegen_workload_name(enum treegen_workload workload) {
+	return workload_names[workload];
+}
+
+int treegen_find_workload(const char *name) {
+	for (unsigned int i = 0; i < sizeof(workload_names) / sizeof(workload_names[0]); i++) {
+		if (strcmp(workload_names[i], name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int treegen_create(const char *root, const struct treegen_profile *profile,
+		const struct treegen_options *options, struct treegen_stats *stats) {
+	if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+		return -1;
+	}
+
+	struct treegen_ctx ctx;
+	ctx.profile = profile;
+	ctx.options = options;
+	ctx.rand_state = options->seed;
+	ctx.content = make_content(&ctx.rand_state);
+	ctx.entries = 0;
+	ctx.written = 0;
+	memset(&ctx.stats, 0, sizeof(ctx.stats));
+
+	/* Breadth first, so that a limit on the entries cuts the deepest levels */
+	unsigned long capacity = 64, num_pending = 1, next = 0;
+	struct pending_dir *pending = malloc(capacity * sizeof(struct pending_dir));
+	pending[0].path = strdup(root);
+	pending[0].level = 0;
+	int result = 0;
+	while (next < num_pending) {
+		/* A copy, as the pending list may be moved while the directory is filled */
+		struct pending_dir dir = pending[next++];
+		if (result == 0 && fill_dir(&ctx, &dir, &pending, &num_pending, &capacity) != 0) {
+			result = -1;
+		}
+		free(dir.path);
+	}
+
+	free(pending);
+	free(ctx.content);
+	if (stats != NULL) {
+		*stats = ctx.stats;
+	}
+	return result;
+}
+
+int treegen_list(const char *root, struct treegen_files *files) {
+	struct stat root_stat;
+	if (stat(root, &root_stat) != 0 || !S_ISDIR(root_stat.st_mode)) {
+		return -1;
+	}
+	char *paths[] = { (char *) root, NULL };
+	FTS *fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+	if (fts == NULL) {
+		return -1;
+	}
+	unsigned long capacity = 1024;
+	files->paths = malloc(capacity * sizeof(char *));
+	files->count = 0;
+	FTSENT *ent;
+	while ((ent = fts_read(fts)) != NULL) {
+		if (ent->fts_info != FTS_F) {
+			continue;
+		}
+		if (files->count == capacity) {
+			capacity *= 2;
+			files->paths = realloc(files->paths, capacity * sizeof(char *));
+		}
+		files->paths[files->count++] = strdup(ent->fts_path);
+	}
+	fts_close(fts);
+	return 0;
+}
+
+void treegen_free_files(struct treegen_files *files) {
+	for (unsigned long i = 0; i < files->count; i++) {
+		free(files->paths[i]);
+	}
+	free(files->paths);
+	files->paths = NULL;
+	files->count = 0;
+}
+
+unsigned long treegen_mutate(struct treegen_files *files, enum treegen_workload workload, uint64_t seed,
+		unsigned long ops, void (*before_op)(const char *name, void *arg), void *arg) {
+	if (ops > files->count) {
+		ops = files->count;
+	}
+
+	uint64_t state = seed;
+	unsigned char *content = make_content(&state);
+	for (unsigned long op = 0; op < ops; op++) {
+		/* Partial Fisher-Yates shuffle: no file is picked twice */
+		unsigned long pick = op + rand_between(&state, 0, files->count - op - 1);
+		char *path = files->paths[pick];
+		files->paths[pick] = files->paths[op];
+		files->paths[op] = path;
+		mutate(workload, path, seed, op, content, &state, before_op, arg);
+	}
+	free(content);
+	return ops;
+}
+
+static uint64_t next_rand(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static uint64_t rand_between(uint64_t *state, uint64_t min, uint64_t max) {
+	return min + next_rand(state) % (max - min + 1);
+}
+
+static uint64_t rand_file_size(struct treegen_ctx *ctx) {
+	const struct treegen_profile *profile = ctx->profile;
+	uint64_t min = profile->min_size, max = profile->max_size;
+	if (rand_between(&ctx->rand_state, 0, 999) < profile->large_permille) {
+		min = profile->large_min_size;
+		max = profile->large_max_size;
+	}
+	/* Log-uniform, as file sizes are spread over orders of magnitude */
+	double fraction = (double) (next_rand(&ctx->rand_state) >> 11) / (double) (1ULL << 53);
+	double log_min = log((double) min + 1), log_max = log((double) max + 1);
+	return (uint64_t) exp(log_min + fraction * (log_max - log_min)) - 1;
+}
+
+static unsigned char *make_content(uint64_t *state) {
+	unsigned char *content = malloc(CONTENT_BLOCK_SIZE);
+	for (int i = 0; i < CONTENT_BLOCK_SIZE; i += sizeof(uint64_t)) {
+		uint64_t value = next_rand(state);
+		memcpy(content + i, &value, sizeof(value));
+	}
+	return content;
+}
+
+static int write_file(const char *path, int flags, uint64_t size, unsigned char *content, uint64_t *state) {
+	int fd = open(path, O_WRONLY | flags, 0644);
+	if (fd == -1) {
+		return -1;
+	}
+	uint64_t unique = next_rand(state);
+	uint64_t written = 0;
+	while (written < size) {
+		size_t len = (size - written < CONTENT_BLOCK_SIZE) ? size - written : CONTENT_BLOCK_SIZE;
+		memcpy(content, &unique, (len < sizeof(unique)) ? len : sizeof(unique));
+		ssize_t ret = write(fd, content, len);
+		if (ret <= 0) {
+			close(fd);
+			return -1;
+		}
+		written += ret;
+	}
+	return close(fd);
+}
+
+static int fill_dir(struct treegen_ctx *ctx, struct pending_dir *dir, struct pending_dir **pending,
+		unsigned long *num_pending, unsigned long *capacity) {
+	const struct treegen_profile *profile = ctx->profile;
+	unsigned int num_exts = 0;
+	while (profile->extensions[num_exts] != NULL) {
+		num_exts++;
+	}
+
+	char path[4096];
+	unsigned long files = rand_between(&ctx->rand_state, profile->min_files, profile->max_files);
+	for (unsigned long i = 0; i < files && !limit_reached(ctx); i++) {
+		const char *ext = profile->extensions[rand_between(&ctx->rand_state, 0, num_exts - 1)];
+		snprintf(path, sizeof(path), "%s/f%07lu%s", dir->path, ctx->entries++, ext);
+		uint64_t size = rand_file_size(ctx);
+		if (ctx->options->max_bytes != 0 && ctx->written + size > ctx->options->max_bytes) {
+			if (write_file(path, O_CREAT | O_TRUNC, 0, ctx->content, &ctx->rand_state) != 0
+					|| truncate(path, size) != 0) {
+				return -1;
+			}
+		} else {
+			if (write_file(path, O_CREAT | O_TRUNC, size, ctx->content, &ctx->rand_state) != 0) {
+				return -1;
+			}
+			ctx->written += size;
+		}
+		ctx->stats.files++;
+		ctx->stats.bytes += size;
+	}
+
+	if (dir->level >= profile->depth) {
+		return 0;
+	}
+	unsigned long subdirs = rand_between(&ctx->rand_state, profile->min_fanout, profile->max_fanout);
+	for (unsigned long i = 0; i < subdirs && !limit_reached(ctx); i++) {
+		snprintf(path, sizeof(path), "%s/d%07lu", dir->path, ctx->entries++);
+		if (mkdir(path, 0755) != 0) {
+			return -1;
+		}
+		ctx->stats.dirs++;
+
+		if (*num_pending == *capacity) {
+			*capacity *= 2;
+			*pending = realloc(*pending, *capacity * sizeof(struct pending_dir));
+		}
+		(*pending)[*num_pending].path = strdup(path);
+		(*pending)[*num_pending].level = dir->level + 1;
+		(*num_pending)++;
+	}
+	return 0;
+}
+
+static int limit_reached(struct treegen_ctx *ctx) {
+	return ctx->options->max_entries != 0 && ctx->entries >= ctx->options->max_entries;
+}
+
+static void mutate(enum treegen_workload workload, const char *path, uint64_t seed, unsigned long op,
+		unsigned char *content, uint64_t *state, void (*before_op)(const char *name, void *arg), void *arg) {
+	const char *name = strrchr(path, '/') + 1;
+	size_t dir_len = name - path;
+	const char *ext = strchr(name, '.');
+	char new_path[4096];
+
+	switch (workload) {
+	case TREEGEN_EDIT_BURST:
+		if (before_op != NULL) {
+			before_op(name, arg);
+		}
+		write_file(path, O_APPEND, EDIT_SIZE, content, state);
+		break;
+
+	case TREEGEN_MASS_RENAME:
+		snprintf(new_path, sizeof(new_path), "%s.moved", path);
+		if (before_op != NULL) {
+			before_op(new_path + dir_len, arg);
+		}
+		rename(path, new_path);
+		break;
+
+	case TREEGEN_CHECKOUT_STORM:
+		/* A checkout replaces, deletes and adds files, and adds directories, in about equal parts */
+		switch (op % 4) {
+		case 0:
+			if (before_op != NULL) {
+				before_op(name, arg);
+			}
+			unlink(path);
+			write_file(path, O_CREAT | O_TRUNC, EDIT_SIZE, content, state);
+			break;
+		case 1:
+			if (before_op != NULL) {
+				before_op(name, arg);
+			}
+			unlink(path);
+			break;
+		case 2:
+			snprintf(new_path, sizeof(new_path), "%.*sco%08x_%06lu%s", (int) dir_len, path,
+					(unsigned int) seed, op, (ext != NULL) ? ext : "");
+			if (before_op != NULL) {
+				before_op(new_path + dir_len, arg);
+			}
+			write_file(new_path, O_CREAT | O_TRUNC, EDIT_SIZE, content, state);
+			break;
+		default:
+			snprintf(new_path, sizeof(new_path), "%.*sco%08x_%06lu", (int) dir_len, path,
+					(unsigned int) seed, op);
+			if (before_op != NULL) {
+				before_op(new_path + dir_len, arg);
+			}
+			if (mkdir(new_path, 0755) == 0) {
+				strcat(new_path, "/README.md");
+				write_file(new_path, O_CREAT | O_TRUNC, EDIT_SIZE, content, state);
+			}
+			break;
+		}
+		break;
+	}
+}
@@ -0,0 +1,159 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_TREEGEN_H
+#define GOODRV_TREEGEN_H
+
+#include <stdint.h>
+
+/*
+ * Shape of a generated tree. Counts are drawn uniformly from [min, max], and
+ * file sizes log-uniformly from [min_size, max_size], except for the
+ * large_permille of files whose size is drawn from [large_min_size, large_max_size].
+ */
+struct treegen_profile {
+	const char *name;
+	/* Levels of directories below the root */
+	unsigned int depth;
+	/* Subdirectories in each directory above the last level */
+	unsigned int min_fanout;
+	unsigned int max_fanout;
+	/* Files in each directory */
+	unsigned int min_files;
+	unsigned int max_files;
+	uint64_t min_size;
+	uint64_t max_size;
+	unsigned int large_permille;
+	uint64_t large_min_size;
+	uint64_t large_max_size;
+	/* Extensions of the file names, NULL terminated */
+	const char *const *extensions;
+};
+
+/*
+ * Built-in profiles, ending with an entry with a NULL name:
+ * "small" - Source and documents: many small files in a moderately deep tree.
+ * "media" - Photos and videos: few directories with large files.
+ * "monorepo" - A deep and narrow source tree, like a large repository.
+ */
+extern const struct treegen_profile treegen_profiles[];
+
+/*
+ * Options of a generation.
+ */
+struct treegen_options {
+	/* Seed of the generator; the same seed gives the same tree */
+	uint64_t seed;
+	/* Stop after creating this many entries; 0 for no limit */
+	unsigned long max_entries;
+	/*
+	 * Files that would take the bytes written beyond this are created sparse,
+	 * with their size but no data; 0 for no limit
+	 */
+	uint64_t max_bytes;
+};
+
+/*
+ * What a generation created.
+ */
+struct treegen_stats {
+	unsigned long dirs;
+	unsigned long files;
+	/* Total size of the files, including the sparse ones */
+	uint64_t bytes;
+};
+
+/*
+ * Regular files of a tree.
+ */
+struct treegen_files {
+	char **paths;
+	unsigned long count;
+};
+
+/*
+ * Kinds of mutations replayed on a tree.
+ */
+enum treegen_workload {
+	/* Append to existing files, like an editor saving a burst of changes */
+	TREEGEN_EDIT_BURST,
+	/* Rename existing files within their directories */
+	TREEGEN_MASS_RENAME,
+	/* Rewrite, delete and create files and directories, like a git checkout of another branch */
+	TREEGEN_CHECKOUT_STORM
+};
+
+/*
+ * Find a built-in profile by its name. Returns NULL if there is none.
+ */
+const struct treegen_profile *treegen_find_profile(const char *name);
+
+/*
+ * Get the name of the workload, as used on the command line.
+ */
+const char *treegen_workload_name(enum treegen_workload workload);
+
+/*
+ * Find a workload by its name. Returns -1 if there is none.
+ */
+int treegen_find_workload(const char *name);
+
+/*
+ * Generate a tree under root, which is created if it does not exist.
+ * Every generated name is unique in the whole tree, so that an inotify event
+ * can be told apart by its name alone.
+ *
+ * stats - If not NULL, filled with what was created.
+ *
+ * Returns 0 on success, -1 if an entry could not be created.
+ */
+int treegen_create(const char *root, const struct treegen_profile *profile,
+		const struct treegen_options *options, struct treegen_stats *stats);
+
+/*
+ * List the regular files in the tree under root, for treegen_mutate.
+ *
+ * Returns 0 on success, -1 if the tree cannot be read.
+ */
+int treegen_list(const char *root, struct treegen_files *files);
+
+/*
+ * Free the list of files.
+ */
+void treegen_free_files(struct treegen_files *files);
+
+/*
+ * Replay a workload of ops mutations on random files of the list. The list is
+ * reordered, and is stale after the mutations.
+ *
+ * before_op - If not NULL, called right before each mutation, with the name
+ * 				(not the path) that the first inotify event of the mutation
+ * 				carries, and with arg.
+ *
+ * Returns the number of mutations done.
+ */
+unsigned long treegen_mutate(struct treegen_files *files, enum treegen_workload workload, uint64_t seed,
+		unsigned long ops, void (*before_op)(const char *name, void *arg), void *arg);
+
+#endif /* GOODRV_TREEGEN_H */
@@ -0,0 +1,93 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "treegen.h"
+
+/* Print the usage and exit */
+static void usage();
+
+/*
+ * Generate a tree, or replay a workload on it, from the command line:
+ *
+ * treegen create PROFILE DIR [SEED] [MAX_ENTRIES] [MAX_BYTES]
+ * treegen mutate WORKLOAD DIR [SEED] [OPS]
+ */
+int main(int argc, char **argv) {
+	if (argc < 4) {
+		usage();
+	}
+	uint64_t seed = (argc > 4) ? strtoull(argv[4], NULL, 10) : 1;
+
+	if (strcmp(argv[1], "create") == 0) {
+		const struct treegen_profile *profile = treegen_find_profile(argv[2]);
+		if (profile == NULL) {
+			usage();
+		}
+		struct treegen_options options;
+		options.seed = seed;
+		options.max_entries = (argc > 5) ? strtoul(argv[5], NULL, 10) : 0;
+		options.max_bytes = (argc > 6) ? strtoull(argv[6], NULL, 10) : 0;
+		struct treegen_stats stats;
+		if (treegen_create(argv[3], profile, &options, &stats) != 0) {
+			perror(argv[3]);
+			return 1;
+		}
+		printf("treegen profile=%s seed=%llu dirs=%lu files=%lu bytes=%llu\n", profile->name,
+				(unsigned long long) seed, stats.dirs, stats.files, (unsigned long long) stats.bytes);
+	} else if (strcmp(argv[1], "mutate") == 0) {
+		int workload = treegen_find_workload(argv[2]);
+		if (workload == -1) {
+			usage();
+		}
+		unsigned long ops = (argc > 5) ? strtoul(argv[5], NULL, 10) : 1000;
+		struct treegen_files files;
+		if (treegen_list(argv[3], &files) != 0) {
+			perror(argv[3]);
+			return 1;
+		}
+		ops = treegen_mutate(&files, workload, seed, ops, NULL, NULL);
+		treegen_free_files(&files);
+		printf("treegen workload=%s seed=%llu ops=%lu\n", argv[2], (unsigned long long) seed, ops);
+	} else {
+		usage();
+	}
+	return 0;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: treegen create PROFILE DIR [SEED] [MAX_ENTRIES] [MAX_BYTES]\n"
+			"       treegen mutate WORKLOAD DIR [SEED] [OPS]\n"
+			"Profiles:");
+	for (const struct treegen_profile *profile = treegen_profiles; profile->name != NULL; profile++) {
+		fprintf(stderr, " %s", profile->name);
+	}
+	fprintf(stderr, "\nWorkloads: %s %s %s\n", treegen_workload_name(TREEGEN_EDIT_BURST),
+			treegen_workload_name(TREEGEN_MASS_RENAME), treegen_workload_name(TREEGEN_CHECKOUT_STORM));
+	exit(2);
+}
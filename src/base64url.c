@@ -27,6 +27,7 @@
 #include <stdlib.h>
 
 #include "base64url.h"
+#include "kernels.h"
 
 static char base64_alphabets[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
                                     'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
@@ -63,27 +64,14 @@ char *base64url_encode(const unsigned char *input_str, ssize_t input_len, size_t
     unsigned char first_two_bit_mask = 192;
     unsigned char last_six_bit_mask = 63;
 
-    // Take three characters from the input, and convert them to four in Base64URL encoding
     unsigned char in_1, in_2, in_3;
     unsigned char out_1=0, out_2=0, out_3=0, out_4=0;
 
-    // For the complete triplets
-    for (in=0; in<input_len-3;) {
-        // printf("%d < %d ? --> %d \n", in, (((ssize_t)input_len)-3), (in<(((ssize_t)input_len)-3)));
-        in_1 = input_str[in++];
-        in_2 = input_str[in++];
-        in_3 = input_str[in++];
-
-        out_1 = (in_1 & first_six_bit_mask) >> 2;
-        out_2 = (((in_1 & last_two_bit_mask) << 4) | ((in_2 & first_four_bit_mask) >> 4));
-        out_3 = (((in_2 & last_four_bit_mask) << 2) | ((in_3 & first_two_bit_mask) >> 6));
-        out_4 = (in_3 & last_six_bit_mask);
-
-        encoded_str[out++] = base64_alphabets[out_1];
-        encoded_str[out++] = base64_alphabets[out_2];
-        encoded_str[out++] = base64_alphabets[out_3];
-        encoded_str[out++] = base64_alphabets[out_4];
-    }
+    /* For the complete triplets, leaving the last 1 to 3 characters to the code below */
+    size_t triplets = (input_len - 1) / 3;
+    kernel_base64url_encode(input_str, triplets, encoded_str);
+    in = 3 * triplets;
+    out = 4 * triplets;
 
     // For the remaining characters
     in_1 = input_str[in++];
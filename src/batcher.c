@@ -0,0 +1,538 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "batcher.h"
+
+/* Path of the Drive API's files, within a batch */
+#define FILES_PATH "/drive/v3/files"
+
+/*
+ * An operation waiting to be sent
+ */
+struct pending_op {
+	struct meta_op op;
+	meta_callback callback;
+	void *arg;
+	struct timespec submitted;
+	struct pending_op *next;
+};
+
+struct batcher {
+	struct batch_sink *sink;
+	unsigned int max_batch;
+	unsigned int max_delay_ms;
+	pthread_t thread;
+
+	pthread_mutex_t lock;
+	/* Signalled when there is something for the batcher's thread to do */
+	pthread_cond_t work;
+	/* Signalled when operations get their results */
+	pthread_cond_t done;
+	/* Operations not yet sent, the oldest first */
+	struct pending_op *head;
+	struct pending_op *tail;
+	unsigned int num_pending;
+	/* Operations sent, but without results yet */
+	unsigned int num_in_flight;
+	int flush_requested;
+	int stopping;
+	unsigned long num_requests;
+	unsigned long boundary_seq;
+};
+
+/*
+ * Waiter for the result of a blocking submit
+ */
+struct meta_waiter {
+	batcher batcher;
+	struct meta_result *result;
+	int done;
+};
+
+/*
+ * A sink over the connection pool
+ */
+struct http_sink {
+	/* First, so that the sink can be freed with free() */
+	struct batch_sink sink;
+	http_pool pool;
+	const char *host;
+	unsigned short port;
+	const char *path;
+	const char *authorization;
+};
+
+/*
+ * Growable character buffer
+ */
+struct strbuf {
+	char *data;
+	size_t len;
+	size_t capacity;
+};
+
+/* Send the pending operations in batches, till the batcher is stopped */
+static void *batcher_thread(void *arg);
+/* Send a batch, and hand the results to the callbacks */
+static void send_batch(batcher batcher, struct pending_op **ops, unsigned int num_ops);
+/* Append the HTTP request for the operation */
+static void append_op_request(struct strbuf *buf, struct meta_op *op);
+/* Split the multipart response into the results of the operations */
+static void parse_batch_response(const char *content_type, char *body, size_t body_len,
+		struct meta_result *results, unsigned int num_ops);
+/* Callback of the blocking submit */
+static void wake_waiter(struct meta_result *result, void *arg);
+/* Free an operation */
+static void free_pending_op(struct pending_op *pending);
+/* Send function of the HTTP sink */
+static int http_sink_send(void *ctx, const char *content_type, const char *body, size_t body_len,
+		char **response_content_type, char **response_body, size_t *response_len);
+/* strdup that allows NULL */
+static char *strdup_null(const char *str);
+/* Add milliseconds to the time */
+static void timespec_add_ms(struct timespec *time, unsigned int ms);
+
+/* Append bytes to the buffer, keeping it NUL terminated */
+static void strbuf_append(struct strbuf *buf, const char *data, size_t len);
+/* Append a NUL terminated string */
+static void strbuf_append_str(struct strbuf *buf, const char *str);
+/* Append a string as a JSON string literal */
+static void strbuf_append_json(struct strbuf *buf, const char *str);
+
+batcher batcher_create(struct batch_sink *sink, unsigned int max_batch, unsigned int max_delay_ms) {
+	if (sink == NULL) {
+		return NULL;
+	}
+	batcher batcher = calloc(1, sizeof(struct batcher));
+	batcher->sink = sink;
+	batcher->max_batch = (max_batch == 0 || max_batch > BATCHER_MAX_BATCH) ? BATCHER_MAX_BATCH : max_batch;
+	batcher->max_delay_ms = max_delay_ms;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&batcher->lock, NULL);
+	pthread_cond_init(&batcher->work, &attr);
+	pthread_cond_init(&batcher->done, NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&batcher->thread, NULL, &batcher_thread, batcher) != 0) {
+		pthread_cond_destroy(&batcher->work);
+		pthread_cond_destroy(&batcher->done);
+		pthread_mutex_destroy(&batcher->lock);
+		free(batcher);
+		return NULL;
+	}
+	return batcher;
+}
+
+void batcher_destroy(batcher batcher) {
+	if (batcher == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&batcher->lock);
+	batcher->stopping = 1;
+	pthread_cond_signal(&batcher->work);
+	pthread_mutex_unlock(&batcher->lock);
+	pthread_join(batcher->thread, NULL);
+
+	pthread_cond_destroy(&batcher->work);
+	pthread_cond_destroy(&batcher->done);
+	pthread_mutex_destroy(&batcher->lock);
+	free(batcher);
+}
+
+void batcher_submit_async(batcher batcher, struct meta_op *op, meta_callback callback, void *arg) {
+	struct pending_op *pending = malloc(sizeof(struct pending_op));
+	pending->op.type = op->type;
+	pending->op.file_id = strdup_null(op->file_id);
+	pending->op.parent_id = strdup_null(op->parent_id);
+	pending->op.name = strdup_null(op->name);
+	pending->op.properties = strdup_null(op->properties);
+	pending->callback = callback;
+	pending->arg = arg;
+	pending->next = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &pending->submitted);
+
+	pthread_mutex_lock(&batcher->lock);
+	if (batcher->tail != NULL) {
+		batcher->tail->next = pending;
+	} else {
+		batcher->head = pending;
+	}
+	batcher->tail = pending;
+	batcher->num_pending++;
+	if (batcher->num_pending == 1 || batcher->num_pending >= batcher->max_batch) {
+		/* The deadline starts, or the batch is full */
+		pthread_cond_signal(&batcher->work);
+	}
+	pthread_mutex_unlock(&batcher->lock);
+}
+
+void batcher_submit(batcher batcher, struct meta_op *op, struct meta_result *result) {
+	struct meta_waiter waiter = { batcher, result, 0 };
+	batcher_submit_async(batcher, op, &wake_waiter, &waiter);
+	pthread_mutex_lock(&batcher->lock);
+	while (!waiter.done) {
+		pthread_cond_wait(&batcher->done, &batcher->lock);
+	}
+	pthread_mutex_unlock(&batcher->lock);
+}
+
+void batcher_flush(batcher batcher) {
+	pthread_mutex_lock(&batcher->lock);
+	if (batcher->num_pending > 0) {
+		batcher->flush_requested = 1;
+		pthread_cond_signal(&batcher->work);
+	}
+	while (batcher->num_pending + batcher->num_in_flight > 0) {
+		pthread_cond_wait(&batcher->done, &batcher->lock);
+	}
+	pthread_mutex_unlock(&batcher->lock);
+}
+
+unsigned long batcher_num_requests(batcher batcher) {
+	pthread_mutex_lock(&batcher->lock);
+	unsigned long num_requests = batcher->num_requests;
+	pthread_mutex_unlock(&batcher->lock);
+	return num_requests;
+}
+
+struct batch_sink *batcher_http_sink(http_pool pool, const char *host, unsigned short port,
+		const char *path, const char *authorization) {
+	struct http_sink *http_sink = malloc(sizeof(struct http_sink));
+	http_sink->sink.ctx = http_sink;
+	http_sink->sink.send = &http_sink_send;
+	http_sink->pool = pool;
+	http_sink->host = host;
+	http_sink->port = port;
+	http_sink->path = path;
+	http_sink->authorization = authorization;
+	return &http_sink->sink;
+}
+
+static void *batcher_thread(void *arg) {
+	batcher batcher = arg;
+	struct pending_op **ops = malloc(batcher->max_batch * sizeof(struct pending_op *));
+
+	pthread_mutex_lock(&batcher->lock);
+	while (1) {
+		while (!batcher->stopping && batcher->num_pending == 0) {
+			pthread_cond_wait(&batcher->work, &batcher->lock);
+		}
+		if (batcher->num_pending == 0) {
+			break;
+		}
+
+		/* Wait for the batch to fill up, till the deadline of its oldest operation */
+		struct timespec deadline = batcher->head->submitted;
+		timespec_add_ms(&deadline, batcher->max_delay_ms);
+		while (!batcher->stopping && !batcher->flush_requested
+				&& batcher->num_pending < batcher->max_batch
+				&& pthread_cond_timedwait(&batcher->work, &batcher->lock, &deadline) == 0) {
+		}
+
+		unsigned int num_ops = 0;
+		while (num_ops < batcher->max_batch && batcher->head != NULL) {
+			ops[num_ops++] = batcher->head;
+			batcher->head = batcher->head->next;
+		}
+		if (batcher->head == NULL) {
+			batcher->tail = NULL;
+			batcher->flush_requested = 0;
+		}
+		batcher->num_pending -= num_ops;
+		batcher->num_in_flight += num_ops;
+		pthread_mutex_unlock(&batcher->lock);
+
+		send_batch(batcher, ops, num_ops);
+
+		pthread_mutex_lock(&batcher->lock);
+		batcher->num_in_flight -= num_ops;
+		batcher->num_requests++;
+		pthread_cond_broadcast(&batcher->done);
+	}
+	pthread_mutex_unlock(&batcher->lock);
+
+	free(ops);
+	return NULL;
+}
+
+static void send_batch(batcher batcher, struct pending_op **ops, unsigned int num_ops) {
+	char boundary[64];
+	snprintf(boundary, sizeof(boundary), "goodrive_batch_%lx_%lu", (unsigned long) time(NULL),
+			batcher->boundary_seq++);
+
+	struct strbuf body = { NULL, 0, 0 };
+	char line[256];
+	for (unsigned int i = 0; i < num_ops; i++) {
+		snprintf(line, sizeof(line), "--%s\r\nContent-Type: application/http\r\n"
+				"Content-ID: <item-%u>\r\n\r\n", boundary, i);
+		strbuf_append_str(&body, line);
+		append_op_request(&body, &ops[i]->op);
+	}
+	snprintf(line, sizeof(line), "--%s--\r\n", boundary);
+	strbuf_append_str(&body, line);
+
+	char content_type[128];
+	snprintf(content_type, sizeof(content_type), "multipart/mixed; boundary=%s", boundary);
+
+	struct meta_result *results = malloc(num_ops * sizeof(struct meta_result));
+	for (unsigned int i = 0; i < num_ops; i++) {
+		results[i].status = -1;
+		results[i].body = NULL;
+	}
+	char *response_content_type = NULL;
+	char *response_body = NULL;
+	size_t response_len;
+	if (batcher->sink->send(batcher->sink->ctx, content_type, body.data, body.len,
+			&response_content_type, &response_body, &response_len) == 0) {
+		parse_batch_response(response_content_type, response_body, response_len, results, num_ops);
+	}
+	free(response_content_type);
+	free(response_body);
+	free(body.data);
+
+	for (unsigned int i = 0; i < num_ops; i++) {
+		if (ops[i]->callback != NULL) {
+			ops[i]->callback(&results[i], ops[i]->arg);
+		} else {
+			free(results[i].body);
+		}
+		free_pending_op(ops[i]);
+	}
+	free(results);
+}
+
+static void append_op_request(struct strbuf *buf, struct meta_op *op) {
+	struct strbuf json = { NULL, 0, 0 };
+	switch (op->type) {
+	case META_CREATE_FOLDER:
+		strbuf_append_str(buf, "POST " FILES_PATH " HTTP/1.1\r\n");
+		strbuf_append_str(&json, "{\"name\":");
+		strbuf_append_json(&json, op->name);
+		strbuf_append_str(&json, ",\"mimeType\":\"application/vnd.google-apps.folder\"");
+		if (op->parent_id != NULL) {
+			strbuf_append_str(&json, ",\"parents\":[");
+			strbuf_append_json(&json, op->parent_id);
+			strbuf_append_str(&json, "]");
+		}
+		strbuf_append_str(&json, "}");
+		break;
+	case META_RENAME:
+	case META_TRASH:
+	case META_UPDATE_PROPERTIES:
+		strbuf_append_str(buf, "PATCH " FILES_PATH "/");
+		strbuf_append_str(buf, op->file_id != NULL ? op->file_id : "");
+		strbuf_append_str(buf, " HTTP/1.1\r\n");
+		if (op->type == META_RENAME) {
+			strbuf_append_str(&json, "{\"name\":");
+			strbuf_append_json(&json, op->name);
+			strbuf_append_str(&json, "}");
+		} else if (op->type == META_TRASH) {
+			strbuf_append_str(&json, "{\"trashed\":true}");
+		} else {
+			strbuf_append_str(&json, "{\"properties\":");
+			strbuf_append_str(&json, op->properties != NULL ? op->properties : "{}");
+			strbuf_append_str(&json, "}");
+		}
+		break;
+	}
+	strbuf_append_str(buf, "Content-Type: application/json; charset=UTF-8\r\n\r\n");
+	strbuf_append(buf, json.data, json.len);
+	strbuf_append_str(buf, "\r\n");
+	free(json.data);
+}
+
+static void parse_batch_response(const char *content_type, char *body, size_t body_len,
+		struct meta_result *results, unsigned int num_ops) {
+	const char *boundary_param = (content_type != NULL) ? strstr(content_type, "boundary=") : NULL;
+	if (boundary_param == NULL || body == NULL) {
+		return;
+	}
+	char delimiter[128] = "--";
+	boundary_param += strlen("boundary=");
+	size_t boundary_len = strcspn(boundary_param, "\"; \r\n");
+	if (*boundary_param == '"') {
+		boundary_param++;
+		boundary_len = strcspn(boundary_param, "\"");
+	}
+	if (boundary_len == 0 || boundary_len + 3 > sizeof(delimiter)) {
+		return;
+	}
+	strncat(delimiter, boundary_param, boundary_len);
+	size_t delimiter_len = strlen(delimiter);
+
+	char *end = body + body_len;
+	char *part = memmem(body, body_len, delimiter, delimiter_len);
+	while (part != NULL) {
+		part += delimiter_len;
+		if (end - part >= 2 && part[0] == '-' && part[1] == '-') {
+			/* The closing delimiter */
+			break;
+		}
+		char *next = memmem(part, end - part, delimiter, delimiter_len);
+		char *part_end = (next != NULL) ? next : end;
+
+		/* The part's headers, the embedded response's status line and headers, and then its body */
+		char *part_body = memmem(part, part_end - part, "\r\n\r\n", 4);
+		char *content_id = memmem(part, part_body != NULL ? part_body - part : 0, "Content-ID:", 11);
+		unsigned int index;
+		int status;
+		if (part_body != NULL && content_id != NULL
+				&& sscanf(content_id, "Content-ID: <response-item-%u>", &index) == 1 && index < num_ops
+				&& sscanf(part_body + 4, "HTTP/1.%*d %d", &status) == 1) {
+			results[index].status = status;
+			char *response_body = memmem(part_body + 4, part_end - part_body - 4, "\r\n\r\n", 4);
+			if (response_body != NULL) {
+				response_body += 4;
+				size_t len = part_end - response_body;
+				/* The CRLF before the next delimiter belongs to it */
+				if (len >= 2 && response_body[len - 2] == '\r' && response_body[len - 1] == '\n') {
+					len -= 2;
+				}
+				free(results[index].body);
+				results[index].body = malloc(len + 1);
+				memcpy(results[index].body, response_body, len);
+				results[index].body[len] = '\0';
+			}
+		}
+		part = next;
+	}
+}
+
+static void wake_waiter(struct meta_result *result, void *arg) {
+	struct meta_waiter *waiter = arg;
+	pthread_mutex_lock(&waiter->batcher->lock);
+	*waiter->result = *result;
+	waiter->done = 1;
+	pthread_cond_broadcast(&waiter->batcher->done);
+	pthread_mutex_unlock(&waiter->batcher->lock);
+}
+
+static void free_pending_op(struct pending_op *pending) {
+	free((char *) pending->op.file_id);
+	free((char *) pending->op.parent_id);
+	free((char *) pending->op.name);
+	free((char *) pending->op.properties);
+	free(pending);
+}
+
+static int http_sink_send(void *ctx, const char *content_type, const char *body, size_t body_len,
+		char **response_content_type, char **response_body, size_t *response_len) {
+	struct http_sink *http_sink = ctx;
+	struct strbuf headers = { NULL, 0, 0 };
+	strbuf_append_str(&headers, "Content-Type: ");
+	strbuf_append_str(&headers, content_type);
+	strbuf_append_str(&headers, "\r\n");
+	if (http_sink->authorization != NULL) {
+		strbuf_append_str(&headers, "Authorization: ");
+		strbuf_append_str(&headers, http_sink->authorization);
+		strbuf_append_str(&headers, "\r\n");
+	}
+
+	struct http_request request = { "POST", http_sink->path, headers.data, body, body_len };
+	struct http_response response;
+	int status = http_send(http_sink->pool, http_sink->host, http_sink->port, &request, &response);
+	free(headers.data);
+	if (status != 0) {
+		return -1;
+	}
+	if (response.status != 200) {
+		http_response_free(&response);
+		return -1;
+	}
+
+	/* Pick the Content-Type out of the response headers */
+	*response_content_type = NULL;
+	for (char *line = response.headers; line != NULL && *line != '\0';) {
+		char *line_end = strstr(line, "\r\n");
+		size_t len = (line_end != NULL) ? (size_t) (line_end - line) : strlen(line);
+		if (strncasecmp(line, "Content-Type:", 13) == 0) {
+			*response_content_type = strndup(line + 13, len - 13);
+			break;
+		}
+		line = (line_end != NULL) ? line_end + 2 : NULL;
+	}
+	*response_body = (char *) response.body;
+	*response_len = response.body_len;
+	free(response.headers);
+	return 0;
+}
+
+static char *strdup_null(const char *str) {
+	return (str != NULL) ? strdup(str) : NULL;
+}
+
+static void timespec_add_ms(struct timespec *time, unsigned int ms) {
+	time->tv_sec += ms / 1000;
+	time->tv_nsec += (long) (ms % 1000) * 1000000;
+	if (time->tv_nsec >= 1000000000) {
+		time->tv_sec++;
+		time->tv_nsec -= 1000000000;
+	}
+}
+
+static void strbuf_append(struct strbuf *buf, const char *data, size_t len) {
+	if (buf->len + len + 1 > buf->capacity) {
+		buf->capacity = (buf->capacity == 0) ? 256 : buf->capacity;
+		while (buf->len + len + 1 > buf->capacity) {
+			buf->capacity *= 2;
+		}
+		buf->data = realloc(buf->data, buf->capacity);
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
+
+static void strbuf_append_str(struct strbuf *buf, const char *str) {
+	strbuf_append(buf, str, strlen(str));
+}
+
+static void strbuf_append_json(struct strbuf *buf, const char *str) {
+	strbuf_append(buf, "\"", 1);
+	for (const char *c = (str != NULL) ? str : ""; *c != '\0'; c++) {
+		char escaped[8];
+		if (*c == '"' || *c == '\\') {
+			escaped[0] = '\\';
+			escaped[1] = *c;
+			strbuf_append(buf, escaped, 2);
+		} else if ((unsigned char) *c < 0x20) {
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) *c);
+			strbuf_append(buf, escaped, 6);
+		} else {
+			strbuf_append(buf, c, 1);
+		}
+	}
+	strbuf_append(buf, "\"", 1);
+}
@@ -0,0 +1,134 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_BATCHER_H
+#define GOODRV_BATCHER_H
+
+#include <stddef.h>
+
+#include "httppool.h"
+
+/* Largest number of calls the Drive API accepts in a batch request */
+#define BATCHER_MAX_BATCH 100
+
+/*
+ * Metadata operations that can be batched
+ */
+enum meta_op_type {
+	/* Create the folder name in parent_id */
+	META_CREATE_FOLDER,
+	/* Rename file_id to name */
+	META_RENAME,
+	/* Move file_id to the trash */
+	META_TRASH,
+	/* Set the properties of file_id, given as a JSON object */
+	META_UPDATE_PROPERTIES
+};
+
+struct meta_op {
+	enum meta_op_type type;
+	const char *file_id;
+	const char *parent_id;
+	const char *name;
+	const char *properties;
+};
+
+/*
+ * Result of an operation. status is the HTTP status of the operation, or -1
+ * if the batch could not be sent. body is the JSON response, or NULL.
+ */
+struct meta_result {
+	int status;
+	char *body;
+};
+
+/*
+ * Called once the result of an operation is known. The result, and its body,
+ * belong to the callback.
+ */
+typedef void (*meta_callback)(struct meta_result *result, void *arg);
+
+/*
+ * Sends a batch request. Given the Content-Type and the body of the request,
+ * it fills in the Content-Type and the body of the response, both allocated
+ * with malloc. Returns 0 on success, and -1 on failure.
+ */
+struct batch_sink {
+	void *ctx;
+	int (*send)(void *ctx, const char *content_type, const char *body, size_t body_len,
+			char **response_content_type, char **response_body, size_t *response_len);
+};
+
+/*
+ * Collects metadata operations, and sends them together in multipart batch
+ * requests, instead of one request each.
+ */
+typedef struct batcher *batcher;
+
+/*
+ * Create a batcher. A batch is sent once max_batch operations are pending,
+ * or max_delay_ms after the first of them was submitted, whichever is earlier.
+ *
+ * max_batch - Operations per batch, at most BATCHER_MAX_BATCH.
+ *
+ * Returns NULL if the batcher could not be started.
+ */
+batcher batcher_create(struct batch_sink *sink, unsigned int max_batch, unsigned int max_delay_ms);
+
+/*
+ * Send whatever is pending, and free the batcher.
+ */
+void batcher_destroy(batcher batcher);
+
+/*
+ * Queue the operation. The callback is called from the batcher's thread once
+ * the response arrives. The strings in op are copied.
+ */
+void batcher_submit_async(batcher batcher, struct meta_op *op, meta_callback callback, void *arg);
+
+/*
+ * Queue the operation, and wait for its result.
+ */
+void batcher_submit(batcher batcher, struct meta_op *op, struct meta_result *result);
+
+/*
+ * Send the pending operations now, and wait till all the submitted ones have
+ * their results.
+ */
+void batcher_flush(batcher batcher);
+
+/*
+ * Number of batch requests sent so far.
+ */
+unsigned long batcher_num_requests(batcher batcher);
+
+/*
+ * A sink that posts the batches to https://host:port/path through the
+ * connection pool, with the given Authorization header value. The strings
+ * must outlive the sink. Free it with free().
+ */
+struct batch_sink *batcher_http_sink(http_pool pool, const char *host, unsigned short port,
+		const char *path, const char *authorization);
+
+#endif /* GOODRV_BATCHER_H */
@@ -0,0 +1,119 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "bqueue.h"
+
+/*
+ * Bounded Queue, as a ring buffer guarded by a mutex.
+ */
+struct bqueue {
+	void **items;
+	unsigned int capacity;
+	unsigned int head;
+	unsigned int size;
+	int closed;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+bqueue bq_create(unsigned int capacity) {
+	if (capacity == 0) {
+		capacity = 1;
+	}
+	bqueue queue = malloc(sizeof(struct bqueue));
+	queue->items = malloc(capacity * sizeof(void*));
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->size = 0;
+	queue->closed = 0;
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+	return queue;
+}
+
+void bq_destroy(bqueue queue) {
+	if (queue != NULL) {
+		pthread_mutex_destroy(&queue->lock);
+		pthread_cond_destroy(&queue->not_empty);
+		pthread_cond_destroy(&queue->not_full);
+		free(queue->items);
+		free(queue);
+	}
+}
+
+int bq_push(bqueue queue, void *item) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->size == queue->capacity && !queue->closed) {
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+	}
+	if (queue->closed) {
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+
+	queue->items[(queue->head + queue->size) % queue->capacity] = item;
+	queue->size++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+int bq_pop(bqueue queue, void **item) {
+	pthread_mutex_lock(&queue->lock);
+	while (queue->size == 0 && !queue->closed) {
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+	}
+	if (queue->size == 0) {
+		pthread_mutex_unlock(&queue->lock);
+		return -1;
+	}
+
+	*item = queue->items[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->size--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+	return 0;
+}
+
+void bq_close(bqueue queue) {
+	pthread_mutex_lock(&queue->lock);
+	queue->closed = 1;
+	pthread_cond_broadcast(&queue->not_empty);
+	pthread_cond_broadcast(&queue->not_full);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+unsigned int bq_size(bqueue queue) {
+	pthread_mutex_lock(&queue->lock);
+	unsigned int size = queue->size;
+	pthread_mutex_unlock(&queue->lock);
+	return size;
+}
@@ -0,0 +1,67 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_BQUEUE_H
+#define GOODRV_BQUEUE_H
+
+/*
+ * Bounded, blocking FIFO queue of pointers, for handing work from one thread
+ * to another. Any number of threads may push and pop.
+ */
+typedef struct bqueue *bqueue;
+
+/*
+ * Create a queue that holds at most capacity items.
+ */
+bqueue bq_create(unsigned int capacity);
+
+/*
+ * Free the queue. Items still in the queue are not freed.
+ */
+void bq_destroy(bqueue queue);
+
+/*
+ * Add an item at the tail, waiting while the queue is full.
+ * Returns 0 on success, and -1 if the queue has been closed.
+ */
+int bq_push(bqueue queue, void *item);
+
+/*
+ * Remove the item at the head into *item, waiting while the queue is empty.
+ * Returns 0 on success, and -1 if the queue has been closed and is empty.
+ */
+int bq_pop(bqueue queue, void **item);
+
+/*
+ * Close the queue. Pushes fail from now on, and pops fail once the remaining
+ * items are drained. Wakes up all the waiting threads.
+ */
+void bq_close(bqueue queue);
+
+/*
+ * Get the number of items in the queue.
+ */
+unsigned int bq_size(bqueue queue);
+
+#endif /* GOODRV_BQUEUE_H */
@@ -0,0 +1,402 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "compress.h"
+
+/* Number of samples read to estimate the entropy of a file */
+#define COMPRESS_NUM_SAMPLES 4
+/* Size of each sample */
+#define COMPRESS_SAMPLE_SIZE 4096
+/* Size of the buffers for streaming compression */
+#define COMPRESS_BUFFER_SIZE (128 * 1024)
+
+/*
+ * Leading bytes of a compressed format
+ */
+struct magic_number {
+	size_t offset;
+	size_t len;
+	const char *bytes;
+};
+
+static const struct magic_number magic_numbers[] = {
+	{ 0, 2, "\x1f\x8b" },						// gzip
+	{ 0, 4, "\x28\xb5\x2f\xfd" },				// zstd
+	{ 0, 6, "\xfd\x37\x7a\x58\x5a\x00" },		// xz
+	{ 0, 3, "BZh" },							// bzip2
+	{ 0, 4, "\x04\x22\x4d\x18" },				// lz4
+	{ 0, 4, "PK\x03\x04" },						// zip, and the office formats, jar, apk
+	{ 0, 6, "\x37\x7a\xbc\xaf\x27\x1c" },		// 7z
+	{ 0, 6, "Rar!\x1a\x07" },					// rar
+	{ 0, 4, "\x89PNG" },
+	{ 0, 3, "\xff\xd8\xff" },					// jpeg
+	{ 0, 4, "GIF8" },
+	{ 8, 4, "WEBP" },
+	{ 4, 4, "ftyp" },							// mp4, mov, heic
+	{ 0, 4, "\x1a\x45\xdf\xa3" },				// mkv, webm
+	{ 0, 4, "OggS" },
+	{ 0, 4, "fLaC" },
+	{ 0, 3, "ID3" },							// mp3
+};
+
+/* Extensions of the compressed formats without a reliable magic number */
+static const char *compressed_extensions[] = {
+	"gz", "tgz", "zst", "xz", "txz", "bz2", "lz4", "br", "zip", "7z", "rar",
+	"jpg", "jpeg", "png", "gif", "webp", "heic", "avif",
+	"mp4", "m4v", "mov", "mkv", "webm", "avi",
+	"mp3", "m4a", "aac", "ogg", "opus", "flac",
+	"docx", "xlsx", "pptx", "odt", "ods", "odp", "epub", "jar", "apk",
+};
+
+/* Compress or decompress with zstd */
+static int zstd_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size);
+/* Compress or decompress with zlib, in the gzip format */
+static int gzip_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size);
+#if defined(HAVE_ZSTD) || defined(HAVE_ZLIB)
+/* Read till the buffer is full or the end of the file */
+static ssize_t read_full(int fd, unsigned char *buf, size_t len);
+/* Write the whole buffer */
+static int write_full(int fd, const unsigned char *buf, size_t len);
+#endif
+
+void compress_default_options(struct compress_options *options) {
+#if defined(HAVE_ZSTD)
+	options->codec = COMPRESS_ZSTD;
+#elif defined(HAVE_ZLIB)
+	options->codec = COMPRESS_GZIP;
+#else
+	options->codec = COMPRESS_NONE;
+#endif
+	options->level = 1;
+	options->max_entropy = 7.0;
+	options->min_size = 4096;
+}
+
+int compress_codec_available(enum compress_codec codec) {
+	switch (codec) {
+#ifdef HAVE_ZSTD
+	case COMPRESS_ZSTD:
+		return 1;
+#endif
+#ifdef HAVE_ZLIB
+	case COMPRESS_GZIP:
+		return 1;
+#endif
+	default:
+		return 0;
+	}
+}
+
+const char *compress_suffix(enum compress_codec codec) {
+	switch (codec) {
+	case COMPRESS_ZSTD:
+		return ".zst";
+	case COMPRESS_GZIP:
+		return ".gz";
+	default:
+		return "";
+	}
+}
+
+double compress_entropy(const unsigned char *buf, size_t len) {
+	if (len == 0) {
+		return 0;
+	}
+	size_t counts[256] = { 0 };
+	for (size_t i = 0; i < len; i++) {
+		counts[buf[i]]++;
+	}
+	double entropy = 0;
+	for (int i = 0; i < 256; i++) {
+		if (counts[i] > 0) {
+			double probability = (double) counts[i] / len;
+			entropy -= probability * log2(probability);
+		}
+	}
+	return entropy;
+}
+
+int compress_is_compressed_format(const char *path, const unsigned char *head, size_t head_len) {
+	for (size_t i = 0; i < sizeof(magic_numbers) / sizeof(magic_numbers[0]); i++) {
+		const struct magic_number *magic = &magic_numbers[i];
+		if (head_len >= magic->offset + magic->len
+				&& memcmp(head + magic->offset, magic->bytes, magic->len) == 0) {
+			return 1;
+		}
+	}
+
+	const char *base_name = strrchr(path, '/');
+	base_name = (base_name != NULL) ? base_name + 1 : path;
+	const char *extension = strrchr(base_name, '.');
+	if (extension == NULL || extension == base_name) {
+		return 0;
+	}
+	extension++;
+	for (size_t i = 0; i < sizeof(compressed_extensions) / sizeof(compressed_extensions[0]); i++) {
+		if (strcasecmp(extension, compressed_extensions[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int compress_worthwhile(struct compress_options *options, const char *path, int fd, uint64_t size) {
+	if (options == NULL || !compress_codec_available(options->codec) || size < options->min_size) {
+		return 0;
+	}
+
+	/*
+	 * Samples at the start, the end, and evenly in between. For a small
+	 * file, they cover the whole of it.
+	 */
+	unsigned char samples[COMPRESS_NUM_SAMPLES * COMPRESS_SAMPLE_SIZE];
+	size_t len = 0;
+	if (size <= sizeof(samples)) {
+		ssize_t count = pread(fd, samples, size, 0);
+		if (count <= 0) {
+			return 0;
+		}
+		len = count;
+	} else {
+		for (int i = 0; i < COMPRESS_NUM_SAMPLES; i++) {
+			off_t offset = (size - COMPRESS_SAMPLE_SIZE) / (COMPRESS_NUM_SAMPLES - 1) * i;
+			ssize_t count = pread(fd, samples + len, COMPRESS_SAMPLE_SIZE, offset);
+			if (count <= 0) {
+				return 0;
+			}
+			len += count;
+		}
+	}
+
+	if (compress_is_compressed_format(path, samples, len)) {
+		return 0;
+	}
+	return compress_entropy(samples, len) <= options->max_entropy;
+}
+
+int compress_stream(enum compress_codec codec, int level, int src_fd, int dst_fd,
+		uint64_t *out_size) {
+	uint64_t size = 0;
+	int status = -1;
+	if (codec == COMPRESS_ZSTD) {
+		status = zstd_stream(1, level, src_fd, dst_fd, &size);
+	} else if (codec == COMPRESS_GZIP) {
+		status = gzip_stream(1, level, src_fd, dst_fd, &size);
+	}
+	if (out_size != NULL) {
+		*out_size = size;
+	}
+	return status;
+}
+
+int decompress_stream(enum compress_codec codec, int src_fd, int dst_fd) {
+	uint64_t size;
+	if (codec == COMPRESS_ZSTD) {
+		return zstd_stream(0, 0, src_fd, dst_fd, &size);
+	} else if (codec == COMPRESS_GZIP) {
+		return gzip_stream(0, 0, src_fd, dst_fd, &size);
+	}
+	return -1;
+}
+
+#ifdef HAVE_ZSTD
+static int zstd_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size) {
+	ZSTD_CCtx *cctx = NULL;
+	ZSTD_DCtx *dctx = NULL;
+	if (compress) {
+		cctx = ZSTD_createCCtx();
+		if (cctx == NULL || ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+			ZSTD_freeCCtx(cctx);
+			return -1;
+		}
+	} else if ((dctx = ZSTD_createDCtx()) == NULL) {
+		return -1;
+	}
+	unsigned char *in = malloc(COMPRESS_BUFFER_SIZE);
+	unsigned char *out = malloc(COMPRESS_BUFFER_SIZE);
+
+	/* Hint from the codec: 0 once the frame is complete */
+	size_t remaining = 1;
+	int status = 0;
+	int last = 0;
+	while (status == 0 && !last) {
+		ssize_t len = read_full(src_fd, in, COMPRESS_BUFFER_SIZE);
+		if (len == -1) {
+			status = -1;
+			break;
+		}
+		last = (len < COMPRESS_BUFFER_SIZE);
+		if (len == 0 && !compress) {
+			break;
+		}
+		ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+		ZSTD_inBuffer input = { in, len, 0 };
+		ZSTD_outBuffer output;
+		do {
+			output.dst = out;
+			output.size = COMPRESS_BUFFER_SIZE;
+			output.pos = 0;
+			if (compress) {
+				remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+			} else {
+				remaining = ZSTD_decompressStream(dctx, &output, &input);
+			}
+			if (ZSTD_isError(remaining) || write_full(dst_fd, out, output.pos) != 0) {
+				status = -1;
+				break;
+			}
+			*out_size += output.pos;
+			/*
+			 * The codec may hold back output even after taking all the input,
+			 * till the frame is complete.
+			 */
+		} while (input.pos < input.size
+				|| (remaining != 0 && (output.pos == output.size || (compress && last))));
+	}
+	if (status == 0 && !compress && remaining != 0) {
+		/* The input ended within a frame */
+		status = -1;
+	}
+
+	free(in);
+	free(out);
+	ZSTD_freeCCtx(cctx);
+	ZSTD_freeDCtx(dctx);
+	return status;
+}
+#else
+static int zstd_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size) {
+	return -1;
+}
+#endif /* HAVE_ZSTD */
+
+#ifdef HAVE_ZLIB
+static int gzip_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size) {
+	z_stream strm;
+	memset(&strm, 0, sizeof(strm));
+	/* 16 over the window bits selects the gzip wrapper */
+	int ret = compress ? deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)
+			: inflateInit2(&strm, 15 + 16);
+	if (ret != Z_OK) {
+		return -1;
+	}
+	unsigned char *in = malloc(COMPRESS_BUFFER_SIZE);
+	unsigned char *out = malloc(COMPRESS_BUFFER_SIZE);
+
+	int status = 0;
+	int last = 0;
+	while (status == 0 && !last && ret != Z_STREAM_END) {
+		ssize_t len = read_full(src_fd, in, COMPRESS_BUFFER_SIZE);
+		if (len == -1) {
+			status = -1;
+			break;
+		}
+		last = (len < COMPRESS_BUFFER_SIZE);
+		strm.next_in = in;
+		strm.avail_in = len;
+		do {
+			strm.next_out = out;
+			strm.avail_out = COMPRESS_BUFFER_SIZE;
+			if (compress) {
+				ret = deflate(&strm, last ? Z_FINISH : Z_NO_FLUSH);
+			} else {
+				ret = inflate(&strm, Z_NO_FLUSH);
+			}
+			/* Z_BUF_ERROR only means that no progress was possible */
+			if ((ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+					|| write_full(dst_fd, out, COMPRESS_BUFFER_SIZE - strm.avail_out) != 0) {
+				status = -1;
+				break;
+			}
+			*out_size += COMPRESS_BUFFER_SIZE - strm.avail_out;
+		} while (strm.avail_out == 0 && ret != Z_STREAM_END);
+	}
+	if (status == 0 && ret != Z_STREAM_END) {
+		/* The input ended within the stream */
+		status = -1;
+	}
+
+	free(in);
+	free(out);
+	if (compress) {
+		deflateEnd(&strm);
+	} else {
+		inflateEnd(&strm);
+	}
+	return status;
+}
+#else
+static int gzip_stream(int compress, int level, int src_fd, int dst_fd, uint64_t *out_size) {
+	return -1;
+}
+#endif /* HAVE_ZLIB */
+
+#if defined(HAVE_ZSTD) || defined(HAVE_ZLIB)
+static ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		ssize_t count = read(fd, buf + total, len - total);
+		if (count == 0) {
+			break;
+		} else if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		total += count;
+	}
+	return total;
+}
+
+static int write_full(int fd, const unsigned char *buf, size_t len) {
+	while (len > 0) {
+		ssize_t count = write(fd, buf, len);
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buf += count;
+		len -= count;
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,115 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_COMPRESS_H
+#define GOODRV_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Compression formats. Only the ones found by configure are built in.
+ */
+enum compress_codec {
+	COMPRESS_NONE,
+	COMPRESS_ZSTD,
+	COMPRESS_GZIP
+};
+
+/*
+ * When and how files are compressed.
+ * codec - Format of the compressed files, COMPRESS_NONE to never compress.
+ * level - Compression level of the codec. The low levels run at streaming
+ * 		   speeds.
+ * max_entropy - Files whose sampled entropy is above this many bits per byte
+ * 				 are taken to be incompressible.
+ * min_size - Files smaller than this are not worth compressing.
+ */
+struct compress_options {
+	enum compress_codec codec;
+	int level;
+	double max_entropy;
+	uint64_t min_size;
+};
+
+/*
+ * Fill the options with the defaults: the fastest built-in codec at its
+ * fastest level.
+ */
+void compress_default_options(struct compress_options *options);
+
+/*
+ * Check whether the codec is built in. COMPRESS_NONE never is.
+ */
+int compress_codec_available(enum compress_codec codec);
+
+/*
+ * Get the suffix of the names of the files in the format, e.g. ".zst".
+ */
+const char *compress_suffix(enum compress_codec codec);
+
+/*
+ * Get the Shannon entropy of the bytes, in bits per byte: 8 for random data,
+ * and about 4.5 to 5.5 for text.
+ */
+double compress_entropy(const unsigned char *buf, size_t len);
+
+/*
+ * Check whether the file is in a format that is already compressed, going by
+ * its leading bytes (magic number) and, failing that, its extension.
+ *
+ * head, head_len - The first bytes of the file. May be empty.
+ */
+int compress_is_compressed_format(const char *path, const unsigned char *head, size_t head_len);
+
+/*
+ * Decide whether the file is worth compressing, by reading a few small
+ * samples spread over it, rather than the whole file.
+ *
+ * fd - Open file, which is read with pread, so its offset does not change.
+ * size - Size of the file.
+ *
+ * Returns 1 to compress, 0 otherwise.
+ */
+int compress_worthwhile(struct compress_options *options, const char *path, int fd, uint64_t size);
+
+/*
+ * Compress the contents of src_fd, from its current offset to the end, and
+ * write them to dst_fd.
+ *
+ * out_size - If not NULL, set to the number of bytes written.
+ *
+ * Returns 0 on success, -1 on failure (including a codec that is not built in).
+ */
+int compress_stream(enum compress_codec codec, int level, int src_fd, int dst_fd,
+		uint64_t *out_size);
+
+/*
+ * Decompress the contents of src_fd, written by compress_stream, to dst_fd.
+ *
+ * Returns 0 on success, -1 on failure or corrupt input.
+ */
+int decompress_stream(enum compress_codec codec, int src_fd, int dst_fd);
+
+#endif /* GOODRV_COMPRESS_H */
@@ -25,11 +25,15 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+/*
+ * Settings of the process, shared by all the accounts. Filled lazily by
+ * linux-api.c; anything specific to an account belongs to its sync_account.
+ */
 struct goodrv_config {
 	char* curr_user_home;
 	char* config_dir;
 };
 
-struct goodrv_config goodrv_config;
+extern struct goodrv_config goodrv_config;
 
 #endif /* CONFIG_H */
@@ -0,0 +1,111 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+/* Names of the features, by bit */
+static const char *feature_names[] = { "ssse3", "sse4.1", "avx2", "avx512bw" };
+#define NUM_FEATURES (sizeof(feature_names) / sizeof(feature_names[0]))
+
+static pthread_once_t features_once = PTHREAD_ONCE_INIT;
+static unsigned int allowed_features;
+
+/* Compute the allowed features, from the detected ones and the environment */
+static void init_features();
+/* Parse the list of feature names in the environment variable */
+static unsigned int parse_features(const char *list);
+
+unsigned int cpu_detect() {
+	unsigned int features = 0;
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+	/* These check the OS support of the wider registers too, through xgetbv */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("ssse3")) {
+		features |= CPU_FEATURE_SSSE3;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		features |= CPU_FEATURE_SSE41;
+	}
+	if (__builtin_cpu_supports("avx2")) {
+		features |= CPU_FEATURE_AVX2;
+	}
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+		features |= CPU_FEATURE_AVX512BW;
+	}
+#endif
+	return features;
+}
+
+unsigned int cpu_features() {
+	pthread_once(&features_once, &init_features);
+	return allowed_features;
+}
+
+const char *cpu_feature_name(unsigned int feature) {
+	for (unsigned int i = 0; i < NUM_FEATURES; i++) {
+		if (feature == (1U << i)) {
+			return feature_names[i];
+		}
+	}
+	return NULL;
+}
+
+const struct cpu_kernel *cpu_select(const struct cpu_kernel *variants) {
+	unsigned int features = cpu_features();
+	while ((variants->features & features) != variants->features) {
+		variants++;
+	}
+	return variants;
+}
+
+static void init_features() {
+	allowed_features = cpu_detect();
+	const char *list = getenv(CPU_FEATURES_ENV);
+	if (list != NULL) {
+		allowed_features &= parse_features(list);
+	}
+}
+
+static unsigned int parse_features(const char *list) {
+	unsigned int features = 0;
+	char *copy = strdup(list);
+	char *saveptr;
+	for (char *name = strtok_r(copy, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+		unsigned int i;
+		for (i = 0; i < NUM_FEATURES && strcmp(name, feature_names[i]) != 0; i++);
+		if (i < NUM_FEATURES) {
+			features |= 1U << i;
+		} else if (strcmp(name, "none") != 0) {
+			fprintf(stderr, "%s: unknown CPU feature %s\n", CPU_FEATURES_ENV, name);
+		}
+	}
+	free(copy);
+	return features;
+}
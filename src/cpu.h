@@ -0,0 +1,76 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_CPU_H
+#define GOODRV_CPU_H
+
+/* Features of the CPU that the kernels can use */
+#define CPU_FEATURE_SSSE3 01
+#define CPU_FEATURE_SSE41 02
+#define CPU_FEATURE_AVX2 04
+#define CPU_FEATURE_AVX512BW 010
+
+/* Environment variable limiting the features used, for testing */
+#define CPU_FEATURES_ENV "GOODRV_CPU_FEATURES"
+
+/*
+ * Generic function pointer, cast to the type of the kernel.
+ */
+typedef void (*cpu_fn)(void);
+
+/*
+ * A variant of a kernel, usable when the CPU has all of its features.
+ */
+struct cpu_kernel {
+	const char *name;
+	unsigned int features;
+	cpu_fn fn;
+};
+
+/*
+ * Get the features of the CPU, as supported by the operating system too.
+ */
+unsigned int cpu_detect();
+
+/*
+ * Get the features the kernels may use: those detected, limited to the ones
+ * listed in GOODRV_CPU_FEATURES when it is set. The variable is a comma
+ * separated list of feature names (ssse3, sse4.1, avx2, avx512bw), or "none"
+ * for the scalar code only. Read once, on the first call.
+ */
+unsigned int cpu_features();
+
+/*
+ * Get the name of a single feature.
+ */
+const char *cpu_feature_name(unsigned int feature);
+
+/*
+ * Choose the first variant of a kernel whose features are all allowed by
+ * cpu_features(). The variants are ordered best first, and end with the scalar
+ * reference, which has no features and is always chosen last.
+ */
+const struct cpu_kernel *cpu_select(const struct cpu_kernel *variants);
+
+#endif /* GOODRV_CPU_H */
@@ -0,0 +1,626 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <openssl/md5.h>
+
+#include "dedup.h"
+#include "hashtable.h"
+
+/* Length of the key of the contents: hex MD5, '-', decimal size, '\0' */
+#define DEDUP_KEY_LEN (2 * MD5_DIGEST_LENGTH + 1 + 20 + 1)
+/* Bytes copied within the kernel at a time */
+#define DEDUP_COPY_RANGE_SIZE (1 << 30)
+/* Size of the buffer for copying in user space */
+#define DEDUP_COPY_BUFFER_SIZE (128 * 1024)
+
+/*
+ * A local file that holds the contents
+ */
+struct dedup_local {
+	char *path;
+	uint64_t dev;
+	uint64_t ino;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+
+/*
+ * A remote object that holds the contents
+ */
+struct dedup_remote {
+	/* Store and name, separated by a newline */
+	char *key;
+	/* Name, within key */
+	const char *name;
+};
+
+/*
+ * Contents, and where they are found
+ */
+struct dedup_entry {
+	char key[DEDUP_KEY_LEN];
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	uint64_t size;
+	struct dedup_local *locals;
+	unsigned int num_locals;
+	unsigned int max_locals;
+	struct dedup_remote *remotes;
+	unsigned int num_remotes;
+	unsigned int max_remotes;
+};
+
+struct dedup_index {
+	/* Key of the contents -> entry */
+	hashtable entries;
+	/* Local path -> entry */
+	hashtable locals;
+	/* Key of the remote object -> entry */
+	hashtable remotes;
+	/* All the entries, for saving and freeing them */
+	struct dedup_entry **list;
+	unsigned int num_entries;
+	unsigned int max_entries;
+	pthread_mutex_t lock;
+};
+
+/* Get the entry of the contents, creating it if needed. Called with the lock held */
+static struct dedup_entry *get_entry(dedup_index index, const unsigned char *digest, uint64_t size,
+		int create);
+/* Add a local file to the entry. Called with the lock held */
+static void add_local(dedup_index index, struct dedup_entry *entry, const char *path, uint64_t dev,
+		uint64_t ino, int64_t mtime_sec, int64_t mtime_nsec);
+/* Remove the local file from its entry, if it has one. Called with the lock held */
+static void remove_local(dedup_index index, const char *path);
+/* Add a remote object to the entry. Called with the lock held */
+static void add_remote(dedup_index index, struct dedup_entry *entry, const char *store,
+		const char *name);
+/* Remove the remote object from its entry, if it has one. Called with the lock held */
+static void remove_remote(dedup_index index, const char *key);
+/* Rename the local file, keeping its metadata. Called with the lock held */
+static void rename_local(dedup_index index, const char *old_path, const char *new_path);
+/* Rename the remote object. Called with the lock held */
+static void rename_remote(dedup_index index, const char *store, const char *old_name,
+		const char *new_name);
+/* Build the name under new_name of a name below old_name */
+static char *renamed(const char *name, size_t old_len, const char *new_name);
+/* Build the key of a remote object */
+static char *remote_key(const char *store, const char *name);
+/* Build the key of some contents */
+static void contents_key(char *key, const unsigned char *digest, uint64_t size);
+/* Parse a hex MD5. Returns 0 on success, -1 if it is not valid */
+static int parse_digest(const char *hex, unsigned char *digest);
+/* Copy the rest of the file with read and write */
+static int copy_user_space(int src_fd, int dest_fd);
+
+dedup_index dedup_create() {
+	dedup_index index = calloc(1, sizeof(struct dedup_index));
+	ht_options options = default_ht_options();
+	options->table_size = 1024;
+	index->entries = ht_create(options);
+	index->locals = ht_create(options);
+	index->remotes = ht_create(options);
+	free(options);
+	pthread_mutex_init(&index->lock, NULL);
+	return index;
+}
+
+void dedup_destroy(dedup_index index) {
+	if (index == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; i < index->num_entries; i++) {
+		struct dedup_entry *entry = index->list[i];
+		for (unsigned int j = 0; j < entry->num_locals; j++) {
+			free(entry->locals[j].path);
+		}
+		for (unsigned int j = 0; j < entry->num_remotes; j++) {
+			free(entry->remotes[j].key);
+		}
+		free(entry->locals);
+		free(entry->remotes);
+		free(entry);
+	}
+	free(index->list);
+	ht_destroy(index->entries);
+	ht_destroy(index->locals);
+	ht_destroy(index->remotes);
+	pthread_mutex_destroy(&index->lock);
+	free(index);
+}
+
+int dedup_save(dedup_index index, const char *file_path) {
+	char *tmp_path = malloc(strlen(file_path) + strlen(".tmp") + 1);
+	strcpy(tmp_path, file_path);
+	strcat(tmp_path, ".tmp");
+	FILE *file = fopen(tmp_path, "w");
+	if (file == NULL) {
+		free(tmp_path);
+		return -1;
+	}
+
+	/*
+	 * One line per record:
+	 * L <md5> <size> <dev> <ino> <mtime sec> <mtime nsec> <path>
+	 * R <md5> <size> <store> <name>
+	 */
+	pthread_mutex_lock(&index->lock);
+	for (unsigned int i = 0; i < index->num_entries; i++) {
+		struct dedup_entry *entry = index->list[i];
+		char hex[2 * MD5_DIGEST_LENGTH + 1];
+		for (int j = 0; j < MD5_DIGEST_LENGTH; j++) {
+			sprintf(hex + 2 * j, "%02x", entry->digest[j]);
+		}
+		for (unsigned int j = 0; j < entry->num_locals; j++) {
+			struct dedup_local *local = &entry->locals[j];
+			fprintf(file, "L %s %llu %llu %llu %lld %lld %s\n", hex, (unsigned long long) entry->size,
+					(unsigned long long) local->dev, (unsigned long long) local->ino,
+					(long long) local->mtime_sec, (long long) local->mtime_nsec, local->path);
+		}
+		for (unsigned int j = 0; j < entry->num_remotes; j++) {
+			struct dedup_remote *remote = &entry->remotes[j];
+			int store_len = remote->name - remote->key - 1;
+			fprintf(file, "R %s %llu %.*s %s\n", hex, (unsigned long long) entry->size, store_len,
+					remote->key, remote->name);
+		}
+	}
+	pthread_mutex_unlock(&index->lock);
+
+	int status = 0;
+	if (ferror(file) | (fclose(file) != 0) || rename(tmp_path, file_path) != 0) {
+		unlink(tmp_path);
+		status = -1;
+	}
+	free(tmp_path);
+	return status;
+}
+
+dedup_index dedup_load(const char *file_path) {
+	FILE *file = fopen(file_path, "r");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	dedup_index index = dedup_create();
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	int valid = 1;
+	while (valid && (len = getline(&line, &line_size, file)) != -1) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		char type, hex[2 * MD5_DIGEST_LENGTH + 1];
+		unsigned long long size;
+		int rest;
+		unsigned char digest[MD5_DIGEST_LENGTH];
+		if (sscanf(line, "%c %32s %llu %n", &type, hex, &size, &rest) != 3
+				|| parse_digest(hex, digest) != 0) {
+			valid = 0;
+			break;
+		}
+
+		struct dedup_entry *entry = get_entry(index, digest, size, 1);
+		if (type == 'L') {
+			unsigned long long dev, ino;
+			long long mtime_sec, mtime_nsec;
+			int path_start;
+			if (sscanf(line + rest, "%llu %llu %lld %lld %n", &dev, &ino, &mtime_sec, &mtime_nsec,
+					&path_start) != 4 || line[rest + path_start] == '\0') {
+				valid = 0;
+			} else {
+				add_local(index, entry, line + rest + path_start, dev, ino, mtime_sec, mtime_nsec);
+			}
+		} else if (type == 'R') {
+			char *store = line + rest;
+			char *name = strchr(store, ' ');
+			if (name == NULL || name == store || name[1] == '\0') {
+				valid = 0;
+			} else {
+				*name++ = '\0';
+				add_remote(index, entry, store, name);
+			}
+		} else {
+			valid = 0;
+		}
+	}
+	free(line);
+	fclose(file);
+
+	if (!valid) {
+		dedup_destroy(index);
+		return NULL;
+	}
+	return index;
+}
+
+void dedup_add_local(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *path, struct stat *file_stat) {
+	if (strchr(path, '\n') != NULL) {
+		return;
+	}
+	pthread_mutex_lock(&index->lock);
+	remove_local(index, path);
+	add_local(index, get_entry(index, digest, size, 1), path, file_stat->st_dev, file_stat->st_ino,
+			file_stat->st_mtim.tv_sec, file_stat->st_mtim.tv_nsec);
+	pthread_mutex_unlock(&index->lock);
+}
+
+void dedup_remove_local(dedup_index index, const char *path) {
+	pthread_mutex_lock(&index->lock);
+	remove_local(index, path);
+	pthread_mutex_unlock(&index->lock);
+}
+
+void dedup_add_remote(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *store, const char *name) {
+	if (strpbrk(store, " \t\n") != NULL || *store == '\0' || strchr(name, '\n') != NULL) {
+		return;
+	}
+	char *key = remote_key(store, name);
+	pthread_mutex_lock(&index->lock);
+	remove_remote(index, key);
+	add_remote(index, get_entry(index, digest, size, 1), store, name);
+	pthread_mutex_unlock(&index->lock);
+	free(key);
+}
+
+void dedup_remove_remote(dedup_index index, const char *store, const char *name) {
+	char *key = remote_key(store, name);
+	pthread_mutex_lock(&index->lock);
+	remove_remote(index, key);
+	pthread_mutex_unlock(&index->lock);
+	free(key);
+}
+
+void dedup_rename_local(dedup_index index, const char *old_path, const char *new_path, int subtree) {
+	size_t old_len = strlen(old_path);
+	pthread_mutex_lock(&index->lock);
+	/* The paths are gathered first, since renaming moves the records around */
+	char **paths = NULL;
+	unsigned int num_paths = 0, max_paths = 0;
+	for (unsigned int i = 0; subtree && i < index->num_entries; i++) {
+		struct dedup_entry *entry = index->list[i];
+		for (unsigned int j = 0; j < entry->num_locals; j++) {
+			const char *path = entry->locals[j].path;
+			if (strncmp(path, old_path, old_len) == 0 && path[old_len] == '/') {
+				if (num_paths == max_paths) {
+					max_paths = (max_paths > 0) ? 2 * max_paths : 16;
+					paths = realloc(paths, max_paths * sizeof(char *));
+				}
+				paths[num_paths++] = strdup(path);
+			}
+		}
+	}
+	rename_local(index, old_path, new_path);
+	for (unsigned int i = 0; i < num_paths; i++) {
+		char *path = renamed(paths[i], old_len, new_path);
+		rename_local(index, paths[i], path);
+		free(path);
+		free(paths[i]);
+	}
+	pthread_mutex_unlock(&index->lock);
+	free(paths);
+}
+
+void dedup_rename_remote(dedup_index index, const char *store, const char *old_name,
+		const char *new_name, int subtree) {
+	char *old_key = remote_key(store, old_name);
+	size_t old_key_len = strlen(old_key);
+	pthread_mutex_lock(&index->lock);
+	char **names = NULL;
+	unsigned int num_names = 0, max_names = 0;
+	for (unsigned int i = 0; subtree && i < index->num_entries; i++) {
+		struct dedup_entry *entry = index->list[i];
+		for (unsigned int j = 0; j < entry->num_remotes; j++) {
+			const char *key = entry->remotes[j].key;
+			if (strncmp(key, old_key, old_key_len) == 0 && key[old_key_len] == '/') {
+				if (num_names == max_names) {
+					max_names = (max_names > 0) ? 2 * max_names : 16;
+					names = realloc(names, max_names * sizeof(char *));
+				}
+				names[num_names++] = strdup(entry->remotes[j].name);
+			}
+		}
+	}
+	rename_remote(index, store, old_name, new_name);
+	for (unsigned int i = 0; i < num_names; i++) {
+		char *name = renamed(names[i], strlen(old_name), new_name);
+		rename_remote(index, store, names[i], name);
+		free(name);
+		free(names[i]);
+	}
+	pthread_mutex_unlock(&index->lock);
+	free(names);
+	free(old_key);
+}
+
+char *dedup_find_local(dedup_index index, const unsigned char *digest, uint64_t size) {
+	char *path = NULL;
+	pthread_mutex_lock(&index->lock);
+	struct dedup_entry *entry = get_entry(index, digest, size, 0);
+	while (entry != NULL && entry->num_locals > 0 && path == NULL) {
+		struct dedup_local *local = &entry->locals[0];
+		struct stat file_stat;
+		if (lstat(local->path, &file_stat) == 0 && S_ISREG(file_stat.st_mode)
+				&& (uint64_t) file_stat.st_size == size && file_stat.st_dev == local->dev
+				&& file_stat.st_ino == local->ino && file_stat.st_mtim.tv_sec == local->mtime_sec
+				&& file_stat.st_mtim.tv_nsec == local->mtime_nsec) {
+			path = strdup(local->path);
+		} else {
+			/* Changed or gone since */
+			remove_local(index, local->path);
+		}
+	}
+	pthread_mutex_unlock(&index->lock);
+	return path;
+}
+
+char *dedup_find_remote(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *store) {
+	char *name = NULL;
+	size_t store_len = strlen(store);
+	pthread_mutex_lock(&index->lock);
+	struct dedup_entry *entry = get_entry(index, digest, size, 0);
+	for (unsigned int i = 0; entry != NULL && i < entry->num_remotes; i++) {
+		struct dedup_remote *remote = &entry->remotes[i];
+		if (strncmp(remote->key, store, store_len) == 0 && remote->key[store_len] == '\n') {
+			name = strdup(remote->name);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&index->lock);
+	return name;
+}
+
+int dedup_clone_file(const char *src_path, const char *dest_path) {
+	int src_fd = open(src_path, O_RDONLY);
+	if (src_fd == -1) {
+		return -1;
+	}
+	int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (dest_fd == -1) {
+		close(src_fd);
+		return -1;
+	}
+
+	int status = 0;
+	if (ioctl(dest_fd, FICLONE, src_fd) != 0) {
+		/* Not a file system with reflinks, or not the same one */
+		ssize_t count;
+		do {
+			count = copy_file_range(src_fd, NULL, dest_fd, NULL, DEDUP_COPY_RANGE_SIZE, 0);
+		} while (count > 0);
+		if (count == -1) {
+			if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+				status = copy_user_space(src_fd, dest_fd);
+			} else {
+				status = -1;
+			}
+		}
+	}
+
+	if ((close(dest_fd) != 0) | (close(src_fd) != 0) || status != 0) {
+		unlink(dest_path);
+		return -1;
+	}
+	return 0;
+}
+
+static struct dedup_entry *get_entry(dedup_index index, const unsigned char *digest, uint64_t size,
+		int create) {
+	char key[DEDUP_KEY_LEN];
+	contents_key(key, digest, size);
+	struct dedup_entry *entry = ht_get(index->entries, key);
+	if (entry != NULL || !create) {
+		return entry;
+	}
+
+	entry = calloc(1, sizeof(struct dedup_entry));
+	strcpy(entry->key, key);
+	memcpy(entry->digest, digest, MD5_DIGEST_LENGTH);
+	entry->size = size;
+	ht_put(index->entries, entry->key, entry);
+	if (index->num_entries == index->max_entries) {
+		index->max_entries = (index->max_entries > 0) ? 2 * index->max_entries : 64;
+		index->list = realloc(index->list, index->max_entries * sizeof(struct dedup_entry *));
+	}
+	index->list[index->num_entries++] = entry;
+	return entry;
+}
+
+static void add_local(dedup_index index, struct dedup_entry *entry, const char *path, uint64_t dev,
+		uint64_t ino, int64_t mtime_sec, int64_t mtime_nsec) {
+	if (ht_exists(index->locals, (void *) path)) {
+		return;
+	}
+	if (entry->num_locals == entry->max_locals) {
+		entry->max_locals = (entry->max_locals > 0) ? 2 * entry->max_locals : 2;
+		entry->locals = realloc(entry->locals, entry->max_locals * sizeof(struct dedup_local));
+	}
+	struct dedup_local *local = &entry->locals[entry->num_locals++];
+	local->path = strdup(path);
+	local->dev = dev;
+	local->ino = ino;
+	local->mtime_sec = mtime_sec;
+	local->mtime_nsec = mtime_nsec;
+	ht_put(index->locals, local->path, entry);
+}
+
+static void remove_local(dedup_index index, const char *path) {
+	struct dedup_entry *entry = ht_get(index->locals, (void *) path);
+	if (entry == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; i < entry->num_locals; i++) {
+		if (strcmp(entry->locals[i].path, path) == 0) {
+			char *local_path = entry->locals[i].path;
+			ht_remove(index->locals, local_path);
+			free(local_path);
+			entry->locals[i] = entry->locals[--entry->num_locals];
+			return;
+		}
+	}
+}
+
+static void add_remote(dedup_index index, struct dedup_entry *entry, const char *store,
+		const char *name) {
+	char *key = remote_key(store, name);
+	if (ht_exists(index->remotes, key)) {
+		free(key);
+		return;
+	}
+	if (entry->num_remotes == entry->max_remotes) {
+		entry->max_remotes = (entry->max_remotes > 0) ? 2 * entry->max_remotes : 2;
+		entry->remotes = realloc(entry->remotes, entry->max_remotes * sizeof(struct dedup_remote));
+	}
+	struct dedup_remote *remote = &entry->remotes[entry->num_remotes++];
+	remote->key = key;
+	remote->name = key + strlen(store) + 1;
+	ht_put(index->remotes, remote->key, entry);
+}
+
+static void remove_remote(dedup_index index, const char *key) {
+	struct dedup_entry *entry = ht_get(index->remotes, (void *) key);
+	if (entry == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; i < entry->num_remotes; i++) {
+		if (strcmp(entry->remotes[i].key, key) == 0) {
+			char *remote_key = entry->remotes[i].key;
+			ht_remove(index->remotes, remote_key);
+			free(remote_key);
+			entry->remotes[i] = entry->remotes[--entry->num_remotes];
+			return;
+		}
+	}
+}
+
+static void rename_local(dedup_index index, const char *old_path, const char *new_path) {
+	struct dedup_entry *entry = ht_get(index->locals, (void *) old_path);
+	if (entry == NULL || strcmp(old_path, new_path) == 0) {
+		return;
+	}
+	struct dedup_local local = { 0 };
+	for (unsigned int i = 0; i < entry->num_locals; i++) {
+		if (strcmp(entry->locals[i].path, old_path) == 0) {
+			local = entry->locals[i];
+			break;
+		}
+	}
+	remove_local(index, new_path);
+	/* The record is dropped along with the path, so its metadata is copied out */
+	if (strchr(new_path, '\n') == NULL) {
+		add_local(index, entry, new_path, local.dev, local.ino, local.mtime_sec, local.mtime_nsec);
+	}
+	remove_local(index, old_path);
+}
+
+static void rename_remote(dedup_index index, const char *store, const char *old_name,
+		const char *new_name) {
+	char *old_key = remote_key(store, old_name);
+	struct dedup_entry *entry = ht_get(index->remotes, old_key);
+	if (entry != NULL && strcmp(old_name, new_name) != 0) {
+		char *new_key = remote_key(store, new_name);
+		remove_remote(index, new_key);
+		remove_remote(index, old_key);
+		if (strchr(new_name, '\n') == NULL) {
+			add_remote(index, entry, store, new_name);
+		}
+		free(new_key);
+	}
+	free(old_key);
+}
+
+static char *renamed(const char *name, size_t old_len, const char *new_name) {
+	char *path = malloc(strlen(new_name) + strlen(name + old_len) + 1);
+	strcpy(path, new_name);
+	strcat(path, name + old_len);
+	return path;
+}
+
+static char *remote_key(const char *store, const char *name) {
+	char *key = malloc(strlen(store) + strlen(name) + 2);
+	sprintf(key, "%s\n%s", store, name);
+	return key;
+}
+
+static void contents_key(char *key, const unsigned char *digest, uint64_t size) {
+	for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+		sprintf(key + 2 * i, "%02x", digest[i]);
+	}
+	sprintf(key + 2 * MD5_DIGEST_LENGTH, "-%llu", (unsigned long long) size);
+}
+
+static int parse_digest(const char *hex, unsigned char *digest) {
+	if (strlen(hex) != 2 * MD5_DIGEST_LENGTH) {
+		return -1;
+	}
+	for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+		unsigned int byte;
+		if (sscanf(hex + 2 * i, "%2x", &byte) != 1) {
+			return -1;
+		}
+		digest[i] = byte;
+	}
+	return 0;
+}
+
+static int copy_user_space(int src_fd, int dest_fd) {
+	unsigned char *buf = malloc(DEDUP_COPY_BUFFER_SIZE);
+	int status = 0;
+	while (1) {
+		ssize_t count = read(src_fd, buf, DEDUP_COPY_BUFFER_SIZE);
+		if (count == -1 && errno == EINTR) {
+			continue;
+		}
+		if (count <= 0) {
+			status = (count == 0) ? 0 : -1;
+			break;
+		}
+		for (ssize_t done = 0; done < count;) {
+			ssize_t written = write(dest_fd, buf + done, count - done);
+			if (written == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				free(buf);
+				return -1;
+			}
+			done += written;
+		}
+	}
+	free(buf);
+	return status;
+}
@@ -0,0 +1,134 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_DEDUP_H
+#define GOODRV_DEDUP_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * Content addressed index: maps the MD5 and size of some contents to the
+ * local files that hold them, and to the remote objects that hold them in
+ * each store (e.g. the Drive of an account).
+ *
+ * A local file is trusted to still hold the contents as long as its inode,
+ * size and modification time are what they were when it was added, the same
+ * way as the fast start trusts the directories. Remote objects are to be
+ * checked with stat_object before they are relied on.
+ *
+ * All the functions may be called from several threads.
+ */
+typedef struct dedup_index *dedup_index;
+
+/*
+ * Create an empty index.
+ */
+dedup_index dedup_create();
+
+/*
+ * Free the index.
+ */
+void dedup_destroy(dedup_index index);
+
+/*
+ * Save the index to a file, replacing it atomically.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int dedup_save(dedup_index index, const char *file_path);
+
+/*
+ * Load an index saved with dedup_save. Returns NULL if the file is missing or
+ * is not a valid index.
+ */
+dedup_index dedup_load(const char *file_path);
+
+/*
+ * Record that the local file holds the contents. Any earlier record of the
+ * path is replaced. Paths with a newline are not recorded.
+ */
+void dedup_add_local(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *path, struct stat *file_stat);
+
+/*
+ * Forget the local file.
+ */
+void dedup_remove_local(dedup_index index, const char *path);
+
+/*
+ * Record that the object with the name, in the store, holds the contents.
+ * Any earlier record of the object is replaced. The name of the store should
+ * not have whitespace, and the name of the object should not have a newline.
+ */
+void dedup_add_remote(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *store, const char *name);
+
+/*
+ * Forget the object.
+ */
+void dedup_remove_remote(dedup_index index, const char *store, const char *name);
+
+/*
+ * Record that the local file at old_path was renamed to new_path. With
+ * subtree non zero, old_path is a directory, and the files below it are
+ * renamed along with it. Any earlier records of the new paths are replaced.
+ */
+void dedup_rename_local(dedup_index index, const char *old_path, const char *new_path, int subtree);
+
+/*
+ * Record that the object old_name, in the store, was renamed to new_name,
+ * and with subtree non zero, along with the objects below old_name/, as
+ * by move_object of the transport. Any earlier records of the new names
+ * are replaced.
+ */
+void dedup_rename_remote(dedup_index index, const char *store, const char *old_name,
+		const char *new_name, int subtree);
+
+/*
+ * Find a local file that still holds the contents. The records of the files
+ * that have changed are dropped on the way.
+ *
+ * Returns the path, which should be freed, or NULL if there is none.
+ */
+char *dedup_find_local(dedup_index index, const unsigned char *digest, uint64_t size);
+
+/*
+ * Find an object in the store that holds the contents.
+ *
+ * Returns the name, which should be freed, or NULL if there is none.
+ */
+char *dedup_find_remote(dedup_index index, const unsigned char *digest, uint64_t size,
+		const char *store);
+
+/*
+ * Copy the file at src_path to dest_path, as a reflink (FICLONE) that shares
+ * the blocks of src_path when the file system allows it, or else as a copy
+ * made within the kernel.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int dedup_clone_file(const char *src_path, const char *dest_path);
+
+#endif /* GOODRV_DEDUP_H */
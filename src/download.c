@@ -0,0 +1,338 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/md5.h>
+
+#include "download.h"
+
+/*
+ * State shared by the fetchers of a download
+ */
+struct download_ctx {
+	struct transport *transport;
+	struct download_options options;
+	const char *name;
+	uint64_t size;
+	uint64_t num_ranges;
+	/* File Descriptor of the temporary file */
+	int fd;
+
+	pthread_mutex_t lock;
+	/* Signalled when the hashing moves ahead, or the download fails */
+	pthread_cond_t window_moved;
+	/* Next range to be fetched */
+	uint64_t next_range;
+	/* Next range to be hashed */
+	uint64_t next_hash;
+	/* Set while a fetcher is hashing the completed ranges */
+	int hashing;
+	int failed;
+	/* Fetched ranges waiting for their turn to be hashed, by range index modulo window */
+	unsigned char **ready;
+	size_t *ready_len;
+	MD5_CTX md5_ctxt;
+	struct download_stats stats;
+};
+
+/* Fetch ranges and write them into the file, till there are none left */
+static void *fetcher_thread(void *arg);
+/* Hand the fetched range over for hashing, and hash the ranges that are due */
+static void complete_range(struct download_ctx *ctx, uint64_t index, unsigned char *buf, size_t len);
+/* Write the whole buffer at offset */
+static int pwrite_full(int fd, const unsigned char *buf, size_t len, uint64_t offset);
+/* Reserve the space for the file */
+static void reserve_space(int fd, uint64_t size);
+/*
+ * Clone a local file with the same contents as the object, as per the dedup
+ * index, into dest_path through tmp_path. Returns 0 on success, -1 if the
+ * object has to be fetched.
+ */
+static int clone_duplicate(struct download_ctx *ctx, const unsigned char *digest, const char *tmp_path,
+		const char *dest_path);
+
+void download_default_options(struct download_options *options) {
+	options->num_fetchers = 4;
+	options->range_size = 1024 * 1024;
+	options->window = 16;
+	options->max_retries = 5;
+	options->backoff_us = 100000;
+	options->dedup = NULL;
+}
+
+int download_file(struct transport *transport, const char *name, const char *dest_path,
+		struct download_options *options, struct download_stats *stats) {
+	if (transport == NULL || name == NULL || dest_path == NULL) {
+		return -1;
+	}
+
+	struct download_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.transport = transport;
+	ctx.name = name;
+	if (options != NULL) {
+		ctx.options = *options;
+	} else {
+		download_default_options(&ctx.options);
+	}
+	if (ctx.options.range_size == 0 || ctx.options.num_fetchers == 0) {
+		return -1;
+	}
+	if (ctx.options.window < ctx.options.num_fetchers) {
+		ctx.options.window = ctx.options.num_fetchers;
+	}
+
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	unsigned int seed = (unsigned int) time(NULL);
+	unsigned int attempt = 0;
+	int status;
+	while ((status = transport->stat_object(transport, name, &ctx.size, digest)) == TRANSPORT_ERR_RETRY
+			&& transport_retry_wait(attempt++, ctx.options.max_retries, ctx.options.backoff_us, &seed)) {
+		ctx.stats.retries++;
+	}
+	if (status != TRANSPORT_OK) {
+		return -1;
+	}
+
+	char *tmp_path = malloc(strlen(dest_path) + strlen(".goodrive-part") + 1);
+	strcpy(tmp_path, dest_path);
+	strcat(tmp_path, ".goodrive-part");
+	if (ctx.options.dedup != NULL && clone_duplicate(&ctx, digest, tmp_path, dest_path) == 0) {
+		free(tmp_path);
+		if (stats != NULL) {
+			*stats = ctx.stats;
+		}
+		return 0;
+	}
+
+	ctx.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (ctx.fd == -1) {
+		free(tmp_path);
+		return -1;
+	}
+	reserve_space(ctx.fd, ctx.size);
+
+	ctx.num_ranges = (ctx.size + ctx.options.range_size - 1) / ctx.options.range_size;
+	ctx.ready = calloc(ctx.options.window, sizeof(unsigned char *));
+	ctx.ready_len = calloc(ctx.options.window, sizeof(size_t));
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.window_moved, NULL);
+	MD5_Init(&ctx.md5_ctxt);
+
+	unsigned int num_fetchers = ctx.options.num_fetchers;
+	if (num_fetchers > ctx.num_ranges) {
+		num_fetchers = (ctx.num_ranges > 0) ? ctx.num_ranges : 0;
+	}
+	pthread_t *fetchers = malloc((num_fetchers + 1) * sizeof(pthread_t));
+	unsigned int num_started = 0;
+	while (num_started < num_fetchers
+			&& pthread_create(&fetchers[num_started], NULL, &fetcher_thread, &ctx) == 0) {
+		num_started++;
+	}
+	if (num_started < num_fetchers) {
+		/* Carry on with the threads that could be started, or in this thread */
+		fetcher_thread(&ctx);
+	}
+	for (unsigned int i = 0; i < num_started; i++) {
+		pthread_join(fetchers[i], NULL);
+	}
+	free(fetchers);
+
+	unsigned char md5sum_bytes[MD5_DIGEST_LENGTH];
+	MD5_Final(md5sum_bytes, &ctx.md5_ctxt);
+	int verified = !ctx.failed && ctx.next_hash == ctx.num_ranges
+			&& memcmp(md5sum_bytes, digest, MD5_DIGEST_LENGTH) == 0;
+
+	for (unsigned int i = 0; i < ctx.options.window; i++) {
+		free(ctx.ready[i]);
+	}
+	free(ctx.ready);
+	free(ctx.ready_len);
+	pthread_cond_destroy(&ctx.window_moved);
+	pthread_mutex_destroy(&ctx.lock);
+
+	if (close(ctx.fd) != 0 || !verified || rename(tmp_path, dest_path) != 0) {
+		unlink(tmp_path);
+		free(tmp_path);
+		return -1;
+	}
+	free(tmp_path);
+	if (ctx.options.dedup != NULL) {
+		struct stat file_stat;
+		if (stat(dest_path, &file_stat) == 0) {
+			dedup_add_local(ctx.options.dedup, digest, ctx.size, dest_path, &file_stat);
+		}
+	}
+	if (stats != NULL) {
+		*stats = ctx.stats;
+	}
+	return 0;
+}
+
+static int clone_duplicate(struct download_ctx *ctx, const unsigned char *digest, const char *tmp_path,
+		const char *dest_path) {
+	char *src_path;
+	while ((src_path = dedup_find_local(ctx->options.dedup, digest, ctx->size)) != NULL) {
+		int status = dedup_clone_file(src_path, tmp_path);
+		struct stat file_stat;
+		if (status == 0 && (stat(tmp_path, &file_stat) != 0 || (uint64_t) file_stat.st_size != ctx->size
+				|| rename(tmp_path, dest_path) != 0)) {
+			/* The file changed while it was being cloned */
+			unlink(tmp_path);
+			status = -1;
+		}
+		if (status == 0) {
+			free(src_path);
+			dedup_add_local(ctx->options.dedup, digest, ctx->size, dest_path, &file_stat);
+			ctx->stats.bytes_cloned += ctx->size;
+			return 0;
+		}
+		/* Try the other copies, if any */
+		dedup_remove_local(ctx->options.dedup, src_path);
+		free(src_path);
+	}
+	return -1;
+}
+
+static void *fetcher_thread(void *arg) {
+	struct download_ctx *ctx = arg;
+	struct transport *transport = ctx->transport;
+	unsigned int seed = (unsigned int) time(NULL) ^ (unsigned int) pthread_self();
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		/* Do not run ahead of the hashing by more than the window */
+		while (!ctx->failed && ctx->next_range < ctx->num_ranges
+				&& ctx->next_range >= ctx->next_hash + ctx->options.window) {
+			pthread_cond_wait(&ctx->window_moved, &ctx->lock);
+		}
+		if (ctx->failed || ctx->next_range == ctx->num_ranges) {
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		uint64_t index = ctx->next_range++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		uint64_t offset = index * ctx->options.range_size;
+		size_t len = (offset + ctx->options.range_size > ctx->size) ? ctx->size - offset
+				: ctx->options.range_size;
+		unsigned char *buf = malloc(len);
+
+		int64_t count;
+		unsigned int attempt = 0;
+		unsigned long retries = 0;
+		while ((count = transport->fetch_range(transport, ctx->name, offset, buf, len))
+				== TRANSPORT_ERR_RETRY && transport_retry_wait(attempt++, ctx->options.max_retries,
+						ctx->options.backoff_us, &seed)) {
+			retries++;
+		}
+
+		int failed = (count != (int64_t) len) || pwrite_full(ctx->fd, buf, len, offset) != 0;
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stats.retries += retries;
+		if (failed) {
+			ctx->failed = 1;
+			pthread_cond_broadcast(&ctx->window_moved);
+		} else {
+			ctx->stats.ranges_fetched++;
+			ctx->stats.bytes_fetched += len;
+		}
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (failed) {
+			free(buf);
+			break;
+		}
+		complete_range(ctx, index, buf, len);
+	}
+	return NULL;
+}
+
+static void complete_range(struct download_ctx *ctx, uint64_t index, unsigned char *buf, size_t len) {
+	unsigned int window = ctx->options.window;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->ready[index % window] = buf;
+	ctx->ready_len[index % window] = len;
+	if (!ctx->hashing) {
+		/*
+		 * Only one fetcher hashes at a time, outside the lock. The others
+		 * leave their ranges behind for it, and go on fetching.
+		 */
+		ctx->hashing = 1;
+		while (ctx->ready[ctx->next_hash % window] != NULL) {
+			unsigned int slot = ctx->next_hash % window;
+			unsigned char *data = ctx->ready[slot];
+			size_t data_len = ctx->ready_len[slot];
+			ctx->ready[slot] = NULL;
+			pthread_mutex_unlock(&ctx->lock);
+
+			MD5_Update(&ctx->md5_ctxt, data, data_len);
+			free(data);
+
+			pthread_mutex_lock(&ctx->lock);
+			ctx->next_hash++;
+			pthread_cond_broadcast(&ctx->window_moved);
+		}
+		ctx->hashing = 0;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static int pwrite_full(int fd, const unsigned char *buf, size_t len, uint64_t offset) {
+	size_t total = 0;
+	while (total < len) {
+		ssize_t count = pwrite(fd, buf + total, len - total, offset + total);
+		if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		total += count;
+	}
+	return 0;
+}
+
+static void reserve_space(int fd, uint64_t size) {
+	if (size == 0) {
+		return;
+	}
+	/*
+	 * Reserving the space up front keeps the file from being fragmented by the
+	 * out of order writes. Where fallocate is not supported, only the size is set.
+	 */
+	if (fallocate(fd, 0, 0, size) != 0) {
+		ftruncate(fd, size);
+	}
+}
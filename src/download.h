@@ -0,0 +1,89 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_DOWNLOAD_H
+#define GOODRV_DOWNLOAD_H
+
+#include <stddef.h>
+
+#include "dedup.h"
+#include "transport.h"
+
+/*
+ * Options for the download engine
+ * num_fetchers - Number of ranges that are fetched concurrently.
+ * range_size - Size of the ranges the object is split into.
+ * window - Number of ranges that may be fetched ahead of the first one not
+ * 			yet hashed. At most (window) ranges are in memory.
+ * max_retries - Number of times a failed request is repeated.
+ * backoff_us - Delay before the first retry, in microseconds. See
+ * 				transport_retry_wait.
+ * dedup - Index of the contents of the local files. When a local file has the
+ * 		   contents of the object, it is cloned instead of fetching the
+ * 		   object, and the downloaded files are added. NULL to fetch every
+ * 		   object.
+ */
+struct download_options {
+	unsigned int num_fetchers;
+	size_t range_size;
+	unsigned int window;
+	unsigned int max_retries;
+	unsigned int backoff_us;
+	dedup_index dedup;
+};
+
+/*
+ * What the download engine did.
+ */
+struct download_stats {
+	unsigned long ranges_fetched;
+	unsigned long long bytes_fetched;
+	unsigned long retries;
+	/* Bytes cloned from a local file with the same contents */
+	unsigned long long bytes_cloned;
+};
+
+/*
+ * Fill the options with the defaults.
+ */
+void download_default_options(struct download_options *options);
+
+/*
+ * Download the object with the name into the file at dest_path.
+ *
+ * The object is split into ranges that are fetched concurrently, and written
+ * in place into a temporary file next to dest_path, with its space reserved
+ * up front. The ranges are hashed in order as they complete, so the MD5 sum is
+ * verified without reading the file again. Only then is the temporary file
+ * renamed over dest_path, so dest_path never holds a partial download.
+ *
+ * options - NULL for the defaults.
+ * stats - If not NULL, filled with what was done.
+ *
+ * Returns 0 on success, and -1 on failure.
+ */
+int download_file(struct transport *transport, const char *name, const char *dest_path,
+		struct download_options *options, struct download_stats *stats);
+
+#endif /* GOODRV_DOWNLOAD_H */
@@ -0,0 +1,1330 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "faststart.h"
+#include "hashtable.h"
+#include "linux-api.h"
+#include "metrics.h"
+#include "pathmatch.h"
+#include "pool.h"
+#include "spill.h"
+#include "trace.h"
+#include "treediff.h"
+#include "typed_hashtable.h"
+
+/* Directories with changes noted between two syncs, past which the whole tree is listed */
+#define MAX_DIRTY_DIRS 4096
+/* Events of a watch that tell of a change in the directory */
+#define WATCH_CHANGE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO \
+		| IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+struct sync_host {
+	scheduler sched;
+	/* Reads and hashes the files of the synced trees */
+	pool pool;
+	/* Accounts of the host, and the next tenant id */
+	struct sync_account *accounts;
+	unsigned int next_tenant;
+	/* Accounts whose trees are in memory, the most recently synced first */
+	struct sync_account *lru_head;
+	struct sync_account *lru_tail;
+	/* Bytes of the trees in memory */
+	size_t tree_bytes;
+	pthread_mutex_t lock;
+};
+
+struct sync_account {
+	sync_host host;
+	/* Tenant id of the account in the scheduler */
+	unsigned int tenant;
+	char *email;
+	char *root_dir;
+	char *state_dir;
+	char *index_path;
+	dedup_index dedup;
+	int watch_fd;
+	struct transport *transport;
+	struct upload_options upload;
+	void (*on_upload)(void *arg, const char *file_path, int failed);
+	void *upload_arg;
+
+	/* Include/exclude rules, NULL if there are none; guarded by the sync lock */
+	char *rules_path;
+	path_matcher matcher;
+	/* Metadata of the rules file when it was read, to find out when it changes */
+	struct stat rules_stat;
+
+	/* Tree as of the last sync, NULL till it is loaded */
+	snapshot tree;
+	char *tree_path;
+	/*
+	 * Watches on the directories of the tree, by descriptor and by entry.
+	 * NULL till a sync places them, and dropped along with the tree.
+	 */
+	wd_map watches;
+	int *watch_wds;
+	unsigned int watch_wds_cap;
+	/* Held through a sync, and while the tree is dropped */
+	pthread_mutex_t sync_lock;
+	/* Place in the host's list of trees in memory, guarded by the host's lock */
+	struct sync_account *lru_prev;
+	struct sync_account *lru_next;
+	int in_lru;
+	size_t tree_bytes;
+
+	/* Cached token, NULL if there is none */
+	token_source get_token;
+	void *token_arg;
+	char *token;
+	time_t token_expiry;
+	pthread_mutex_t token_lock;
+
+	/* Guards the counts and stats below */
+	pthread_mutex_t lock;
+	/* Signalled when a transfer of the account is done */
+	pthread_cond_t done;
+	unsigned long pending;
+	struct sync_account_stats stats;
+	/* Hashing of the running sync, NULL if there is none; cancelled by a newer sync */
+	pool_group hash_group;
+	/*
+	 * Watches with changes since the last sync, which lists only their
+	 * directories. Past MAX_DIRTY_DIRS, or once events are lost, it lists
+	 * the whole tree instead.
+	 */
+	wd_map dirty_set;
+	int *dirty_wds;
+	unsigned int num_dirty_wds;
+	unsigned int max_dirty_wds;
+	int rescan_all;
+	/*
+	 * Files queued for upload and not sent yet, by path and in a list. The ones
+	 * that failed, or were cut short by the end of an earlier run, are queued
+	 * again by the next sync.
+	 */
+	hashtable unsent_index;
+	struct unsent_file **unsent;
+	unsigned int num_unsent;
+	unsigned int max_unsent;
+	char *unsent_path;
+
+	struct sync_account *next;
+};
+
+/*
+ * A file queued for upload, and not sent yet
+ */
+struct unsent_file {
+	char *path;
+	/* Uploads of the file queued or running */
+	unsigned int queued;
+	/* Place in the list of the account */
+	unsigned int index;
+};
+
+/*
+ * An upload waiting in the scheduler
+ */
+struct upload_task {
+	sync_account account;
+	char *path;
+};
+
+/*
+ * A sync waiting in the scheduler
+ */
+struct sync_task {
+	sync_account account;
+	void (*done)(void *arg, long queued);
+	void *arg;
+};
+
+/*
+ * The information passed onto the change handler of a sync
+ */
+struct sync_info {
+	sync_account account;
+	snapshot tree;
+	long queued;
+	/*
+	 * Moves are replayed within the store, rather than by sending the files
+	 * again. Only when no upload of an earlier sync is running, since one
+	 * that completes after the move would leave the contents at the old name.
+	 */
+	int move_objects;
+};
+
+/*
+ * State of the scan of a sync. Only the directories with changes, and the
+ * new ones, are listed; the others are taken from the tree of the last sync.
+ */
+struct rescan_ctx {
+	sync_account account;
+	/* Tree of the last sync, and its directories with changes, NULL to list them all */
+	snapshot old_tree;
+	unsigned char *dirty;
+	snapshot tree;
+	/* Watches on the directories of the new tree */
+	wd_map watches;
+	int *watch_wds;
+	unsigned int watch_wds_cap;
+	unsigned long dirs_listed;
+	/* Length of the path of the root, so that paths relative to it can be formed */
+	size_t root_len;
+	/* Buffer for the relative path of a child, while it is checked against the rules */
+	char *rel_path;
+	size_t rel_path_capacity;
+};
+
+/* Run an upload of an account, from a worker */
+static void run_upload(void *arg);
+/* Run a sync of an account, from a worker */
+static void run_sync(void *arg);
+/* Refresh the token of an account, from a worker */
+static void run_token(void *arg);
+/* Queue the uploads for a change found by a sync */
+static void sync_change_handle(struct tdiff_change *change, void *handle_info);
+/* Replay a move within the store; returns 0 on success, -1 if the files are to be sent again */
+static int move_objects(sync_account account, struct tdiff_change *change);
+/* Move the objects with the transport, repeating the transient failures */
+static int move_with_retries(sync_account account, const char *old_name, const char *new_name);
+/* Replay a delete within the store, of the file or, with subtree non zero, of the directory */
+static void delete_objects(sync_account account, const char *path, int subtree);
+/* Delete the objects with the transport, repeating the transient failures */
+static int delete_with_retries(sync_account account, const char *name);
+/* Queue the uploads of the files in the subtree */
+static void queue_subtree(struct sync_info *info, path_id id);
+/* Record that an upload of the file is queued; the account's lock must be held */
+static void add_unsent(sync_account account, const char *path);
+/* Record that an upload of the file is done; the account's lock must be held */
+static void remove_unsent(sync_account account, const char *path, int failed);
+/* Record that the files not sent were renamed along with a move; the account's lock must be held */
+static void rename_unsent(sync_account account, const char *old_path, const char *new_path, int subtree);
+/* Queue again the files of the new tree whose uploads failed or were cut short */
+static void queue_unsent(struct sync_info *info);
+/* Save the paths of the files not sent, one per line */
+static int save_unsent(sync_account account);
+/* Load the paths of the files not sent, saved by an earlier run */
+static void load_unsent(sync_account account);
+/* Put the account's new tree at the head of the host's list, and drop the coldest trees over the budget */
+static void keep_tree(sync_account account);
+/* Drop the tree of an account, which must be in the list, and whose sync lock is held */
+static void evict_tree(sync_account account);
+/* Remove the account from the host's list of trees in memory */
+static void lru_unlink(sync_host host, sync_account account);
+/* Read the rules of the account again if the file changed; the sync lock must be held */
+static void refresh_rules(sync_account account);
+/* Note the events left in the queue of the watches */
+static void drain_events(sync_account account);
+/* Scan the root directory into a new tree, listing only the directories with changes */
+static snapshot rescan_tree(struct rescan_ctx *ctx, sync_account account);
+/* Watch the directory if it is not watched yet, and scan its subtree into the new tree */
+static void rescan_dir(struct rescan_ctx *ctx, path_id old_id, path_id new_id, const char *dir_path);
+/* Read the children of the directory into the new tree */
+static void list_dir(struct rescan_ctx *ctx, path_id new_id, const char *dir_path);
+/* Check whether the rules exclude the child of the directory */
+static int child_excluded(struct rescan_ctx *ctx, const char *dir_path, const char *name,
+		size_t name_len, int is_dir);
+/* Copy the children of the directory from the tree of the last sync into the new tree */
+static void reuse_dir(struct rescan_ctx *ctx, path_id old_id, path_id new_id);
+/* Record the watch on a directory of the new tree */
+static void record_watch(struct rescan_ctx *ctx, int wd, path_id id);
+/* Hand the watches of the new tree, which is the account's now, over to the account */
+static void install_watches(struct rescan_ctx *ctx);
+/* Forget the watches of the tree, which is being dropped; the sync lock must be held */
+static void drop_watches(sync_account account);
+/* Place the watches and get the MD5 sum of the hierarchy; the sync lock must be held */
+static int scan_locked(sync_account account, char **md5sum_ptr);
+/* Take a queued task of the account off the count, and wake its waiters */
+static void task_done(sync_account account);
+/* Add the stats of an upload to the totals of the account */
+static void add_upload_stats(struct upload_stats *total, struct upload_stats *stats);
+/* Get the default state directory of the account */
+static char *default_state_dir(const char *email);
+/* Join a directory and a file name */
+static char *join_path(const char *dir, const char *name);
+
+sync_host sync_host_create(unsigned int num_workers, struct sched_policy *policy) {
+	scheduler sched = sched_create(num_workers, policy);
+	if (sched == NULL) {
+		return NULL;
+	}
+	pool pool = pool_create(NULL);
+	if (pool == NULL) {
+		sched_destroy(sched);
+		return NULL;
+	}
+	sync_host host = calloc(1, sizeof(struct sync_host));
+	host->sched = sched;
+	host->pool = pool;
+	host->next_tenant = 1;
+	pthread_mutex_init(&host->lock, NULL);
+	return host;
+}
+
+void sync_host_destroy(sync_host host) {
+	if (host == NULL) {
+		return;
+	}
+	while (1) {
+		pthread_mutex_lock(&host->lock);
+		sync_account account = host->accounts;
+		pthread_mutex_unlock(&host->lock);
+		if (account == NULL) {
+			break;
+		}
+		sync_account_remove(account);
+	}
+	sched_destroy(host->sched);
+	pool_destroy(host->pool);
+	pthread_mutex_destroy(&host->lock);
+	free(host);
+}
+
+scheduler sync_host_scheduler(sync_host host) {
+	return host->sched;
+}
+
+sync_account sync_account_add(sync_host host, struct sync_account_options *options) {
+	if (options->email == NULL || options->root_dir == NULL || options->transport == NULL
+			|| options->get_token == NULL) {
+		return NULL;
+	}
+	char *state_dir = (options->state_dir != NULL) ? strdup(options->state_dir)
+			: default_state_dir(options->email);
+	if (state_dir == NULL || (mkdir(state_dir, 0700) != 0 && errno != EEXIST)) {
+		free(state_dir);
+		return NULL;
+	}
+	int watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd == -1) {
+		free(state_dir);
+		return NULL;
+	}
+
+	sync_account account = calloc(1, sizeof(struct sync_account));
+	account->host = host;
+	account->email = strdup(options->email);
+	account->root_dir = strdup(options->root_dir);
+	account->state_dir = state_dir;
+	account->index_path = join_path(state_dir, "dedup.index");
+	account->dedup = dedup_load(account->index_path);
+	if (account->dedup == NULL) {
+		account->dedup = dedup_create();
+	}
+	account->watch_fd = watch_fd;
+	account->transport = options->transport;
+	if (options->upload != NULL) {
+		account->upload = *options->upload;
+	} else {
+		upload_default_options(&account->upload);
+	}
+	account->upload.state_dir = account->state_dir;
+	/* The workers of the host send the chunks themselves, instead of threads per file */
+	account->upload.num_senders = 0;
+	account->upload.dedup = account->dedup;
+	account->upload.dedup_store = account->email;
+	account->on_upload = options->on_upload;
+	account->upload_arg = options->upload_arg;
+	account->rules_path = (options->rules_path != NULL) ? strdup(options->rules_path)
+			: join_path(account->root_dir, PM_RULES_FILE);
+	account->tree_path = join_path(state_dir, "tree.snap");
+	account->unsent_index = ht_create(NULL);
+	account->unsent_path = join_path(state_dir, "uploads.unsent");
+	load_unsent(account);
+	account->get_token = options->get_token;
+	account->token_arg = options->token_arg;
+	pthread_mutex_init(&account->sync_lock, NULL);
+	pthread_mutex_init(&account->token_lock, NULL);
+	pthread_mutex_init(&account->lock, NULL);
+	pthread_cond_init(&account->done, NULL);
+
+	pthread_mutex_lock(&host->lock);
+	account->tenant = host->next_tenant++;
+	account->next = host->accounts;
+	host->accounts = account;
+	pthread_mutex_unlock(&host->lock);
+	return account;
+}
+
+void sync_account_remove(sync_account account) {
+	if (account == NULL) {
+		return;
+	}
+	sync_account_wait(account);
+
+	sync_host host = account->host;
+	pthread_mutex_lock(&host->lock);
+	sync_account *link = &host->accounts;
+	while (*link != account) {
+		link = &(*link)->next;
+	}
+	*link = account->next;
+	if (account->in_lru) {
+		lru_unlink(host, account);
+	}
+	pthread_mutex_unlock(&host->lock);
+
+	dedup_save(account->dedup, account->index_path);
+	dedup_destroy(account->dedup);
+	save_unsent(account);
+	for (unsigned int i = 0; i < account->num_unsent; i++) {
+		free(account->unsent[i]->path);
+		free(account->unsent[i]);
+	}
+	free(account->unsent);
+	ht_destroy(account->unsent_index);
+	free(account->unsent_path);
+	drop_watches(account);
+	wd_map_destroy(account->dirty_set);
+	free(account->dirty_wds);
+	close(account->watch_fd);
+	account->transport->destroy(account->transport);
+	snap_destroy(account->tree);
+	pm_destroy(account->matcher);
+	pthread_mutex_destroy(&account->sync_lock);
+	pthread_mutex_destroy(&account->token_lock);
+	pthread_mutex_destroy(&account->lock);
+	pthread_cond_destroy(&account->done);
+	free(account->token);
+	free(account->email);
+	free(account->root_dir);
+	free(account->state_dir);
+	free(account->index_path);
+	free(account->tree_path);
+	free(account->rules_path);
+	free(account);
+}
+
+const char *sync_account_email(sync_account account) {
+	return account->email;
+}
+
+int sync_account_watch_fd(sync_account account) {
+	return account->watch_fd;
+}
+
+int sync_account_scan(sync_account account, char **md5sum_ptr) {
+	pthread_mutex_lock(&account->sync_lock);
+	refresh_rules(account);
+	int result = scan_locked(account, md5sum_ptr);
+	pthread_mutex_unlock(&account->sync_lock);
+	return result;
+}
+
+long sync_account_sync(sync_account account) {
+	uint64_t sync_span = trace_begin();
+	/* The scan is under the sync lock too, since it goes by the rules of the account */
+	pthread_mutex_lock(&account->sync_lock);
+	refresh_rules(account);
+	if (account->tree == NULL) {
+		account->tree = snap_load(account->tree_path);
+		if (account->tree != NULL
+				&& strcmp(ps_name(snap_paths(account->tree), PATH_ID_ROOT, NULL), account->root_dir) != 0) {
+			/* The tree of some other directory */
+			snap_destroy(account->tree);
+			account->tree = NULL;
+		}
+		if (account->tree == NULL) {
+			account->tree = snap_create(account->root_dir);
+		}
+	}
+	uint64_t span = trace_begin();
+	struct rescan_ctx ctx;
+	snapshot tree = rescan_tree(&ctx, account);
+	trace_end(TRACE_SCAN, span);
+	if (tree == NULL) {
+		pthread_mutex_unlock(&account->sync_lock);
+		return -1;
+	}
+
+	/*
+	 * The digests find the files moved under a new inode, and leave out the
+	 * ones touched without a change. A newer sync cancels the hashing, and
+	 * the files left without a digest are compared by their metadata.
+	 */
+	snap_copy_digests(account->tree, tree);
+	pool_group group = pool_group_create(account->host->pool);
+	pthread_mutex_lock(&account->lock);
+	account->hash_group = group;
+	pthread_mutex_unlock(&account->lock);
+	snap_hash_contents(tree, group);
+	pthread_mutex_lock(&account->lock);
+	account->hash_group = NULL;
+	pthread_mutex_unlock(&account->lock);
+	pool_group_destroy(group);
+
+	struct sync_info info = { account, tree, 0, 0 };
+	if (account->transport->move_object != NULL) {
+		pthread_mutex_lock(&account->lock);
+		info.move_objects = account->stats.files_queued
+				== account->stats.files_done + account->stats.files_failed;
+		pthread_mutex_unlock(&account->lock);
+	}
+	span = trace_begin();
+	tdiff_compare(account->tree, tree, &sync_change_handle, &info);
+	trace_end(TRACE_TREE_DIFF, span);
+	/* The tree saved below takes the files as synced, so the failed ones are queued here */
+	queue_unsent(&info);
+	int saved = (snap_save(tree, account->tree_path) == 0);
+	snap_destroy(account->tree);
+	account->tree = tree;
+	install_watches(&ctx);
+	pthread_mutex_lock(&account->lock);
+	account->stats.dirs_listed += ctx.dirs_listed;
+	pthread_mutex_unlock(&account->lock);
+	if (saved) {
+		/* A tree that is not saved could not be loaded back, so it is never dropped */
+		keep_tree(account);
+	} else if (account->in_lru) {
+		pthread_mutex_lock(&account->host->lock);
+		lru_unlink(account->host, account);
+		pthread_mutex_unlock(&account->host->lock);
+	}
+	pthread_mutex_unlock(&account->sync_lock);
+	trace_end(TRACE_SYNC, sync_span);
+	return info.queued;
+}
+
+void sync_account_queue_sync(sync_account account, void (*done)(void *arg, long queued), void *arg) {
+	struct sync_task *task = malloc(sizeof(struct sync_task));
+	task->account = account;
+	task->done = done;
+	task->arg = arg;
+	pthread_mutex_lock(&account->lock);
+	account->pending++;
+	if (account->hash_group != NULL) {
+		/* This sync supersedes the running one, which stops hashing its tree */
+		pool_group_cancel(account->hash_group);
+	}
+	pthread_mutex_unlock(&account->lock);
+	sched_submit_tenant(account->host->sched, SCHED_INTERACTIVE, account->tenant, &run_sync, task);
+}
+
+void sync_account_queue_token(sync_account account, void (*done)(void *arg, long status), void *arg) {
+	struct sync_task *task = malloc(sizeof(struct sync_task));
+	task->account = account;
+	task->done = done;
+	task->arg = arg;
+	pthread_mutex_lock(&account->lock);
+	account->pending++;
+	pthread_mutex_unlock(&account->lock);
+	sched_submit_tenant(account->host->sched, SCHED_INTERACTIVE, account->tenant, &run_token, task);
+}
+
+int sync_account_note_events(sync_account account, const char *buf, size_t len) {
+	int changes = 0;
+	pthread_mutex_lock(&account->lock);
+	for (const char *ptr = buf; ptr + sizeof(struct inotify_event) <= buf + len;) {
+		const struct inotify_event *event = (const struct inotify_event *) ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			/* The events lost could be of any directory */
+			account->rescan_all = 1;
+			changes++;
+			continue;
+		}
+		if (!(event->mask & WATCH_CHANGE_EVENTS)) {
+			/* Only read, like by the uploads */
+			continue;
+		}
+		changes++;
+		if (account->rescan_all) {
+			continue;
+		}
+		if (account->dirty_set == NULL) {
+			account->dirty_set = wd_map_create(64);
+		}
+		if (wd_map_get(account->dirty_set, event->wd) != NULL) {
+			continue;
+		}
+		if (account->num_dirty_wds == MAX_DIRTY_DIRS || wd_map_put(account->dirty_set, event->wd, 0) == -1) {
+			account->rescan_all = 1;
+			continue;
+		}
+		if (account->num_dirty_wds == account->max_dirty_wds) {
+			account->max_dirty_wds = (account->max_dirty_wds > 0) ? 2 * account->max_dirty_wds : 16;
+			account->dirty_wds = realloc(account->dirty_wds, account->max_dirty_wds * sizeof(int));
+		}
+		account->dirty_wds[account->num_dirty_wds++] = event->wd;
+	}
+	pthread_mutex_unlock(&account->lock);
+	return changes;
+}
+
+int sync_account_token(sync_account account, char **token) {
+	pthread_mutex_lock(&account->token_lock);
+	if (account->token == NULL || time(NULL) + ENGINE_TOKEN_MARGIN >= account->token_expiry) {
+		char *new_token;
+		time_t expiry;
+		if (account->get_token(account->token_arg, &new_token, &expiry) != 0) {
+			pthread_mutex_unlock(&account->token_lock);
+			return -1;
+		}
+		free(account->token);
+		account->token = new_token;
+		account->token_expiry = expiry;
+
+		pthread_mutex_lock(&account->lock);
+		account->stats.token_fetches++;
+		pthread_mutex_unlock(&account->lock);
+	}
+	*token = strdup(account->token);
+	pthread_mutex_unlock(&account->token_lock);
+	return 0;
+}
+
+int sync_account_queue_upload(sync_account account, const char *file_path, int pinned) {
+	struct stat file_stat;
+	if (stat(file_path, &file_stat) != 0) {
+		return -1;
+	}
+	scheduler sched = account->host->sched;
+	enum sched_class class = sched_classify(sched, file_stat.st_size, file_stat.st_mtime, pinned);
+
+	struct upload_task *task = malloc(sizeof(struct upload_task));
+	task->account = account;
+	task->path = strdup(file_path);
+	pthread_mutex_lock(&account->lock);
+	account->pending++;
+	account->stats.files_queued++;
+	add_unsent(account, file_path);
+	pthread_mutex_unlock(&account->lock);
+	sched_submit_tenant(sched, class, account->tenant, &run_upload, task);
+	return 0;
+}
+
+void sync_account_wait(sync_account account) {
+	pthread_mutex_lock(&account->lock);
+	while (account->pending > 0) {
+		pthread_cond_wait(&account->done, &account->lock);
+	}
+	pthread_mutex_unlock(&account->lock);
+}
+
+void sync_account_get_stats(sync_account account, struct sync_account_stats *stats) {
+	pthread_mutex_lock(&account->lock);
+	*stats = account->stats;
+	pthread_mutex_unlock(&account->lock);
+}
+
+static void run_upload(void *arg) {
+	struct upload_task *task = arg;
+	sync_account account = task->account;
+	struct upload_stats stats;
+	uint64_t span = trace_begin();
+	int failed = upload_files(account->transport, &task->path, 1, &account->upload, &stats);
+	trace_end(TRACE_UPLOAD, span);
+
+	pthread_mutex_lock(&account->lock);
+	if (failed == 0) {
+		account->stats.files_done++;
+	} else {
+		account->stats.files_failed++;
+	}
+	if (failed != -1) {
+		add_upload_stats(&account->stats.upload, &stats);
+	}
+	remove_unsent(account, task->path, failed != 0);
+	pthread_mutex_unlock(&account->lock);
+	struct stat file_stat;
+	if (failed == 0 && account->transport->delete_object != NULL && lstat(task->path, &file_stat) != 0
+			&& errno == ENOENT) {
+		/* Deleted while it was sent, so the delete replayed by the sync may have come first */
+		delete_objects(account, task->path, 0);
+	}
+	if (account->on_upload != NULL) {
+		account->on_upload(account->upload_arg, task->path, failed != 0);
+	}
+	free(task->path);
+	free(task);
+	task_done(account);
+}
+
+static void run_sync(void *arg) {
+	struct sync_task *task = arg;
+	long queued = sync_account_sync(task->account);
+	if (task->done != NULL) {
+		task->done(task->arg, queued);
+	}
+	task_done(task->account);
+	free(task);
+}
+
+static void run_token(void *arg) {
+	struct sync_task *task = arg;
+	char *token;
+	long status = sync_account_token(task->account, &token);
+	if (status == 0) {
+		free(token);
+	}
+	if (task->done != NULL) {
+		task->done(task->arg, status);
+	}
+	task_done(task->account);
+	free(task);
+}
+
+static void sync_change_handle(struct tdiff_change *change, void *handle_info) {
+	struct sync_info *info = handle_info;
+	struct transport *transport = info->account->transport;
+	/* Only the files, and the directories they are in, have objects in the store */
+	mode_t old_mode = (change->old_entry != NULL) ? change->old_entry->mode : 0;
+	int in_store = S_ISDIR(old_mode) || S_ISREG(old_mode);
+	if (change->op == TDIFF_DELETE) {
+		/* An entry that is still there is only excluded by the rules now, and stays in the store */
+		struct stat file_stat;
+		if (transport->delete_object != NULL && in_store && (lstat(change->old_path, &file_stat) != 0
+				|| (file_stat.st_mode & S_IFMT) != (old_mode & S_IFMT))) {
+			delete_objects(info->account, change->old_path, S_ISDIR(old_mode));
+		}
+		return;
+	}
+	if (change->op == TDIFF_MOVE && info->move_objects && move_objects(info->account, change) == 0) {
+		/* Nothing is sent; changed contents follow as a TDIFF_MODIFY */
+		return;
+	}
+	if (change->op == TDIFF_MOVE && transport->delete_object != NULL && in_store) {
+		/* Sent again at the new path below, so the objects at the old one go */
+		delete_objects(info->account, change->old_path, S_ISDIR(old_mode));
+	}
+	if (S_ISDIR(change->new_entry->mode)) {
+		/* The entries moved along are not reported, and are new objects in the store */
+		if (change->op == TDIFF_MOVE) {
+			queue_subtree(info, change->new_id);
+		}
+	} else if (S_ISREG(change->new_entry->mode)
+			&& sync_account_queue_upload(info->account, change->new_path, 0) == 0) {
+		info->queued++;
+	}
+}
+
+static int move_objects(sync_account account, struct tdiff_change *change) {
+	int subtree = S_ISDIR(change->new_entry->mode);
+	if (!subtree && !S_ISREG(change->new_entry->mode)) {
+		/* Not in the store at all */
+		return 0;
+	}
+	char *old_name = strdup(change->old_path);
+	char *new_name = strdup(change->new_path);
+	int status = move_with_retries(account, old_name, new_name);
+	if (status == TRANSPORT_ERR_FATAL && !subtree && account->upload.compress != NULL) {
+		/* The file may have been sent compressed, under a name with the suffix of the codec */
+		const char *suffix = compress_suffix(account->upload.compress->codec);
+		old_name = realloc(old_name, strlen(old_name) + strlen(suffix) + 1);
+		strcat(old_name, suffix);
+		new_name = realloc(new_name, strlen(new_name) + strlen(suffix) + 1);
+		strcat(new_name, suffix);
+		status = move_with_retries(account, old_name, new_name);
+	}
+	if (status == TRANSPORT_OK) {
+		dedup_rename_remote(account->dedup, account->upload.dedup_store, old_name, new_name, subtree);
+		dedup_rename_local(account->dedup, change->old_path, change->new_path, subtree);
+		pthread_mutex_lock(&account->lock);
+		rename_unsent(account, change->old_path, change->new_path, subtree);
+		account->stats.files_moved++;
+		pthread_mutex_unlock(&account->lock);
+		metrics_add(METRIC_OBJECTS_MOVED, 1);
+	}
+	free(old_name);
+	free(new_name);
+	return (status == TRANSPORT_OK) ? 0 : -1;
+}
+
+static int move_with_retries(sync_account account, const char *old_name, const char *new_name) {
+	struct transport *transport = account->transport;
+	unsigned int seed = account->tenant;
+	unsigned int attempt = 0;
+	int status;
+	do {
+		status = transport->move_object(transport, old_name, new_name);
+	} while (status == TRANSPORT_ERR_RETRY && transport_retry_wait(attempt++,
+			account->upload.max_retries, account->upload.backoff_us, &seed));
+	return status;
+}
+
+static void delete_objects(sync_account account, const char *path, int subtree) {
+	int status = delete_with_retries(account, path);
+	if (status == TRANSPORT_ERR_FATAL && !subtree && account->upload.compress != NULL) {
+		/* The file may have been sent compressed, under a name with the suffix of the codec */
+		const char *suffix = compress_suffix(account->upload.compress->codec);
+		char *name = malloc(strlen(path) + strlen(suffix) + 1);
+		strcpy(name, path);
+		strcat(name, suffix);
+		if (delete_with_retries(account, name) == TRANSPORT_OK) {
+			dedup_remove_remote(account->dedup, account->upload.dedup_store, name);
+			status = TRANSPORT_OK;
+		}
+		free(name);
+	}
+	if (status != TRANSPORT_OK) {
+		/* Nothing to delete, or the store keeps failing and the objects stay */
+		return;
+	}
+	/* The records below a directory are dropped as they turn out stale, when they are used */
+	dedup_remove_remote(account->dedup, account->upload.dedup_store, path);
+	dedup_remove_local(account->dedup, path);
+	pthread_mutex_lock(&account->lock);
+	account->stats.files_deleted++;
+	pthread_mutex_unlock(&account->lock);
+	metrics_add(METRIC_OBJECTS_DELETED, 1);
+}
+
+static int delete_with_retries(sync_account account, const char *name) {
+	struct transport *transport = account->transport;
+	unsigned int seed = account->tenant;
+	unsigned int attempt = 0;
+	int status;
+	do {
+		status = transport->delete_object(transport, name);
+	} while (status == TRANSPORT_ERR_RETRY && transport_retry_wait(attempt++,
+			account->upload.max_retries, account->upload.backoff_us, &seed));
+	return status;
+}
+
+static void queue_subtree(struct sync_info *info, path_id id) {
+	pathstore ps = snap_paths(info->tree);
+	for (path_id child = ps_first_child(ps, id); child != PATH_ID_NONE;
+			child = ps_next_sibling(ps, child)) {
+		struct snap_entry *entry = snap_get(info->tree, child);
+		if (S_ISDIR(entry->mode)) {
+			queue_subtree(info, child);
+		} else if (S_ISREG(entry->mode)
+				&& sync_account_queue_upload(info->account, ps_path(ps, child), 0) == 0) {
+			info->queued++;
+		}
+	}
+}
+
+static void add_unsent(sync_account account, const char *path) {
+	struct unsent_file *file = ht_get(account->unsent_index, (void *) path);
+	if (file == NULL) {
+		if (account->num_unsent == account->max_unsent) {
+			account->max_unsent = (account->max_unsent > 0) ? 2 * account->max_unsent : 16;
+			account->unsent = realloc(account->unsent, account->max_unsent * sizeof(struct unsent_file *));
+		}
+		file = malloc(sizeof(struct unsent_file));
+		file->path = strdup(path);
+		file->queued = 0;
+		file->index = account->num_unsent;
+		account->unsent[account->num_unsent++] = file;
+		ht_put(account->unsent_index, file->path, file);
+	}
+	file->queued++;
+}
+
+static void remove_unsent(sync_account account, const char *path, int failed) {
+	struct unsent_file *file = ht_get(account->unsent_index, (void *) path);
+	if (file == NULL) {
+		return;
+	}
+	if (file->queued > 0) {
+		file->queued--;
+	}
+	if (failed || file->queued > 0) {
+		/* Sent again by a later sync, or by the upload still queued */
+		return;
+	}
+	ht_remove(account->unsent_index, file->path);
+	struct unsent_file *last = account->unsent[--account->num_unsent];
+	account->unsent[file->index] = last;
+	last->index = file->index;
+	free(file->path);
+	free(file);
+}
+
+static void rename_unsent(sync_account account, const char *old_path, const char *new_path, int subtree) {
+	size_t old_len = strlen(old_path);
+	/* Backwards, since a file whose new path is taken is dropped, and the last one takes its place */
+	for (unsigned int i = account->num_unsent; i > 0; i--) {
+		struct unsent_file *file = account->unsent[i - 1];
+		if (strncmp(file->path, old_path, old_len) != 0 || (file->path[old_len] != '\0'
+				&& (!subtree || file->path[old_len] != '/'))) {
+			continue;
+		}
+		char *path = malloc(strlen(new_path) + strlen(file->path + old_len) + 1);
+		strcpy(path, new_path);
+		strcat(path, file->path + old_len);
+		unsigned int queued = file->queued;
+		file->queued = 0;
+		remove_unsent(account, file->path, 0);
+		if (ht_get(account->unsent_index, path) == NULL) {
+			add_unsent(account, path);
+			((struct unsent_file *) ht_get(account->unsent_index, path))->queued = queued;
+		}
+		free(path);
+	}
+}
+
+static void queue_unsent(struct sync_info *info) {
+	sync_account account = info->account;
+	pathstore ps = snap_paths(info->tree);
+	size_t root_len = strlen(account->root_dir);
+	char **paths = NULL;
+	unsigned int num_paths = 0;
+	pthread_mutex_lock(&account->lock);
+	for (unsigned int i = 0; i < account->num_unsent; i++) {
+		if (account->unsent[i]->queued == 0) {
+			if (num_paths == 0) {
+				paths = malloc(account->num_unsent * sizeof(char *));
+			}
+			paths[num_paths++] = strdup(account->unsent[i]->path);
+		}
+	}
+	pthread_mutex_unlock(&account->lock);
+
+	for (unsigned int i = 0; i < num_paths; i++) {
+		/* Only the files still in the tree, which leaves out the deleted and the excluded ones */
+		path_id id = PATH_ID_NONE;
+		if (strncmp(paths[i], account->root_dir, root_len) == 0 && paths[i][root_len] == '/') {
+			id = ps_lookup_path(ps, PATH_ID_ROOT, paths[i] + root_len + 1);
+		}
+		if (id != PATH_ID_NONE && S_ISREG(snap_get(info->tree, id)->mode)
+				&& sync_account_queue_upload(account, paths[i], 0) == 0) {
+			info->queued++;
+		} else {
+			pthread_mutex_lock(&account->lock);
+			remove_unsent(account, paths[i], 0);
+			pthread_mutex_unlock(&account->lock);
+		}
+		free(paths[i]);
+	}
+	free(paths);
+}
+
+static int save_unsent(sync_account account) {
+	char *tmp_path = malloc(strlen(account->unsent_path) + strlen(".tmp") + 1);
+	strcpy(tmp_path, account->unsent_path);
+	strcat(tmp_path, ".tmp");
+	FILE *file = fopen(tmp_path, "w");
+	if (file == NULL) {
+		free(tmp_path);
+		return -1;
+	}
+	pthread_mutex_lock(&account->lock);
+	for (unsigned int i = 0; i < account->num_unsent; i++) {
+		if (strchr(account->unsent[i]->path, '\n') == NULL) {
+			fprintf(file, "%s\n", account->unsent[i]->path);
+		}
+	}
+	pthread_mutex_unlock(&account->lock);
+
+	int status = 0;
+	if (ferror(file) | (fclose(file) != 0) || rename(tmp_path, account->unsent_path) != 0) {
+		unlink(tmp_path);
+		status = -1;
+	}
+	free(tmp_path);
+	return status;
+}
+
+static void load_unsent(sync_account account) {
+	FILE *file = fopen(account->unsent_path, "r");
+	if (file == NULL) {
+		return;
+	}
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_size, file)) != -1) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (len > 0) {
+			/* Queued by no one yet */
+			add_unsent(account, line);
+			((struct unsent_file *) ht_get(account->unsent_index, line))->queued = 0;
+		}
+	}
+	free(line);
+	fclose(file);
+}
+
+static void keep_tree(sync_account account) {
+	sync_host host = account->host;
+	size_t tree_bytes = snap_memory_usage(account->tree);
+	pthread_mutex_lock(&host->lock);
+	if (account->in_lru) {
+		lru_unlink(host, account);
+	}
+	account->lru_prev = NULL;
+	account->lru_next = host->lru_head;
+	if (host->lru_head != NULL) {
+		host->lru_head->lru_prev = account;
+	} else {
+		host->lru_tail = account;
+	}
+	host->lru_head = account;
+	account->in_lru = 1;
+	account->tree_bytes = tree_bytes;
+	host->tree_bytes += tree_bytes;
+	metrics_gauge_add(METRIC_TREE_BYTES, tree_bytes);
+
+	uint64_t limit = spill_budget() / ENGINE_TREE_BUDGET_SHARE;
+	sync_account victim = host->lru_tail;
+	while (limit > 0 && host->tree_bytes > limit && victim != NULL) {
+		sync_account prev = victim->lru_prev;
+		/*
+		 * The caller holds its own sync lock. Another account in the middle of
+		 * a sync is skipped, rather than waited for: it checks the budget
+		 * itself once it is done.
+		 */
+		if (victim == account) {
+			evict_tree(victim);
+		} else if (pthread_mutex_trylock(&victim->sync_lock) == 0) {
+			evict_tree(victim);
+			pthread_mutex_unlock(&victim->sync_lock);
+		}
+		victim = prev;
+	}
+	pthread_mutex_unlock(&host->lock);
+}
+
+static void evict_tree(sync_account account) {
+	lru_unlink(account->host, account);
+	snap_destroy(account->tree);
+	account->tree = NULL;
+	/* The watches stay, and the next sync finds them again as it lists the whole tree */
+	drop_watches(account);
+	metrics_add(METRIC_TREES_EVICTED, 1);
+	pthread_mutex_lock(&account->lock);
+	account->stats.trees_evicted++;
+	pthread_mutex_unlock(&account->lock);
+}
+
+static void lru_unlink(sync_host host, sync_account account) {
+	if (account->lru_prev != NULL) {
+		account->lru_prev->lru_next = account->lru_next;
+	} else {
+		host->lru_head = account->lru_next;
+	}
+	if (account->lru_next != NULL) {
+		account->lru_next->lru_prev = account->lru_prev;
+	} else {
+		host->lru_tail = account->lru_prev;
+	}
+	account->lru_prev = account->lru_next = NULL;
+	account->in_lru = 0;
+	host->tree_bytes -= account->tree_bytes;
+	metrics_gauge_add(METRIC_TREE_BYTES, -(int64_t) account->tree_bytes);
+	account->tree_bytes = 0;
+}
+
+static void refresh_rules(sync_account account) {
+	struct stat rules_stat;
+	if (stat(account->rules_path, &rules_stat) != 0) {
+		if (account->matcher != NULL) {
+			pm_destroy(account->matcher);
+			account->matcher = NULL;
+			pthread_mutex_lock(&account->lock);
+			account->rescan_all = 1;
+			pthread_mutex_unlock(&account->lock);
+		}
+		return;
+	}
+	if (account->matcher != NULL && rules_stat.st_ino == account->rules_stat.st_ino
+			&& rules_stat.st_dev == account->rules_stat.st_dev
+			&& rules_stat.st_size == account->rules_stat.st_size
+			&& rules_stat.st_mtim.tv_sec == account->rules_stat.st_mtim.tv_sec
+			&& rules_stat.st_mtim.tv_nsec == account->rules_stat.st_mtim.tv_nsec) {
+		return;
+	}
+	path_matcher matcher = pm_create();
+	if (pm_load(matcher, account->rules_path) != 0) {
+		pm_destroy(matcher);
+		matcher = NULL;
+	}
+	pm_destroy(account->matcher);
+	account->matcher = matcher;
+	account->rules_stat = rules_stat;
+	/* The directories listed under the old rules cannot be taken as they are */
+	pthread_mutex_lock(&account->lock);
+	account->rescan_all = 1;
+	pthread_mutex_unlock(&account->lock);
+}
+
+static void drain_events(sync_account account) {
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read(account->watch_fd, buf, sizeof(buf))) > 0) {
+		sync_account_note_events(account, buf, len);
+	}
+}
+
+static snapshot rescan_tree(struct rescan_ctx *ctx, sync_account account) {
+	struct stat dir_stat;
+	if ((stat(account->root_dir, &dir_stat) != 0) || !S_ISDIR(dir_stat.st_mode)) {
+		return NULL;
+	}
+	memset(ctx, 0, sizeof(struct rescan_ctx));
+	ctx->account = account;
+	ctx->old_tree = account->tree;
+	ctx->root_len = strlen(account->root_dir);
+
+	/* The events still queued are of changes that this scan sees */
+	drain_events(account);
+	pthread_mutex_lock(&account->lock);
+	int *dirty_wds = account->dirty_wds;
+	unsigned int num_dirty_wds = account->num_dirty_wds;
+	int rescan_all = account->rescan_all;
+	wd_map_destroy(account->dirty_set);
+	account->dirty_set = NULL;
+	account->dirty_wds = NULL;
+	account->num_dirty_wds = account->max_dirty_wds = 0;
+	account->rescan_all = 0;
+	pthread_mutex_unlock(&account->lock);
+	if (!rescan_all && account->watches != NULL) {
+		ctx->dirty = calloc(ps_id_limit(snap_paths(ctx->old_tree)), 1);
+		for (unsigned int i = 0; i < num_dirty_wds; i++) {
+			path_id *id = wd_map_get(account->watches, dirty_wds[i]);
+			if (id == NULL) {
+				/* A watch that was not placed by a sync, on a directory it does not know */
+				free(ctx->dirty);
+				ctx->dirty = NULL;
+				break;
+			}
+			ctx->dirty[*id] = 1;
+		}
+	}
+	free(dirty_wds);
+
+	ctx->tree = snap_create(account->root_dir);
+	snap_entry_set_stat(snap_get(ctx->tree, PATH_ID_ROOT), &dir_stat);
+	ctx->watches = wd_map_create((account->watches != NULL) ? wd_map_num_entries(account->watches) : 0);
+	struct snap_entry *old_root = snap_get(ctx->old_tree, PATH_ID_ROOT);
+	path_id old_id = (old_root->ino == (uint64_t) dir_stat.st_ino && old_root->dev == (uint64_t) dir_stat.st_dev)
+			? PATH_ID_ROOT : PATH_ID_NONE;
+	rescan_dir(ctx, old_id, PATH_ID_ROOT, account->root_dir);
+	free(ctx->dirty);
+	free(ctx->rel_path);
+	return ctx->tree;
+}
+
+static void rescan_dir(struct rescan_ctx *ctx, path_id old_id, path_id new_id, const char *dir_path) {
+	sync_account account = ctx->account;
+	int wd = (old_id != PATH_ID_NONE && old_id < account->watch_wds_cap) ? account->watch_wds[old_id] : -1;
+	if (wd == -1) {
+		/* Placed before the listing, so that no change after it is missed */
+		wd = inotify_add_watch(account->watch_fd, dir_path, IN_ALL_EVENTS);
+	}
+	if (wd != -1) {
+		record_watch(ctx, wd, new_id);
+	}
+
+	if (ctx->dirty != NULL && old_id != PATH_ID_NONE && !ctx->dirty[old_id]) {
+		reuse_dir(ctx, old_id, new_id);
+	} else {
+		list_dir(ctx, new_id, dir_path);
+		ctx->dirs_listed++;
+	}
+
+	pathstore ps = snap_paths(ctx->tree);
+	pathstore old_ps = snap_paths(ctx->old_tree);
+	for (path_id child = ps_first_child(ps, new_id); child != PATH_ID_NONE;
+			child = ps_next_sibling(ps, child)) {
+		struct snap_entry *entry = snap_get(ctx->tree, child);
+		if (!S_ISDIR(entry->mode)) {
+			continue;
+		}
+		/* The same directory in the tree of the last sync, if it is still there */
+		path_id old_child = PATH_ID_NONE;
+		if (old_id != PATH_ID_NONE) {
+			size_t name_len;
+			const char *name = ps_name(ps, child, &name_len);
+			old_child = ps_lookup_child(old_ps, old_id, name, name_len);
+			struct snap_entry *old_entry = snap_get(ctx->old_tree, old_child);
+			if (old_entry != NULL && (!S_ISDIR(old_entry->mode) || old_entry->ino != entry->ino
+					|| old_entry->dev != entry->dev)) {
+				old_child = PATH_ID_NONE;
+			}
+		}
+		/* ps_path returns a buffer that the next call overwrites */
+		char *child_path = strdup(ps_path(ps, child));
+		rescan_dir(ctx, old_child, child, child_path);
+		free(child_path);
+	}
+}
+
+static void list_dir(struct rescan_ctx *ctx, path_id new_id, const char *dir_path) {
+	char *paths[] = { (char *) dir_path, NULL };
+	uint64_t start = metrics_now();
+	uint64_t span = trace_begin();
+	FTS *fts = fts_open(paths, FTS_PHYSICAL, NULL);
+	if (fts == NULL) {
+		return;
+	}
+	fts_read(fts);
+	FTSENT *child = fts_children(fts, 0);
+	metrics_record_since(METRIC_DIR_LIST, start);
+	trace_end(TRACE_DIR_LIST, span);
+	uint64_t num_entries = 0;
+	for (; child != NULL; child = child->fts_link) {
+		if (ctx->account->matcher != NULL && child_excluded(ctx, dir_path, child->fts_name,
+				child->fts_namelen, S_ISDIR(child->fts_statp->st_mode))) {
+			continue;
+		}
+		snap_add(ctx->tree, new_id, child->fts_name, child->fts_namelen, child->fts_statp, NULL);
+		num_entries++;
+	}
+	metrics_add(METRIC_ENTRIES_SCANNED, num_entries);
+	fts_close(fts);
+}
+
+static int child_excluded(struct rescan_ctx *ctx, const char *dir_path, const char *name,
+		size_t name_len, int is_dir) {
+	const char *dir_rel = dir_path + ctx->root_len;
+	dir_rel += strspn(dir_rel, "/");
+	size_t dir_rel_len = strlen(dir_rel);
+	size_t needed = dir_rel_len + name_len + 2;
+	if (needed > ctx->rel_path_capacity) {
+		ctx->rel_path_capacity = needed * 2;
+		ctx->rel_path = realloc(ctx->rel_path, ctx->rel_path_capacity);
+	}
+	char *rel = ctx->rel_path;
+	if (dir_rel_len > 0) {
+		memcpy(rel, dir_rel, dir_rel_len);
+		rel[dir_rel_len++] = '/';
+	}
+	memcpy(rel + dir_rel_len, name, name_len);
+	rel[dir_rel_len + name_len] = '\0';
+	return pm_excluded(ctx->account->matcher, rel, is_dir);
+}
+
+static void reuse_dir(struct rescan_ctx *ctx, path_id old_id, path_id new_id) {
+	pathstore old_ps = snap_paths(ctx->old_tree);
+	for (path_id child = ps_first_child(old_ps, old_id); child != PATH_ID_NONE;
+			child = ps_next_sibling(old_ps, child)) {
+		size_t name_len;
+		const char *name = ps_name(old_ps, child, &name_len);
+		path_id new_child = snap_add(ctx->tree, new_id, name, name_len, NULL, NULL);
+		*snap_get(ctx->tree, new_child) = *snap_get(ctx->old_tree, child);
+	}
+}
+
+static void record_watch(struct rescan_ctx *ctx, int wd, path_id id) {
+	if (id >= ctx->watch_wds_cap) {
+		unsigned int cap = (ctx->watch_wds_cap > 0) ? ctx->watch_wds_cap : 64;
+		while (cap <= id) {
+			cap <<= 1;
+		}
+		ctx->watch_wds = realloc(ctx->watch_wds, cap * sizeof(int));
+		for (unsigned int i = ctx->watch_wds_cap; i < cap; i++) {
+			ctx->watch_wds[i] = -1;
+		}
+		ctx->watch_wds_cap = cap;
+	}
+	ctx->watch_wds[id] = wd;
+	wd_map_put(ctx->watches, wd, id);
+}
+
+static void install_watches(struct rescan_ctx *ctx) {
+	sync_account account = ctx->account;
+	/*
+	 * The watches not carried over are on the directories gone from the
+	 * tree, or excluded by the rules now. A directory moved within the tree
+	 * keeps its watch, under the same descriptor.
+	 */
+	for (unsigned int id = 0; id < account->watch_wds_cap; id++) {
+		int wd = account->watch_wds[id];
+		if (wd != -1 && wd_map_get(ctx->watches, wd) == NULL) {
+			inotify_rm_watch(account->watch_fd, wd);
+		}
+	}
+	drop_watches(account);
+	account->watches = ctx->watches;
+	account->watch_wds = ctx->watch_wds;
+	account->watch_wds_cap = ctx->watch_wds_cap;
+}
+
+static void drop_watches(sync_account account) {
+	wd_map_destroy(account->watches);
+	account->watches = NULL;
+	free(account->watch_wds);
+	account->watch_wds = NULL;
+	account->watch_wds_cap = 0;
+}
+
+static int scan_locked(sync_account account, char **md5sum_ptr) {
+	char *state_path = join_path(account->state_dir, "tree.dirs");
+	int fd = watch_md5sum_fsh_fast(account->watch_fd, md5sum_ptr, account->root_dir, state_path,
+			account->matcher, NULL);
+	free(state_path);
+	return (fd == -1) ? -1 : 0;
+}
+
+static void task_done(sync_account account) {
+	pthread_mutex_lock(&account->lock);
+	account->pending--;
+	pthread_cond_broadcast(&account->done);
+	pthread_mutex_unlock(&account->lock);
+}
+
+static void add_upload_stats(struct upload_stats *total, struct upload_stats *stats) {
+	total->files_done += stats->files_done;
+	total->files_failed += stats->files_failed;
+	total->chunks_sent += stats->chunks_sent;
+	total->bytes_sent += stats->bytes_sent;
+	total->bytes_resumed += stats->bytes_resumed;
+	total->retries += stats->retries;
+	total->files_compressed += stats->files_compressed;
+	total->bytes_uncompressed += stats->bytes_uncompressed;
+	total->bytes_compressed += stats->bytes_compressed;
+	total->files_deduplicated += stats->files_deduplicated;
+	total->bytes_deduplicated += stats->bytes_deduplicated;
+}
+
+static char *default_state_dir(const char *email) {
+	char *config_dir = get_config_dir_curruser();
+	if (config_dir == NULL) {
+		return NULL;
+	}
+	mkdir(config_dir, 0700);
+
+	char *email_md5sum = md5sum_str((char *) email);
+	char *dir_name = malloc(strlen(email_md5sum) + strlen(".d") + 1);
+	strcpy(dir_name, email_md5sum);
+	strcat(dir_name, ".d");
+	char *state_dir = get_abs_path(config_dir, dir_name);
+	free(email_md5sum);
+	free(dir_name);
+	return state_dir;
+}
+
+static char *join_path(const char *dir, const char *name) {
+	size_t len = strlen(dir) + strlen(name) + 2;
+	char *path = malloc(len);
+	snprintf(path, len, "%s/%s", dir, name);
+	return path;
+}
@@ -0,0 +1,251 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_ENGINE_H
+#define GOODRV_ENGINE_H
+
+#include <time.h>
+
+#include "scheduler.h"
+#include "transport.h"
+#include "upload.h"
+
+/* Seconds before its expiry that a cached token is replaced */
+#define ENGINE_TOKEN_MARGIN 300
+/* Under a memory budget, the trees kept between syncs take up to 1/N of it */
+#define ENGINE_TREE_BUDGET_SHARE 2
+
+/*
+ * Sync engine of a host, shared by the accounts synced on it: one scheduler,
+ * whose workers run the transfers of all the accounts. Within a class, the
+ * accounts with pending transfers take turns, so that an account with a
+ * large backlog does not starve the others.
+ *
+ * Each account keeps the tree of its last sync in memory for the next one.
+ * Under a memory budget (see spill_configure), the trees are kept in least
+ * recently synced order, and the coldest ones are dropped once they take
+ * more than their share of the budget; a dropped tree is loaded back from
+ * the state directory by the next sync of its account.
+ */
+typedef struct sync_host *sync_host;
+
+/*
+ * Sync engine of an account, within a host. Each account has its own state
+ * directory, content index, inotify instance for the watches on its root
+ * directory, token cache and transfer queue, so nothing of one account is
+ * seen by another.
+ *
+ * All the functions may be called from several threads.
+ */
+typedef struct sync_account *sync_account;
+
+/*
+ * Get an access token for an account, e.g. with build_jwt_from_file.
+ * Returns 0 and sets *token (to be freed by the caller) and *expiry, or -1.
+ */
+typedef int (*token_source)(void *arg, char **token, time_t *expiry);
+
+/*
+ * Options of an account
+ * email - Identifies the account, and names its store in the content index.
+ * root_dir - Directory that is synced.
+ * state_dir - Directory for the records of the account. NULL for a directory
+ * 			   named after the MD5 sum of the email in the user's config
+ * 			   directory.
+ * transport - Transport to the account's store. The account takes it over,
+ * 			   and destroys it when it is removed.
+ * get_token, token_arg - Source of the access tokens of the account.
+ * upload - Options for the uploads, NULL for the defaults. The state
+ * 			directory and the content index are always the account's, and
+ * 			every file is sent by the worker that uploads it (num_senders 0).
+ * on_upload, upload_arg - If not NULL, called by the worker when an upload
+ * 						   of the account is done, with failed non zero if
+ * 						   it failed.
+ * rules_path - File with the include/exclude rules of the account, in the
+ * 				syntax of pathmatch.h. NULL for PM_RULES_FILE in the root
+ * 				directory. It is read again whenever it changes.
+ */
+struct sync_account_options {
+	const char *email;
+	const char *root_dir;
+	const char *state_dir;
+	struct transport *transport;
+	token_source get_token;
+	void *token_arg;
+	struct upload_options *upload;
+	void (*on_upload)(void *arg, const char *file_path, int failed);
+	void *upload_arg;
+	const char *rules_path;
+};
+
+/*
+ * What an account did.
+ */
+struct sync_account_stats {
+	unsigned long files_queued;
+	unsigned long files_done;
+	unsigned long files_failed;
+	/* Times a token was fetched from the source, rather than the cache */
+	unsigned long token_fetches;
+	/* Times the tree of the account was dropped from memory, to stay within the budget */
+	unsigned long trees_evicted;
+	/* Moves replayed within the store, each taking everything below it along */
+	unsigned long files_moved;
+	/* Deletes replayed within the store, each taking everything below it along */
+	unsigned long files_deleted;
+	/* Directories listed by the syncs; the others were taken from the tree of the last sync */
+	unsigned long dirs_listed;
+	/* Totals of the uploads of the account */
+	struct upload_stats upload;
+};
+
+/*
+ * Create the engine of the host, with the workers shared by the accounts.
+ * Returns NULL if no worker could be started.
+ *
+ * policy - NULL for the defaults.
+ */
+sync_host sync_host_create(unsigned int num_workers, struct sched_policy *policy);
+
+/*
+ * Remove the remaining accounts, and free the engine.
+ */
+void sync_host_destroy(sync_host host);
+
+/*
+ * Get the scheduler shared by the accounts.
+ */
+scheduler sync_host_scheduler(sync_host host);
+
+/*
+ * Add an account to the host. Its content index is loaded from its state
+ * directory. Returns NULL if the options are incomplete, or the state
+ * directory cannot be created.
+ */
+sync_account sync_account_add(sync_host host, struct sync_account_options *options);
+
+/*
+ * Wait for the queued transfers of the account, save its content index, and
+ * free it along with its transport.
+ */
+void sync_account_remove(sync_account account);
+
+/*
+ * Get the email of the account.
+ */
+const char *sync_account_email(sync_account account);
+
+/*
+ * Get the File Descriptor of the account's inotify instance.
+ */
+int sync_account_watch_fd(sync_account account);
+
+/*
+ * Note the directories that the inotify events, read from the File
+ * Descriptor of the account, tell of changes in, so that the next sync lists
+ * them again. The events left unread are noted by the sync itself.
+ *
+ * Returns the number of events that tell of a change, rather than of a read.
+ */
+int sync_account_note_events(sync_account account, const char *buf, size_t len);
+
+/*
+ * Place the watches on the root directory of the account, with the fast start
+ * records in its state directory, and get the MD5 sum of its hierarchy. The
+ * paths excluded by the rules of the account are left out, and excluded
+ * directories are not watched.
+ *
+ * Returns 0 on success, -1 if the root directory cannot be read.
+ */
+int sync_account_scan(sync_account account, char **md5sum_ptr);
+
+/*
+ * Find the files in the root directory of the account that were created,
+ * changed or moved since the last sync, and queue their uploads. The first
+ * sync of an account uploads every file. The paths excluded by the rules of
+ * the account are not scanned; paths that the rules include again are found
+ * as created, and uploaded. The new and changed files are hashed on the pool
+ * of the host. Files and directories that were moved, as told by their
+ * (device, inode) or, for a file, by its digest, are moved within the store
+ * as well, without sending them again; if the store cannot, they are uploaded
+ * at the new path. Files whose contents are the same are not sent again.
+ * Deleted files and directories are deleted from the store as well, unless
+ * the store cannot; a delete that keeps failing leaves the objects there.
+ * The files still in the tree whose uploads failed, or had not finished when
+ * the account was last removed, are queued again. The tree is kept in the
+ * state directory for the next sync.
+ *
+ * The sync places the watches on the directories of the tree, and lists only
+ * the ones with changes noted since the last sync (and the new ones); the
+ * rest are taken from the tree of the last sync. The whole tree is listed by
+ * the first sync, after the tree is dropped from memory, after the rules
+ * change, and once inotify events are lost.
+ *
+ * Returns the number of uploads queued, or -1 if the root directory cannot
+ * be read.
+ */
+long sync_account_sync(sync_account account);
+
+/*
+ * Run sync_account_sync on a worker of the host, and call done (if not NULL)
+ * with its result from the worker. A sync of the account that is hashing its
+ * tree stops, and compares the files left by their metadata, since this one
+ * scans the tree again.
+ */
+void sync_account_queue_sync(sync_account account, void (*done)(void *arg, long queued), void *arg);
+
+/*
+ * Get an access token of the account. The token is cached till
+ * ENGINE_TOKEN_MARGIN seconds before it expires.
+ *
+ * Returns 0 and sets *token (to be freed by the caller), or -1.
+ */
+int sync_account_token(sync_account account, char **token);
+
+/*
+ * Run sync_account_token on a worker of the host, so that the token is in the
+ * cache before it is needed, and call done (if not NULL) from the worker with
+ * 0 on success or -1.
+ */
+void sync_account_queue_token(sync_account account, void (*done)(void *arg, long status), void *arg);
+
+/*
+ * Queue the upload of a file of the account, in the class that
+ * sched_classify picks.
+ *
+ * Returns 0 on success, -1 if the file cannot be stat'ed.
+ */
+int sync_account_queue_upload(sync_account account, const char *file_path, int pinned);
+
+/*
+ * Wait till the queued syncs and transfers of the account are done.
+ */
+void sync_account_wait(sync_account account);
+
+/*
+ * Get what the account did so far.
+ */
+void sync_account_get_stats(sync_account account, struct sync_account_stats *stats);
+
+#endif /* GOODRV_ENGINE_H */
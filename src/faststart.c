@@ -0,0 +1,335 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include <openssl/md5.h>
+
+#include "bqueue.h"
+#include "faststart.h"
+#include "linux-api.h"
+#include "snapshot.h"
+
+/* Number of directories that can wait for their watches */
+#define WATCH_QUEUE_SIZE 1024
+
+/*
+ * State of a fast start
+ */
+struct fast_start_ctx {
+	/* Records of the previous run, NULL if there are none */
+	snapshot old_snap;
+	/* Records being built for the next run */
+	snapshot new_snap;
+	MD5_CTX md5_ctxt;
+	/* File Descriptor of the inotify instance */
+	int fd;
+	/* Paths of the directories to be watched, NULL if the watcher thread is not running */
+	bqueue watch_queue;
+	/* Rules for the entries to be left out, NULL if there are none */
+	path_matcher matcher;
+	/* Length of the path of the root, so that paths relative to it can be formed */
+	size_t root_len;
+	/* Buffer for the relative path of a child, while it is checked against the rules */
+	char *rel_path;
+	size_t rel_path_capacity;
+	struct fast_start_stats stats;
+};
+
+/*
+ * The information passed onto the watcher thread
+ */
+struct watch_thread_info {
+	int fd;
+	bqueue watch_queue;
+};
+
+/* Verify the directory and its subtree, and update the MD5 context with their paths */
+static void verify_dir(struct fast_start_ctx *ctx, path_id old_id, path_id new_id, const char *dir_path);
+/* Read the children of the directory into the new snapshot */
+static void list_dir(struct fast_start_ctx *ctx, path_id new_id, const char *dir_path);
+/* Check whether the rules exclude the child of the directory */
+static int child_excluded(struct fast_start_ctx *ctx, const char *dir_path, const char *name,
+		size_t name_len, int is_dir);
+/* Copy the saved children of the directory into the new snapshot */
+static void reuse_dir(struct fast_start_ctx *ctx, path_id old_id, path_id new_id);
+/* Place a watch for the directory, through the watcher thread if it is running */
+static void watch_dir(struct fast_start_ctx *ctx, const char *dir_path);
+/* Check whether the saved record of the directory still holds */
+static int dir_unchanged(struct snap_entry *old_entry, struct snap_entry *new_entry);
+/* Place the watches for the directories in the queue, till it is closed */
+static void *watch_thread(void *arg);
+
+char *get_fast_start_state_path(char *dirpath) {
+	char *config_dir = get_config_dir_curruser();
+	if (config_dir == NULL) {
+		return NULL;
+	}
+	mkdir(config_dir, 0700);
+
+	char *dir_md5sum = md5sum_str(dirpath);
+	char *file_name = malloc(strlen(dir_md5sum) + strlen(".dirs") + 1);
+	strcpy(file_name, dir_md5sum);
+	strcat(file_name, ".dirs");
+	char *state_path = get_abs_path(config_dir, file_name);
+	free(dir_md5sum);
+	free(file_name);
+	return state_path;
+}
+
+int watch_md5sum_fsh_fast(int fd, char **md5sum_ptr, char *dirpath, char *state_path,
+		path_matcher matcher, struct fast_start_stats *stats) {
+	if (md5sum_ptr == NULL || dirpath == NULL) {
+		return -1;
+	}
+
+	struct stat dir_stat;
+	if ((stat(dirpath, &dir_stat) != 0) || !S_ISDIR(dir_stat.st_mode)) {
+		return -1;
+	}
+	if (fd == -1) {
+		fd = inotify_init();
+	}
+
+	char *default_state_path = NULL;
+	if (state_path == NULL) {
+		default_state_path = get_fast_start_state_path(dirpath);
+		state_path = default_state_path;
+	}
+
+	struct fast_start_ctx ctx;
+	memset(&ctx.stats, 0, sizeof(ctx.stats));
+	ctx.old_snap = (state_path != NULL) ? snap_load(state_path) : NULL;
+	if (ctx.old_snap != NULL
+			&& strcmp(ps_name(snap_paths(ctx.old_snap), PATH_ID_ROOT, NULL), dirpath) != 0) {
+		/* The records belong to some other directory */
+		snap_destroy(ctx.old_snap);
+		ctx.old_snap = NULL;
+	}
+	ctx.new_snap = snap_create(dirpath);
+	struct snap_entry *root = snap_get(ctx.new_snap, PATH_ID_ROOT);
+	snap_entry_set_stat(root, &dir_stat);
+	/* The root keeps the digest of the rules that the listings were made under */
+	pm_digest(matcher, root->digest);
+	if (ctx.old_snap != NULL
+			&& memcmp(snap_get(ctx.old_snap, PATH_ID_ROOT)->digest, root->digest, sizeof(root->digest)) != 0) {
+		snap_destroy(ctx.old_snap);
+		ctx.old_snap = NULL;
+	}
+	ctx.matcher = matcher;
+	ctx.root_len = strlen(dirpath);
+	ctx.rel_path = NULL;
+	ctx.rel_path_capacity = 0;
+	MD5_Init(&ctx.md5_ctxt);
+
+	ctx.fd = fd;
+
+	struct watch_thread_info thread_info;
+	thread_info.fd = fd;
+	thread_info.watch_queue = ctx.watch_queue = bq_create(WATCH_QUEUE_SIZE);
+	pthread_t watcher;
+	if (pthread_create(&watcher, NULL, &watch_thread, &thread_info) != 0) {
+		bq_destroy(ctx.watch_queue);
+		ctx.watch_queue = NULL;
+	}
+
+	watch_dir(&ctx, dirpath);
+	verify_dir(&ctx, ctx.old_snap != NULL ? PATH_ID_ROOT : PATH_ID_NONE, PATH_ID_ROOT, dirpath);
+
+	if (ctx.watch_queue != NULL) {
+		bq_close(ctx.watch_queue);
+		pthread_join(watcher, NULL);
+		bq_destroy(ctx.watch_queue);
+	}
+
+	if (state_path != NULL) {
+		snap_save(ctx.new_snap, state_path);
+	}
+
+	unsigned char md5sum_bytes[MD5_DIGEST_LENGTH];
+	MD5_Final(md5sum_bytes, &ctx.md5_ctxt);
+	char *md5sum = (char*) malloc(33);
+	for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+		/*
+		 * For each byte in the array, there will be two hexadecimal characters.
+		 */
+		sprintf(md5sum + (i * 2), "%02x", md5sum_bytes[i]);
+	}
+	*md5sum_ptr = md5sum;
+
+	if (stats != NULL) {
+		*stats = ctx.stats;
+	}
+	snap_destroy(ctx.old_snap);
+	snap_destroy(ctx.new_snap);
+	free(ctx.rel_path);
+	free(default_state_path);
+	return fd;
+}
+
+static void verify_dir(struct fast_start_ctx *ctx, path_id old_id, path_id new_id, const char *dir_path) {
+	pathstore new_ps = snap_paths(ctx->new_snap);
+	int reused = 0;
+	if (old_id != PATH_ID_NONE
+			&& dir_unchanged(snap_get(ctx->old_snap, old_id), snap_get(ctx->new_snap, new_id))) {
+		reuse_dir(ctx, old_id, new_id);
+		reused = 1;
+		ctx->stats.dirs_reused++;
+	} else {
+		list_dir(ctx, new_id, dir_path);
+		ctx->stats.dirs_listed++;
+	}
+
+	/*
+	 * Same order as traverse_fsh: every child is followed by its own subtree,
+	 * so that the MD5 sum matches the one from watch_md5sum_fsh.
+	 */
+	for (path_id child = ps_first_child(new_ps, new_id); child != PATH_ID_NONE;
+			child = ps_next_sibling(new_ps, child)) {
+		ctx->stats.entries++;
+		const char *path = ps_path(new_ps, child);
+		MD5_Update(&ctx->md5_ctxt, path, strlen(path));
+		MD5_Update(&ctx->md5_ctxt, "\n", 1);	// newline character as the delimiter
+
+		struct snap_entry *entry = snap_get(ctx->new_snap, child);
+		if (!S_ISDIR(entry->mode)) {
+			continue;
+		}
+
+		char *child_path = strdup(path);
+		struct stat child_stat;
+		if (reused) {
+			/* The listing is the same, but the subdirectory itself could have changed */
+			if (lstat(child_path, &child_stat) != 0) {
+				free(child_path);
+				continue;
+			}
+			snap_entry_set_stat(entry, &child_stat);
+		} else {
+			memset(&child_stat, 0, sizeof(child_stat));
+			child_stat.st_mode = entry->mode;
+			child_stat.st_uid = entry->uid;
+			child_stat.st_gid = entry->gid;
+		}
+
+		if (S_ISDIR(child_stat.st_mode)) {
+			watch_dir(ctx, child_path);
+			if (has_file_permission_curruser(READ_ACCESS | EXECUTE_ACCESS, &child_stat)) {
+				path_id old_child = PATH_ID_NONE;
+				if (old_id != PATH_ID_NONE) {
+					size_t name_len;
+					const char *name = ps_name(new_ps, child, &name_len);
+					old_child = ps_lookup_child(snap_paths(ctx->old_snap), old_id, name, name_len);
+					if (old_child != PATH_ID_NONE && snap_get(ctx->old_snap, old_child)->ino != entry->ino) {
+						old_child = PATH_ID_NONE;
+					}
+				}
+				verify_dir(ctx, old_child, child, child_path);
+			}
+		}
+		free(child_path);
+	}
+}
+
+static void list_dir(struct fast_start_ctx *ctx, path_id new_id, const char *dir_path) {
+	char *paths[] = { (char *) dir_path, NULL };
+	FTS *fts = fts_open(paths, FTS_PHYSICAL, NULL);
+	if (fts == NULL) {
+		return;
+	}
+	fts_read(fts);
+	for (FTSENT *child = fts_children(fts, 0); child != NULL; child = child->fts_link) {
+		if (ctx->matcher != NULL && child_excluded(ctx, dir_path, child->fts_name, child->fts_namelen,
+				S_ISDIR(child->fts_statp->st_mode))) {
+			continue;
+		}
+		snap_add(ctx->new_snap, new_id, child->fts_name, child->fts_namelen, child->fts_statp, NULL);
+	}
+	fts_close(fts);
+}
+
+static int child_excluded(struct fast_start_ctx *ctx, const char *dir_path, const char *name,
+		size_t name_len, int is_dir) {
+	const char *dir_rel = dir_path + ctx->root_len;
+	dir_rel += strspn(dir_rel, "/");
+	size_t dir_rel_len = strlen(dir_rel);
+	size_t needed = dir_rel_len + name_len + 2;
+	if (needed > ctx->rel_path_capacity) {
+		ctx->rel_path_capacity = needed * 2;
+		ctx->rel_path = realloc(ctx->rel_path, ctx->rel_path_capacity);
+	}
+	char *rel = ctx->rel_path;
+	if (dir_rel_len > 0) {
+		memcpy(rel, dir_rel, dir_rel_len);
+		rel[dir_rel_len++] = '/';
+	}
+	memcpy(rel + dir_rel_len, name, name_len);
+	rel[dir_rel_len + name_len] = '\0';
+	return pm_excluded(ctx->matcher, rel, is_dir);
+}
+
+static void reuse_dir(struct fast_start_ctx *ctx, path_id old_id, path_id new_id) {
+	pathstore old_ps = snap_paths(ctx->old_snap);
+	for (path_id child = ps_first_child(old_ps, old_id); child != PATH_ID_NONE;
+			child = ps_next_sibling(old_ps, child)) {
+		size_t name_len;
+		const char *name = ps_name(old_ps, child, &name_len);
+		path_id new_child = snap_add(ctx->new_snap, new_id, name, name_len, NULL, NULL);
+		*snap_get(ctx->new_snap, new_child) = *snap_get(ctx->old_snap, child);
+	}
+}
+
+static void watch_dir(struct fast_start_ctx *ctx, const char *dir_path) {
+	if (ctx->watch_queue != NULL) {
+		bq_push(ctx->watch_queue, strdup(dir_path));
+	} else if (ctx->fd > 0 && inotify_add_watch(ctx->fd, dir_path, IN_ALL_EVENTS) == -1) {
+		printf("\n Cannot add watch for %s", dir_path);
+	}
+}
+
+static int dir_unchanged(struct snap_entry *old_entry, struct snap_entry *new_entry) {
+	return old_entry->ino == new_entry->ino && old_entry->dev == new_entry->dev
+			&& old_entry->mtime_sec == new_entry->mtime_sec
+			&& old_entry->mtime_nsec == new_entry->mtime_nsec
+			&& old_entry->ctime_sec == new_entry->ctime_sec
+			&& old_entry->ctime_nsec == new_entry->ctime_nsec;
+}
+
+static void *watch_thread(void *arg) {
+	struct watch_thread_info *thread_info = arg;
+	void *item;
+	while (bq_pop(thread_info->watch_queue, &item) == 0) {
+		char *dir_path = item;
+		if (thread_info->fd > 0 && inotify_add_watch(thread_info->fd, dir_path, IN_ALL_EVENTS) == -1) {
+			printf("\n Cannot add watch for %s", dir_path);
+		}
+		free(dir_path);
+	}
+	return NULL;
+}
@@ -0,0 +1,77 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_FASTSTART_H
+#define GOODRV_FASTSTART_H
+
+#include "pathmatch.h"
+
+/*
+ * What the fast start had to do.
+ */
+struct fast_start_stats {
+	/* Directories that were read, since they were new or their metadata changed */
+	unsigned long dirs_listed;
+	/* Directories whose listing was taken from the saved records */
+	unsigned long dirs_reused;
+	/* Entries in the hierarchy, excluding the root */
+	unsigned long entries;
+};
+
+/*
+ * Get the default path of the file that keeps the directory records of dirpath,
+ * in the user's config directory.
+ */
+char *get_fast_start_state_path(char *dirpath);
+
+/*
+ * Same as watch_md5sum_fsh_filtered, but uses the directory records saved by
+ * the previous run to avoid reading directories that have not changed.
+ *
+ * The (inode, mtime, ctime) of every directory is compared with the saved
+ * record. When they are the same, the set of names in the directory is the
+ * same too, so the saved listing is used, and only its subdirectories are
+ * stat'ed. Watches are placed by a separate thread while the hierarchy is
+ * being verified. The records are saved again for the next run.
+ *
+ * Params
+ * =======
+ * fd - File Descriptor for the inotify instance. If this is -1, a new inotify
+ * 		instance will be created.
+ * md5sum_ptr - Pointer to the char* where MD5 Sum should be stored.
+ * dirpath - Directory path for placing watches and finding MD5 sum.
+ * state_path - File with the directory records. If NULL, the default path
+ * 				from get_fast_start_state_path is used.
+ * matcher - Rules for the entries to leave out, as in watch_md5sum_fsh_filtered.
+ * 			 May be NULL. Saved records are reused only under the same rules.
+ * stats - If not NULL, filled with what had to be done.
+ *
+ * Returns
+ * ========
+ * Same as watch_md5sum_fsh.
+ */
+int watch_md5sum_fsh_fast(int fd, char **md5sum_ptr, char *dirpath, char *state_path,
+		path_matcher matcher, struct fast_start_stats *stats);
+
+#endif /* GOODRV_FASTSTART_H */
@@ -28,6 +28,8 @@
 #include<stdlib.h>
 #include<string.h>
 #include "hashtable.h"
+#include "kernels.h"
+#include "metrics.h"
 
 /*
  * Hashtable
@@ -70,12 +72,7 @@ static void insert_in_bucket(struct bucket_elem **bucket_ptr, int (*equals)(void
  */
 static int hash_fn_string(void *input) {
 	char *input_str = input;
-	int hash = 0;
-	int input_len = strlen(input_str);
-	for (char *ptr = input_str; ptr < (input_str + input_len); ptr++) {
-		hash = 31 * hash + *ptr;
-	}
-	return hash;
+	return kernel_hash_string(input_str, strlen(input_str));
 }
 
 /*
@@ -97,8 +94,9 @@ ht_options default_ht_options() {
 }
 
 hashtable ht_create(ht_options options) {
+	ht_options default_options = NULL;
 	if (options == NULL) {
-		options = default_ht_options();
+		options = default_options = default_ht_options();
 	}
 	hashtable hashtable = malloc(sizeof(struct hashtable));
 	hashtable->table_size = options->table_size;
@@ -106,8 +104,9 @@ hashtable ht_create(ht_options options) {
 	hashtable->hash_fn = options->hash_fn;
 	hashtable->equals = options->equals;
 	hashtable->num_entries = 0;
+	free(default_options);
 
-	hashtable->table = malloc(sizeof(struct bucket_elem*) * hashtable->table_size);
+	hashtable->table = calloc(hashtable->table_size, sizeof(struct bucket_elem*));
 	return hashtable;
 }
 
@@ -161,6 +160,24 @@ void *ht_remove(hashtable hashtable, void *key) {
 	return NULL;
 }
 
+void ht_destroy(hashtable hashtable) {
+	if (hashtable == NULL) {
+		return;
+	}
+
+	struct bucket_elem *elem, *temp;
+	for (unsigned int i = 0; i < hashtable->table_size; i++) {
+		elem = hashtable->table[i];
+		while (elem) {
+			temp = elem;
+			elem = elem->next;
+			free(temp);
+		}
+	}
+	free(hashtable->table);
+	free(hashtable);
+}
+
 unsigned int ht_num_entries(hashtable hashtable) {
 	return hashtable->num_entries;
 }
@@ -216,9 +233,10 @@ static void check_and_resize(hashtable hashtable) {
 		return;
 	}
 
+	uint64_t start = metrics_now();
 	unsigned int old_size = hashtable->table_size;
-	struct bucket_elem **new_table = malloc(
-			sizeof(struct bucket_elem*) * new_size);
+	struct bucket_elem **new_table = calloc(new_size,
+			sizeof(struct bucket_elem*));
 	struct bucket_elem **elem_ptr = hashtable->table;
 
 	struct bucket_elem *elem, *temp;
@@ -239,4 +257,6 @@ static void check_and_resize(hashtable hashtable) {
 	free(hashtable->table);
 	hashtable->table = new_table;
 	hashtable->table_size = new_size;
+	metrics_add(METRIC_HT_RESIZES, 1);
+	metrics_record_since(METRIC_HT_RESIZE, start);
 }
@@ -60,6 +60,11 @@ ht_options default_ht_options();
  */
 hashtable ht_create(ht_options options);
 
+/*
+ * Free the hashtable. The keys and values are not freed.
+ */
+void ht_destroy(hashtable hashtable);
+
 /*
  * Get the number of Key-Value pairs in the hashtable.
  */
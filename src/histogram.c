@@ -0,0 +1,105 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+/* Get the largest value counted in the bucket */
+static uint64_t hist_bucket_limit(unsigned int bucket);
+
+void hist_init(struct histogram *hist) {
+	memset(hist, 0, sizeof(struct histogram));
+	hist->min = UINT64_MAX;
+}
+
+void hist_record(struct histogram *hist, uint64_t value) {
+	hist->counts[hist_bucket(value)]++;
+	hist->count++;
+	hist->sum += value;
+	if (value < hist->min) {
+		hist->min = value;
+	}
+	if (value > hist->max) {
+		hist->max = value;
+	}
+}
+
+void hist_merge(struct histogram *dest, const struct histogram *src) {
+	for (unsigned int i = 0; i < HIST_NUM_BUCKETS; i++) {
+		dest->counts[i] += src->counts[i];
+	}
+	dest->count += src->count;
+	dest->sum += src->sum;
+	if (src->min < dest->min) {
+		dest->min = src->min;
+	}
+	if (src->max > dest->max) {
+		dest->max = src->max;
+	}
+}
+
+uint64_t hist_percentile(const struct histogram *hist, double percentile) {
+	if (hist->count == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t) (percentile / 100 * hist->count + 0.5);
+	if (rank == 0) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (unsigned int i = 0; i < HIST_NUM_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			uint64_t limit = hist_bucket_limit(i);
+			return (limit < hist->max) ? limit : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+double hist_mean(const struct histogram *hist) {
+	return (hist->count > 0) ? (double) hist->sum / hist->count : 0;
+}
+
+unsigned int hist_bucket(uint64_t value) {
+	if (value < HIST_LINEAR_LIMIT) {
+		return value;
+	}
+	/* The power of two, and then the top three bits below the leading one */
+	unsigned int exponent = 63 - __builtin_clzll(value);
+	unsigned int sub_bucket = (value >> (exponent - 3)) & (HIST_SUB_BUCKETS - 1);
+	return HIST_LINEAR_LIMIT + (exponent - 4) * HIST_SUB_BUCKETS + sub_bucket;
+}
+
+static uint64_t hist_bucket_limit(unsigned int bucket) {
+	if (bucket < HIST_LINEAR_LIMIT) {
+		return bucket;
+	}
+	unsigned int exponent = (bucket - HIST_LINEAR_LIMIT) / HIST_SUB_BUCKETS + 4;
+	uint64_t sub_bucket = (bucket - HIST_LINEAR_LIMIT) % HIST_SUB_BUCKETS;
+	uint64_t width = (uint64_t) 1 << (exponent - 3);
+	return ((uint64_t) 1 << exponent) + (sub_bucket + 1) * width - 1;
+}
@@ -0,0 +1,83 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_HISTOGRAM_H
+#define GOODRV_HISTOGRAM_H
+
+#include <stdint.h>
+
+/* Values below this are counted exactly */
+#define HIST_LINEAR_LIMIT 16
+/* Buckets for every power of two beyond that, so that the error is within 12.5% */
+#define HIST_SUB_BUCKETS 8
+#define HIST_NUM_BUCKETS (HIST_LINEAR_LIMIT + (64 - 4) * HIST_SUB_BUCKETS)
+
+/*
+ * Histogram of values, like latencies, with log-linear buckets as in HDR
+ * histograms. Recording a value is a few instructions, and histograms kept
+ * apart (e.g. one per thread) can be merged when they are read.
+ *
+ * Not thread safe.
+ */
+struct histogram {
+	uint64_t counts[HIST_NUM_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+/*
+ * Empty the histogram.
+ */
+void hist_init(struct histogram *hist);
+
+/*
+ * Count a value.
+ */
+void hist_record(struct histogram *hist, uint64_t value);
+
+/*
+ * Get the index in counts of the bucket of the value, for the callers that
+ * count into a histogram on their own.
+ */
+unsigned int hist_bucket(uint64_t value);
+
+/*
+ * Add the counts of src to dest.
+ */
+void hist_merge(struct histogram *dest, const struct histogram *src);
+
+/*
+ * Get the value below which the given percentage (0 - 100) of the values
+ * fall, rounded up to the bucket. Returns 0 for an empty histogram.
+ */
+uint64_t hist_percentile(const struct histogram *hist, double percentile);
+
+/*
+ * Get the mean of the values, 0 for an empty histogram.
+ */
+double hist_mean(const struct histogram *hist);
+
+#endif /* GOODRV_HISTOGRAM_H */
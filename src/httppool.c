@@ -0,0 +1,653 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "httppool.h"
+
+/* Size of the read buffer of a connection */
+#define CONN_BUFFER_SIZE 16384
+
+/*
+ * A TLS connection to a host
+ */
+struct http_conn {
+	int fd;
+	SSL *ssl;
+	/* Set once the connection has served a request */
+	int reused;
+	time_t last_used;
+	/* Bytes read from the connection, from rpos up to rlen not yet consumed */
+	unsigned char rbuf[CONN_BUFFER_SIZE];
+	size_t rpos;
+	size_t rlen;
+	struct http_conn *next;
+};
+
+/*
+ * Connections and TLS session of a host
+ */
+struct http_host {
+	char *name;
+	unsigned short port;
+	/* Latest session offered by the host, for resuming the next connection */
+	SSL_SESSION *session;
+	unsigned int in_use;
+	unsigned int num_idle;
+	/* Unused connections, the most recently used first */
+	struct http_conn *idle;
+	struct http_host *next;
+};
+
+struct http_pool {
+	struct http_pool_options options;
+	SSL_CTX *ssl_ctx;
+	/* Guards the hosts, and the stats */
+	pthread_mutex_t lock;
+	/* Signalled when a connection is released */
+	pthread_cond_t conn_released;
+	struct http_host *hosts;
+	struct http_pool_stats stats;
+};
+
+/*
+ * Growable character buffer
+ */
+struct strbuf {
+	char *data;
+	size_t len;
+	size_t capacity;
+};
+
+/* Take a connection to the host, waiting if the host's limit is reached */
+static struct http_conn *acquire_conn(http_pool pool, struct http_host *host);
+/* Give back the connection, keeping it open for later if keep_alive is set */
+static void release_conn(http_pool pool, struct http_host *host, struct http_conn *conn, int keep_alive);
+/* Open a new connection to the host */
+static struct http_conn *open_conn(http_pool pool, struct http_host *host);
+/* Close the connection, and free it */
+static void close_conn(struct http_conn *conn);
+/* Check that the peer has not closed an unused connection */
+static int conn_alive(struct http_conn *conn);
+/* Find the host, adding it if it is new. Called with the lock held */
+static struct http_host *find_host(http_pool pool, const char *name, unsigned short port);
+/* Keep the session offered by the server, for resuming later connections */
+static int new_session_cb(SSL *ssl, SSL_SESSION *session);
+
+/* Write the request onto the connection */
+static int write_request(struct http_conn *conn, struct http_host *host, struct http_request *request);
+/* Read a response from the connection. *keep_alive tells whether the connection can be used again */
+static int read_response(struct http_conn *conn, struct http_request *request,
+		struct http_response *response, int *keep_alive);
+/* Read a body in the chunked transfer coding */
+static int read_chunked_body(struct http_conn *conn, struct strbuf *body);
+/* Write the whole buffer */
+static int conn_write(struct http_conn *conn, const void *buf, size_t len);
+/* Read more bytes into the read buffer. Returns the number of bytes read, 0 at the end */
+static int conn_fill(struct http_conn *conn);
+/* Read a line, without the CRLF */
+static int conn_read_line(struct http_conn *conn, struct strbuf *line);
+/* Read exactly len bytes, appending them to the buffer */
+static int conn_read(struct http_conn *conn, struct strbuf *buf, size_t len);
+
+/* Append bytes to the buffer, keeping it NUL terminated */
+static void strbuf_append(struct strbuf *buf, const void *data, size_t len);
+
+void http_pool_default_options(struct http_pool_options *options) {
+	options->max_per_host = 4;
+	options->max_idle_per_host = 4;
+	options->idle_timeout_sec = 60;
+	options->io_timeout_sec = 30;
+	options->ca_file = NULL;
+}
+
+http_pool http_pool_create(struct http_pool_options *options) {
+	SSL_CTX *ssl_ctx = SSL_CTX_new(TLS_client_method());
+	if (ssl_ctx == NULL) {
+		return NULL;
+	}
+
+	http_pool pool = calloc(1, sizeof(struct http_pool));
+	if (options != NULL) {
+		pool->options = *options;
+	} else {
+		http_pool_default_options(&pool->options);
+	}
+	if (pool->options.max_per_host == 0) {
+		pool->options.max_per_host = 1;
+	}
+
+	SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, NULL);
+	int trusted = (pool->options.ca_file != NULL)
+			? SSL_CTX_load_verify_locations(ssl_ctx, pool->options.ca_file, NULL)
+			: SSL_CTX_set_default_verify_paths(ssl_ctx);
+	if (trusted != 1) {
+		SSL_CTX_free(ssl_ctx);
+		free(pool);
+		return NULL;
+	}
+	/* The sessions are kept by the hosts, and not in OpenSSL's cache */
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, &new_session_cb);
+	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_AUTO_RETRY);
+	SSL_CTX_set_app_data(ssl_ctx, pool);
+	pool->ssl_ctx = ssl_ctx;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->conn_released, NULL);
+	return pool;
+}
+
+void http_pool_destroy(http_pool pool) {
+	if (pool == NULL) {
+		return;
+	}
+	struct http_host *host = pool->hosts;
+	while (host != NULL) {
+		struct http_host *next_host = host->next;
+		struct http_conn *conn = host->idle;
+		while (conn != NULL) {
+			struct http_conn *next_conn = conn->next;
+			close_conn(conn);
+			conn = next_conn;
+		}
+		SSL_SESSION_free(host->session);
+		free(host->name);
+		free(host);
+		host = next_host;
+	}
+	SSL_CTX_free(pool->ssl_ctx);
+	pthread_cond_destroy(&pool->conn_released);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int http_send(http_pool pool, const char *host, unsigned short port, struct http_request *request,
+		struct http_response *response) {
+	return (http_send_pipelined(pool, host, port, request, response, 1) == 1) ? 0 : -1;
+}
+
+int http_send_pipelined(http_pool pool, const char *host_name, unsigned short port,
+		struct http_request *requests, struct http_response *responses, int count) {
+	pthread_mutex_lock(&pool->lock);
+	struct http_host *host = find_host(pool, host_name, port);
+	pthread_mutex_unlock(&pool->lock);
+
+	int done = 0;
+	int stale_retried = 0;
+	while (done < count) {
+		struct http_conn *conn = acquire_conn(pool, host);
+		if (conn == NULL) {
+			break;
+		}
+		int was_reused = conn->reused;
+
+		/* Send everything first, so that the server can work through the requests back to back */
+		int sent = done;
+		while (sent < count && write_request(conn, host, &requests[sent]) == 0) {
+			sent++;
+		}
+
+		int received = 0;
+		int keep_alive = 1;
+		while (done < sent && keep_alive) {
+			if (read_response(conn, &requests[done], &responses[done], &keep_alive) != 0) {
+				keep_alive = 0;
+				break;
+			}
+			done++;
+			received++;
+		}
+		keep_alive = keep_alive && (sent == count);
+		release_conn(pool, host, conn, keep_alive);
+
+		pthread_mutex_lock(&pool->lock);
+		pool->stats.requests += received;
+		if (was_reused) {
+			pool->stats.connections_reused += received;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		/*
+		 * The rest of the requests go over a new connection, when this one got
+		 * through some of them before it was closed, or when it had been lying
+		 * unused and the server had given up on it.
+		 */
+		if (received == 0) {
+			if (!was_reused || stale_retried) {
+				break;
+			}
+			stale_retried = 1;
+		}
+	}
+	return done;
+}
+
+void http_response_free(struct http_response *response) {
+	free(response->headers);
+	free(response->body);
+	response->headers = NULL;
+	response->body = NULL;
+}
+
+void http_pool_get_stats(http_pool pool, struct http_pool_stats *stats) {
+	pthread_mutex_lock(&pool->lock);
+	*stats = pool->stats;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static struct http_conn *acquire_conn(http_pool pool, struct http_host *host) {
+	struct http_conn *stale = NULL;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&pool->lock);
+	while (host->in_use >= pool->options.max_per_host) {
+		pthread_cond_wait(&pool->conn_released, &pool->lock);
+	}
+	host->in_use++;
+	struct http_conn *conn = NULL;
+	while (conn == NULL && host->idle != NULL) {
+		conn = host->idle;
+		host->idle = conn->next;
+		host->num_idle--;
+		if (now - conn->last_used > pool->options.idle_timeout_sec || !conn_alive(conn)) {
+			conn->next = stale;
+			stale = conn;
+			conn = NULL;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	while (stale != NULL) {
+		struct http_conn *next = stale->next;
+		close_conn(stale);
+		stale = next;
+	}
+
+	if (conn == NULL && (conn = open_conn(pool, host)) == NULL) {
+		pthread_mutex_lock(&pool->lock);
+		host->in_use--;
+		pthread_cond_signal(&pool->conn_released);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return conn;
+}
+
+static void release_conn(http_pool pool, struct http_host *host, struct http_conn *conn, int keep_alive) {
+	pthread_mutex_lock(&pool->lock);
+	host->in_use--;
+	if (keep_alive && host->num_idle < pool->options.max_idle_per_host) {
+		conn->reused = 1;
+		conn->last_used = time(NULL);
+		conn->next = host->idle;
+		host->idle = conn;
+		host->num_idle++;
+		conn = NULL;
+	}
+	pthread_cond_signal(&pool->conn_released);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (conn != NULL) {
+		close_conn(conn);
+	}
+}
+
+static struct http_conn *open_conn(http_pool pool, struct http_host *host) {
+	char port[8];
+	snprintf(port, sizeof(port), "%hu", host->port);
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addrs;
+	if (getaddrinfo(host->name, port, &hints, &addrs) != 0) {
+		return NULL;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *addr = addrs; addr != NULL && fd == -1; addr = addr->ai_next) {
+		fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+		if (fd != -1 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(addrs);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	int nodelay = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	struct timeval timeout = { pool->options.io_timeout_sec, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	struct http_conn *conn = malloc(sizeof(struct http_conn));
+	conn->fd = fd;
+	conn->reused = 0;
+	conn->rpos = conn->rlen = 0;
+	conn->next = NULL;
+	conn->ssl = SSL_new(pool->ssl_ctx);
+	SSL_set_fd(conn->ssl, fd);
+	SSL_set_tlsext_host_name(conn->ssl, host->name);
+	SSL_set1_host(conn->ssl, host->name);
+	SSL_set_app_data(conn->ssl, host);
+
+	pthread_mutex_lock(&pool->lock);
+	if (host->session != NULL) {
+		SSL_set_session(conn->ssl, host->session);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if (SSL_connect(conn->ssl) != 1) {
+		ERR_clear_error();
+		close_conn(conn);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stats.connections_opened++;
+	if (SSL_session_reused(conn->ssl)) {
+		pool->stats.sessions_resumed++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return conn;
+}
+
+static void close_conn(struct http_conn *conn) {
+	/*
+	 * OpenSSL does not resume sessions from connections that were not shut
+	 * down. A connection that failed cannot be shut down, and its session is
+	 * rightly dropped.
+	 */
+	SSL_shutdown(conn->ssl);
+	ERR_clear_error();
+	SSL_free(conn->ssl);
+	close(conn->fd);
+	free(conn);
+}
+
+static int conn_alive(struct http_conn *conn) {
+	if (conn->rpos < conn->rlen) {
+		/* Nothing should arrive before a request is sent */
+		return 0;
+	}
+	char c;
+	ssize_t count = recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	/* Pending bytes could be session tickets, which are read along with the next response */
+	return count > 0 || (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+static struct http_host *find_host(http_pool pool, const char *name, unsigned short port) {
+	struct http_host *host;
+	for (host = pool->hosts; host != NULL; host = host->next) {
+		if (host->port == port && strcmp(host->name, name) == 0) {
+			return host;
+		}
+	}
+	host = calloc(1, sizeof(struct http_host));
+	host->name = strdup(name);
+	host->port = port;
+	host->next = pool->hosts;
+	pool->hosts = host;
+	return host;
+}
+
+static int new_session_cb(SSL *ssl, SSL_SESSION *session) {
+	http_pool pool = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+	struct http_host *host = SSL_get_app_data(ssl);
+
+	pthread_mutex_lock(&pool->lock);
+	SSL_SESSION_free(host->session);
+	host->session = session;
+	pthread_mutex_unlock(&pool->lock);
+	/* The reference is kept */
+	return 1;
+}
+
+static int write_request(struct http_conn *conn, struct http_host *host, struct http_request *request) {
+	struct strbuf head = { NULL, 0, 0 };
+	char line[64];
+	strbuf_append(&head, request->method, strlen(request->method));
+	strbuf_append(&head, " ", 1);
+	strbuf_append(&head, request->path, strlen(request->path));
+	strbuf_append(&head, " HTTP/1.1\r\nHost: ", strlen(" HTTP/1.1\r\nHost: "));
+	strbuf_append(&head, host->name, strlen(host->name));
+	if (host->port != 443) {
+		snprintf(line, sizeof(line), ":%hu", host->port);
+		strbuf_append(&head, line, strlen(line));
+	}
+	strbuf_append(&head, "\r\n", 2);
+	if (request->body != NULL
+			|| (strcmp(request->method, "GET") != 0 && strcmp(request->method, "HEAD") != 0)) {
+		snprintf(line, sizeof(line), "Content-Length: %zu\r\n", request->body_len);
+		strbuf_append(&head, line, strlen(line));
+	}
+	if (request->headers != NULL) {
+		strbuf_append(&head, request->headers, strlen(request->headers));
+	}
+	strbuf_append(&head, "\r\n", 2);
+
+	int status = conn_write(conn, head.data, head.len);
+	if (status == 0 && request->body_len > 0) {
+		status = conn_write(conn, request->body, request->body_len);
+	}
+	free(head.data);
+	return status;
+}
+
+static int read_response(struct http_conn *conn, struct http_request *request,
+		struct http_response *response, int *keep_alive) {
+	struct strbuf line = { NULL, 0, 0 };
+	struct strbuf headers = { NULL, 0, 0 };
+	struct strbuf body = { NULL, 0, 0 };
+	int status = -1;
+	int minor_version = 0;
+	long long content_length = -1;
+	int chunked = 0;
+	int conn_close = 0;
+
+	do {
+		/* Skip the interim responses, like 100 Continue */
+		if (conn_read_line(conn, &line) != 0
+				|| sscanf(line.data, "HTTP/1.%d %d", &minor_version, &status) != 2) {
+			goto fail;
+		}
+		headers.len = 0;
+		while (1) {
+			if (conn_read_line(conn, &line) != 0) {
+				goto fail;
+			}
+			if (line.len == 0) {
+				break;
+			}
+			if (strncasecmp(line.data, "Content-Length:", 15) == 0) {
+				content_length = strtoll(line.data + 15, NULL, 10);
+			} else if (strncasecmp(line.data, "Transfer-Encoding:", 18) == 0) {
+				chunked = (strcasestr(line.data + 18, "chunked") != NULL);
+			} else if (strncasecmp(line.data, "Connection:", 11) == 0) {
+				conn_close = (strcasestr(line.data + 11, "close") != NULL);
+			}
+			strbuf_append(&headers, line.data, line.len);
+			strbuf_append(&headers, "\r\n", 2);
+		}
+	} while (status >= 100 && status < 200);
+
+	strbuf_append(&body, "", 0);
+	*keep_alive = !conn_close && minor_version >= 1;
+	if (strcmp(request->method, "HEAD") == 0 || status == 204 || status == 304) {
+		/* No body */
+	} else if (chunked) {
+		if (read_chunked_body(conn, &body) != 0) {
+			goto fail;
+		}
+	} else if (content_length >= 0) {
+		if (conn_read(conn, &body, content_length) != 0) {
+			goto fail;
+		}
+	} else {
+		/* The body ends with the connection */
+		int count;
+		while ((count = conn_fill(conn)) > 0) {
+			strbuf_append(&body, conn->rbuf + conn->rpos, conn->rlen - conn->rpos);
+			conn->rpos = conn->rlen;
+		}
+		*keep_alive = 0;
+	}
+
+	strbuf_append(&headers, "", 0);
+	response->status = status;
+	response->headers = headers.data;
+	response->body = (unsigned char *) body.data;
+	response->body_len = body.len;
+	free(line.data);
+	return 0;
+
+fail:
+	free(line.data);
+	free(headers.data);
+	free(body.data);
+	return -1;
+}
+
+static int read_chunked_body(struct http_conn *conn, struct strbuf *body) {
+	struct strbuf line = { NULL, 0, 0 };
+	int status = -1;
+	while (conn_read_line(conn, &line) == 0) {
+		size_t chunk_size = strtoul(line.data, NULL, 16);
+		if (chunk_size == 0) {
+			/* Skip the trailers */
+			while (conn_read_line(conn, &line) == 0) {
+				if (line.len == 0) {
+					status = 0;
+					break;
+				}
+			}
+			break;
+		}
+		if (conn_read(conn, body, chunk_size) != 0 || conn_read_line(conn, &line) != 0) {
+			break;
+		}
+	}
+	free(line.data);
+	return status;
+}
+
+static int conn_write(struct http_conn *conn, const void *buf, size_t len) {
+	size_t written;
+	while (len > 0) {
+		if (SSL_write_ex(conn->ssl, buf, len, &written) != 1) {
+			ERR_clear_error();
+			return -1;
+		}
+		buf = (const char *) buf + written;
+		len -= written;
+	}
+	return 0;
+}
+
+static int conn_fill(struct http_conn *conn) {
+	if (conn->rpos == conn->rlen) {
+		conn->rpos = conn->rlen = 0;
+	} else if (conn->rlen == CONN_BUFFER_SIZE) {
+		memmove(conn->rbuf, conn->rbuf + conn->rpos, conn->rlen - conn->rpos);
+		conn->rlen -= conn->rpos;
+		conn->rpos = 0;
+	}
+	size_t count;
+	if (SSL_read_ex(conn->ssl, conn->rbuf + conn->rlen, CONN_BUFFER_SIZE - conn->rlen, &count) != 1) {
+		ERR_clear_error();
+		return 0;
+	}
+	conn->rlen += count;
+	return count;
+}
+
+static int conn_read_line(struct http_conn *conn, struct strbuf *line) {
+	line->len = 0;
+	while (1) {
+		unsigned char *start = conn->rbuf + conn->rpos;
+		unsigned char *newline = memchr(start, '\n', conn->rlen - conn->rpos);
+		size_t len = (newline != NULL) ? (size_t) (newline - start) : conn->rlen - conn->rpos;
+		strbuf_append(line, start, len);
+		if (newline != NULL) {
+			conn->rpos += len + 1;
+			if (line->len > 0 && line->data[line->len - 1] == '\r') {
+				line->data[--line->len] = '\0';
+			}
+			return 0;
+		}
+		conn->rpos = conn->rlen;
+		if (conn_fill(conn) == 0) {
+			return -1;
+		}
+	}
+}
+
+static int conn_read(struct http_conn *conn, struct strbuf *buf, size_t len) {
+	while (len > 0) {
+		if (conn->rpos == conn->rlen && conn_fill(conn) == 0) {
+			return -1;
+		}
+		size_t count = conn->rlen - conn->rpos;
+		if (count > len) {
+			count = len;
+		}
+		strbuf_append(buf, conn->rbuf + conn->rpos, count);
+		conn->rpos += count;
+		len -= count;
+	}
+	return 0;
+}
+
+static void strbuf_append(struct strbuf *buf, const void *data, size_t len) {
+	if (buf->len + len + 1 > buf->capacity) {
+		buf->capacity = (buf->capacity == 0) ? 256 : buf->capacity;
+		while (buf->len + len + 1 > buf->capacity) {
+			buf->capacity *= 2;
+		}
+		buf->data = realloc(buf->data, buf->capacity);
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	buf->data[buf->len] = '\0';
+}
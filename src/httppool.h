@@ -0,0 +1,142 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_HTTPPOOL_H
+#define GOODRV_HTTPPOOL_H
+
+#include <stddef.h>
+
+/*
+ * Pool of persistent HTTPS connections. Connections to a host are kept open
+ * between requests, and new connections resume the host's last TLS session,
+ * so that a request seldom pays for a full handshake.
+ */
+typedef struct http_pool *http_pool;
+
+/*
+ * Options for the connection pool
+ * max_per_host - Number of connections to a host that may be in use at once.
+ * 				  Requests beyond that wait for a connection to be released.
+ * max_idle_per_host - Number of unused connections kept open for each host.
+ * idle_timeout_sec - Unused connections older than this are closed.
+ * io_timeout_sec - Time to wait for the server before failing a request.
+ * ca_file - File with the trusted certificates in PEM format. NULL for the
+ * 			 system's default trust store.
+ */
+struct http_pool_options {
+	unsigned int max_per_host;
+	unsigned int max_idle_per_host;
+	unsigned int idle_timeout_sec;
+	unsigned int io_timeout_sec;
+	const char *ca_file;
+};
+
+/*
+ * An HTTP/1.1 request.
+ * headers - Additional header lines, each ending with "\r\n". May be NULL.
+ * 			 Host and Content-Length are added by the pool.
+ */
+struct http_request {
+	const char *method;
+	const char *path;
+	const char *headers;
+	const void *body;
+	size_t body_len;
+};
+
+/*
+ * An HTTP/1.1 response. headers holds the header lines as received, and is
+ * NUL terminated, as is body.
+ */
+struct http_response {
+	int status;
+	char *headers;
+	unsigned char *body;
+	size_t body_len;
+};
+
+/*
+ * What the pool has done so far.
+ */
+struct http_pool_stats {
+	unsigned long requests;
+	unsigned long connections_opened;
+	/* Connections that resumed a TLS session instead of a full handshake */
+	unsigned long sessions_resumed;
+	/* Requests that were sent over a connection that was already open */
+	unsigned long connections_reused;
+};
+
+/*
+ * Fill the options with the defaults.
+ */
+void http_pool_default_options(struct http_pool_options *options);
+
+/*
+ * Create a connection pool. Returns NULL if TLS could not be set up.
+ *
+ * The process must ignore SIGPIPE, or block it in the threads sending the
+ * requests: a write to a connection closed by the server would otherwise
+ * kill it, instead of failing the request.
+ *
+ * options - NULL for the defaults.
+ */
+http_pool http_pool_create(struct http_pool_options *options);
+
+/*
+ * Close all the connections, and free the pool. No request may be in progress.
+ */
+void http_pool_destroy(http_pool pool);
+
+/*
+ * Send the request to https://host:port, and wait for the response.
+ * May be called from several threads.
+ *
+ * Returns 0 on success, and -1 if no response could be received.
+ */
+int http_send(http_pool pool, const char *host, unsigned short port, struct http_request *request,
+		struct http_response *response);
+
+/*
+ * Send the requests one after another over a single connection, without
+ * waiting for the responses in between, and then receive the responses in
+ * the same order. Only idempotent requests should be pipelined.
+ *
+ * Returns the number of responses received. Those after a failure are not
+ * filled in.
+ */
+int http_send_pipelined(http_pool pool, const char *host, unsigned short port,
+		struct http_request *requests, struct http_response *responses, int count);
+
+/*
+ * Free the contents of a response.
+ */
+void http_response_free(struct http_response *response);
+
+/*
+ * Get what the pool has done so far.
+ */
+void http_pool_get_stats(http_pool pool, struct http_pool_stats *stats);
+
+#endif /* GOODRV_HTTPPOOL_H */
@@ -39,40 +39,58 @@
 #include "base64url.h"
 #include "jwt.h"
 #include "linux-api.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define SUCCESSFUL_OPERATION 1
 #define FAILED_OPERATION -1
 
 static int build_jwt_header(char **dest, size_t *encoded_header_len);
-static int build_jwt_claim_set(char **dest, json_object *token_file_obj, size_t *encoded_claim_set_len);
+static int build_jwt_claim_set(char **dest, json_object *token_file_obj, time_t epoch, size_t *encoded_claim_set_len);
 static int build_jwt_signature(char **dest, json_object *token_file_obj, const char *jwt_header, const char *jwt_claim_set, size_t *encoded_sig_len);
 
 void build_jwt(char *email_addr, char **jwt) {
+    char *user_md5sum = md5sum_str(email_addr);
+    char *account_details_file_path = get_abs_path(get_config_dir_curruser(), user_md5sum);
+    if (account_details_file_path != NULL && access(account_details_file_path, R_OK) != -1) {
+        build_jwt_from_file(account_details_file_path, jwt, NULL);
+    }
+    free(account_details_file_path);
+    free(user_md5sum);
+}
+
+int build_jwt_from_file(const char *key_file_path, char **jwt, time_t *expiry) {
+    uint64_t span = trace_begin();
+    json_object *token_file_obj = json_object_from_file(key_file_path); // The entire token file
+    if (token_file_obj == NULL) {
+        return -1;
+    }
     char *jwt_header = NULL;
     char *jwt_claim_set = NULL;
     char *jwt_signature = NULL;
-    char *user_md5sum = md5sum_str(email_addr);
-    char *account_details_file_path = get_abs_path(get_config_dir_curruser(), user_md5sum);
-    if (access(account_details_file_path, R_OK) != -1) {
-        json_object *token_file_obj = json_object_from_file(account_details_file_path); // The entire token file
-        if (token_file_obj == NULL) {
-            return;
-        }
-        size_t encoded_header_len, encoded_claim_set_len, encoded_sig_len;
-        build_jwt_header(&jwt_header, &encoded_header_len);
-        build_jwt_claim_set(&jwt_claim_set, token_file_obj, &encoded_claim_set_len);
-        build_jwt_signature(&jwt_signature, token_file_obj, jwt_header, jwt_claim_set, &encoded_sig_len);
+    size_t encoded_header_len, encoded_claim_set_len, encoded_sig_len;
+    time_t epoch = time(NULL);
+    int result = -1;
+    if (build_jwt_header(&jwt_header, &encoded_header_len) == SUCCESSFUL_OPERATION
+            && build_jwt_claim_set(&jwt_claim_set, token_file_obj, epoch, &encoded_claim_set_len) == SUCCESSFUL_OPERATION
+            && build_jwt_signature(&jwt_signature, token_file_obj, jwt_header, jwt_claim_set, &encoded_sig_len) == SUCCESSFUL_OPERATION) {
         *jwt = malloc(encoded_header_len + encoded_claim_set_len + encoded_sig_len + 3);
-        if (*jwt == NULL) {
+        if (*jwt != NULL) {
+            sprintf(*jwt, "%s.%s.%s", jwt_header, jwt_claim_set, jwt_signature);
+            if (expiry != NULL) {
+                *expiry = epoch + JWT_LIFETIME;
+            }
+            result = 0;
+        } else {
             printf("Failed to allocate memory\n");
-            return;
         }
-        sprintf(*jwt, "%s.%s.%s", jwt_header, jwt_claim_set, jwt_signature);
-        (*jwt)[encoded_header_len + encoded_claim_set_len + encoded_sig_len + 2] = 0;
-        free(jwt_header);
-        free(jwt_claim_set);
-        free(jwt_signature);
     }
+    free(jwt_header);
+    free(jwt_claim_set);
+    free(jwt_signature);
+    json_object_put(token_file_obj);
+    trace_end(TRACE_JWT_BUILD, span);
+    return result;
 }
 
 static int build_jwt_header(char **dest, size_t *encoded_header_len) {
@@ -91,12 +109,13 @@ static int build_jwt_header(char **dest, size_t *encoded_header_len) {
     return SUCCESSFUL_OPERATION;
 }
 
-static int build_jwt_claim_set(char **dest, json_object *token_file_obj, size_t *encoded_claim_set_len) {
+static int build_jwt_claim_set(char **dest, json_object *token_file_obj, time_t epoch, size_t *encoded_claim_set_len) {
     json_object *service_acct_node;
     json_object_object_get_ex(token_file_obj, "client_email", &service_acct_node);
     const char *service_acct = json_object_get_string(service_acct_node);
-
-    time_t epoch = time(NULL);
+    if (service_acct == NULL) {
+        return FAILED_OPERATION;
+    }
 
     const char *claim_set_template = "{\"iss\":\"%s\",\"scope\":\"%s\",\"aud\":\"%s\",\"iat\":%lu,\"exp\":%lu}";
     const char *scope_drive = "https://www.googleapis.com/auth/drive";
@@ -105,13 +124,15 @@ static int build_jwt_claim_set(char **dest, json_object *token_file_obj, size_t
     // 20 is for two epoch times, and 12 is for the format specifiers in the template
     size_t claim_set_len = strlen(claim_set_template) + strlen(service_acct) + strlen(scope_drive) + strlen(aud_token) + 20 - 12;
     char *claim_set = (char *)malloc(claim_set_len+1);
-    sprintf(claim_set, claim_set_template, service_acct, scope_drive, aud_token, epoch, epoch + 3600);
+    sprintf(claim_set, claim_set_template, service_acct, scope_drive, aud_token, epoch, epoch + JWT_LIFETIME);
     claim_set[claim_set_len] = 0;
     *dest = base64url_encode(claim_set, claim_set_len, encoded_claim_set_len);
+    free(claim_set);
     return SUCCESSFUL_OPERATION;
 }
 
 static int build_jwt_signature(char **dest, json_object *token_file_obj, const char *jwt_header, const char *jwt_claim_set, size_t *encoded_sig_len) {
+    uint64_t start = metrics_now();
     json_object *private_key_node;
     json_object_object_get_ex(token_file_obj, "private_key", &private_key_node);
     const char *private_key = json_object_get_string(private_key_node);
@@ -162,5 +183,10 @@ static int build_jwt_signature(char **dest, json_object *token_file_obj, const c
     }
     *dest = base64url_encode(signature, written_bytes, encoded_sig_len);
     OPENSSL_free(signature);
+    EVP_MD_CTX_destroy(ctx);
+    EVP_PKEY_free(pkey);
+    BIO_free(bio);
+    metrics_add(METRIC_JWTS_SIGNED, 1);
+    metrics_record_since(METRIC_JWT_SIGN, start);
     return SUCCESSFUL_OPERATION;
 }
@@ -26,6 +26,24 @@
 #ifndef JWT_H
 #define JWT_H
 
+#include <time.h>
+
+/* Seconds for which a JWT is valid */
+#define JWT_LIFETIME 3600
+
+/*
+ * Build the JWT of the account, from its key file in the user's config directory.
+ * *jwt is left as is if the key file cannot be read.
+ */
 void build_jwt(char *email_addr, char **jwt);
 
+/*
+ * Build a JWT from the key file of a service account.
+ *
+ * expiry - If not NULL, set to the time when the JWT expires.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int build_jwt_from_file(const char *key_file_path, char **jwt, time_t *expiry);
+
 #endif /* End of inclusion guard */
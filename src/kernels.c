@@ -0,0 +1,257 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+/* The variants are built with their target attributes, and run only on the CPUs that have them */
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static const char base64url_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+static base64url_encode_fn base64url_encode_impl;
+static hash_string_fn hash_string_impl;
+
+/* Choose the variants of all the kernels */
+static void select_kernels();
+/* Scalar references */
+static void base64url_encode_scalar(const unsigned char *input, size_t triplets, char *output);
+static unsigned int hash_string_scalar(const char *str, size_t len);
+#ifdef KERNELS_X86
+static void base64url_encode_ssse3(const unsigned char *input, size_t triplets, char *output);
+static void base64url_encode_avx2(const unsigned char *input, size_t triplets, char *output);
+static void base64url_encode_avx512bw(const unsigned char *input, size_t triplets, char *output);
+static unsigned int hash_string_avx2(const char *str, size_t len);
+static unsigned int hash_string_avx512bw(const char *str, size_t len);
+#endif
+
+const struct cpu_kernel base64url_encode_kernels[] = {
+#ifdef KERNELS_X86
+	{ "avx512bw", CPU_FEATURE_AVX512BW, (cpu_fn) &base64url_encode_avx512bw },
+	{ "avx2", CPU_FEATURE_AVX2, (cpu_fn) &base64url_encode_avx2 },
+	{ "ssse3", CPU_FEATURE_SSSE3, (cpu_fn) &base64url_encode_ssse3 },
+#endif
+	{ "scalar", 0, (cpu_fn) &base64url_encode_scalar }
+};
+
+const struct cpu_kernel hash_string_kernels[] = {
+#ifdef KERNELS_X86
+	{ "avx512bw", CPU_FEATURE_AVX512BW, (cpu_fn) &hash_string_avx512bw },
+	{ "avx2", CPU_FEATURE_AVX2, (cpu_fn) &hash_string_avx2 },
+#endif
+	{ "scalar", 0, (cpu_fn) &hash_string_scalar }
+};
+
+void kernel_base64url_encode(const unsigned char *input, size_t triplets, char *output) {
+	pthread_once(&select_once, &select_kernels);
+	base64url_encode_impl(input, triplets, output);
+}
+
+unsigned int kernel_hash_string(const char *str, size_t len) {
+	pthread_once(&select_once, &select_kernels);
+	return hash_string_impl(str, len);
+}
+
+static void select_kernels() {
+	base64url_encode_impl = (base64url_encode_fn) cpu_select(base64url_encode_kernels)->fn;
+	hash_string_impl = (hash_string_fn) cpu_select(hash_string_kernels)->fn;
+}
+
+static void base64url_encode_scalar(const unsigned char *input, size_t triplets, char *output) {
+	for (size_t i = 0; i < triplets; i++, input += 3, output += 4) {
+		uint32_t bits = (input[0] << 16) | (input[1] << 8) | input[2];
+		output[0] = base64url_alphabet[bits >> 18];
+		output[1] = base64url_alphabet[(bits >> 12) & 63];
+		output[2] = base64url_alphabet[(bits >> 6) & 63];
+		output[3] = base64url_alphabet[bits & 63];
+	}
+}
+
+static unsigned int hash_string_scalar(const char *str, size_t len) {
+	unsigned int hash = 0;
+	for (size_t i = 0; i < len; i++) {
+		hash = 31 * hash + (signed char) str[i];
+	}
+	return hash;
+}
+
+#ifdef KERNELS_X86
+
+/*
+ * The base64url variants follow W. Muła and D. Lemire, "Faster Base64
+ * Encoding and Decoding using AVX2 Instructions": every 128 bit lane takes 12
+ * input bytes, spreads each triplet over 4 bytes, moves the 6 bit fields into
+ * place with two multiplies, and maps them to the alphabet with a lookup on
+ * the range of each value. Lanes are loaded 16 bytes at a time, so the loops
+ * stop 4 bytes short of the input, and the scalar code does the rest.
+ */
+
+/* Spread the 4 triplets in the lowest 12 bytes of each lane to 4 bytes each, in _mm_setr_epi8 order */
+#define BASE64_SPREAD 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+/* Offsets from the 6 bit values to their characters: A-Z, a-z, 0-9 (10 times), '-' and '_' */
+#define BASE64URL_OFFSETS 65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 0, 0
+
+__attribute__((target("ssse3")))
+static inline __m128i base64url_lane_ssse3(__m128i in) {
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(BASE64_SPREAD));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	__m128i values = _mm_or_si128(t1, t3);
+
+	/* 0 for A-Z, 1 for a-z, 2 - 13 for the rest */
+	__m128i indices = _mm_subs_epu8(values, _mm_set1_epi8(51));
+	indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(values, _mm_set1_epi8(25)));
+	return _mm_add_epi8(values, _mm_shuffle_epi8(_mm_setr_epi8(BASE64URL_OFFSETS), indices));
+}
+
+__attribute__((target("ssse3")))
+static void base64url_encode_ssse3(const unsigned char *input, size_t triplets, char *output) {
+	for (; triplets >= 6; triplets -= 4, input += 12, output += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *) input);
+		_mm_storeu_si128((__m128i *) output, base64url_lane_ssse3(in));
+	}
+	base64url_encode_scalar(input, triplets, output);
+}
+
+__attribute__((target("avx2")))
+static void base64url_encode_avx2(const unsigned char *input, size_t triplets, char *output) {
+	const __m256i spread = _mm256_setr_epi8(BASE64_SPREAD, BASE64_SPREAD);
+	const __m256i offsets = _mm256_setr_epi8(BASE64URL_OFFSETS, BASE64URL_OFFSETS);
+	for (; triplets >= 10; triplets -= 8, input += 24, output += 32) {
+		__m256i in = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) input)),
+				_mm_loadu_si128((const __m128i *) (input + 12)), 1);
+		in = _mm256_shuffle_epi8(in, spread);
+		__m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		__m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		__m256i values = _mm256_or_si256(t1, t3);
+
+		__m256i indices = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+		indices = _mm256_sub_epi8(indices, _mm256_cmpgt_epi8(values, _mm256_set1_epi8(25)));
+		__m256i chars = _mm256_add_epi8(values, _mm256_shuffle_epi8(offsets, indices));
+		_mm256_storeu_si256((__m256i *) output, chars);
+	}
+	base64url_encode_scalar(input, triplets, output);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void base64url_encode_avx512bw(const unsigned char *input, size_t triplets, char *output) {
+	const __m512i spread = _mm512_broadcast_i32x4(_mm_setr_epi8(BASE64_SPREAD));
+	const __m512i offsets = _mm512_broadcast_i32x4(_mm_setr_epi8(BASE64URL_OFFSETS));
+	for (; triplets >= 18; triplets -= 16, input += 48, output += 64) {
+		__m512i in = _mm512_castsi128_si512(_mm_loadu_si128((const __m128i *) input));
+		in = _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *) (input + 12)), 1);
+		in = _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *) (input + 24)), 2);
+		in = _mm512_inserti32x4(in, _mm_loadu_si128((const __m128i *) (input + 36)), 3);
+		in = _mm512_shuffle_epi8(in, spread);
+		__m512i t0 = _mm512_and_si512(in, _mm512_set1_epi32(0x0fc0fc00));
+		__m512i t1 = _mm512_mulhi_epu16(t0, _mm512_set1_epi32(0x04000040));
+		__m512i t2 = _mm512_and_si512(in, _mm512_set1_epi32(0x003f03f0));
+		__m512i t3 = _mm512_mullo_epi16(t2, _mm512_set1_epi32(0x01000010));
+		__m512i values = _mm512_or_si512(t1, t3);
+
+		__m512i indices = _mm512_subs_epu8(values, _mm512_set1_epi8(51));
+		__mmask64 letters_lower = _mm512_cmpgt_epi8_mask(values, _mm512_set1_epi8(25));
+		indices = _mm512_mask_add_epi8(indices, letters_lower, indices, _mm512_set1_epi8(1));
+		__m512i chars = _mm512_add_epi8(values, _mm512_shuffle_epi8(offsets, indices));
+		_mm512_storeu_si512((void *) output, chars);
+	}
+	base64url_encode_scalar(input, triplets, output);
+}
+
+/*
+ * The hash of the string, sum(c[i] * 31^(len - 1 - i)), is split over the
+ * lanes: lane j sums c[j], c[j + N], ... with the powers of 31^N, and the
+ * lanes are combined with the powers 31^(N - 1 - j) at the end.
+ */
+
+/* Powers of 31, from 31^15 down to 31^0, with 32 bit wrap around */
+static const uint32_t powers_of_31[16] = {
+	0xe191dddfU, 0x59db6a41U, 0xe1ddc99fU, 0xee830681U,
+	0x07b1a55fU, 0x94e4b2c1U, 0xf449711fU, 0x94446f01U,
+	0x67e12cdfU, 0x34e63b41U, 0x01b4d89fU, 0x000e1781U,
+	0x0000745fU, 0x000003c1U, 0x0000001fU, 0x00000001U
+};
+
+__attribute__((target("avx2")))
+static unsigned int hash_string_avx2(const char *str, size_t len) {
+	unsigned int hash = 0;
+	size_t i = 0;
+	if (len >= 8) {
+		const __m256i step = _mm256_set1_epi32(0x94446f01U);	/* 31^8 */
+		__m256i sums = _mm256_setzero_si256();
+		for (; i + 8 <= len; i += 8) {
+			__m256i chars = _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *) (str + i)));
+			sums = _mm256_add_epi32(_mm256_mullo_epi32(sums, step), chars);
+		}
+		sums = _mm256_mullo_epi32(sums, _mm256_loadu_si256((const __m256i *) (powers_of_31 + 8)));
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		hash = _mm_cvtsi128_si32(sum);
+	}
+	for (; i < len; i++) {
+		hash = 31 * hash + (signed char) str[i];
+	}
+	return hash;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static unsigned int hash_string_avx512bw(const char *str, size_t len) {
+	unsigned int hash = 0;
+	size_t i = 0;
+	if (len >= 16) {
+		const __m512i step = _mm512_set1_epi32(0x50a9de01U);	/* 31^16 */
+		__m512i sums = _mm512_setzero_si512();
+		for (; i + 16 <= len; i += 16) {
+			__m512i chars = _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *) (str + i)));
+			sums = _mm512_add_epi32(_mm512_mullo_epi32(sums, step), chars);
+		}
+		sums = _mm512_mullo_epi32(sums, _mm512_loadu_si512((const void *) powers_of_31));
+		/* Not _mm512_reduce_add_epi32, which adds them as signed ints */
+		__m256i half = _mm256_add_epi32(_mm512_castsi512_si256(sums), _mm512_extracti64x4_epi64(sums, 1));
+		__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		hash = _mm_cvtsi128_si32(sum);
+	}
+	for (; i < len; i++) {
+		hash = 31 * hash + (signed char) str[i];
+	}
+	return hash;
+}
+
+#endif /* KERNELS_X86 */
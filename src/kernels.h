@@ -0,0 +1,57 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_KERNELS_H
+#define GOODRV_KERNELS_H
+
+#include <stddef.h>
+
+#include "cpu.h"
+
+/*
+ * Encode whole triplets of bytes into base64url, 4 characters each.
+ */
+typedef void (*base64url_encode_fn)(const unsigned char *input, size_t triplets, char *output);
+
+/*
+ * Hash a string as h = 31 * h + c over its characters, taken as signed,
+ * with 32 bit wrap around.
+ */
+typedef unsigned int (*hash_string_fn)(const char *str, size_t len);
+
+/*
+ * Variants of each kernel for cpu_select, ending with the scalar reference.
+ * Exposed for the tests, which check every variant against the reference.
+ */
+extern const struct cpu_kernel base64url_encode_kernels[];
+extern const struct cpu_kernel hash_string_kernels[];
+
+/*
+ * Run the variant of the kernel chosen for this CPU. The variants are chosen
+ * once, on the first call to any of these.
+ */
+void kernel_base64url_encode(const unsigned char *input, size_t triplets, char *output);
+unsigned int kernel_hash_string(const char *str, size_t len);
+
+#endif /* GOODRV_KERNELS_H */
@@ -29,9 +29,11 @@
 #include <grp.h>
 #include <limits.h>
 #include <malloc.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <unistd.h>
@@ -39,6 +41,9 @@
 #include <openssl/md5.h>
 
 #include "config.h"
+#include "metrics.h"
+#include "pathmatch.h"
+#include "trace.h"
 
 /*
  * The information to be passed onto the watch and md5 context handlers
@@ -51,6 +56,25 @@ struct watch_md5sum_handle_info {
 };
 typedef struct watch_md5sum_handle_info watch_md5sum_handle_info;
 
+/*
+ * Groups of a user, resolved once and kept sorted for the permission checks
+ */
+struct cred_cache {
+	// Non zero when the groups below belong to uid
+	int valid;
+	uid_t uid;
+	// Primary and supplementary groups of the user, in ascending order
+	gid_t *gids;
+	int num_gids;
+	pthread_mutex_t lock;
+};
+
+static struct cred_cache cred_cache = { 0, 0, NULL, 0, PTHREAD_MUTEX_INITIALIZER };
+
+struct goodrv_config goodrv_config;
+/* Guards the lazy initialisation of goodrv_config, which any thread may do */
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Get the passwd entry */
 struct passwd *get_passwd_entry(uid_t uid);
 /* Get the group entry */
@@ -61,11 +85,19 @@ struct group *get_group_entry(gid_t gid);
  * 2. Update the MD5 Context with the same path
  */
 static void watch_and_update_md5ctx_handle(FTSENT *ftsent, void *handle_info);
+/* Traverse the directory, whose root path has root_len characters */
+static void traverse_dir(char *dirpath, size_t root_len, path_matcher matcher,
+		void (*child_handle)(FTSENT*, void*), void *handle_info);
 /* Add a watch to the specified path, if it is a directory */
 static void watch_dir_handle(FTSENT *ftsent, void *handle_info);
 /* Update the MD5 Context with a path */
 static void update_md5ctx_path_handle(FTSENT *ftsent, void *handle_info);
 
+/* Resolve the groups of the user into the credential cache */
+static int load_cred_cache(uid_t uid);
+/* Compare two GIDs, for qsort and bsearch */
+static int compare_gid(const void *gid1, const void *gid2);
+
 /* Returns maxval if maxval > minval, else returns defval */
 static size_t get_max_value(size_t minval, size_t maxval, size_t defval);
 
@@ -79,24 +111,28 @@ char *get_home_dir(uid_t uid) {
 }
 
 char *get_home_dir_curruser() {
+	pthread_mutex_lock(&config_lock);
 	char *home_dir = goodrv_config.curr_user_home;
 	if (home_dir == NULL) {
 		home_dir = get_home_dir(geteuid());
 		goodrv_config.curr_user_home = home_dir;
 	}
+	pthread_mutex_unlock(&config_lock);
 	return home_dir;
 }
 
 char *get_config_dir_curruser() {
+	char *home_dir = get_home_dir_curruser();
+	pthread_mutex_lock(&config_lock);
 	char *conf_dir = goodrv_config.config_dir;
-	if (conf_dir == NULL) {
-		char *home_dir = get_home_dir_curruser();
+	if (conf_dir == NULL && home_dir != NULL) {
 		const char *CONF_DIR_SUFFIX = "/.goodrive/";
 		conf_dir = malloc(strlen(home_dir) + strlen(CONF_DIR_SUFFIX) + 1);
 		strcpy(conf_dir, home_dir);
 		strcat(conf_dir, CONF_DIR_SUFFIX);
 		goodrv_config.config_dir = conf_dir;
 	}
+	pthread_mutex_unlock(&config_lock);
 	return conf_dir;
 }
 
@@ -143,6 +179,24 @@ char *md5sum_fsh(char *dir_path) {
 }
 
 char *md5sum_file(char *file_path) {
+	unsigned char md5sum_bytes[MD5_DIGEST_LENGTH];
+	if (md5sum_file_bytes(file_path, md5sum_bytes) == 0) {
+		// Convert the MD5Sum from bytes form to char array.
+		char *md5sum = (char*) malloc(33);
+		for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+			/*
+			 * For each byte in the array, there will be two hexadecimal characters.
+			 */
+			sprintf(md5sum + (i * 2), "%02x", md5sum_bytes[i]);
+		}
+		return md5sum;
+	}
+	return NULL;
+}
+
+int md5sum_file_bytes(char *file_path, unsigned char *md5sum_bytes) {
+	uint64_t start = metrics_now();
+	uint64_t span = trace_begin();
 	FILE *file = fopen(file_path, "r");
 	if (file != NULL) {
 		MD5_CTX md5_ctxt;
@@ -151,26 +205,21 @@ char *md5sum_file(char *file_path) {
 		char buf[MD5_CBLOCK]; // For reading from the file.
 		ssize_t bytes; // bytes read from the file
 
+		uint64_t total_bytes = 0;
 		while ((bytes = fread(buf, 1, MD5_CBLOCK, file)) > 0) {
 			MD5_Update(&md5_ctxt, buf, bytes);
+			total_bytes += bytes;
 		}
 
-		unsigned char md5sum_bytes[MD5_DIGEST_LENGTH];
 		MD5_Final(md5sum_bytes, &md5_ctxt);
-
-		// Convert the MD5Sum from bytes form to char array.
-		char *md5sum = (char*) malloc(33);
-		for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-			/*
-			 * For each byte in the array, there will be two hexadecimal characters.
-			 */
-			sprintf(md5sum + (i * 2), "%02x", md5sum_bytes[i]);
-		}
 		fclose(file);
-
-		return md5sum;
+		metrics_add(METRIC_FILES_HASHED, 1);
+		metrics_add(METRIC_BYTES_HASHED, total_bytes);
+		metrics_record_since(METRIC_FILE_HASH, start);
+		trace_end(TRACE_FILE_HASH, span);
+		return 0;
 	}
-	return NULL;
+	return -1;
 }
 
 char *md5sum_str(char *input) {
@@ -196,6 +245,16 @@ char *md5sum_str(char *input) {
 }
 
 void traverse_fsh(char *dirpath, void (*child_handle)(FTSENT*, void*), void *handle_info) {
+	traverse_fsh_filtered(dirpath, NULL, child_handle, handle_info);
+}
+
+void traverse_fsh_filtered(char *dirpath, path_matcher matcher,
+		void (*child_handle)(FTSENT*, void*), void *handle_info) {
+	traverse_dir(dirpath, strlen(dirpath), matcher, child_handle, handle_info);
+}
+
+static void traverse_dir(char *dirpath, size_t root_len, path_matcher matcher,
+		void (*child_handle)(FTSENT*, void*), void *handle_info) {
 	char *paths[] = { dirpath, NULL };
 
 	/*
@@ -203,30 +262,61 @@ void traverse_fsh(char *dirpath, void (*child_handle)(FTSENT*, void*), void *han
 	 * the symbolic links and find the MD5 checksum for the target file.
 	 * TODO Need to examine this decision.
 	 */
+	uint64_t start = metrics_now();
+	uint64_t span = trace_begin();
 	FTS *fts = fts_open(paths, FTS_PHYSICAL, NULL);
+	if (fts == NULL) {
+		return;
+	}
 	fts_read(fts);
 	FTSENT *child = fts_children(fts, 0);
-	while (child_handle != NULL && child != NULL) {
+	metrics_record_since(METRIC_DIR_LIST, start);
+	trace_end(TRACE_DIR_LIST, span);
+	uint64_t num_entries = 0;
+	for (; child_handle != NULL && child != NULL; child = child->fts_link) {
+		int is_dir = S_ISDIR((child->fts_statp)->st_mode);
+		char *child_path = NULL;
+		if (matcher != NULL) {
+			child_path = get_full_path(child);
+			/* Excluded entries are neither reported nor descended into */
+			if (pm_excluded(matcher, child_path + root_len + strspn(child_path + root_len, "/"), is_dir)) {
+				free(child_path);
+				continue;
+			}
+		}
 		child_handle(child, handle_info);
-		if (S_ISDIR((child->fts_statp)->st_mode)
-				&& has_file_permission_curruser(READ_ACCESS | EXECUTE_ACCESS,
-						child->fts_statp)) {
-			traverse_fsh(get_full_path(child), child_handle, handle_info);
+		num_entries++;
+		if (is_dir && has_file_permission_curruser(READ_ACCESS | EXECUTE_ACCESS, child->fts_statp)) {
+			if (child_path == NULL) {
+				child_path = get_full_path(child);
+			}
+			traverse_dir(child_path, root_len, matcher, child_handle, handle_info);
 		}
-		child = child->fts_link;
+		free(child_path);
 	}
+	metrics_add(METRIC_ENTRIES_SCANNED, num_entries);
+	/* Every level holds a descriptor of its own, so release it before returning */
+	fts_close(fts);
 }
 
 int is_group_member(uid_t uid, gid_t gid) {
-	struct passwd *passwd_entry = get_passwd_entry(uid);
-	struct group *group_entry = get_group_entry(gid);
-	char *uname;
-	while ((uname = *(group_entry->gr_mem++)) != NULL) {
-		if (strcmp(uname, passwd_entry->pw_name) == 0) {
-			return 1;
-		}
+	int is_member = 0;
+	pthread_mutex_lock(&cred_cache.lock);
+	if ((cred_cache.valid && cred_cache.uid == uid) || load_cred_cache(uid) == 0) {
+		is_member = bsearch(&gid, cred_cache.gids, cred_cache.num_gids, sizeof(gid_t),
+				&compare_gid) != NULL;
 	}
-	return 0;
+	pthread_mutex_unlock(&cred_cache.lock);
+	return is_member;
+}
+
+void invalidate_cred_cache() {
+	pthread_mutex_lock(&cred_cache.lock);
+	cred_cache.valid = 0;
+	free(cred_cache.gids);
+	cred_cache.gids = NULL;
+	cred_cache.num_gids = 0;
+	pthread_mutex_unlock(&cred_cache.lock);
 }
 
 int has_file_permission(uid_t uid, int permission, struct stat *file_stat) {
@@ -281,6 +371,10 @@ char *get_full_path(FTSENT *ftsent) {
 }
 
 int watch_md5sum_fsh(int fd, char **md5sum_ptr, char *dirpath) {
+	return watch_md5sum_fsh_filtered(fd, md5sum_ptr, dirpath, NULL);
+}
+
+int watch_md5sum_fsh_filtered(int fd, char **md5sum_ptr, char *dirpath, path_matcher matcher) {
 	if (md5sum_ptr != NULL && dirpath != NULL) {
 		struct stat dir_stat;
 		if ((stat(dirpath, &dir_stat) == 0) && S_ISDIR(dir_stat.st_mode)) {
@@ -295,7 +389,11 @@ int watch_md5sum_fsh(int fd, char **md5sum_ptr, char *dirpath) {
 			handle_info.fd = fd;
 			handle_info.md5_ctxt = &md5_ctxt;
 
-			traverse_fsh(dirpath, &watch_and_update_md5ctx_handle, &handle_info);
+			/* traverse_fsh reports only the contents, so the directory itself is watched here */
+			if (fd > 0 && inotify_add_watch(fd, dirpath, IN_ALL_EVENTS) == -1) {
+				printf("\n Cannot add watch for %s", dirpath);
+			}
+			traverse_fsh_filtered(dirpath, matcher, &watch_and_update_md5ctx_handle, &handle_info);
 
 			unsigned char md5sum_bytes[MD5_DIGEST_LENGTH];
 			MD5_Final(md5sum_bytes, &md5_ctxt);
@@ -314,6 +412,35 @@ int watch_md5sum_fsh(int fd, char **md5sum_ptr, char *dirpath) {
 	return -1;
 }
 
+void watch_moves_add(struct watch_moves *moves, const char *buf, size_t len) {
+	for (const char *ptr = buf; ptr + sizeof(struct inotify_event) <= buf + len;) {
+		const struct inotify_event *event = (const struct inotify_event *) ptr;
+		ptr += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_MOVED_FROM) {
+			if (moves->num_pending == WATCH_MAX_PENDING_MOVES) {
+				memmove(moves->pending, moves->pending + 1,
+						(WATCH_MAX_PENDING_MOVES - 1) * sizeof(uint32_t));
+				moves->num_pending--;
+			}
+			moves->pending[moves->num_pending++] = event->cookie;
+		} else if (event->mask & IN_MOVED_TO) {
+			unsigned int i = 0;
+			while (i < moves->num_pending && moves->pending[i] != event->cookie) {
+				i++;
+			}
+			if (i < moves->num_pending) {
+				/* The rest keep their order, so that the oldest is dropped first */
+				moves->num_pending--;
+				memmove(moves->pending + i, moves->pending + i + 1,
+						(moves->num_pending - i) * sizeof(uint32_t));
+				moves->paired++;
+			} else {
+				moves->moved_in++;
+			}
+		}
+	}
+}
+
 /* Watch the directory and update the MD5 Context */
 static void watch_and_update_md5ctx_handle(FTSENT *ftsent, void *handle_info) {
 	watch_md5sum_handle_info *hinfo = (watch_md5sum_handle_info *) handle_info;
@@ -345,6 +472,7 @@ static void update_md5ctx_path_handle(FTSENT *ftsent, void *handle_info) {
 	full_path = get_full_path(ftsent);
 	MD5_Update(md5_ctxt, full_path, strlen(full_path));
 	MD5_Update(md5_ctxt, "\n", 1);	// newline character as the delimiter
+	free(full_path);
 }
 
 struct passwd *get_passwd_entry(uid_t uid) {
@@ -395,6 +523,52 @@ struct group *get_group_entry(gid_t gid) {
 	return group_entry;
 }
 
+/*
+ * Called with the cache lock held. Returns 0 on success, -1 if the user is unknown.
+ */
+static int load_cred_cache(uid_t uid) {
+	struct passwd passwd_entry;
+	struct passwd *result = NULL;
+	long buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
+	if (buflen == -1) {
+		buflen = 1024;
+	}
+	char *buf = malloc(buflen);
+	while (getpwuid_r(uid, &passwd_entry, buf, buflen, &result) == ERANGE) {
+		buflen *= 2;
+		buf = realloc(buf, buflen);
+	}
+	if (result == NULL) {
+		free(buf);
+		return -1;
+	}
+
+	int num_gids = 16;
+	gid_t *gids = malloc(num_gids * sizeof(gid_t));
+	int capacity = num_gids;
+	while (getgrouplist(passwd_entry.pw_name, passwd_entry.pw_gid, gids, &num_gids) == -1) {
+		// num_gids now holds the number of groups needed
+		capacity = (num_gids > capacity) ? num_gids : capacity * 2;
+		num_gids = capacity;
+		gids = realloc(gids, capacity * sizeof(gid_t));
+	}
+	free(buf);
+	qsort(gids, num_gids, sizeof(gid_t), &compare_gid);
+
+	free(cred_cache.gids);
+	cred_cache.gids = gids;
+	cred_cache.num_gids = num_gids;
+	cred_cache.uid = uid;
+	cred_cache.valid = 1;
+	return 0;
+}
+
+static int compare_gid(const void *gid1, const void *gid2) {
+	gid_t left = *(const gid_t *) gid1;
+	gid_t right = *(const gid_t *) gid2;
+	return (left > right) - (left < right);
+}
+
 static size_t get_max_value(size_t minval, size_t maxval, size_t defval) {
 	if (minval > maxval) {
 		return defval;
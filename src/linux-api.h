@@ -27,13 +27,34 @@
 #define GOODRV_LINUX_API_H
 
 #include <fts.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/stat.h>
 
+/* Rules of the entries to leave out, from pathmatch.h */
+struct path_matcher;
+
 #define FULL_ACCESS 07
 #define READ_ACCESS 04
 #define WRITE_ACCESS 02
 #define EXECUTE_ACCESS 01
 
+/* Number of IN_MOVED_FROM events that can wait for their IN_MOVED_TO */
+#define WATCH_MAX_PENDING_MOVES 64
+
+/*
+ * Pairs the IN_MOVED_FROM and IN_MOVED_TO events of renames by their cookie.
+ */
+struct watch_moves {
+	/* Cookies of the IN_MOVED_FROM events still waiting for their IN_MOVED_TO */
+	uint32_t pending[WATCH_MAX_PENDING_MOVES];
+	unsigned int num_pending;
+	/* Renames within the watched directories */
+	unsigned long paired;
+	/* Entries moved in from outside, with an IN_MOVED_TO alone */
+	unsigned long moved_in;
+};
+
 /*
  * Get the User's home directory
  */
@@ -68,6 +89,15 @@ char *md5sum_fsh(char *dir_path);
  */
 char *md5sum_file(char *file_path);
 
+/*
+ * Get the MD5 Sum of the file in its binary form (MD5_DIGEST_LENGTH bytes).
+ * Returns 0 on success, and -1 when the file is not accessible.
+ *
+ * path - path of the file for which the MD5 checksum is to be calculated.
+ * md5sum_bytes - buffer of at least 16 bytes for the checksum.
+ */
+int md5sum_file_bytes(char *file_path, unsigned char *md5sum_bytes);
+
 /*
  * Calculate the MD5 sum for a given character array.
  *
@@ -81,13 +111,33 @@ char *md5sum_str(char *input);
  */
 void traverse_fsh(char *dir_path, void (*child_handle)(FTSENT*, void*), void *handle_info);
 
+/*
+ * Same as traverse_fsh, but skips the entries excluded by the matcher. An
+ * excluded directory is not descended into, so nothing in it is reported.
+ * A NULL matcher excludes nothing.
+ */
+void traverse_fsh_filtered(char *dir_path, struct path_matcher *matcher,
+		void (*child_handle)(FTSENT*, void*), void *handle_info);
+
 /*
  * Check whether the user with UID is present in the group with GID?
+ * Either as the primary group or as a supplementary group.
+ *
+ * The groups of the user are resolved once and cached, so that the checks
+ * during a traversal do not go to the name service for every file. The cache
+ * holds one user at a time.
+ *
  * uid - The UID of the user
  * gid - The GID of the group
  */
 int is_group_member(uid_t uid, gid_t gid);
 
+/*
+ * Drop the cached groups, so that the next check resolves them again.
+ * Call this when the group membership of the user may have changed.
+ */
+void invalidate_cred_cache();
+
 /*
  * Check whether the user has file permission for the file
  * uid - The UID of the user for whom the permission needs to be tested
@@ -131,4 +181,21 @@ char *get_full_path(FTSENT *ftsent);
  */
 int watch_md5sum_fsh(int fd, char **md5sum_ptr, char *dirpath);
 
+/*
+ * Same as watch_md5sum_fsh, but leaves out the entries excluded by the
+ * matcher: they are not part of the MD5 sum, and excluded directories are
+ * not watched.
+ */
+int watch_md5sum_fsh_filtered(int fd, char **md5sum_ptr, char *dirpath,
+		struct path_matcher *matcher);
+
+/*
+ * Pair the move events in a buffer read from an inotify instance. An
+ * IN_MOVED_FROM stays pending till its IN_MOVED_TO comes; one still pending
+ * once the events are drained moved its entry out of the watched directories,
+ * from where it may yet come back. When too many are pending, the oldest is
+ * dropped.
+ */
+void watch_moves_add(struct watch_moves *moves, const char *buf, size_t len);
+
 #endif /* GOODRV_LINUX_API_H */
@@ -0,0 +1,513 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <openssl/md5.h>
+
+#include "loopback.h"
+#include "ratelimit.h"
+
+/*
+ * Range of bytes received in a session, from start up to (excluding) end
+ */
+struct lb_range {
+	uint64_t start;
+	uint64_t end;
+};
+
+/*
+ * An upload session, and the object once it is complete
+ */
+struct lb_session {
+	char *name;
+	unsigned char *data;
+	uint64_t size;
+	/* Disjoint received ranges, in ascending order */
+	struct lb_range *ranges;
+	unsigned int num_ranges;
+	unsigned int max_ranges;
+	int complete;
+	/* MD5 of the data, once complete */
+	unsigned char digest[MD5_DIGEST_LENGTH];
+};
+
+/*
+ * State of the loopback store
+ */
+struct loopback {
+	struct loopback_options options;
+	/* Paces the transfers to the bandwidth */
+	struct token_bucket link;
+	struct loopback_stats stats;
+	struct lb_session **sessions;
+	unsigned int num_sessions;
+	unsigned int max_sessions;
+	pthread_mutex_t lock;
+};
+
+/* Transport functions */
+static int lb_begin_session(struct transport *transport, const char *name, uint64_t size,
+		char *session_id);
+static int64_t lb_query_offset(struct transport *transport, const char *session_id);
+static int lb_send_chunk(struct transport *transport, const char *session_id, uint64_t offset,
+		const void *data, size_t len);
+static int lb_finish_session(struct transport *transport, const char *session_id,
+		const unsigned char *digest);
+static int lb_stat_object(struct transport *transport, const char *name, uint64_t *size,
+		unsigned char *digest);
+static int64_t lb_fetch_range(struct transport *transport, const char *name, uint64_t offset,
+		void *buf, size_t len);
+static int lb_copy_object(struct transport *transport, const char *src_name, const char *dest_name);
+static int lb_move_object(struct transport *transport, const char *src_name, const char *dest_name);
+static int lb_delete_object(struct transport *transport, const char *name);
+static void lb_destroy(struct transport *transport);
+
+/*
+ * Account for a request and decide its fate. Called with the lock held.
+ * Returns TRANSPORT_OK to serve the request, or TRANSPORT_ERR_RETRY to fail it.
+ * *apply is set when the request should take effect regardless.
+ */
+static int lb_admit(struct loopback *lb, int *apply);
+/* Add a new session, called with the lock held. Returns its index */
+static unsigned int lb_new_session(struct loopback *lb, const char *name, uint64_t size);
+/* Find the session, called with the lock held */
+static struct lb_session *lb_find_session(struct loopback *lb, const char *session_id);
+/* Find the latest completed session of the object, called with the lock held */
+static struct lb_session *lb_find_object(struct loopback *lb, const char *name);
+/* Wait for the bytes to cross the link */
+static void lb_transfer(struct loopback *lb, size_t len);
+/* Mark the range as received */
+static void lb_add_range(struct lb_session *session, uint64_t start, uint64_t end);
+
+struct transport *loopback_create(struct loopback_options *options) {
+	struct loopback *lb = calloc(1, sizeof(struct loopback));
+	if (options != NULL) {
+		lb->options = *options;
+	} else {
+		lb->options.max_chunks = -1;
+	}
+	tb_init(&lb->link, lb->options.bandwidth, lb->options.bandwidth / 10.0);
+	pthread_mutex_init(&lb->lock, NULL);
+
+	struct transport *transport = malloc(sizeof(struct transport));
+	transport->impl = lb;
+	transport->begin_session = &lb_begin_session;
+	transport->query_offset = &lb_query_offset;
+	transport->send_chunk = &lb_send_chunk;
+	transport->finish_session = &lb_finish_session;
+	transport->stat_object = &lb_stat_object;
+	transport->fetch_range = &lb_fetch_range;
+	transport->copy_object = &lb_copy_object;
+	transport->move_object = &lb_move_object;
+	transport->delete_object = &lb_delete_object;
+	transport->destroy = &lb_destroy;
+	return transport;
+}
+
+void loopback_set_options(struct transport *transport, struct loopback_options *options) {
+	struct loopback *lb = transport->impl;
+	pthread_mutex_lock(&lb->lock);
+	lb->options = *options;
+	tb_init(&lb->link, lb->options.bandwidth, lb->options.bandwidth / 10.0);
+	pthread_mutex_unlock(&lb->lock);
+}
+
+void loopback_get_stats(struct transport *transport, struct loopback_stats *stats) {
+	struct loopback *lb = transport->impl;
+	pthread_mutex_lock(&lb->lock);
+	*stats = lb->stats;
+	pthread_mutex_unlock(&lb->lock);
+}
+
+void loopback_put_object(struct transport *transport, const char *name, const void *data,
+		size_t size) {
+	struct loopback *lb = transport->impl;
+	pthread_mutex_lock(&lb->lock);
+	unsigned int index = lb_new_session(lb, name, size);
+	struct lb_session *session = lb->sessions[index];
+	memcpy(session->data, data, size);
+	MD5(session->data, size, session->digest);
+	session->complete = 1;
+	pthread_mutex_unlock(&lb->lock);
+}
+
+const void *loopback_get_object(struct transport *transport, const char *name, size_t *size) {
+	struct loopback *lb = transport->impl;
+	const void *data = NULL;
+	pthread_mutex_lock(&lb->lock);
+	struct lb_session *session = lb_find_object(lb, name);
+	if (session != NULL) {
+		data = session->data;
+		*size = session->size;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return data;
+}
+
+static int lb_begin_session(struct transport *transport, const char *name, uint64_t size,
+		char *session_id) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	if (apply) {
+		snprintf(session_id, TRANSPORT_SESSION_ID_LEN, "lb-%u", lb_new_session(lb, name, size));
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int64_t lb_query_offset(struct transport *transport, const char *session_id) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int64_t offset = lb_admit(lb, &apply);
+	if (offset == TRANSPORT_OK) {
+		struct lb_session *session = lb_find_session(lb, session_id);
+		if (session == NULL || session->complete) {
+			offset = TRANSPORT_ERR_FATAL;
+		} else if (session->num_ranges > 0 && session->ranges[0].start == 0) {
+			offset = session->ranges[0].end;
+		}
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return offset;
+}
+
+static int lb_send_chunk(struct transport *transport, const char *session_id, uint64_t offset,
+		const void *data, size_t len) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+	lb_transfer(lb, len);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	struct lb_session *session = lb_find_session(lb, session_id);
+	if (session == NULL || session->complete || offset + len > session->size) {
+		status = TRANSPORT_ERR_FATAL;
+	} else if (apply) {
+		memcpy(session->data + offset, data, len);
+		lb_add_range(session, offset, offset + len);
+		lb->stats.chunks++;
+		lb->stats.bytes += len;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int lb_finish_session(struct transport *transport, const char *session_id,
+		const unsigned char *digest) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	struct lb_session *session = lb_find_session(lb, session_id);
+	if (session == NULL) {
+		status = TRANSPORT_ERR_FATAL;
+	} else if (apply && !session->complete) {
+		MD5(session->data, session->size, session->digest);
+		int received = (session->size == 0) || (session->num_ranges == 1
+				&& session->ranges[0].start == 0 && session->ranges[0].end == session->size);
+		if (!received || memcmp(session->digest, digest, MD5_DIGEST_LENGTH) != 0) {
+			status = TRANSPORT_ERR_FATAL;
+		} else {
+			session->complete = 1;
+		}
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int lb_stat_object(struct transport *transport, const char *name, uint64_t *size,
+		unsigned char *digest) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	if (status == TRANSPORT_OK) {
+		struct lb_session *session = lb_find_object(lb, name);
+		if (session == NULL) {
+			status = TRANSPORT_ERR_FATAL;
+		} else {
+			*size = session->size;
+			memcpy(digest, session->digest, MD5_DIGEST_LENGTH);
+		}
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int64_t lb_fetch_range(struct transport *transport, const char *name, uint64_t offset,
+		void *buf, size_t len) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int64_t count = lb_admit(lb, &apply);
+	if (count == TRANSPORT_OK) {
+		struct lb_session *session = lb_find_object(lb, name);
+		if (session == NULL || offset > session->size) {
+			count = TRANSPORT_ERR_FATAL;
+		} else {
+			count = (offset + len > session->size) ? session->size - offset : len;
+			memcpy(buf, session->data + offset, count);
+			lb->stats.ranges++;
+			lb->stats.bytes_out += count;
+		}
+	}
+	pthread_mutex_unlock(&lb->lock);
+	if (count > 0) {
+		lb_transfer(lb, count);
+	}
+	return count;
+}
+
+static int lb_copy_object(struct transport *transport, const char *src_name, const char *dest_name) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	struct lb_session *src = lb_find_object(lb, src_name);
+	if (src == NULL) {
+		status = TRANSPORT_ERR_FATAL;
+	} else if (apply) {
+		/* Not lb->sessions[lb_new_session(...)], which may read the array before it is moved */
+		unsigned int index = lb_new_session(lb, dest_name, src->size);
+		struct lb_session *dest = lb->sessions[index];
+		memcpy(dest->data, src->data, src->size);
+		memcpy(dest->digest, src->digest, MD5_DIGEST_LENGTH);
+		dest->complete = 1;
+		lb->stats.copies++;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int lb_move_object(struct transport *transport, const char *src_name, const char *dest_name) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	size_t src_len = strlen(src_name);
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	unsigned int num_moved = 0;
+	unsigned int num_sessions = lb->num_sessions;
+	for (unsigned int i = 0; i < num_sessions; i++) {
+		struct lb_session *src = lb->sessions[i];
+		if (!src->complete || strncmp(src->name, src_name, src_len) != 0
+				|| (src->name[src_len] != '\0' && src->name[src_len] != '/')) {
+			continue;
+		}
+		num_moved++;
+		if (!apply) {
+			continue;
+		}
+		/*
+		 * The contents go to a new session under the new name, so that it is
+		 * found before the objects it replaces, and the session ids, which are
+		 * indices, stay the same. The old session is left empty.
+		 */
+		char *name = malloc(strlen(dest_name) + strlen(src->name + src_len) + 1);
+		strcpy(name, dest_name);
+		strcat(name, src->name + src_len);
+		unsigned int index = lb_new_session(lb, name, 0);
+		struct lb_session *dest = lb->sessions[index];
+		free(name);
+		free(dest->data);
+		dest->data = src->data;
+		dest->size = src->size;
+		memcpy(dest->digest, src->digest, MD5_DIGEST_LENGTH);
+		dest->complete = 1;
+		src->data = malloc(1);
+		src->size = 0;
+		src->complete = 0;
+		lb->stats.moves++;
+	}
+	if (num_moved == 0) {
+		status = TRANSPORT_ERR_FATAL;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static int lb_delete_object(struct transport *transport, const char *name) {
+	struct loopback *lb = transport->impl;
+	usleep(lb->options.latency_us);
+
+	int apply;
+	size_t name_len = strlen(name);
+	pthread_mutex_lock(&lb->lock);
+	int status = lb_admit(lb, &apply);
+	unsigned int num_deleted = 0;
+	for (unsigned int i = 0; i < lb->num_sessions; i++) {
+		struct lb_session *session = lb->sessions[i];
+		if (!session->complete || strncmp(session->name, name, name_len) != 0
+				|| (session->name[name_len] != '\0' && session->name[name_len] != '/')) {
+			continue;
+		}
+		num_deleted++;
+		if (!apply) {
+			continue;
+		}
+		/* Left empty, as a moved session is, so that the session ids stay the same */
+		free(session->data);
+		session->data = malloc(1);
+		session->size = 0;
+		session->complete = 0;
+		lb->stats.deletes++;
+	}
+	if (num_deleted == 0) {
+		status = TRANSPORT_ERR_FATAL;
+	}
+	pthread_mutex_unlock(&lb->lock);
+	return status;
+}
+
+static void lb_destroy(struct transport *transport) {
+	struct loopback *lb = transport->impl;
+	for (unsigned int i = 0; i < lb->num_sessions; i++) {
+		free(lb->sessions[i]->name);
+		free(lb->sessions[i]->data);
+		free(lb->sessions[i]->ranges);
+		free(lb->sessions[i]);
+	}
+	free(lb->sessions);
+	pthread_mutex_destroy(&lb->lock);
+	free(lb);
+	free(transport);
+}
+
+static int lb_admit(struct loopback *lb, int *apply) {
+	lb->stats.requests++;
+	if (lb->options.max_chunks >= 0 && lb->stats.chunks >= (unsigned long) lb->options.max_chunks) {
+		lb->stats.failures++;
+		*apply = 0;
+		return TRANSPORT_ERR_RETRY;
+	}
+	if (lb->options.loss_percent > 0
+			&& (unsigned int) rand_r(&lb->options.seed) % 100 < lb->options.loss_percent) {
+		lb->stats.failures++;
+		*apply = rand_r(&lb->options.seed) % 2;
+		return TRANSPORT_ERR_RETRY;
+	}
+	*apply = 1;
+	return TRANSPORT_OK;
+}
+
+static unsigned int lb_new_session(struct loopback *lb, const char *name, uint64_t size) {
+	if (lb->num_sessions == lb->max_sessions) {
+		lb->max_sessions = (lb->max_sessions == 0) ? 16 : lb->max_sessions * 2;
+		lb->sessions = realloc(lb->sessions, lb->max_sessions * sizeof(struct lb_session *));
+	}
+	struct lb_session *session = calloc(1, sizeof(struct lb_session));
+	session->name = strdup(name);
+	session->size = size;
+	session->data = malloc(size > 0 ? size : 1);
+	lb->sessions[lb->num_sessions] = session;
+	return lb->num_sessions++;
+}
+
+static struct lb_session *lb_find_session(struct loopback *lb, const char *session_id) {
+	unsigned int index;
+	if (sscanf(session_id, "lb-%u", &index) != 1 || index >= lb->num_sessions) {
+		return NULL;
+	}
+	return lb->sessions[index];
+}
+
+static void lb_transfer(struct loopback *lb, size_t len) {
+	pthread_mutex_lock(&lb->lock);
+	double delay = tb_take(&lb->link, len);
+	pthread_mutex_unlock(&lb->lock);
+	if (delay > 0) {
+		usleep(delay * 1e6);
+	}
+}
+
+static void lb_add_range(struct lb_session *session, uint64_t start, uint64_t end) {
+	if (start == end) {
+		return;
+	}
+	/* First range that ends at or after the new start */
+	unsigned int first = 0;
+	while (first < session->num_ranges && session->ranges[first].end < start) {
+		first++;
+	}
+	/* Ranges from first up to last overlap or touch the new one, and are merged */
+	unsigned int last = first;
+	while (last < session->num_ranges && session->ranges[last].start <= end) {
+		if (session->ranges[last].start < start) {
+			start = session->ranges[last].start;
+		}
+		if (session->ranges[last].end > end) {
+			end = session->ranges[last].end;
+		}
+		last++;
+	}
+
+	if (first == last) {
+		if (session->num_ranges == session->max_ranges) {
+			session->max_ranges = (session->max_ranges == 0) ? 8 : session->max_ranges * 2;
+			session->ranges = realloc(session->ranges, session->max_ranges * sizeof(struct lb_range));
+		}
+		memmove(session->ranges + first + 1, session->ranges + first,
+				(session->num_ranges - first) * sizeof(struct lb_range));
+		session->num_ranges++;
+	} else {
+		memmove(session->ranges + first + 1, session->ranges + last,
+				(session->num_ranges - last) * sizeof(struct lb_range));
+		session->num_ranges -= last - first - 1;
+	}
+	session->ranges[first].start = start;
+	session->ranges[first].end = end;
+}
+
+static struct lb_session *lb_find_object(struct loopback *lb, const char *name) {
+	for (unsigned int i = lb->num_sessions; i > 0; i--) {
+		struct lb_session *session = lb->sessions[i - 1];
+		if (session->complete && strcmp(session->name, name) == 0) {
+			return session;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,100 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_LOOPBACK_H
+#define GOODRV_LOOPBACK_H
+
+#include <stddef.h>
+
+#include "transport.h"
+
+/*
+ * Faults injected by the loopback transport.
+ * latency_us - Delay of every request, in microseconds.
+ * loss_percent - Percentage of the requests that fail with TRANSPORT_ERR_RETRY.
+ * 				  Half of the failed requests take effect anyway, as if only
+ * 				  the response was lost.
+ * max_chunks - Number of chunks accepted before every request starts failing,
+ * 				as with a dropped connection. Negative for no limit.
+ * seed - Seed for choosing the failed requests.
+ * bandwidth - Bytes per second of the chunks and ranges, shared by all the
+ * 			   requests, as over a single link. 0 for no limit.
+ */
+struct loopback_options {
+	unsigned int latency_us;
+	unsigned int loss_percent;
+	long max_chunks;
+	unsigned int seed;
+	unsigned long long bandwidth;
+};
+
+/*
+ * Requests served by the loopback transport.
+ */
+struct loopback_stats {
+	unsigned long requests;
+	unsigned long failures;
+	/* Chunks and bytes received */
+	unsigned long chunks;
+	unsigned long long bytes;
+	/* Ranges and bytes sent */
+	unsigned long ranges;
+	unsigned long long bytes_out;
+	/* Objects copied within the store */
+	unsigned long copies;
+	/* Objects moved within the store, counting those moved along with another */
+	unsigned long moves;
+	/* Objects removed from the store, counting those removed along with another */
+	unsigned long deletes;
+};
+
+/*
+ * Create a transport that keeps the objects in memory, within the process.
+ * Faults are injected as per the options; none if options is NULL.
+ */
+struct transport *loopback_create(struct loopback_options *options);
+
+/*
+ * Change the faults injected from now on.
+ */
+void loopback_set_options(struct transport *transport, struct loopback_options *options);
+
+/*
+ * Get the requests served so far.
+ */
+void loopback_get_stats(struct transport *transport, struct loopback_stats *stats);
+
+/*
+ * Store an object directly, without going through an upload session.
+ */
+void loopback_put_object(struct transport *transport, const char *name, const void *data,
+		size_t size);
+
+/*
+ * Get the contents of the object with the name, from its latest completed
+ * upload. Returns NULL if there is no such object.
+ */
+const void *loopback_get_object(struct transport *transport, const char *name, size_t *size);
+
+#endif /* GOODRV_LOOPBACK_H */
@@ -23,10 +23,415 @@
  * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include<stdio.h>
+/*
+ * The sync daemon. Everything is driven by a single reactor: the inotify
+ * instances of the accounts, the timers for the debouncing and the token
+ * refreshes and the metrics dump, the signals, the connections to the
+ * metrics endpoint, and the completions posted by the workers. The
+ * loop sleeps in epoll_wait when there is nothing to do.
+ *
+ * With GOODRV_TRACE set, the stages of the pipeline are traced, and SIGUSR1
+ * dumps the recent spans to trace.json in the config directory.
+ *
+ * With GOODRV_MEM_BUDGET set (e.g. "256M"), the daemon runs in the bounded
+ * memory mode, spilling its big arrays to the spill directory within the
+ * config directory.
+ *
+ * There is no transport to Drive yet, so the daemon only runs with
+ * --dry-run: the files go to an in-memory store, lost at exit, and are
+ * reported as such. The records of a dry run are kept in a temporary
+ * directory, removed at exit, so that a later run does not take the files
+ * for synced.
+ */
+
+#include <ftw.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "jwt.h"
 #include "linux-api.h"
+#include "loopback.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "spill.h"
+#include "trace.h"
+
+/* Quiet time after a change before the tree is synced */
+#define DEBOUNCE_MS 1000
+/*
+ * Quiet time after an entry is moved out of the tree, so that if it is moved
+ * back in, the sync sees a move rather than a delete and a create
+ */
+#define MOVE_OUT_DEBOUNCE_MS 5000
+/* Longest a sync waits after the first change, for files that keep changing */
+#define MAX_DEBOUNCE_MS 30000
+/* Workers shared by the accounts */
+#define NUM_WORKERS 4
+/* Period of the metrics dump, in the config directory */
+#define METRICS_DUMP_MS 60000
+/* Sync to an in-memory store, the only one for now */
+#define DRY_RUN_FLAG "--dry-run"
+/* Temporary directory of the records of a dry run */
+#define DRY_RUN_DIR_TEMPLATE "/tmp/goodrive-dry-run-XXXXXX"
+
+/*
+ * An account of the daemon, and its state in the loop
+ */
+struct daemon_account {
+	reactor loop;
+	sync_account account;
+	char *key_path;
+	/* The uploads go to an in-memory store */
+	int dry_run;
+	int debounce_timer;
+	/* Time of the first change not synced yet, from metrics_now, 0 if none */
+	uint64_t dirty_since;
+	int token_timer;
+	/* Moves seen by the watches since the last sync */
+	struct watch_moves moves;
+	/* A sync is running, and another is to follow it */
+	int syncing;
+	int dirty;
+};
+
+/*
+ * The signals of the daemon: SIGINT and SIGTERM stop it, SIGUSR1 dumps the trace
+ */
+struct daemon_signals {
+	reactor loop;
+	int fd;
+	char *trace_path;
+};
+
+/*
+ * Completion of a sync, posted to the loop
+ */
+struct sync_done {
+	struct daemon_account *daemon_account;
+	long queued;
+};
+
+/* Token source, through the key file of the account */
+static int get_jwt(void *arg, char **token, time_t *expiry);
+/* Start a sync of the account, or have it follow the running one */
+static void start_sync(struct daemon_account *daemon_account);
+/* Called by the worker when a sync is done */
+static void on_sync_done(void *arg, long queued);
+/* Handle the completion of a sync in the loop */
+static void handle_sync_done(void *arg);
+/* Called by the worker when an upload is done */
+static void on_upload_done(void *arg, const char *file_path, int failed);
+/* Called by the worker when a token refresh is done */
+static void on_token_done(void *arg, long status);
+/* Print a message of a worker in the loop */
+static void handle_message(void *arg);
+/* Drain the inotify events of the account, and restart its debounce */
+static void handle_watch(void *arg, uint32_t events);
+/* Debounce timer of the account */
+static void handle_debounce(void *arg, uint32_t events);
+/* Token refresh timer of the account */
+static void handle_token_refresh(void *arg, uint32_t events);
+/* Write the metrics to a client of the endpoint */
+static void handle_metrics_client(void *arg, uint32_t events);
+/* Dump the metrics to the file */
+static void handle_metrics_dump(void *arg, uint32_t events);
+/* Stop the loop on SIGINT or SIGTERM, dump the trace on SIGUSR1 */
+static void handle_signal(void *arg, uint32_t events);
+/* Remove a directory and everything in it */
+static int remove_tree(const char *path);
+/* Remove an entry, for nftw */
+static int remove_entry(const char *path, const struct stat *entry_stat, int type, struct FTW *ftw);
+
+int main(int argc, char *argv[]) {
+	int dry_run = argc > 1 && strcmp(argv[1], DRY_RUN_FLAG) == 0;
+	if (dry_run) {
+		argv[1] = argv[0];
+		argc--;
+		argv++;
+	}
+	if (argc < 3 || argc % 2 == 0) {
+		fprintf(stderr, "Usage: %s %s EMAIL DIR [EMAIL DIR]...\n", argv[0], DRY_RUN_FLAG);
+		return 1;
+	}
+	if (!dry_run) {
+		fprintf(stderr, "No remote store is available yet; run with %s to sync to memory only\n",
+				DRY_RUN_FLAG);
+		return 1;
+	}
+
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	/* Writes to the connections closed by their peer fail with EPIPE instead */
+	signal(SIGPIPE, SIG_IGN);
+	struct daemon_signals stop_signals;
+	stop_signals.fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	reactor loop = reactor_create();
+	sync_host host = sync_host_create(NUM_WORKERS, NULL);
+	if (stop_signals.fd == -1 || loop == NULL || host == NULL) {
+		fprintf(stderr, "Cannot start the sync engine\n");
+		return 1;
+	}
+	stop_signals.loop = loop;
+	reactor_add(loop, stop_signals.fd, EPOLLIN, &handle_signal, &stop_signals);
+
+	char *config_dir = get_config_dir_curruser();
+	mkdir(config_dir, 0700);
+	char *metrics_path = get_abs_path(config_dir, "metrics");
+	char *socket_path = get_abs_path(config_dir, "metrics.sock");
+	stop_signals.trace_path = get_abs_path(config_dir, "trace.json");
+	if (getenv(TRACE_ENV) != NULL) {
+		trace_enable(1);
+	}
+	if (getenv(SPILL_BUDGET_ENV) != NULL) {
+		uint64_t budget = spill_parse_size(getenv(SPILL_BUDGET_ENV));
+		char *spill_dir = get_abs_path(config_dir, "spill");
+		mkdir(spill_dir, 0700);
+		if (budget == 0 || spill_configure(budget, spill_dir) != 0) {
+			fprintf(stderr, "Ignoring the memory budget %s\n", getenv(SPILL_BUDGET_ENV));
+		}
+		free(spill_dir);
+	}
+	int metrics_fd = metrics_listen(socket_path);
+	if (metrics_fd != -1) {
+		reactor_add(loop, metrics_fd, EPOLLIN, &handle_metrics_client, &metrics_fd);
+	}
+	int dump_timer = reactor_add_timer(loop, &handle_metrics_dump, metrics_path);
+	reactor_arm_timer(loop, dump_timer, METRICS_DUMP_MS, METRICS_DUMP_MS);
+	char dry_run_dir[] = DRY_RUN_DIR_TEMPLATE;
+	if (dry_run && mkdtemp(dry_run_dir) == NULL) {
+		fprintf(stderr, "Cannot create a directory for the dry run\n");
+		return 1;
+	}
+
+	int num_accounts = (argc - 1) / 2;
+	struct daemon_account *daemon_accounts = calloc(num_accounts, sizeof(struct daemon_account));
+	for (int i = 0; i < num_accounts; i++) {
+		struct daemon_account *daemon_account = &daemon_accounts[i];
+		char *email = argv[1 + 2 * i];
+		char *user_md5sum = md5sum_str(email);
+		daemon_account->loop = loop;
+		daemon_account->dry_run = dry_run;
+		daemon_account->key_path = get_abs_path(get_config_dir_curruser(), user_md5sum);
+		char *state_dir = dry_run ? get_abs_path(dry_run_dir, user_md5sum) : NULL;
+		free(user_md5sum);
+
+		struct sync_account_options options;
+		memset(&options, 0, sizeof(options));
+		options.email = email;
+		options.root_dir = argv[2 + 2 * i];
+		options.state_dir = state_dir;
+		/* Till the Drive transport is in place, only the dry run, into an in-memory store */
+		options.transport = loopback_create(NULL);
+		options.get_token = &get_jwt;
+		options.token_arg = daemon_account->key_path;
+		options.on_upload = &on_upload_done;
+		options.upload_arg = daemon_account;
+		daemon_account->account = sync_account_add(host, &options);
+		free(state_dir);
+		if (daemon_account->account == NULL) {
+			fprintf(stderr, "Cannot add the account %s\n", email);
+			options.transport->destroy(options.transport);
+			continue;
+		}
+
+		reactor_add(loop, sync_account_watch_fd(daemon_account->account), EPOLLIN, &handle_watch,
+				daemon_account);
+		daemon_account->debounce_timer = reactor_add_timer(loop, &handle_debounce, daemon_account);
+		if (!dry_run) {
+			/* The dry run never sends anything, and needs no token */
+			daemon_account->token_timer = reactor_add_timer(loop, &handle_token_refresh, daemon_account);
+			reactor_arm_timer(loop, daemon_account->token_timer, 1,
+					(JWT_LIFETIME - ENGINE_TOKEN_MARGIN) * 1000UL);
+		}
+		start_sync(daemon_account);
+	}
+
+	int result = reactor_run(loop);
+
+	/* Let the workers finish, and handle what they posted, without starting more */
+	for (int i = 0; i < num_accounts; i++) {
+		if (daemon_accounts[i].account != NULL) {
+			sync_account_wait(daemon_accounts[i].account);
+			daemon_accounts[i].dirty = 0;
+		}
+	}
+	reactor_stop(loop);
+	reactor_run(loop);
+	sync_host_destroy(host);
+	reactor_destroy(loop);
+	close(stop_signals.fd);
+	metrics_dump(metrics_path);
+	if (metrics_fd != -1) {
+		close(metrics_fd);
+		unlink(socket_path);
+	}
+	free(metrics_path);
+	free(socket_path);
+	free(stop_signals.trace_path);
+	for (int i = 0; i < num_accounts; i++) {
+		free(daemon_accounts[i].key_path);
+	}
+	free(daemon_accounts);
+	if (dry_run) {
+		remove_tree(dry_run_dir);
+	}
+	return (result == 0) ? 0 : 1;
+}
+
+static int get_jwt(void *arg, char **token, time_t *expiry) {
+	return build_jwt_from_file(arg, token, expiry);
+}
+
+static void start_sync(struct daemon_account *daemon_account) {
+	if (daemon_account->syncing) {
+		daemon_account->dirty = 1;
+		return;
+	}
+	daemon_account->syncing = 1;
+	sync_account_queue_sync(daemon_account->account, &on_sync_done, daemon_account);
+}
+
+static void on_sync_done(void *arg, long queued) {
+	struct daemon_account *daemon_account = arg;
+	struct sync_done *done = malloc(sizeof(struct sync_done));
+	done->daemon_account = daemon_account;
+	done->queued = queued;
+	reactor_post(daemon_account->loop, &handle_sync_done, done);
+}
+
+static void handle_sync_done(void *arg) {
+	struct sync_done *done = arg;
+	struct daemon_account *daemon_account = done->daemon_account;
+	const char *email = sync_account_email(daemon_account->account);
+	if (done->queued == -1) {
+		printf("%s: cannot read the directory\n", email);
+	} else if (done->queued > 0) {
+		printf("%s%s: %ld files to upload\n", daemon_account->dry_run ? "[dry run] " : "", email,
+				done->queued);
+	}
+	free(done);
+
+	daemon_account->syncing = 0;
+	if (daemon_account->dirty) {
+		daemon_account->dirty = 0;
+		start_sync(daemon_account);
+	}
+}
+
+static void on_upload_done(void *arg, const char *file_path, int failed) {
+	struct daemon_account *daemon_account = arg;
+	const char *email = sync_account_email(daemon_account->account);
+	size_t len = strlen(email) + strlen(file_path) + 48;
+	char *message = malloc(len);
+	snprintf(message, len, "%s%s: %s %s", daemon_account->dry_run ? "[dry run] " : "", email,
+			failed ? "failed" : "uploaded", file_path);
+	reactor_post(daemon_account->loop, &handle_message, message);
+}
+
+static void on_token_done(void *arg, long status) {
+	struct daemon_account *daemon_account = arg;
+	if (status != 0) {
+		const char *email = sync_account_email(daemon_account->account);
+		char *message = malloc(strlen(email) + 32);
+		sprintf(message, "%s: cannot get a token", email);
+		reactor_post(daemon_account->loop, &handle_message, message);
+	}
+}
+
+static void handle_message(void *arg) {
+	char *message = arg;
+	printf("%s\n", message);
+	free(message);
+}
+
+static void handle_watch(void *arg, uint32_t events) {
+	struct daemon_account *daemon_account = arg;
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	int fd = sync_account_watch_fd(daemon_account->account);
+	uint64_t span = trace_begin();
+	/*
+	 * The sync finds what changed in the directories noted here, and pairs
+	 * the moves by inode, so only the moves that have not come back yet
+	 * matter here
+	 */
+	ssize_t len;
+	int changes = 0;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		watch_moves_add(&daemon_account->moves, buf, len);
+		changes += sync_account_note_events(daemon_account->account, buf, len);
+	}
+	trace_end(TRACE_WATCH_EVENTS, span);
+	if (changes == 0) {
+		/* Only reads, like those of the uploads */
+		return;
+	}
+
+	/* Restart the quiet time, but not past MAX_DEBOUNCE_MS from the first change */
+	uint64_t now = metrics_now();
+	if (daemon_account->dirty_since == 0) {
+		daemon_account->dirty_since = now;
+	}
+	unsigned long delay = daemon_account->moves.num_pending > 0 ? MOVE_OUT_DEBOUNCE_MS : DEBOUNCE_MS;
+	uint64_t waited_ms = (now - daemon_account->dirty_since) / 1000000;
+	if (waited_ms + delay > MAX_DEBOUNCE_MS) {
+		delay = (waited_ms < MAX_DEBOUNCE_MS) ? MAX_DEBOUNCE_MS - waited_ms : 1;
+	}
+	reactor_arm_timer(daemon_account->loop, daemon_account->debounce_timer, delay, 0);
+}
+
+static void handle_debounce(void *arg, uint32_t events) {
+	struct daemon_account *daemon_account = arg;
+	/* What has not come back by now is gone, and the sync takes it as deleted */
+	daemon_account->moves.num_pending = 0;
+	daemon_account->dirty_since = 0;
+	start_sync(daemon_account);
+}
+
+static void handle_token_refresh(void *arg, uint32_t events) {
+	struct daemon_account *daemon_account = arg;
+	/* Reading the key and signing are left to a worker, off the loop */
+	sync_account_queue_token(daemon_account->account, &on_token_done, daemon_account);
+}
+
+static void handle_metrics_client(void *arg, uint32_t events) {
+	metrics_serve(*(int *) arg);
+}
+
+static void handle_metrics_dump(void *arg, uint32_t events) {
+	metrics_dump(arg);
+}
+
+static void handle_signal(void *arg, uint32_t events) {
+	struct daemon_signals *stop_signals = arg;
+	struct signalfd_siginfo info;
+	while (read(stop_signals->fd, &info, sizeof(info)) > 0) {
+		if (info.ssi_signo != SIGUSR1) {
+			reactor_stop(stop_signals->loop);
+		} else if (trace_dump(stop_signals->trace_path) != 0) {
+			printf("Cannot write the trace to %s\n", stop_signals->trace_path);
+		}
+	}
+}
+
+static int remove_tree(const char *path) {
+	return nftw(path, &remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
 
-int main() {
-    printf("%s", get_home_dir_curruser());
-    return 0;
+static int remove_entry(const char *path, const struct stat *entry_stat, int type, struct FTW *ftw) {
+	remove(path);
+	return 0;
 }
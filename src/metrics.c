@@ -0,0 +1,350 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+/* Size of a cache line, so that the blocks of two threads never share one */
+#define METRICS_ALIGN 64
+
+/*
+ * Metrics recorded by a thread. Only the owning thread writes to it, with
+ * relaxed atomic stores, so that the readers see whole values.
+ */
+struct metrics_block {
+	uint64_t counters[METRIC_NUM_COUNTERS];
+	struct histogram timers[METRIC_NUM_TIMERS];
+	/* Non zero while a thread owns the block */
+	int in_use;
+	struct metrics_block *next;
+};
+
+static const char *counter_names[METRIC_NUM_COUNTERS] = {
+	"entries_scanned", "files_hashed", "bytes_hashed", "ht_resizes", "jwts_signed", "trees_evicted",
+	"objects_moved", "objects_deleted"
+};
+
+static const char *timer_names[METRIC_NUM_TIMERS] = {
+	"dir_list_ns", "file_hash_ns", "ht_resize_ns", "jwt_sign_ns"
+};
+
+static const char *gauge_names[METRIC_NUM_GAUGES] = {
+	"mem_budget_bytes", "spilled_bytes", "tree_bytes"
+};
+
+/* Block of the calling thread, NULL till it records something */
+static __thread struct metrics_block *thread_block;
+/* Hands the block back when its thread exits */
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+/* All the blocks, guarded by blocks_lock */
+static struct metrics_block *blocks;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Few writers update the gauges, so they are plain shared atomics */
+static uint64_t gauges[METRIC_NUM_GAUGES];
+
+/* Get the block of the calling thread */
+static struct metrics_block *get_block();
+/* Take a free block (or a new one) for the calling thread */
+static struct metrics_block *claim_block();
+/* Release the block of a thread that exits */
+static void release_block(void *block);
+/* Create the key for the blocks */
+static void create_block_key();
+/* Add to a value that only the calling thread writes */
+static void owner_add(uint64_t *value, uint64_t delta);
+/* Format the metrics as text, into memory to be freed by the caller */
+static char *format_metrics(size_t *len);
+/* Read the resident set of the process from /proc/self/status */
+static void read_rss(struct metrics_snapshot *snapshot);
+/* Write all the bytes, with send if the fd is a socket */
+static int write_all(int fd, const char *buf, size_t len, int is_socket);
+
+void metrics_add(enum metric_counter counter, uint64_t value) {
+	owner_add(&get_block()->counters[counter], value);
+}
+
+void metrics_record(enum metric_timer timer, uint64_t nsec) {
+	struct histogram *hist = &get_block()->timers[timer];
+	owner_add(&hist->counts[hist_bucket(nsec)], 1);
+	owner_add(&hist->count, 1);
+	owner_add(&hist->sum, nsec);
+	if (nsec < hist->min) {
+		__atomic_store_n(&hist->min, nsec, __ATOMIC_RELAXED);
+	}
+	if (nsec > hist->max) {
+		__atomic_store_n(&hist->max, nsec, __ATOMIC_RELAXED);
+	}
+}
+
+void metrics_gauge_add(enum metric_gauge gauge, int64_t delta) {
+	__atomic_fetch_add(&gauges[gauge], (uint64_t) delta, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_set(enum metric_gauge gauge, uint64_t value) {
+	__atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+uint64_t metrics_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void metrics_record_since(enum metric_timer timer, uint64_t start) {
+	metrics_record(timer, metrics_now() - start);
+}
+
+void metrics_read(struct metrics_snapshot *snapshot) {
+	memset(snapshot->counters, 0, sizeof(snapshot->counters));
+	for (int i = 0; i < METRIC_NUM_TIMERS; i++) {
+		hist_init(&snapshot->timers[i]);
+	}
+
+	struct histogram hist;
+	pthread_mutex_lock(&blocks_lock);
+	for (struct metrics_block *block = blocks; block != NULL; block = block->next) {
+		for (int i = 0; i < METRIC_NUM_COUNTERS; i++) {
+			snapshot->counters[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+		}
+		for (int i = 0; i < METRIC_NUM_TIMERS; i++) {
+			struct histogram *src = &block->timers[i];
+			for (unsigned int j = 0; j < HIST_NUM_BUCKETS; j++) {
+				hist.counts[j] = __atomic_load_n(&src->counts[j], __ATOMIC_RELAXED);
+			}
+			hist.count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+			hist.sum = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+			hist.min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+			hist.max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+			hist_merge(&snapshot->timers[i], &hist);
+		}
+	}
+	pthread_mutex_unlock(&blocks_lock);
+
+	for (int i = 0; i < METRIC_NUM_GAUGES; i++) {
+		snapshot->gauges[i] = __atomic_load_n(&gauges[i], __ATOMIC_RELAXED);
+	}
+	read_rss(snapshot);
+}
+
+const char *metrics_counter_name(enum metric_counter counter) {
+	return counter_names[counter];
+}
+
+const char *metrics_timer_name(enum metric_timer timer) {
+	return timer_names[timer];
+}
+
+const char *metrics_gauge_name(enum metric_gauge gauge) {
+	return gauge_names[gauge];
+}
+
+int metrics_write(int fd) {
+	size_t len;
+	char *text = format_metrics(&len);
+	if (text == NULL) {
+		return -1;
+	}
+	int result = write_all(fd, text, len, 0);
+	free(text);
+	return result;
+}
+
+int metrics_dump(const char *file_path) {
+	size_t len = strlen(file_path) + sizeof(".tmp");
+	char *tmp_path = malloc(len);
+	snprintf(tmp_path, len, "%s.tmp", file_path);
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		free(tmp_path);
+		return -1;
+	}
+	int result = metrics_write(fd);
+	if (close(fd) != 0 || result != 0 || rename(tmp_path, file_path) != 0) {
+		unlink(tmp_path);
+		result = -1;
+	}
+	free(tmp_path);
+	return result;
+}
+
+int metrics_listen(const char *socket_path) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		return -1;
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void metrics_serve(int listen_fd) {
+	int fd;
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+		size_t len;
+		char *text = format_metrics(&len);
+		if (text != NULL) {
+			write_all(fd, text, len, 1);
+			free(text);
+		}
+		close(fd);
+	}
+}
+
+static struct metrics_block *get_block() {
+	struct metrics_block *block = thread_block;
+	return (block != NULL) ? block : claim_block();
+}
+
+static struct metrics_block *claim_block() {
+	pthread_once(&block_key_once, &create_block_key);
+	pthread_mutex_lock(&blocks_lock);
+	struct metrics_block *block = blocks;
+	while (block != NULL && block->in_use) {
+		block = block->next;
+	}
+	if (block == NULL) {
+		void *memory;
+		if (posix_memalign(&memory, METRICS_ALIGN, sizeof(struct metrics_block)) != 0) {
+			abort();
+		}
+		block = memory;
+		memset(block->counters, 0, sizeof(block->counters));
+		for (int i = 0; i < METRIC_NUM_TIMERS; i++) {
+			hist_init(&block->timers[i]);
+		}
+		block->next = blocks;
+		blocks = block;
+	}
+	block->in_use = 1;
+	pthread_mutex_unlock(&blocks_lock);
+
+	pthread_setspecific(block_key, block);
+	thread_block = block;
+	return block;
+}
+
+static void release_block(void *block) {
+	pthread_mutex_lock(&blocks_lock);
+	((struct metrics_block *) block)->in_use = 0;
+	pthread_mutex_unlock(&blocks_lock);
+}
+
+static void create_block_key() {
+	pthread_key_create(&block_key, &release_block);
+}
+
+static void owner_add(uint64_t *value, uint64_t delta) {
+	/* Not a read-modify-write: no other thread writes the value */
+	__atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+}
+
+static char *format_metrics(size_t *len) {
+	struct metrics_snapshot *snapshot = malloc(sizeof(struct metrics_snapshot));
+	metrics_read(snapshot);
+
+	char *text = NULL;
+	FILE *out = open_memstream(&text, len);
+	if (out == NULL) {
+		free(snapshot);
+		return NULL;
+	}
+	for (int i = 0; i < METRIC_NUM_COUNTERS; i++) {
+		fprintf(out, "%s %llu\n", counter_names[i], (unsigned long long) snapshot->counters[i]);
+	}
+	for (int i = 0; i < METRIC_NUM_TIMERS; i++) {
+		struct histogram *hist = &snapshot->timers[i];
+		fprintf(out, "%s count=%llu mean=%.0f p50=%llu p90=%llu p99=%llu max=%llu\n", timer_names[i],
+				(unsigned long long) hist->count, hist_mean(hist),
+				(unsigned long long) hist_percentile(hist, 50),
+				(unsigned long long) hist_percentile(hist, 90),
+				(unsigned long long) hist_percentile(hist, 99), (unsigned long long) hist->max);
+	}
+	for (int i = 0; i < METRIC_NUM_GAUGES; i++) {
+		fprintf(out, "%s %llu\n", gauge_names[i], (unsigned long long) snapshot->gauges[i]);
+	}
+	fprintf(out, "rss_bytes %llu\nrss_anon_bytes %llu\npeak_rss_bytes %llu\n",
+			(unsigned long long) snapshot->rss, (unsigned long long) snapshot->rss_anon,
+			(unsigned long long) snapshot->peak_rss);
+	fclose(out);
+	free(snapshot);
+	return text;
+}
+
+static void read_rss(struct metrics_snapshot *snapshot) {
+	snapshot->rss = snapshot->rss_anon = snapshot->peak_rss = 0;
+	FILE *status = fopen("/proc/self/status", "r");
+	if (status == NULL) {
+		return;
+	}
+	char line[128];
+	unsigned long long kbytes;
+	while (fgets(line, sizeof(line), status) != NULL) {
+		if (sscanf(line, "VmRSS: %llu kB", &kbytes) == 1) {
+			snapshot->rss = kbytes * 1024;
+		} else if (sscanf(line, "RssAnon: %llu kB", &kbytes) == 1) {
+			snapshot->rss_anon = kbytes * 1024;
+		} else if (sscanf(line, "VmHWM: %llu kB", &kbytes) == 1) {
+			snapshot->peak_rss = kbytes * 1024;
+		}
+	}
+	fclose(status);
+}
+
+static int write_all(int fd, const char *buf, size_t len, int is_socket) {
+	while (len > 0) {
+		ssize_t written = is_socket ? send(fd, buf, len, MSG_NOSIGNAL) : write(fd, buf, len);
+		if (written == -1 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return -1;
+		}
+		buf += written;
+		len -= written;
+	}
+	return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_METRICS_H
+#define GOODRV_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+/*
+ * Counters of the hot paths
+ */
+enum metric_counter {
+	/* Entries handed to the handler by traverse_fsh */
+	METRIC_ENTRIES_SCANNED,
+	/* Files and bytes hashed by md5sum_file_bytes */
+	METRIC_FILES_HASHED,
+	METRIC_BYTES_HASHED,
+	/* Times a hashtable grew */
+	METRIC_HT_RESIZES,
+	/* JWTs signed */
+	METRIC_JWTS_SIGNED,
+	/* Trees of accounts dropped from memory, to stay within the budget */
+	METRIC_TREES_EVICTED,
+	/* Moves replayed within the store, instead of uploading the files again */
+	METRIC_OBJECTS_MOVED,
+	/* Deletes replayed within the store */
+	METRIC_OBJECTS_DELETED,
+	METRIC_NUM_COUNTERS
+};
+
+/*
+ * Levels that go up and down, shared by all the threads
+ */
+enum metric_gauge {
+	/* Memory budget of the process, 0 if it is not bounded */
+	METRIC_MEM_BUDGET,
+	/* Bytes of the arrays spilled to files */
+	METRIC_SPILLED_BYTES,
+	/* Bytes of the trees of the accounts kept in memory between syncs */
+	METRIC_TREE_BYTES,
+	METRIC_NUM_GAUGES
+};
+
+/*
+ * Latencies of the hot paths, in nanoseconds
+ */
+enum metric_timer {
+	/* Listing a directory in traverse_fsh */
+	METRIC_DIR_LIST,
+	/* Hashing a file in md5sum_file_bytes */
+	METRIC_FILE_HASH,
+	/* Rehashing a hashtable into a bigger table */
+	METRIC_HT_RESIZE,
+	/* Signing a JWT in build_jwt_signature */
+	METRIC_JWT_SIGN,
+	METRIC_NUM_TIMERS
+};
+
+/*
+ * The metrics of all the threads, merged.
+ */
+struct metrics_snapshot {
+	uint64_t counters[METRIC_NUM_COUNTERS];
+	struct histogram timers[METRIC_NUM_TIMERS];
+	uint64_t gauges[METRIC_NUM_GAUGES];
+	/* Resident set of the process: all of it, the part that is not file backed, and its peak */
+	uint64_t rss;
+	uint64_t rss_anon;
+	uint64_t peak_rss;
+};
+
+/*
+ * Every thread records into a block of its own, so recording takes no lock
+ * and shares no cache line with other threads; the blocks are merged when
+ * the metrics are read. The block of a thread that exits is handed to the
+ * next new thread, with its counts.
+ */
+
+/*
+ * Add to a counter.
+ */
+void metrics_add(enum metric_counter counter, uint64_t value);
+
+/*
+ * Record a latency, in nanoseconds.
+ */
+void metrics_record(enum metric_timer timer, uint64_t nsec);
+
+/*
+ * Add to (or, with a negative delta, subtract from) a gauge.
+ */
+void metrics_gauge_add(enum metric_gauge gauge, int64_t delta);
+
+/*
+ * Set a gauge.
+ */
+void metrics_gauge_set(enum metric_gauge gauge, uint64_t value);
+
+/*
+ * Get the monotonic time in nanoseconds, for metrics_record_since.
+ */
+uint64_t metrics_now();
+
+/*
+ * Record the latency from start, a time from metrics_now, till now.
+ */
+void metrics_record_since(enum metric_timer timer, uint64_t start);
+
+/*
+ * Merge the metrics of all the threads into the snapshot, along with the
+ * gauges and the resident set of the process.
+ */
+void metrics_read(struct metrics_snapshot *snapshot);
+
+/*
+ * Get the name of a counter, a timer or a gauge.
+ */
+const char *metrics_counter_name(enum metric_counter counter);
+const char *metrics_timer_name(enum metric_timer timer);
+const char *metrics_gauge_name(enum metric_gauge gauge);
+
+/*
+ * Write the metrics as text, a line for each: "<counter> <value>",
+ * "<timer> count=<n> mean=<ns> p50=<ns> p90=<ns> p99=<ns> max=<ns>",
+ * "<gauge> <value>", and the resident set next to the budget as
+ * "rss_bytes <n>", "rss_anon_bytes <n>" and "peak_rss_bytes <n>".
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int metrics_write(int fd);
+
+/*
+ * Write the metrics to the file, replacing it atomically.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int metrics_dump(const char *file_path);
+
+/*
+ * Listen on a UNIX socket at the path, for the stats endpoint. Any stale
+ * socket at the path is replaced.
+ *
+ * Returns the non-blocking listening socket, or -1 on failure.
+ */
+int metrics_listen(const char *socket_path);
+
+/*
+ * Accept the pending connections on the listening socket, and write the
+ * metrics to each of them. Called when the socket is readable.
+ */
+void metrics_serve(int listen_fd);
+
+#endif /* GOODRV_METRICS_H */
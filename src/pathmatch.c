@@ -0,0 +1,441 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/md5.h>
+
+#include "hashtable.h"
+#include "pathmatch.h"
+
+/* The rule includes the paths it matches, instead of excluding them */
+#define PM_NEGATE 01
+/* The rule matches only directories */
+#define PM_DIR_ONLY 02
+/* The rule is matched against the whole path, instead of the name */
+#define PM_ANCHORED 04
+
+/* Depth of the paths that are split without allocating */
+#define PM_MAX_DEPTH 64
+
+/*
+ * A component of a path, or of a rule
+ */
+struct pm_segment {
+	const char *start;
+	size_t len;
+};
+
+/*
+ * A compiled rule
+ */
+struct pm_rule {
+	/* Pattern without the '!' and the leading and trailing '/', with single '/' between components */
+	char *pattern;
+	/* Components of the pattern */
+	struct pm_segment *segments;
+	unsigned int num_segments;
+	unsigned int flags;
+};
+
+struct path_matcher {
+	struct pm_rule *rules;
+	unsigned int num_rules;
+	unsigned int rules_capacity;
+	/*
+	 * Rules without wildcards, keyed by the name (or by the path, when
+	 * anchored). The value is the index of the last such rule plus one.
+	 */
+	hashtable names;
+	hashtable dir_names;
+	hashtable paths;
+	hashtable dir_paths;
+	/* Indices of the rules with wildcards, in order */
+	unsigned int *globs;
+	unsigned int num_globs;
+	/* Whether some rule with wildcards is anchored, so that paths need to be split */
+	int anchored_globs;
+	MD5_CTX md5_ctxt;
+};
+
+/* Add the rule to the table, if it decides later than the rule already there */
+static void put_literal(hashtable table, char *key, unsigned int index);
+/* Get the index plus one of the rule in the table for the key, 0 if there is none */
+static unsigned int get_literal(hashtable table, const char *key);
+/* Check whether the rule with wildcards matches the path */
+static int glob_rule_matches(struct pm_rule *rule, const char *name,
+		struct pm_segment *path, unsigned int depth, int is_dir);
+/* Match the rule components from rule_pos onwards with the path components from path_pos onwards */
+static int match_segments(struct pm_rule *rule, unsigned int rule_pos,
+		struct pm_segment *path, unsigned int depth, unsigned int path_pos);
+/* Match a component against a glob pattern */
+static int match_glob(const char *pat, size_t pat_len, const char *str, size_t str_len);
+/* Match one character against the pattern at pos; returns the position past it, or 0 */
+static size_t match_char(const char *pat, size_t pat_len, size_t pos, char c);
+/* Match one character against the "[...]" at pos; returns the position past it, or 0 */
+static size_t match_class(const char *pat, size_t pat_len, size_t pos, char c);
+/* Split the path into its components; returns the number of components */
+static unsigned int split_path(const char *path, struct pm_segment *segments, unsigned int max);
+/* Check whether the component is "**" */
+static int is_double_star(struct pm_segment *segment);
+
+path_matcher pm_create() {
+	path_matcher pm = calloc(1, sizeof(struct path_matcher));
+	pm->names = ht_create(NULL);
+	pm->dir_names = ht_create(NULL);
+	pm->paths = ht_create(NULL);
+	pm->dir_paths = ht_create(NULL);
+	MD5_Init(&pm->md5_ctxt);
+	return pm;
+}
+
+void pm_destroy(path_matcher pm) {
+	if (pm == NULL) {
+		return;
+	}
+	for (unsigned int i = 0; i < pm->num_rules; i++) {
+		free(pm->rules[i].pattern);
+		free(pm->rules[i].segments);
+	}
+	free(pm->rules);
+	free(pm->globs);
+	ht_destroy(pm->names);
+	ht_destroy(pm->dir_names);
+	ht_destroy(pm->paths);
+	ht_destroy(pm->dir_paths);
+	free(pm);
+}
+
+int pm_add_rule(path_matcher pm, const char *line) {
+	size_t len = strcspn(line, "\r\n");
+	/* Trailing spaces are dropped, unless escaped */
+	while (len > 0 && line[len - 1] == ' ' && !(len > 1 && line[len - 2] == '\\')) {
+		len--;
+	}
+	if (len == 0 || line[0] == '#') {
+		return 0;
+	}
+
+	unsigned int flags = 0;
+	size_t start = 0;
+	if (line[0] == '!') {
+		flags |= PM_NEGATE;
+		start++;
+	} else if (line[0] == '\\' && len > 1 && (line[1] == '!' || line[1] == '#')) {
+		start++;
+	}
+	if (len > start && line[len - 1] == '/') {
+		flags |= PM_DIR_ONLY;
+		len--;
+	}
+	if (len > start && line[start] == '/') {
+		flags |= PM_ANCHORED;
+		start++;
+	}
+
+	/* Copy the pattern with single '/' between its components */
+	char *pattern = malloc(len - start + 1);
+	size_t pattern_len = 0;
+	unsigned int num_segments = 0;
+	for (size_t i = start; i < len; i++) {
+		if (line[i] == '/') {
+			if (pattern_len > 0 && pattern[pattern_len - 1] != '/') {
+				pattern[pattern_len++] = '/';
+			}
+			continue;
+		}
+		if (pattern_len == 0 || pattern[pattern_len - 1] == '/') {
+			num_segments++;
+		}
+		pattern[pattern_len++] = line[i];
+	}
+	if (pattern_len > 0 && pattern[pattern_len - 1] == '/') {
+		pattern_len--;
+	}
+	pattern[pattern_len] = '\0';
+	if (num_segments == 0) {
+		free(pattern);
+		return -1;
+	}
+	if (num_segments > 1) {
+		flags |= PM_ANCHORED;
+	}
+
+	if (pm->num_rules == pm->rules_capacity) {
+		pm->rules_capacity = pm->rules_capacity == 0 ? 16 : pm->rules_capacity * 2;
+		pm->rules = realloc(pm->rules, pm->rules_capacity * sizeof(struct pm_rule));
+		pm->globs = realloc(pm->globs, pm->rules_capacity * sizeof(unsigned int));
+	}
+	unsigned int index = pm->num_rules++;
+	struct pm_rule *rule = &pm->rules[index];
+	rule->pattern = pattern;
+	rule->flags = flags;
+	rule->num_segments = num_segments;
+	rule->segments = malloc(num_segments * sizeof(struct pm_segment));
+	const char *segment = pattern;
+	for (unsigned int i = 0; i < num_segments; i++) {
+		size_t segment_len = strcspn(segment, "/");
+		rule->segments[i].start = segment;
+		rule->segments[i].len = segment_len;
+		segment += segment_len + 1;
+	}
+
+	if (strpbrk(pattern, "*?[\\") == NULL) {
+		if (flags & PM_ANCHORED) {
+			put_literal((flags & PM_DIR_ONLY) ? pm->dir_paths : pm->paths, pattern, index);
+		} else {
+			put_literal((flags & PM_DIR_ONLY) ? pm->dir_names : pm->names, pattern, index);
+		}
+	} else {
+		pm->globs[pm->num_globs++] = index;
+		pm->anchored_globs |= (flags & PM_ANCHORED) != 0;
+	}
+
+	unsigned char flags_byte = flags;
+	MD5_Update(&pm->md5_ctxt, &flags_byte, 1);
+	MD5_Update(&pm->md5_ctxt, pattern, pattern_len + 1);
+	return 0;
+}
+
+int pm_load(path_matcher pm, const char *file_path) {
+	FILE *file = fopen(file_path, "r");
+	if (file == NULL) {
+		return -1;
+	}
+	char *line = NULL;
+	size_t capacity = 0;
+	while (getline(&line, &capacity, file) != -1) {
+		pm_add_rule(pm, line);
+	}
+	free(line);
+	fclose(file);
+	return 0;
+}
+
+unsigned int pm_num_rules(path_matcher pm) {
+	return pm->num_rules;
+}
+
+int pm_excluded(path_matcher pm, const char *rel_path, int is_dir) {
+	if (pm == NULL || pm->num_rules == 0) {
+		return 0;
+	}
+	const char *name = strrchr(rel_path, '/');
+	name = (name != NULL) ? name + 1 : rel_path;
+
+	/* The last rule that matches decides, so only the later rules need to be tried */
+	unsigned int decided = get_literal(pm->names, name);
+	unsigned int found = get_literal(pm->paths, rel_path);
+	decided = found > decided ? found : decided;
+	if (is_dir) {
+		found = get_literal(pm->dir_names, name);
+		decided = found > decided ? found : decided;
+		found = get_literal(pm->dir_paths, rel_path);
+		decided = found > decided ? found : decided;
+	}
+
+	struct pm_segment path_buf[PM_MAX_DEPTH];
+	struct pm_segment *path = path_buf;
+	unsigned int depth = 0;
+	if (pm->anchored_globs) {
+		depth = split_path(rel_path, path_buf, PM_MAX_DEPTH);
+		if (depth > PM_MAX_DEPTH) {
+			path = malloc(depth * sizeof(struct pm_segment));
+			split_path(rel_path, path, depth);
+		}
+	}
+	for (unsigned int i = pm->num_globs; i-- > 0 && pm->globs[i] >= decided;) {
+		if (glob_rule_matches(&pm->rules[pm->globs[i]], name, path, depth, is_dir)) {
+			decided = pm->globs[i] + 1;
+			break;
+		}
+	}
+	if (path != path_buf) {
+		free(path);
+	}
+	return decided != 0 && !(pm->rules[decided - 1].flags & PM_NEGATE);
+}
+
+void pm_digest(path_matcher pm, unsigned char *digest) {
+	if (pm == NULL || pm->num_rules == 0) {
+		memset(digest, 0, MD5_DIGEST_LENGTH);
+		return;
+	}
+	MD5_CTX md5_ctxt = pm->md5_ctxt;
+	MD5_Final(digest, &md5_ctxt);
+}
+
+static void put_literal(hashtable table, char *key, unsigned int index) {
+	/* An earlier rule with the same key keeps its key, and both live as long as the matcher */
+	ht_put(table, key, (void *) (uintptr_t) (index + 1));
+}
+
+static unsigned int get_literal(hashtable table, const char *key) {
+	if (ht_num_entries(table) == 0) {
+		return 0;
+	}
+	return (unsigned int) (uintptr_t) ht_get(table, (void *) key);
+}
+
+static int glob_rule_matches(struct pm_rule *rule, const char *name,
+		struct pm_segment *path, unsigned int depth, int is_dir) {
+	if ((rule->flags & PM_DIR_ONLY) && !is_dir) {
+		return 0;
+	}
+	if (!(rule->flags & PM_ANCHORED)) {
+		return match_glob(rule->segments[0].start, rule->segments[0].len, name, strlen(name));
+	}
+	return match_segments(rule, 0, path, depth, 0);
+}
+
+static int match_segments(struct pm_rule *rule, unsigned int rule_pos,
+		struct pm_segment *path, unsigned int depth, unsigned int path_pos) {
+	while (rule_pos < rule->num_segments) {
+		struct pm_segment *segment = &rule->segments[rule_pos];
+		if (is_double_star(segment)) {
+			if (rule_pos + 1 == rule->num_segments) {
+				/* A trailing "**" matches everything inside, but not the directory itself */
+				return path_pos < depth;
+			}
+			for (unsigned int skip = path_pos; skip < depth; skip++) {
+				if (match_segments(rule, rule_pos + 1, path, depth, skip)) {
+					return 1;
+				}
+			}
+			return 0;
+		}
+		if (path_pos == depth
+				|| !match_glob(segment->start, segment->len, path[path_pos].start, path[path_pos].len)) {
+			return 0;
+		}
+		rule_pos++;
+		path_pos++;
+	}
+	return path_pos == depth;
+}
+
+static int match_glob(const char *pat, size_t pat_len, const char *str, size_t str_len) {
+	size_t pat_pos = 0, str_pos = 0;
+	/* Where to resume after the last '*', if the rest does not match */
+	size_t star_pat = SIZE_MAX, star_str = 0;
+	while (str_pos < str_len) {
+		if (pat_pos < pat_len && pat[pat_pos] == '*') {
+			star_pat = ++pat_pos;
+			star_str = str_pos;
+			continue;
+		}
+		size_t next = (pat_pos < pat_len) ? match_char(pat, pat_len, pat_pos, str[str_pos]) : 0;
+		if (next != 0) {
+			pat_pos = next;
+			str_pos++;
+		} else if (star_pat != SIZE_MAX) {
+			/* Let the last '*' take one more character */
+			pat_pos = star_pat;
+			str_pos = ++star_str;
+		} else {
+			return 0;
+		}
+	}
+	while (pat_pos < pat_len && pat[pat_pos] == '*') {
+		pat_pos++;
+	}
+	return pat_pos == pat_len;
+}
+
+static size_t match_char(const char *pat, size_t pat_len, size_t pos, char c) {
+	switch (pat[pos]) {
+	case '?':
+		return pos + 1;
+	case '[':
+		return match_class(pat, pat_len, pos, c);
+	case '\\':
+		if (pos + 1 < pat_len) {
+			return pat[pos + 1] == c ? pos + 2 : 0;
+		}
+		/* no break */
+	default:
+		return pat[pos] == c ? pos + 1 : 0;
+	}
+}
+
+static size_t match_class(const char *pat, size_t pat_len, size_t pos, char c) {
+	size_t i = pos + 1;
+	int negate = 0, matched = 0;
+	if (i < pat_len && (pat[i] == '!' || pat[i] == '^')) {
+		negate = 1;
+		i++;
+	}
+	/* A ']' right at the start is one of the characters */
+	size_t first = i;
+	while (i < pat_len && (pat[i] != ']' || i == first)) {
+		unsigned char low = pat[i];
+		if (low == '\\' && i + 1 < pat_len) {
+			low = pat[++i];
+		}
+		unsigned char high = low;
+		if (i + 2 < pat_len && pat[i + 1] == '-' && pat[i + 2] != ']') {
+			i += 2;
+			high = pat[i];
+			if (high == '\\' && i + 1 < pat_len) {
+				high = pat[++i];
+			}
+		}
+		if ((unsigned char) c >= low && (unsigned char) c <= high) {
+			matched = 1;
+		}
+		i++;
+	}
+	if (i >= pat_len) {
+		/* Without a closing ']', the '[' is an ordinary character */
+		return c == '[' ? pos + 1 : 0;
+	}
+	return matched != negate ? i + 1 : 0;
+}
+
+static unsigned int split_path(const char *path, struct pm_segment *segments, unsigned int max) {
+	unsigned int depth = 0;
+	while (*path != '\0') {
+		size_t len = strcspn(path, "/");
+		if (len > 0) {
+			if (depth < max) {
+				segments[depth].start = path;
+				segments[depth].len = len;
+			}
+			depth++;
+		}
+		path += len;
+		if (*path == '/') {
+			path++;
+		}
+	}
+	return depth;
+}
+
+static int is_double_star(struct pm_segment *segment) {
+	return segment->len == 2 && segment->start[0] == '*' && segment->start[1] == '*';
+}
@@ -0,0 +1,102 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_PATHMATCH_H
+#define GOODRV_PATHMATCH_H
+
+/* File in the root of a synced directory with its include/exclude rules */
+#define PM_RULES_FILE ".goodriveignore"
+
+/*
+ * Matcher of include/exclude rules, in the syntax of .gitignore:
+ *
+ * - Blank lines and lines starting with '#' are skipped.
+ * - A rule excludes the paths it matches; a rule starting with '!' includes
+ *   them again. The last rule that matches a path decides.
+ * - A rule ending with '/' matches only directories.
+ * - A rule with a '/' at its start or middle is matched against the whole
+ *   path from the root; any other rule against the name alone, at any depth.
+ * - '*' matches anything but '/', '?' any one character, and '[...]' one of
+ *   a set of characters. "**" as a whole component matches any number of
+ *   directories. '\' escapes the next character.
+ *
+ * Rules are compiled as they are added: rules without wildcards go into
+ * tables by name and by path, so most paths are decided by a couple of
+ * lookups, and only the rules with wildcards are matched one by one.
+ *
+ * A path inside an excluded directory is excluded, whatever the rules say
+ * about it: the traversals never descend into an excluded directory, so its
+ * subtree costs neither reads nor watches. pm_excluded is thus only asked
+ * about the paths whose parent is included.
+ */
+typedef struct path_matcher *path_matcher;
+
+/*
+ * Create a matcher with no rules, which excludes nothing.
+ */
+path_matcher pm_create();
+
+/*
+ * Free the matcher.
+ */
+void pm_destroy(path_matcher pm);
+
+/*
+ * Add a rule, as a line of a rules file.
+ *
+ * Returns 0 if the line is a rule, a comment or blank, and -1 if it is not
+ * valid (such as a lone "!" or "/").
+ */
+int pm_add_rule(path_matcher pm, const char *line);
+
+/*
+ * Add the rules of a file, a line each. Invalid lines are skipped.
+ *
+ * Returns 0 on success, and -1 if the file cannot be read.
+ */
+int pm_load(path_matcher pm, const char *file_path);
+
+/*
+ * Get the number of rules.
+ */
+unsigned int pm_num_rules(path_matcher pm);
+
+/*
+ * Check whether the rules exclude the path.
+ *
+ * rel_path - Path relative to the root, without a leading '/', e.g. "a/b".
+ * is_dir - Non zero if the path is a directory.
+ *
+ * Returns 1 if the path is excluded, 0 otherwise.
+ */
+int pm_excluded(path_matcher pm, const char *rel_path, int is_dir);
+
+/*
+ * Get the MD5 digest of the rules, so that records kept under one set of
+ * rules are not reused under another. A matcher without rules has a digest
+ * of zeros, the same as having no matcher.
+ */
+void pm_digest(path_matcher pm, unsigned char *digest);
+
+#endif /* GOODRV_PATHMATCH_H */
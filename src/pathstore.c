@@ -0,0 +1,592 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pathstore.h"
+#include "spill.h"
+
+/* Initial number of entries (and index buckets) in a new path store */
+#define PS_INITIAL_CAPACITY 64
+/* Initial size of the name arena */
+#define PS_INITIAL_NAMES_SIZE 1024
+/* Longest name that can be stored in an entry */
+#define PS_MAX_NAME_LEN USHRT_MAX
+
+/*
+ * An entry in the path store. The children of an entry form a doubly linked
+ * list through next_sibling and prev_sibling, so that an entry can be unlinked
+ * in constant time.
+ */
+struct ps_node {
+	path_id parent;
+	path_id first_child;
+	path_id last_child;
+	path_id next_sibling;
+	path_id prev_sibling;
+	/* Next entry in the same index bucket */
+	path_id hash_next;
+	/* Offset of the null terminated name in the name arena */
+	unsigned int name_off;
+	unsigned short name_len;
+	unsigned short in_use;
+};
+
+/*
+ * Path Store
+ */
+struct pathstore {
+	/* Entries, indexed by path_id. Index 0 is never used. */
+	struct ps_node *nodes;
+	unsigned int nodes_cap;
+	/* The highest id handed out so far */
+	unsigned int nodes_used;
+	unsigned int num_entries;
+	/* Head of the list of removed entries, chained through next_sibling */
+	path_id free_head;
+
+	/* Index of (parent, name) -> id. Number of buckets is a power of 2. */
+	path_id *buckets;
+	unsigned int num_buckets;
+
+	/* Arena of null terminated names */
+	char *names;
+	size_t names_len;
+	size_t names_cap;
+	/* Bytes in the arena that belong to removed or renamed entries */
+	size_t dead_bytes;
+
+	/* Scratch buffer for ps_path */
+	char *scratch;
+	size_t scratch_cap;
+};
+
+/* Compute the index hash for a (parent, name) pair */
+static unsigned int hash_child(path_id parent, const char *name, size_t name_len);
+/* Copy the name into the arena, and return its offset */
+static unsigned int store_name(pathstore ps, const char *name, size_t name_len);
+/* Remove the names of the dead entries from the arena */
+static void compact_names(pathstore ps);
+/* Get an unused entry id, growing the entry array when necessary */
+static path_id alloc_node(pathstore ps);
+/* Add the entry to the index */
+static void index_insert(pathstore ps, path_id id);
+/* Remove the entry from the index */
+static void index_remove(pathstore ps, path_id id);
+/* Double the number of buckets in the index, if the load crosses 3/4 */
+static void check_and_resize_index(pathstore ps);
+/* Append the entry to the list of children of the parent */
+static void link_child(pathstore ps, path_id parent, path_id id);
+/* Remove the entry from the list of children of its parent */
+static void unlink_child(pathstore ps, path_id id);
+/* Release an entry which has been unlinked from its parent and the index */
+static void free_node(pathstore ps, path_id id);
+/* Check whether the root path needs a '/' before the names of its children */
+static int root_needs_separator(pathstore ps);
+
+pathstore ps_create(const char *root_path) {
+	if (root_path == NULL) {
+		root_path = "";
+	}
+
+	pathstore ps = malloc(sizeof(struct pathstore));
+	ps->nodes_cap = PS_INITIAL_CAPACITY;
+	ps->nodes = spill_calloc(ps->nodes_cap, sizeof(struct ps_node));
+	ps->nodes_used = 0;
+	ps->num_entries = 0;
+	ps->free_head = PATH_ID_NONE;
+
+	ps->num_buckets = PS_INITIAL_CAPACITY;
+	ps->buckets = spill_calloc(ps->num_buckets, sizeof(path_id));
+
+	ps->names_cap = PS_INITIAL_NAMES_SIZE;
+	ps->names = spill_calloc(1, ps->names_cap);
+	ps->names_len = 0;
+	ps->dead_bytes = 0;
+
+	ps->scratch = NULL;
+	ps->scratch_cap = 0;
+
+	path_id root = alloc_node(ps);
+	ps->nodes[root].name_off = store_name(ps, root_path, strlen(root_path));
+	ps->nodes[root].name_len = strlen(root_path);
+	return ps;
+}
+
+void ps_destroy(pathstore ps) {
+	if (ps != NULL) {
+		spill_free(ps->nodes);
+		spill_free(ps->buckets);
+		spill_free(ps->names);
+		free(ps->scratch);
+		free(ps);
+	}
+}
+
+unsigned int ps_num_entries(pathstore ps) {
+	return ps->num_entries;
+}
+
+path_id ps_id_limit(pathstore ps) {
+	return ps->nodes_used + 1;
+}
+
+size_t ps_memory_usage(pathstore ps) {
+	return sizeof(struct pathstore) + ps->nodes_cap * sizeof(struct ps_node)
+			+ ps->num_buckets * sizeof(path_id) + ps->names_cap + ps->scratch_cap;
+}
+
+path_id ps_intern(pathstore ps, path_id parent, const char *name, size_t name_len) {
+	if (!ps_is_valid(ps, parent) || name_len == 0 || name_len > PS_MAX_NAME_LEN) {
+		return PATH_ID_NONE;
+	}
+
+	path_id id = ps_lookup_child(ps, parent, name, name_len);
+	if (id != PATH_ID_NONE) {
+		return id;
+	}
+
+	unsigned int name_off = store_name(ps, name, name_len);
+	id = alloc_node(ps);
+	ps->nodes[id].name_off = name_off;
+	ps->nodes[id].name_len = name_len;
+	ps->nodes[id].parent = parent;
+	link_child(ps, parent, id);
+	index_insert(ps, id);
+	return id;
+}
+
+path_id ps_lookup_child(pathstore ps, path_id parent, const char *name, size_t name_len) {
+	unsigned int bucket = hash_child(parent, name, name_len) & (ps->num_buckets - 1);
+	path_id id = ps->buckets[bucket];
+	while (id != PATH_ID_NONE) {
+		struct ps_node *node = &ps->nodes[id];
+		if (node->parent == parent && node->name_len == name_len
+				&& memcmp(ps->names + node->name_off, name, name_len) == 0) {
+			return id;
+		}
+		id = node->hash_next;
+	}
+	return PATH_ID_NONE;
+}
+
+path_id ps_intern_path(pathstore ps, path_id parent, const char *rel_path) {
+	path_id id = parent;
+	const char *start = rel_path;
+	while (id != PATH_ID_NONE && *start != 0) {
+		const char *end = strchr(start, '/');
+		size_t len = (end == NULL) ? strlen(start) : (size_t) (end - start);
+		if (len > 0) {
+			id = ps_intern(ps, id, start, len);
+		}
+		start += len;
+		if (*start == '/') {
+			start++;
+		}
+	}
+	return id;
+}
+
+path_id ps_lookup_path(pathstore ps, path_id parent, const char *rel_path) {
+	if (!ps_is_valid(ps, parent)) {
+		return PATH_ID_NONE;
+	}
+
+	path_id id = parent;
+	const char *start = rel_path;
+	while (id != PATH_ID_NONE && *start != 0) {
+		const char *end = strchr(start, '/');
+		size_t len = (end == NULL) ? strlen(start) : (size_t) (end - start);
+		if (len > 0) {
+			id = ps_lookup_child(ps, id, start, len);
+		}
+		start += len;
+		if (*start == '/') {
+			start++;
+		}
+	}
+	return id;
+}
+
+size_t ps_build_path(pathstore ps, path_id id, char *buf, size_t buflen) {
+	if (!ps_is_valid(ps, id)) {
+		if (buflen > 0) {
+			buf[0] = 0;
+		}
+		return 0;
+	}
+
+	/* First pass: find the length of the full path */
+	int root_sep = root_needs_separator(ps);
+	size_t path_len = 0;
+	path_id curr;
+	for (curr = id; curr != PATH_ID_NONE; curr = ps->nodes[curr].parent) {
+		path_len += ps->nodes[curr].name_len;
+		path_id parent = ps->nodes[curr].parent;
+		if (parent != PATH_ID_NONE && (parent != PATH_ID_ROOT || root_sep)) {
+			path_len++;
+		}
+	}
+
+	if (buflen == 0) {
+		return path_len;
+	}
+
+	/* Second pass: fill the components from the end, skipping what does not fit */
+	size_t end = path_len;
+	buf[(path_len < buflen) ? path_len : buflen - 1] = 0;
+	for (curr = id; curr != PATH_ID_NONE; curr = ps->nodes[curr].parent) {
+		struct ps_node *node = &ps->nodes[curr];
+		size_t start = end - node->name_len;
+		for (size_t i = 0; i < node->name_len; i++) {
+			if (start + i < buflen - 1) {
+				buf[start + i] = ps->names[node->name_off + i];
+			}
+		}
+		end = start;
+		if (node->parent != PATH_ID_NONE && (node->parent != PATH_ID_ROOT || root_sep)) {
+			end--;
+			if (end < buflen - 1) {
+				buf[end] = '/';
+			}
+		}
+	}
+	return path_len;
+}
+
+const char *ps_path(pathstore ps, path_id id) {
+	if (!ps_is_valid(ps, id)) {
+		return NULL;
+	}
+	size_t path_len = ps_build_path(ps, id, ps->scratch, ps->scratch_cap);
+	if (path_len >= ps->scratch_cap) {
+		ps->scratch_cap = path_len + 1 > 256 ? path_len + 1 : 256;
+		ps->scratch = realloc(ps->scratch, ps->scratch_cap);
+		ps_build_path(ps, id, ps->scratch, ps->scratch_cap);
+	}
+	return ps->scratch;
+}
+
+char *ps_full_path(pathstore ps, path_id id) {
+	if (!ps_is_valid(ps, id)) {
+		return NULL;
+	}
+	size_t path_len = ps_build_path(ps, id, NULL, 0);
+	char *full_path = malloc(path_len + 1);
+	ps_build_path(ps, id, full_path, path_len + 1);
+	return full_path;
+}
+
+const char *ps_name(pathstore ps, path_id id, size_t *name_len) {
+	if (!ps_is_valid(ps, id)) {
+		return NULL;
+	}
+	if (name_len != NULL) {
+		*name_len = ps->nodes[id].name_len;
+	}
+	return ps->names + ps->nodes[id].name_off;
+}
+
+path_id ps_parent(pathstore ps, path_id id) {
+	return ps_is_valid(ps, id) ? ps->nodes[id].parent : PATH_ID_NONE;
+}
+
+path_id ps_first_child(pathstore ps, path_id id) {
+	return ps_is_valid(ps, id) ? ps->nodes[id].first_child : PATH_ID_NONE;
+}
+
+path_id ps_next_sibling(pathstore ps, path_id id) {
+	return ps_is_valid(ps, id) ? ps->nodes[id].next_sibling : PATH_ID_NONE;
+}
+
+int ps_is_valid(pathstore ps, path_id id) {
+	return id != PATH_ID_NONE && id <= ps->nodes_used && ps->nodes[id].in_use;
+}
+
+int ps_is_ancestor(pathstore ps, path_id ancestor, path_id id) {
+	if (!ps_is_valid(ps, ancestor) || !ps_is_valid(ps, id)) {
+		return 0;
+	}
+	for (path_id curr = id; curr != PATH_ID_NONE; curr = ps->nodes[curr].parent) {
+		if (curr == ancestor) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void ps_walk_subtree(pathstore ps, path_id id, void (*visit)(pathstore, path_id, void*), void *visit_info) {
+	if (!ps_is_valid(ps, id)) {
+		return;
+	}
+
+	path_id curr = id;
+	while (curr != PATH_ID_NONE) {
+		visit(ps, curr, visit_info);
+
+		if (ps->nodes[curr].first_child != PATH_ID_NONE) {
+			curr = ps->nodes[curr].first_child;
+			continue;
+		}
+
+		/* Climb up till an entry with a next sibling is found, without leaving the subtree */
+		while (curr != id && ps->nodes[curr].next_sibling == PATH_ID_NONE) {
+			curr = ps->nodes[curr].parent;
+		}
+		curr = (curr == id) ? PATH_ID_NONE : ps->nodes[curr].next_sibling;
+	}
+}
+
+int ps_move(pathstore ps, path_id id, path_id new_parent, const char *new_name, size_t name_len) {
+	if (id == PATH_ID_ROOT || !ps_is_valid(ps, id) || !ps_is_valid(ps, new_parent)
+			|| name_len == 0 || name_len > PS_MAX_NAME_LEN) {
+		return -1;
+	}
+
+	path_id existing = ps_lookup_child(ps, new_parent, new_name, name_len);
+	if (existing == id) {
+		return 0;
+	}
+	if (existing != PATH_ID_NONE || ps_is_ancestor(ps, id, new_parent)) {
+		return -1;
+	}
+
+	index_remove(ps, id);
+	unlink_child(ps, id);
+
+	struct ps_node *node = &ps->nodes[id];
+	if (node->name_len != name_len
+			|| memcmp(ps->names + node->name_off, new_name, name_len) != 0) {
+		size_t old_name_len = node->name_len;
+		node->name_off = store_name(ps, new_name, name_len);
+		node->name_len = name_len;
+		ps->dead_bytes += old_name_len + 1;
+	}
+
+	ps->nodes[id].parent = new_parent;
+	link_child(ps, new_parent, id);
+	index_insert(ps, id);
+	return 0;
+}
+
+void ps_remove(pathstore ps, path_id id) {
+	if (id == PATH_ID_ROOT || !ps_is_valid(ps, id)) {
+		return;
+	}
+
+	index_remove(ps, id);
+	unlink_child(ps, id);
+
+	/*
+	 * Post-order removal without a stack: always descend to the first child,
+	 * and release leaves, which makes their next sibling the first child.
+	 */
+	path_id curr = id;
+	while (1) {
+		while (ps->nodes[curr].first_child != PATH_ID_NONE) {
+			curr = ps->nodes[curr].first_child;
+		}
+		if (curr == id) {
+			free_node(ps, curr);
+			break;
+		}
+
+		path_id parent = ps->nodes[curr].parent;
+		path_id next = ps->nodes[curr].next_sibling;
+		index_remove(ps, curr);
+		ps->nodes[parent].first_child = next;
+		if (next == PATH_ID_NONE) {
+			ps->nodes[parent].last_child = PATH_ID_NONE;
+		} else {
+			ps->nodes[next].prev_sibling = PATH_ID_NONE;
+		}
+		free_node(ps, curr);
+		curr = (next != PATH_ID_NONE) ? next : parent;
+	}
+}
+
+static unsigned int hash_child(path_id parent, const char *name, size_t name_len) {
+	/* FNV-1a over the parent id and the name */
+	unsigned int hash = 2166136261u;
+	for (int i = 0; i < 4; i++) {
+		hash ^= (parent >> (i * 8)) & 0xff;
+		hash *= 16777619u;
+	}
+	for (size_t i = 0; i < name_len; i++) {
+		hash ^= (unsigned char) name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static unsigned int store_name(pathstore ps, const char *name, size_t name_len) {
+	if (ps->names_len + name_len + 1 > ps->names_cap) {
+		if (ps->dead_bytes > ps->names_len / 2) {
+			compact_names(ps);
+		}
+		while (ps->names_len + name_len + 1 > ps->names_cap) {
+			ps->names_cap <<= 1;
+		}
+		ps->names = spill_realloc(ps->names, ps->names_cap);
+	}
+
+	unsigned int name_off = ps->names_len;
+	memcpy(ps->names + name_off, name, name_len);
+	ps->names[name_off + name_len] = 0;
+	ps->names_len += name_len + 1;
+	return name_off;
+}
+
+static void compact_names(pathstore ps) {
+	char *names = spill_calloc(1, ps->names_cap);
+	size_t names_len = 0;
+	for (unsigned int id = 1; id <= ps->nodes_used; id++) {
+		struct ps_node *node = &ps->nodes[id];
+		if (node->in_use) {
+			memcpy(names + names_len, ps->names + node->name_off, node->name_len + 1);
+			node->name_off = names_len;
+			names_len += node->name_len + 1;
+		}
+	}
+	spill_free(ps->names);
+	ps->names = names;
+	ps->names_len = names_len;
+	ps->dead_bytes = 0;
+}
+
+static path_id alloc_node(pathstore ps) {
+	path_id id;
+	if (ps->free_head != PATH_ID_NONE) {
+		id = ps->free_head;
+		ps->free_head = ps->nodes[id].next_sibling;
+	} else {
+		if (ps->nodes_used + 1 >= ps->nodes_cap) {
+			unsigned int new_cap = ps->nodes_cap << 1;
+			ps->nodes = spill_realloc(ps->nodes, new_cap * sizeof(struct ps_node));
+			memset(ps->nodes + ps->nodes_cap, 0, (new_cap - ps->nodes_cap) * sizeof(struct ps_node));
+			ps->nodes_cap = new_cap;
+		}
+		id = ++ps->nodes_used;
+	}
+
+	memset(&ps->nodes[id], 0, sizeof(struct ps_node));
+	ps->nodes[id].in_use = 1;
+	ps->num_entries++;
+	return id;
+}
+
+static void index_insert(pathstore ps, path_id id) {
+	check_and_resize_index(ps);
+	struct ps_node *node = &ps->nodes[id];
+	unsigned int bucket = hash_child(node->parent, ps->names + node->name_off, node->name_len)
+			& (ps->num_buckets - 1);
+	node->hash_next = ps->buckets[bucket];
+	ps->buckets[bucket] = id;
+}
+
+static void index_remove(pathstore ps, path_id id) {
+	struct ps_node *node = &ps->nodes[id];
+	unsigned int bucket = hash_child(node->parent, ps->names + node->name_off, node->name_len)
+			& (ps->num_buckets - 1);
+	path_id *link = &ps->buckets[bucket];
+	while (*link != PATH_ID_NONE) {
+		if (*link == id) {
+			*link = node->hash_next;
+			node->hash_next = PATH_ID_NONE;
+			return;
+		}
+		link = &ps->nodes[*link].hash_next;
+	}
+}
+
+static void check_and_resize_index(pathstore ps) {
+	/* The root is not in the index */
+	unsigned int indexed = ps->num_entries - 1;
+	if (indexed <= ps->num_buckets - (ps->num_buckets >> 2)) {
+		return;
+	}
+
+	unsigned int new_size = ps->num_buckets << 1;
+	path_id *new_buckets = spill_calloc(new_size, sizeof(path_id));
+	for (unsigned int bucket = 0; bucket < ps->num_buckets; bucket++) {
+		path_id id = ps->buckets[bucket];
+		while (id != PATH_ID_NONE) {
+			struct ps_node *node = &ps->nodes[id];
+			path_id next = node->hash_next;
+			unsigned int new_bucket = hash_child(node->parent, ps->names + node->name_off,
+					node->name_len) & (new_size - 1);
+			node->hash_next = new_buckets[new_bucket];
+			new_buckets[new_bucket] = id;
+			id = next;
+		}
+	}
+	spill_free(ps->buckets);
+	ps->buckets = new_buckets;
+	ps->num_buckets = new_size;
+}
+
+static void link_child(pathstore ps, path_id parent, path_id id) {
+	struct ps_node *pnode = &ps->nodes[parent];
+	ps->nodes[id].next_sibling = PATH_ID_NONE;
+	ps->nodes[id].prev_sibling = pnode->last_child;
+	if (pnode->last_child != PATH_ID_NONE) {
+		ps->nodes[pnode->last_child].next_sibling = id;
+	} else {
+		pnode->first_child = id;
+	}
+	pnode->last_child = id;
+}
+
+static void unlink_child(pathstore ps, path_id id) {
+	struct ps_node *node = &ps->nodes[id];
+	struct ps_node *pnode = &ps->nodes[node->parent];
+	if (node->prev_sibling != PATH_ID_NONE) {
+		ps->nodes[node->prev_sibling].next_sibling = node->next_sibling;
+	} else {
+		pnode->first_child = node->next_sibling;
+	}
+	if (node->next_sibling != PATH_ID_NONE) {
+		ps->nodes[node->next_sibling].prev_sibling = node->prev_sibling;
+	} else {
+		pnode->last_child = node->prev_sibling;
+	}
+	node->next_sibling = PATH_ID_NONE;
+	node->prev_sibling = PATH_ID_NONE;
+}
+
+static void free_node(pathstore ps, path_id id) {
+	ps->dead_bytes += ps->nodes[id].name_len + 1;
+	memset(&ps->nodes[id], 0, sizeof(struct ps_node));
+	ps->nodes[id].next_sibling = ps->free_head;
+	ps->free_head = id;
+	ps->num_entries--;
+}
+
+static int root_needs_separator(pathstore ps) {
+	struct ps_node *root = &ps->nodes[PATH_ID_ROOT];
+	return root->name_len > 0 && ps->names[root->name_off + root->name_len - 1] != '/';
+}
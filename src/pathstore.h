@@ -0,0 +1,179 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_PATHSTORE_H
+#define GOODRV_PATHSTORE_H
+
+#include <stddef.h>
+
+/*
+ * Interned store of the paths in a File System Hierarchy.
+ *
+ * Every entry is a (parent id, name) pair kept in flat arrays, so a path
+ * component is stored only once no matter how many descendants it has.
+ * Full paths are built on demand from the parent chain.
+ */
+typedef struct pathstore *pathstore;
+
+/* Identifier of an entry in the path store */
+typedef unsigned int path_id;
+
+/* Invalid / absent entry */
+#define PATH_ID_NONE ((path_id) 0)
+/* The root of the path store */
+#define PATH_ID_ROOT ((path_id) 1)
+
+/*
+ * Create a path store.
+ *
+ * root_path - Path of the root entry. The paths built from the store are
+ * 			   prefixed with it.
+ */
+pathstore ps_create(const char *root_path);
+
+/*
+ * Free the path store and all its entries.
+ */
+void ps_destroy(pathstore ps);
+
+/*
+ * Get the number of entries in the path store, including the root.
+ */
+unsigned int ps_num_entries(pathstore ps);
+
+/*
+ * Get the upper bound of the ids in use. Every valid id is less than it, so it
+ * can be used to size arrays indexed by path_id.
+ */
+path_id ps_id_limit(pathstore ps);
+
+/*
+ * Get the number of bytes held by the path store.
+ */
+size_t ps_memory_usage(pathstore ps);
+
+/*
+ * Get the entry for the child with the given name, inserting it when it does
+ * not exist yet. Returns PATH_ID_NONE if the parent is not a valid entry.
+ *
+ * name - Name of the child (a single path component, not null terminated).
+ * name_len - Length of the name.
+ */
+path_id ps_intern(pathstore ps, path_id parent, const char *name, size_t name_len);
+
+/*
+ * Find the child of the parent with the given name, in constant time.
+ * Returns PATH_ID_NONE if there is no such child.
+ */
+path_id ps_lookup_child(pathstore ps, path_id parent, const char *name, size_t name_len);
+
+/*
+ * Intern every component of the relative path under the parent, and return the
+ * entry for the last component. Empty components are skipped.
+ */
+path_id ps_intern_path(pathstore ps, path_id parent, const char *rel_path);
+
+/*
+ * Find the entry for the relative path under the parent.
+ * Returns PATH_ID_NONE if any component is missing.
+ */
+path_id ps_lookup_path(pathstore ps, path_id parent, const char *rel_path);
+
+/*
+ * Build the full path of the entry into buf. At most buflen bytes (including
+ * the null character) are written.
+ *
+ * Returns the length of the full path (excluding the null character), like
+ * snprintf. If the return value is >= buflen, the path was truncated. Returns 0
+ * for an invalid entry.
+ */
+size_t ps_build_path(pathstore ps, path_id id, char *buf, size_t buflen);
+
+/*
+ * Get the full path of the entry in a scratch buffer owned by the path store.
+ * The buffer is overwritten by the next call. Returns NULL for an invalid entry.
+ */
+const char *ps_path(pathstore ps, path_id id);
+
+/*
+ * Get the full path of the entry in newly allocated memory.
+ */
+char *ps_full_path(pathstore ps, path_id id);
+
+/*
+ * Get the name (last component) of the entry. For the root, this is the root path.
+ */
+const char *ps_name(pathstore ps, path_id id, size_t *name_len);
+
+/*
+ * Get the parent of the entry. Returns PATH_ID_NONE for the root.
+ */
+path_id ps_parent(pathstore ps, path_id id);
+
+/*
+ * Get the first child of the entry. Returns PATH_ID_NONE if it has no children.
+ */
+path_id ps_first_child(pathstore ps, path_id id);
+
+/*
+ * Get the next sibling of the entry. Returns PATH_ID_NONE for the last child.
+ * Children are enumerated in the order they were interned.
+ */
+path_id ps_next_sibling(pathstore ps, path_id id);
+
+/*
+ * Check whether the entry id is currently present in the path store.
+ */
+int ps_is_valid(pathstore ps, path_id id);
+
+/*
+ * Check whether the entry is the ancestor of (or same as) the other entry.
+ */
+int ps_is_ancestor(pathstore ps, path_id ancestor, path_id id);
+
+/*
+ * Visit the entry and all of its descendants in pre-order (every entry is
+ * visited before its children). The walk is iterative, so arbitrarily deep
+ * hierarchies do not grow the stack.
+ *
+ * The visitor must not add or remove entries of the subtree being walked.
+ */
+void ps_walk_subtree(pathstore ps, path_id id, void (*visit)(pathstore, path_id, void*), void *visit_info);
+
+/*
+ * Move the entry (with its whole subtree) under the new parent, with the new name.
+ * The descendants keep their ids, so renaming a directory costs the same
+ * irrespective of its size.
+ *
+ * Returns 0 on success. Returns -1 if an entry with the new name already exists
+ * under the new parent, or if the new parent is within the moved subtree.
+ */
+int ps_move(pathstore ps, path_id id, path_id new_parent, const char *new_name, size_t name_len);
+
+/*
+ * Remove the entry and all of its descendants. The root cannot be removed.
+ */
+void ps_remove(pathstore ps, path_id id);
+
+#endif /* GOODRV_PATHSTORE_H */
@@ -0,0 +1,462 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pool.h"
+
+/* Tasks a deque holds before it first grows */
+#define DEQUE_INITIAL_CAPACITY 64
+/* Longest a waiting worker sleeps, when the tasks of its group run elsewhere */
+#define HELP_WAIT_NS 1000000
+
+/*
+ * A queued task
+ */
+struct pool_task {
+	void (*run)(void *arg);
+	void (*discard)(void *arg);
+	void *arg;
+	pool_group group;
+};
+
+/*
+ * Deque of tasks, as a growable ring guarded by a lock. The owner pushes and
+ * pops at the bottom, and thieves take from the top, so the lock is only
+ * contended when a thief comes.
+ */
+struct task_deque {
+	struct pool_task **tasks;
+	size_t capacity;
+	/* Index of the oldest task */
+	size_t top;
+	size_t size;
+	pthread_mutex_t lock;
+};
+
+struct pool_worker {
+	struct pool *pool;
+	enum pool_lane lane;
+	pthread_t thread;
+	/* For choosing the first victim to steal from */
+	unsigned int seed;
+	struct task_deque deque;
+};
+
+/*
+ * Workers of a lane, and how they sleep. A worker sleeps only when no task
+ * is queued in the lane; a submitter wakes one only when some sleep. Both
+ * counts are sequentially consistent, so that either the worker sees the
+ * task, or the submitter sees the worker sleeping.
+ */
+struct pool_lane_state {
+	struct pool_worker *workers;
+	unsigned int num_workers;
+	/* Tasks submitted from outside the lane's workers */
+	struct task_deque shared;
+	/* Tasks queued in all the deques of the lane */
+	unsigned long queued;
+	unsigned int sleepers;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+struct pool {
+	struct pool_lane_state lanes[POOL_NUM_LANES];
+	/* Set when the pool is destroyed: the workers exit once the lane is empty */
+	int stopping;
+};
+
+struct pool_group {
+	struct pool *pool;
+	int cancelled;
+	/* Tasks submitted and not yet run (or dropped) */
+	unsigned long pending;
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+};
+
+/* Worker running on the calling thread, NULL on other threads */
+static __thread struct pool_worker *current_worker;
+
+/* Start the workers of a lane. Returns the number started */
+static unsigned int start_lane(struct pool *pool, enum pool_lane lane, unsigned int num_workers, int pin);
+/* Stop the workers of a lane, after the remaining tasks */
+static void stop_lane(struct pool *pool, enum pool_lane lane, unsigned int num_started);
+/* Main loop of a worker */
+static void *worker_main(void *arg);
+/* Take a task for the worker (NULL for another thread): its own, a shared one, or a stolen one */
+static struct pool_task *find_task(struct pool_lane_state *state, struct pool_worker *worker);
+/* Run the task (or drop it if its group was cancelled), and free it */
+static void run_task(struct pool_task *task);
+/* Get the number of tasks of the group not yet done */
+static unsigned long group_pending(pool_group group);
+static void deque_init(struct task_deque *deque);
+static void deque_destroy(struct task_deque *deque);
+static void deque_push_bottom(struct task_deque *deque, struct pool_task *task);
+static struct pool_task *deque_pop_bottom(struct task_deque *deque);
+static struct pool_task *deque_steal_top(struct task_deque *deque);
+
+void pool_default_options(struct pool_options *options) {
+	memset(options, 0, sizeof(struct pool_options));
+	options->io_workers = POOL_DEFAULT_IO_WORKERS;
+}
+
+pool pool_create(struct pool_options *options) {
+	struct pool_options default_options;
+	if (options == NULL) {
+		pool_default_options(&default_options);
+		options = &default_options;
+	}
+	unsigned int num_workers[POOL_NUM_LANES];
+	num_workers[POOL_COMPUTE] = options->compute_workers;
+	if (num_workers[POOL_COMPUTE] == 0) {
+		cpu_set_t cpus;
+		num_workers[POOL_COMPUTE] = (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) ? CPU_COUNT(&cpus) : 1;
+	}
+	num_workers[POOL_IO] = (options->io_workers > 0) ? options->io_workers : POOL_DEFAULT_IO_WORKERS;
+
+	struct pool *pool = calloc(1, sizeof(struct pool));
+	for (int lane = 0; lane < POOL_NUM_LANES; lane++) {
+		unsigned int started = start_lane(pool, lane, num_workers[lane],
+				lane == POOL_COMPUTE && options->pin_compute);
+		if (started < num_workers[lane]) {
+			stop_lane(pool, lane, started);
+			while (--lane >= 0) {
+				stop_lane(pool, lane, num_workers[lane]);
+			}
+			free(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void pool_destroy(pool pool) {
+	if (pool == NULL) {
+		return;
+	}
+	for (int lane = 0; lane < POOL_NUM_LANES; lane++) {
+		stop_lane(pool, lane, pool->lanes[lane].num_workers);
+	}
+	free(pool);
+}
+
+unsigned int pool_num_workers(pool pool, enum pool_lane lane) {
+	return pool->lanes[lane].num_workers;
+}
+
+pool_group pool_group_create(pool pool) {
+	pool_group group = malloc(sizeof(struct pool_group));
+	group->pool = pool;
+	group->cancelled = 0;
+	group->pending = 0;
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->done, NULL);
+	return group;
+}
+
+void pool_group_destroy(pool_group group) {
+	if (group != NULL) {
+		pool_group_wait(group);
+		pthread_mutex_destroy(&group->lock);
+		pthread_cond_destroy(&group->done);
+		free(group);
+	}
+}
+
+int pool_submit(pool_group group, enum pool_lane lane, void (*run)(void *arg),
+		void (*discard)(void *arg), void *arg) {
+	if (pool_group_cancelled(group)) {
+		return -1;
+	}
+	struct pool_task *task = malloc(sizeof(struct pool_task));
+	task->run = run;
+	task->discard = discard;
+	task->arg = arg;
+	task->group = group;
+	pthread_mutex_lock(&group->lock);
+	group->pending++;
+	pthread_mutex_unlock(&group->lock);
+
+	struct pool_lane_state *state = &group->pool->lanes[lane];
+	struct pool_worker *worker = current_worker;
+	if (worker != NULL && worker->pool == group->pool && worker->lane == lane) {
+		deque_push_bottom(&worker->deque, task);
+	} else {
+		deque_push_bottom(&state->shared, task);
+	}
+	__atomic_fetch_add(&state->queued, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&state->sleepers, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&state->lock);
+		pthread_cond_signal(&state->wake);
+		pthread_mutex_unlock(&state->lock);
+	}
+	return 0;
+}
+
+void pool_group_cancel(pool_group group) {
+	__atomic_store_n(&group->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+int pool_group_cancelled(pool_group group) {
+	return __atomic_load_n(&group->cancelled, __ATOMIC_ACQUIRE);
+}
+
+int pool_group_wait(pool_group group) {
+	struct pool_worker *worker = current_worker;
+	if (worker != NULL && worker->pool == group->pool) {
+		/* Blocking here could take the last worker that would run the tasks */
+		struct pool_lane_state *state = &group->pool->lanes[worker->lane];
+		while (group_pending(group) > 0) {
+			struct pool_task *task = find_task(state, worker);
+			if (task != NULL) {
+				run_task(task);
+				continue;
+			}
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += HELP_WAIT_NS;
+			if (until.tv_nsec >= 1000000000) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000;
+			}
+			pthread_mutex_lock(&group->lock);
+			if (group->pending > 0) {
+				pthread_cond_timedwait(&group->done, &group->lock, &until);
+			}
+			pthread_mutex_unlock(&group->lock);
+		}
+	} else {
+		pthread_mutex_lock(&group->lock);
+		while (group->pending > 0) {
+			pthread_cond_wait(&group->done, &group->lock);
+		}
+		pthread_mutex_unlock(&group->lock);
+	}
+	return pool_group_cancelled(group) ? -1 : 0;
+}
+
+static unsigned int start_lane(struct pool *pool, enum pool_lane lane, unsigned int num_workers, int pin) {
+	struct pool_lane_state *state = &pool->lanes[lane];
+	/* Every deque is ready before the first worker may steal from it */
+	state->workers = calloc(num_workers, sizeof(struct pool_worker));
+	state->num_workers = num_workers;
+	for (unsigned int i = 0; i < num_workers; i++) {
+		state->workers[i].pool = pool;
+		state->workers[i].lane = lane;
+		state->workers[i].seed = i + 1;
+		deque_init(&state->workers[i].deque);
+	}
+	deque_init(&state->shared);
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->wake, NULL);
+
+	cpu_set_t allowed;
+	int num_cpus = 0;
+	if (pin && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+		num_cpus = CPU_COUNT(&allowed);
+	}
+	unsigned int started;
+	for (started = 0; started < num_workers; started++) {
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (num_cpus > 0) {
+			/* The i-th allowed CPU, round robin */
+			int nth = started % num_cpus;
+			int cpu = 0;
+			while (!CPU_ISSET(cpu, &allowed) || nth-- > 0) {
+				cpu++;
+			}
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu, &cpus);
+			pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		}
+		int result = pthread_create(&state->workers[started].thread, &attr, &worker_main,
+				&state->workers[started]);
+		pthread_attr_destroy(&attr);
+		if (result != 0) {
+			break;
+		}
+	}
+	return started;
+}
+
+static void stop_lane(struct pool *pool, enum pool_lane lane, unsigned int num_started) {
+	struct pool_lane_state *state = &pool->lanes[lane];
+	pthread_mutex_lock(&state->lock);
+	__atomic_store_n(&pool->stopping, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&state->wake);
+	pthread_mutex_unlock(&state->lock);
+	for (unsigned int i = 0; i < num_started; i++) {
+		pthread_join(state->workers[i].thread, NULL);
+	}
+	/* Only now no worker can be stealing from the deques */
+	for (unsigned int i = 0; i < state->num_workers; i++) {
+		deque_destroy(&state->workers[i].deque);
+	}
+	deque_destroy(&state->shared);
+	pthread_mutex_destroy(&state->lock);
+	pthread_cond_destroy(&state->wake);
+	free(state->workers);
+}
+
+static void *worker_main(void *arg) {
+	struct pool_worker *worker = arg;
+	struct pool *pool = worker->pool;
+	struct pool_lane_state *state = &pool->lanes[worker->lane];
+	current_worker = worker;
+	for (;;) {
+		struct pool_task *task = find_task(state, worker);
+		if (task != NULL) {
+			run_task(task);
+			continue;
+		}
+
+		pthread_mutex_lock(&state->lock);
+		__atomic_fetch_add(&state->sleepers, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&state->queued, __ATOMIC_SEQ_CST) == 0
+				&& !__atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST)) {
+			pthread_cond_wait(&state->wake, &state->lock);
+		}
+		__atomic_fetch_sub(&state->sleepers, 1, __ATOMIC_SEQ_CST);
+		int stop = __atomic_load_n(&state->queued, __ATOMIC_SEQ_CST) == 0
+				&& __atomic_load_n(&pool->stopping, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&state->lock);
+		if (stop) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static struct pool_task *find_task(struct pool_lane_state *state, struct pool_worker *worker) {
+	struct pool_task *task = NULL;
+	if (worker != NULL) {
+		task = deque_pop_bottom(&worker->deque);
+	}
+	if (task == NULL) {
+		task = deque_steal_top(&state->shared);
+	}
+	if (task == NULL && state->num_workers > 0) {
+		unsigned int first = (worker != NULL) ? rand_r(&worker->seed) % state->num_workers : 0;
+		for (unsigned int i = 0; i < state->num_workers && task == NULL; i++) {
+			struct pool_worker *victim = &state->workers[(first + i) % state->num_workers];
+			if (victim != worker) {
+				task = deque_steal_top(&victim->deque);
+			}
+		}
+	}
+	if (task != NULL) {
+		__atomic_fetch_sub(&state->queued, 1, __ATOMIC_SEQ_CST);
+	}
+	return task;
+}
+
+static void run_task(struct pool_task *task) {
+	pool_group group = task->group;
+	if (pool_group_cancelled(group)) {
+		if (task->discard != NULL) {
+			task->discard(task->arg);
+		}
+	} else {
+		task->run(task->arg);
+	}
+	free(task);
+
+	/* The waiter may free the group as soon as the lock is released */
+	pthread_mutex_lock(&group->lock);
+	if (--group->pending == 0) {
+		pthread_cond_broadcast(&group->done);
+	}
+	pthread_mutex_unlock(&group->lock);
+}
+
+static unsigned long group_pending(pool_group group) {
+	pthread_mutex_lock(&group->lock);
+	unsigned long pending = group->pending;
+	pthread_mutex_unlock(&group->lock);
+	return pending;
+}
+
+static void deque_init(struct task_deque *deque) {
+	deque->capacity = DEQUE_INITIAL_CAPACITY;
+	deque->tasks = malloc(deque->capacity * sizeof(struct pool_task *));
+	deque->top = 0;
+	deque->size = 0;
+	pthread_mutex_init(&deque->lock, NULL);
+}
+
+static void deque_destroy(struct task_deque *deque) {
+	free(deque->tasks);
+	pthread_mutex_destroy(&deque->lock);
+}
+
+static void deque_push_bottom(struct task_deque *deque, struct pool_task *task) {
+	pthread_mutex_lock(&deque->lock);
+	if (deque->size == deque->capacity) {
+		/* Unwrap the ring into the bigger array */
+		struct pool_task **tasks = malloc(2 * deque->capacity * sizeof(struct pool_task *));
+		for (size_t i = 0; i < deque->size; i++) {
+			tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+		}
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->capacity *= 2;
+		deque->top = 0;
+	}
+	deque->tasks[(deque->top + deque->size) % deque->capacity] = task;
+	deque->size++;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+static struct pool_task *deque_pop_bottom(struct task_deque *deque) {
+	struct pool_task *task = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->size > 0) {
+		deque->size--;
+		task = deque->tasks[(deque->top + deque->size) % deque->capacity];
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
+
+static struct pool_task *deque_steal_top(struct task_deque *deque) {
+	struct pool_task *task = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->size > 0) {
+		task = deque->tasks[deque->top];
+		deque->top = (deque->top + 1) % deque->capacity;
+		deque->size--;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return task;
+}
@@ -0,0 +1,141 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_POOL_H
+#define GOODRV_POOL_H
+
+/* Blocking I/O workers when none are asked for */
+#define POOL_DEFAULT_IO_WORKERS 4
+
+/*
+ * Lanes of the pool, each with workers of its own, so that tasks blocked on
+ * I/O never take the workers of the CPU bound tasks.
+ */
+enum pool_lane {
+	/* CPU bound tasks, such as hashing and signing */
+	POOL_COMPUTE,
+	/* Tasks that block, such as reading files */
+	POOL_IO,
+	POOL_NUM_LANES
+};
+
+/*
+ * How the pool is set up
+ * compute_workers - Workers of the compute lane, 0 for one per CPU the
+ * 					 process may run on.
+ * io_workers - Workers of the I/O lane, 0 for POOL_DEFAULT_IO_WORKERS.
+ * pin_compute - If non zero, each compute worker is pinned to one of the CPUs
+ * 				 the process may run on, in order, so that its caches (and
+ * 				 its NUMA node) stay the same.
+ */
+struct pool_options {
+	unsigned int compute_workers;
+	unsigned int io_workers;
+	int pin_compute;
+};
+
+/*
+ * Work-stealing thread pool. Every worker has a deque of its own: the tasks
+ * it submits go to the bottom of its deque and are taken back from there,
+ * newest first, while idle workers of the same lane steal from the top of
+ * the others' deques. Tasks submitted from other threads go to a queue shared
+ * by the lane.
+ */
+typedef struct pool *pool;
+
+/*
+ * Group of tasks that are waited on, or cancelled, together.
+ */
+typedef struct pool_group *pool_group;
+
+/*
+ * Fill the options with the defaults: a compute worker per CPU, unpinned,
+ * and POOL_DEFAULT_IO_WORKERS I/O workers.
+ */
+void pool_default_options(struct pool_options *options);
+
+/*
+ * Create a pool with its workers. Returns NULL if the workers cannot be
+ * started.
+ *
+ * options - NULL for the defaults.
+ */
+pool pool_create(struct pool_options *options);
+
+/*
+ * Run the remaining tasks, stop the workers, and free the pool. The lanes
+ * stop one after the other, so the groups whose tasks hop across lanes must
+ * be waited on first.
+ */
+void pool_destroy(pool pool);
+
+/*
+ * Get the number of workers of a lane.
+ */
+unsigned int pool_num_workers(pool pool, enum pool_lane lane);
+
+/*
+ * Create a group of tasks on the pool.
+ */
+pool_group pool_group_create(pool pool);
+
+/*
+ * Wait for the tasks of the group, and free it.
+ */
+void pool_group_destroy(pool_group group);
+
+/*
+ * Queue a task of the group on the lane. A worker calls run with arg.
+ * Tasks may submit more tasks to their group, or to other groups.
+ *
+ * discard - Called with arg instead of run, if the group is cancelled before
+ * 			 the task starts, so that arg can be released. May be NULL.
+ *
+ * Returns 0 on success, and -1 if the group has been cancelled, in which
+ * case the task is not queued (and discard is not called).
+ */
+int pool_submit(pool_group group, enum pool_lane lane, void (*run)(void *arg),
+		void (*discard)(void *arg), void *arg);
+
+/*
+ * Cancel the group. The tasks that have not started are dropped, and the
+ * running ones can stop early by checking pool_group_cancelled.
+ */
+void pool_group_cancel(pool_group group);
+
+/*
+ * Check whether the group has been cancelled.
+ */
+int pool_group_cancelled(pool_group group);
+
+/*
+ * Wait till every task of the group has run (or been dropped). A worker of
+ * the pool that waits runs the queued tasks meanwhile, so that tasks can wait
+ * for the groups they start.
+ *
+ * Returns 0 if all the tasks ran, and -1 if the group was cancelled.
+ */
+int pool_group_wait(pool_group group);
+
+#endif /* GOODRV_POOL_H */
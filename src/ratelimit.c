@@ -0,0 +1,67 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ratelimit.h"
+
+/* Add the tokens that accrued since the last update */
+static void tb_refill(struct token_bucket *bucket);
+
+void tb_init(struct token_bucket *bucket, double rate, double burst) {
+	bucket->rate = rate;
+	bucket->burst = (burst > 0) ? burst : 1;
+	bucket->tokens = bucket->burst;
+	clock_gettime(CLOCK_MONOTONIC, &bucket->last);
+}
+
+double tb_delay(struct token_bucket *bucket, double amount) {
+	if (bucket->rate <= 0) {
+		return 0;
+	}
+	tb_refill(bucket);
+	if (bucket->tokens >= amount) {
+		return 0;
+	}
+	return (amount - bucket->tokens) / bucket->rate;
+}
+
+double tb_take(struct token_bucket *bucket, double amount) {
+	if (bucket->rate <= 0) {
+		return 0;
+	}
+	tb_refill(bucket);
+	bucket->tokens -= amount;
+	return (bucket->tokens < 0) ? -bucket->tokens / bucket->rate : 0;
+}
+
+static void tb_refill(struct token_bucket *bucket) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - bucket->last.tv_sec) + (now.tv_nsec - bucket->last.tv_nsec) / 1e9;
+	bucket->last = now;
+	bucket->tokens += elapsed * bucket->rate;
+	if (bucket->tokens > bucket->burst) {
+		bucket->tokens = bucket->burst;
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_RATELIMIT_H
+#define GOODRV_RATELIMIT_H
+
+#include <time.h>
+
+/*
+ * Token bucket. Tokens accrue at rate per second, up to burst, and are taken
+ * for the work done. Taking more than there are leaves the bucket in debt,
+ * which the following work has to wait out.
+ *
+ * Not thread safe; the users guard it with their own locks.
+ */
+struct token_bucket {
+	/* Tokens per second, 0 for no limit */
+	double rate;
+	double burst;
+	double tokens;
+	/* When the tokens were last brought up to date */
+	struct timespec last;
+};
+
+/*
+ * Initialise a full bucket. A rate of 0 means no limit.
+ */
+void tb_init(struct token_bucket *bucket, double rate, double burst);
+
+/*
+ * Get the seconds to wait till amount tokens are available, 0 if they are
+ * available now.
+ */
+double tb_delay(struct token_bucket *bucket, double amount);
+
+/*
+ * Take amount tokens, even if there are not enough. Returns the seconds the
+ * caller should wait for the debt to be paid off, 0 if there was no debt.
+ */
+double tb_take(struct token_bucket *bucket, double amount);
+
+#endif /* GOODRV_RATELIMIT_H */
@@ -0,0 +1,306 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "reactor.h"
+
+/* Events taken from epoll at a time */
+#define REACTOR_MAX_EVENTS 64
+
+/*
+ * A File Descriptor or a timer watched by the loop
+ */
+struct reactor_source {
+	int fd;
+	int is_timer;
+	reactor_handler handler;
+	void *arg;
+	/*
+	 * Set when the source is removed. It is freed only after the events
+	 * already taken from epoll are handled, since they may refer to it.
+	 */
+	int removed;
+	struct reactor_source *next;
+};
+
+/*
+ * A callback posted to the loop
+ */
+struct reactor_call {
+	void (*fn)(void *arg);
+	void *arg;
+	struct reactor_call *next;
+};
+
+struct reactor {
+	int epoll_fd;
+	/* eventfd that wakes the loop for the posted callbacks, and to stop */
+	int wake_fd;
+	struct reactor_source *sources;
+	/* Removed sources, to be freed after the current events */
+	struct reactor_source *removed;
+
+	/* Guards the posted callbacks and stopping */
+	pthread_mutex_t lock;
+	struct reactor_call *calls_head;
+	struct reactor_call *calls_tail;
+	int stopping;
+};
+
+/* Add a source to the epoll instance and the list */
+static int add_source(reactor loop, int fd, int is_timer, uint32_t events, reactor_handler handler,
+		void *arg);
+/* Remove the source with the File Descriptor, returning it, or NULL */
+static struct reactor_source *remove_source(reactor loop, int fd);
+/* Run the posted callbacks */
+static void run_calls(reactor loop);
+/* Free the removed sources */
+static void free_removed(reactor loop);
+/* Wake the loop */
+static void wake(reactor loop);
+
+reactor reactor_create() {
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1) {
+		return NULL;
+	}
+	int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	struct epoll_event event = { EPOLLIN, { NULL } };
+	if (wake_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+		if (wake_fd != -1) {
+			close(wake_fd);
+		}
+		close(epoll_fd);
+		return NULL;
+	}
+
+	reactor loop = calloc(1, sizeof(struct reactor));
+	loop->epoll_fd = epoll_fd;
+	loop->wake_fd = wake_fd;
+	pthread_mutex_init(&loop->lock, NULL);
+	return loop;
+}
+
+void reactor_destroy(reactor loop) {
+	if (loop == NULL) {
+		return;
+	}
+	while (loop->sources != NULL) {
+		struct reactor_source *source = remove_source(loop, loop->sources->fd);
+		if (source->is_timer) {
+			close(source->fd);
+		}
+	}
+	free_removed(loop);
+	while (loop->calls_head != NULL) {
+		struct reactor_call *call = loop->calls_head;
+		loop->calls_head = call->next;
+		free(call);
+	}
+	close(loop->wake_fd);
+	close(loop->epoll_fd);
+	pthread_mutex_destroy(&loop->lock);
+	free(loop);
+}
+
+int reactor_add(reactor loop, int fd, uint32_t events, reactor_handler handler, void *arg) {
+	return add_source(loop, fd, 0, events, handler, arg);
+}
+
+int reactor_remove(reactor loop, int fd) {
+	return (remove_source(loop, fd) != NULL) ? 0 : -1;
+}
+
+int reactor_add_timer(reactor loop, reactor_handler handler, void *arg) {
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer == -1) {
+		return -1;
+	}
+	if (add_source(loop, timer, 1, EPOLLIN, handler, arg) != 0) {
+		close(timer);
+		return -1;
+	}
+	return timer;
+}
+
+int reactor_arm_timer(reactor loop, int timer, unsigned long first_ms, unsigned long interval_ms) {
+	struct itimerspec spec;
+	spec.it_value.tv_sec = first_ms / 1000;
+	spec.it_value.tv_nsec = (first_ms % 1000) * 1000000;
+	spec.it_interval.tv_sec = interval_ms / 1000;
+	spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+	return timerfd_settime(timer, 0, &spec, NULL);
+}
+
+void reactor_remove_timer(reactor loop, int timer) {
+	if (remove_source(loop, timer) != NULL) {
+		close(timer);
+	}
+}
+
+int reactor_post(reactor loop, void (*fn)(void *arg), void *arg) {
+	struct reactor_call *call = malloc(sizeof(struct reactor_call));
+	if (call == NULL) {
+		return -1;
+	}
+	call->fn = fn;
+	call->arg = arg;
+	call->next = NULL;
+	pthread_mutex_lock(&loop->lock);
+	if (loop->calls_tail != NULL) {
+		loop->calls_tail->next = call;
+	} else {
+		loop->calls_head = call;
+	}
+	loop->calls_tail = call;
+	pthread_mutex_unlock(&loop->lock);
+	wake(loop);
+	return 0;
+}
+
+int reactor_run(reactor loop) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	while (1) {
+		pthread_mutex_lock(&loop->lock);
+		int stopping = loop->stopping;
+		loop->stopping = 0;
+		pthread_mutex_unlock(&loop->lock);
+		if (stopping) {
+			/* The callbacks posted before the stop still run */
+			run_calls(loop);
+			return 0;
+		}
+
+		int num_events = epoll_wait(loop->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+		if (num_events == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		for (int i = 0; i < num_events; i++) {
+			struct reactor_source *source = events[i].data.ptr;
+			if (source == NULL) {
+				uint64_t count;
+				if (read(loop->wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+					return -1;
+				}
+				run_calls(loop);
+				continue;
+			}
+			if (source->removed) {
+				continue;
+			}
+			if (source->is_timer) {
+				uint64_t expirations;
+				if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+					/* Rearmed or disarmed since the event was taken */
+					continue;
+				}
+			}
+			source->handler(source->arg, events[i].events);
+		}
+		free_removed(loop);
+	}
+}
+
+void reactor_stop(reactor loop) {
+	pthread_mutex_lock(&loop->lock);
+	loop->stopping = 1;
+	pthread_mutex_unlock(&loop->lock);
+	wake(loop);
+}
+
+static int add_source(reactor loop, int fd, int is_timer, uint32_t events, reactor_handler handler,
+		void *arg) {
+	struct reactor_source *source = calloc(1, sizeof(struct reactor_source));
+	source->fd = fd;
+	source->is_timer = is_timer;
+	source->handler = handler;
+	source->arg = arg;
+	struct epoll_event event;
+	event.events = events;
+	event.data.ptr = source;
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		free(source);
+		return -1;
+	}
+	source->next = loop->sources;
+	loop->sources = source;
+	return 0;
+}
+
+static struct reactor_source *remove_source(reactor loop, int fd) {
+	struct reactor_source **link = &loop->sources;
+	while (*link != NULL && (*link)->fd != fd) {
+		link = &(*link)->next;
+	}
+	struct reactor_source *source = *link;
+	if (source == NULL) {
+		return NULL;
+	}
+	*link = source->next;
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	source->removed = 1;
+	source->next = loop->removed;
+	loop->removed = source;
+	return source;
+}
+
+static void run_calls(reactor loop) {
+	pthread_mutex_lock(&loop->lock);
+	struct reactor_call *call = loop->calls_head;
+	loop->calls_head = loop->calls_tail = NULL;
+	pthread_mutex_unlock(&loop->lock);
+	while (call != NULL) {
+		struct reactor_call *next = call->next;
+		call->fn(call->arg);
+		free(call);
+		call = next;
+	}
+}
+
+static void free_removed(reactor loop) {
+	while (loop->removed != NULL) {
+		struct reactor_source *source = loop->removed;
+		loop->removed = source->next;
+		free(source);
+	}
+}
+
+static void wake(reactor loop) {
+	uint64_t one = 1;
+	/* Fails only if the counter is about to overflow, when the loop is woken anyway */
+	if (write(loop->wake_fd, &one, sizeof(one)) == -1) {
+		return;
+	}
+}
@@ -0,0 +1,113 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_REACTOR_H
+#define GOODRV_REACTOR_H
+
+#include <stdint.h>
+
+/*
+ * Event loop over epoll. The File Descriptors (e.g. inotify instances), the
+ * timers and the callbacks posted by other threads are all handled by the
+ * thread that runs the loop, which sleeps in the kernel when there is
+ * nothing to do.
+ */
+typedef struct reactor *reactor;
+
+/*
+ * Called by the loop when a File Descriptor is ready, with the epoll events,
+ * or when a timer expires, with EPOLLIN.
+ */
+typedef void (*reactor_handler)(void *arg, uint32_t events);
+
+/*
+ * Create a reactor. Returns NULL on failure.
+ */
+reactor reactor_create();
+
+/*
+ * Free the reactor, along with its timers. The other File Descriptors are
+ * left open. The callbacks that are still posted are not run.
+ */
+void reactor_destroy(reactor loop);
+
+/*
+ * Call the handler whenever the File Descriptor has any of the epoll events.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int reactor_add(reactor loop, int fd, uint32_t events, reactor_handler handler, void *arg);
+
+/*
+ * Stop watching the File Descriptor. Its handler is not called after this,
+ * even for events that are already pending.
+ *
+ * Returns 0 on success, -1 if it is not watched.
+ */
+int reactor_remove(reactor loop, int fd);
+
+/*
+ * Create a timer, disarmed, that calls the handler when it expires.
+ *
+ * Returns the timer, or -1 on failure.
+ */
+int reactor_add_timer(reactor loop, reactor_handler handler, void *arg);
+
+/*
+ * Arm the timer to expire after first_ms milliseconds, and then every
+ * interval_ms milliseconds if that is not 0. Arming a timer again replaces
+ * the previous expiry, which makes it a debounce. A first_ms of 0 disarms
+ * the timer.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int reactor_arm_timer(reactor loop, int timer, unsigned long first_ms, unsigned long interval_ms);
+
+/*
+ * Remove and free the timer.
+ */
+void reactor_remove_timer(reactor loop, int timer);
+
+/*
+ * Have the loop call fn with arg, in the order posted. May be called from
+ * any thread, e.g. by the workers as their tasks complete.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int reactor_post(reactor loop, void (*fn)(void *arg), void *arg);
+
+/*
+ * Run the loop in the calling thread, till reactor_stop.
+ *
+ * Returns 0 when stopped, -1 if the loop failed.
+ */
+int reactor_run(reactor loop);
+
+/*
+ * Make reactor_run return, once the events at hand and the callbacks posted
+ * so far are handled. May be called from any thread, or from a handler.
+ */
+void reactor_stop(reactor loop);
+
+#endif /* GOODRV_REACTOR_H */
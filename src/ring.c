@@ -0,0 +1,351 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+/* Size of a cache line, so that the indices written by each side never share one */
+#define RING_ALIGN 64
+
+/*
+ * Single producer ring: the producer owns the tail and the consumer owns the
+ * head, each on a cache line of its own, along with the last value it read
+ * of the other index, so that the other line is only read when the ring
+ * looks full (or empty). The items are published by the store of the tail.
+ */
+struct spsc_ring {
+	void **items;
+	uint64_t mask;
+	int event_fd;
+	int closed;
+	/* Written by the producer */
+	uint64_t tail __attribute__((aligned(RING_ALIGN)));
+	uint64_t head_cache;
+	/* Written by the consumer */
+	uint64_t head __attribute__((aligned(RING_ALIGN)));
+	uint64_t tail_cache;
+	/* Set by the consumer before it sleeps, cleared by the producer that wakes it */
+	int sleeping __attribute__((aligned(RING_ALIGN)));
+};
+
+/*
+ * A slot of an MPSC ring. The item at index i of the ring is ready when the
+ * sequence of its cell is i + 1.
+ */
+struct mpsc_cell {
+	uint64_t seq;
+	void *item;
+};
+
+/*
+ * Multiple producer ring: the producers claim a run of cells by moving the
+ * tail with a CAS, fill them, and publish each through its sequence. The
+ * consumer takes the ready cells in order from the head; the producers only
+ * claim cells below head + capacity, so the cells they fill have been read.
+ */
+struct mpsc_ring {
+	struct mpsc_cell *cells;
+	uint64_t mask;
+	int event_fd;
+	int closed;
+	/* Claimed by the producers */
+	uint64_t tail __attribute__((aligned(RING_ALIGN)));
+	/* Written by the consumer */
+	uint64_t head __attribute__((aligned(RING_ALIGN)));
+	/* Set by the consumer before it sleeps, cleared by the producer that wakes it */
+	int sleeping __attribute__((aligned(RING_ALIGN)));
+};
+
+/* Allocate memory aligned to a cache line, zeroed */
+static void *alloc_aligned(size_t size);
+/* Get the smallest power of two that is at least the capacity */
+static uint64_t round_capacity(unsigned int capacity);
+/*
+ * Wake the consumer if it sleeps. The items must have been published with a
+ * sequentially consistent store, so that either the consumer sees them when
+ * it arms, or the producer sees it sleeping here.
+ */
+static void wake(int *sleeping, int event_fd);
+/* Make the eventfd readable */
+static void notify(int event_fd);
+/* Wait till the eventfd is readable, and reset it */
+static void wait_event(int event_fd);
+
+spsc_ring spsc_create(unsigned int capacity) {
+	int event_fd = eventfd(0, EFD_CLOEXEC);
+	if (event_fd == -1) {
+		return NULL;
+	}
+	spsc_ring ring = alloc_aligned(sizeof(struct spsc_ring));
+	ring->mask = round_capacity(capacity) - 1;
+	ring->items = malloc((ring->mask + 1) * sizeof(void *));
+	ring->event_fd = event_fd;
+	return ring;
+}
+
+void spsc_destroy(spsc_ring ring) {
+	if (ring != NULL) {
+		close(ring->event_fd);
+		free(ring->items);
+		free(ring);
+	}
+}
+
+int spsc_push(spsc_ring ring, void *item) {
+	return (spsc_push_batch(ring, &item, 1) == 1) ? 0 : -1;
+}
+
+unsigned int spsc_push_batch(spsc_ring ring, void **items, unsigned int count) {
+	if (__atomic_load_n(&ring->closed, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	uint64_t capacity = ring->mask + 1;
+	uint64_t tail = ring->tail;
+	if (tail + count - ring->head_cache > capacity) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+	uint64_t space = capacity - (tail - ring->head_cache);
+	unsigned int n = (count < space) ? count : space;
+	if (n == 0) {
+		return 0;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		ring->items[(tail + i) & ring->mask] = items[i];
+	}
+	__atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+	wake(&ring->sleeping, ring->event_fd);
+	return n;
+}
+
+int spsc_pop(spsc_ring ring, void **item) {
+	return (spsc_pop_batch(ring, item, 1) == 1) ? 0 : -1;
+}
+
+unsigned int spsc_pop_batch(spsc_ring ring, void **items, unsigned int max) {
+	uint64_t head = ring->head;
+	if (ring->tail_cache - head < max) {
+		ring->tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	}
+	uint64_t available = ring->tail_cache - head;
+	unsigned int n = (max < available) ? max : available;
+	if (n == 0) {
+		return 0;
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		items[i] = ring->items[(head + i) & ring->mask];
+	}
+	__atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+void spsc_close(spsc_ring ring) {
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+	notify(ring->event_fd);
+}
+
+int spsc_fd(spsc_ring ring) {
+	return ring->event_fd;
+}
+
+int spsc_arm(spsc_ring ring) {
+	__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head) {
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return 0;
+}
+
+int spsc_wait(spsc_ring ring) {
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head) {
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+			/* Items pushed before the close are in place by now */
+			return (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != ring->head) ? 0 : -1;
+		}
+		if (spsc_arm(ring) == 0) {
+			wait_event(ring->event_fd);
+		}
+	}
+	return 0;
+}
+
+mpsc_ring mpsc_create(unsigned int capacity) {
+	int event_fd = eventfd(0, EFD_CLOEXEC);
+	if (event_fd == -1) {
+		return NULL;
+	}
+	mpsc_ring ring = alloc_aligned(sizeof(struct mpsc_ring));
+	ring->mask = round_capacity(capacity) - 1;
+	/* No cell is ready: the sequence of cell i is first checked against i + 1 */
+	ring->cells = alloc_aligned((ring->mask + 1) * sizeof(struct mpsc_cell));
+	ring->event_fd = event_fd;
+	return ring;
+}
+
+void mpsc_destroy(mpsc_ring ring) {
+	if (ring != NULL) {
+		close(ring->event_fd);
+		free(ring->cells);
+		free(ring);
+	}
+}
+
+int mpsc_push(mpsc_ring ring, void *item) {
+	return (mpsc_push_batch(ring, &item, 1) == 1) ? 0 : -1;
+}
+
+unsigned int mpsc_push_batch(mpsc_ring ring, void **items, unsigned int count) {
+	if (__atomic_load_n(&ring->closed, __ATOMIC_RELAXED)) {
+		return 0;
+	}
+	uint64_t capacity = ring->mask + 1;
+	uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int n;
+	for (;;) {
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if ((int64_t) (tail - head) < 0) {
+			/* The tail read is older than the head: some other producer moved it */
+			tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+			continue;
+		}
+		uint64_t space = capacity - (tail - head);
+		n = (count < space) ? count : space;
+		if (n == 0) {
+			return 0;
+		}
+		if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + n, 1, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < n; i++) {
+		struct mpsc_cell *cell = &ring->cells[(tail + i) & ring->mask];
+		cell->item = items[i];
+		__atomic_store_n(&cell->seq, tail + i + 1, __ATOMIC_SEQ_CST);
+	}
+	wake(&ring->sleeping, ring->event_fd);
+	return n;
+}
+
+int mpsc_pop(mpsc_ring ring, void **item) {
+	return (mpsc_pop_batch(ring, item, 1) == 1) ? 0 : -1;
+}
+
+unsigned int mpsc_pop_batch(mpsc_ring ring, void **items, unsigned int max) {
+	uint64_t head = ring->head;
+	unsigned int n = 0;
+	while (n < max) {
+		struct mpsc_cell *cell = &ring->cells[(head + n) & ring->mask];
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != head + n + 1) {
+			break;
+		}
+		items[n++] = cell->item;
+	}
+	if (n > 0) {
+		__atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+	}
+	return n;
+}
+
+void mpsc_close(mpsc_ring ring) {
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+	notify(ring->event_fd);
+}
+
+int mpsc_fd(mpsc_ring ring) {
+	return ring->event_fd;
+}
+
+int mpsc_arm(mpsc_ring ring) {
+	__atomic_store_n(&ring->sleeping, 1, __ATOMIC_SEQ_CST);
+	uint64_t head = ring->head;
+	if (__atomic_load_n(&ring->cells[head & ring->mask].seq, __ATOMIC_SEQ_CST) == head + 1) {
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return 0;
+}
+
+int mpsc_wait(mpsc_ring ring) {
+	for (;;) {
+		uint64_t head = ring->head;
+		struct mpsc_cell *cell = &ring->cells[head & ring->mask];
+		if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) == head + 1) {
+			return 0;
+		}
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)) {
+			/* A producer that claimed its cells before the close may still be filling them */
+			if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+				return -1;
+			}
+			continue;
+		}
+		if (mpsc_arm(ring) == 0) {
+			wait_event(ring->event_fd);
+		}
+	}
+}
+
+static void *alloc_aligned(size_t size) {
+	void *memory;
+	if (posix_memalign(&memory, RING_ALIGN, size) != 0) {
+		abort();
+	}
+	memset(memory, 0, size);
+	return memory;
+}
+
+static uint64_t round_capacity(unsigned int capacity) {
+	uint64_t size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+	return size;
+}
+
+static void wake(int *sleeping, int event_fd) {
+	if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(sleeping, 0, __ATOMIC_SEQ_CST)) {
+		notify(event_fd);
+	}
+}
+
+static void notify(int event_fd) {
+	uint64_t one = 1;
+	while (write(event_fd, &one, sizeof(one)) == -1 && errno == EINTR) {
+	}
+}
+
+static void wait_event(int event_fd) {
+	uint64_t count;
+	while (read(event_fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+	}
+}
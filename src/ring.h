@@ -0,0 +1,120 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_RING_H
+#define GOODRV_RING_H
+
+/*
+ * Bounded, lock-free FIFO rings of pointers, for handing work from one stage
+ * of a pipeline to the next. An SPSC ring has a single producer thread and a
+ * single consumer thread; an MPSC ring has any number of producers and a
+ * single consumer. Pushes and pops never block: they fail when the ring is
+ * full or empty. The consumer can wait for items, either with *_wait or
+ * through an eventfd in a reactor:
+ *
+ *	handler: read the eventfd, then
+ *		do {
+ *			while ((n = spsc_pop_batch(ring, items, max)) > 0) { ... }
+ *		} while (spsc_arm(ring) != 0);
+ *
+ * The capacity is rounded up to a power of two.
+ */
+typedef struct spsc_ring *spsc_ring;
+typedef struct mpsc_ring *mpsc_ring;
+
+/*
+ * Create a ring that holds at least capacity items.
+ * Returns NULL if the eventfd cannot be created.
+ */
+spsc_ring spsc_create(unsigned int capacity);
+mpsc_ring mpsc_create(unsigned int capacity);
+
+/*
+ * Free the ring. Items still in the ring are not freed.
+ */
+void spsc_destroy(spsc_ring ring);
+void mpsc_destroy(mpsc_ring ring);
+
+/*
+ * Add an item at the tail.
+ * Returns 0 on success, and -1 if the ring is full or has been closed.
+ */
+int spsc_push(spsc_ring ring, void *item);
+int mpsc_push(mpsc_ring ring, void *item);
+
+/*
+ * Add up to count items at the tail, in order, publishing them together.
+ * Returns the number of items added, which is less than count when the ring
+ * fills up, and 0 once it has been closed.
+ */
+unsigned int spsc_push_batch(spsc_ring ring, void **items, unsigned int count);
+unsigned int mpsc_push_batch(mpsc_ring ring, void **items, unsigned int count);
+
+/*
+ * Remove the item at the head into *item. Only the consumer may call this.
+ * Returns 0 on success, and -1 if the ring is empty.
+ */
+int spsc_pop(spsc_ring ring, void **item);
+int mpsc_pop(mpsc_ring ring, void **item);
+
+/*
+ * Remove up to max items from the head into items. Only the consumer may
+ * call this. Returns the number of items removed.
+ */
+unsigned int spsc_pop_batch(spsc_ring ring, void **items, unsigned int max);
+unsigned int mpsc_pop_batch(mpsc_ring ring, void **items, unsigned int max);
+
+/*
+ * Close the ring, once the producers are done. Pushes fail from now on, and
+ * the consumer is woken up to drain the remaining items: *_wait fails once
+ * they are drained.
+ */
+void spsc_close(spsc_ring ring);
+void mpsc_close(mpsc_ring ring);
+
+/*
+ * Get the eventfd of the ring, readable once the consumer has armed it and
+ * an item arrives (or the ring is closed). Wake ups may be spurious.
+ */
+int spsc_fd(spsc_ring ring);
+int mpsc_fd(mpsc_ring ring);
+
+/*
+ * Arm the eventfd, when the consumer has found the ring empty. Only the
+ * consumer may call this.
+ * Returns 0 if the consumer can sleep till the eventfd is readable, and -1 if
+ * items arrived meanwhile, and are to be popped.
+ */
+int spsc_arm(spsc_ring ring);
+int mpsc_arm(mpsc_ring ring);
+
+/*
+ * Wait till there is an item to pop. Only the consumer may call this.
+ * Returns 0 when there is an item, and -1 if the ring has been closed and is
+ * empty.
+ */
+int spsc_wait(spsc_ring ring);
+int mpsc_wait(mpsc_ring ring);
+
+#endif /* GOODRV_RING_H */
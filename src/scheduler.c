@@ -0,0 +1,353 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "ratelimit.h"
+#include "scheduler.h"
+
+/*
+ * A task waiting for a worker
+ */
+struct sched_task {
+	void (*run)(void *arg);
+	void *arg;
+	struct timespec submitted;
+	struct sched_task *next;
+};
+
+/*
+ * Tasks of a tenant within a class
+ */
+struct sched_flow {
+	unsigned int tenant;
+	struct sched_task *head;
+	struct sched_task *tail;
+	/* Next flow in the round */
+	struct sched_flow *next;
+};
+
+/*
+ * Queue and limits of a class. The flows with pending tasks form a ring, and
+ * take a task each in turn.
+ */
+struct sched_queue {
+	/* Flow that was served last, so the next one in the round is last->next */
+	struct sched_flow *last;
+	struct token_bucket rate;
+	struct token_bucket bandwidth;
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long pending;
+	struct histogram latency;
+};
+
+struct scheduler {
+	struct sched_policy policy;
+	struct sched_queue queues[SCHED_NUM_CLASSES];
+	struct token_bucket api_rate;
+	pthread_t *workers;
+	unsigned int num_workers;
+
+	/* Guards everything above */
+	pthread_mutex_t lock;
+	/* Signalled when a task is submitted, or the scheduler is stopping */
+	pthread_cond_t work;
+	/* Signalled when the scheduler becomes idle */
+	pthread_cond_t idle;
+	unsigned int num_running;
+	int stopping;
+};
+
+/* Run the tasks, till the scheduler is stopped */
+static void *worker_thread(void *arg);
+/*
+ * Take the next task that may run now, from the most urgent class. Otherwise
+ * returns NULL, with the seconds till one may run in *delay, or a negative
+ * delay if there is nothing to run at all. Called with the lock held.
+ */
+static struct sched_task *take_task(scheduler sched, enum sched_class *class, double *delay);
+/* Take the task at the head of the next flow in the round. Called with the lock held. */
+static struct sched_task *take_flow_task(struct sched_queue *queue);
+/* Microseconds since the time */
+static uint64_t elapsed_us(struct timespec *since);
+
+void sched_default_policy(struct sched_policy *policy) {
+	memset(policy, 0, sizeof(struct sched_policy));
+	policy->small_size = 1024 * 1024;
+	policy->recent_sec = 300;
+	policy->bulk_size = 64 * 1024 * 1024;
+}
+
+scheduler sched_create(unsigned int num_workers, struct sched_policy *policy) {
+	scheduler sched = calloc(1, sizeof(struct scheduler));
+	if (policy != NULL) {
+		sched->policy = *policy;
+	} else {
+		sched_default_policy(&sched->policy);
+	}
+	for (int i = 0; i < SCHED_NUM_CLASSES; i++) {
+		struct sched_queue *queue = &sched->queues[i];
+		tb_init(&queue->rate, sched->policy.class_rate[i], sched->policy.class_burst[i]);
+		tb_init(&queue->bandwidth, sched->policy.class_bandwidth[i], sched->policy.class_bandwidth[i]);
+		hist_init(&queue->latency);
+	}
+	tb_init(&sched->api_rate, sched->policy.api_rate, sched->policy.api_burst);
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&sched->lock, NULL);
+	pthread_cond_init(&sched->work, &attr);
+	pthread_cond_init(&sched->idle, NULL);
+	pthread_condattr_destroy(&attr);
+
+	sched->workers = malloc(num_workers * sizeof(pthread_t));
+	while (sched->num_workers < num_workers
+			&& pthread_create(&sched->workers[sched->num_workers], NULL, &worker_thread, sched) == 0) {
+		sched->num_workers++;
+	}
+	if (sched->num_workers == 0) {
+		sched_destroy(sched);
+		return NULL;
+	}
+	return sched;
+}
+
+void sched_destroy(scheduler sched) {
+	if (sched == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&sched->lock);
+	sched->stopping = 1;
+	pthread_cond_broadcast(&sched->work);
+	pthread_mutex_unlock(&sched->lock);
+	for (unsigned int i = 0; i < sched->num_workers; i++) {
+		pthread_join(sched->workers[i], NULL);
+	}
+
+	free(sched->workers);
+	pthread_cond_destroy(&sched->work);
+	pthread_cond_destroy(&sched->idle);
+	pthread_mutex_destroy(&sched->lock);
+	free(sched);
+}
+
+enum sched_class sched_classify(scheduler sched, uint64_t size, time_t mtime, int pinned) {
+	if (pinned) {
+		return SCHED_PINNED;
+	}
+	if (size >= sched->policy.bulk_size) {
+		return SCHED_BULK;
+	}
+	if (size <= sched->policy.small_size && time(NULL) - mtime <= (time_t) sched->policy.recent_sec) {
+		return SCHED_INTERACTIVE;
+	}
+	return SCHED_NORMAL;
+}
+
+void sched_submit(scheduler sched, enum sched_class class, void (*run)(void *arg), void *arg) {
+	sched_submit_tenant(sched, class, 0, run, arg);
+}
+
+void sched_submit_tenant(scheduler sched, enum sched_class class, unsigned int tenant,
+		void (*run)(void *arg), void *arg) {
+	struct sched_task *task = malloc(sizeof(struct sched_task));
+	task->run = run;
+	task->arg = arg;
+	task->next = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &task->submitted);
+
+	pthread_mutex_lock(&sched->lock);
+	struct sched_queue *queue = &sched->queues[class];
+	struct sched_flow *flow = NULL;
+	if (queue->last != NULL) {
+		flow = queue->last;
+		do {
+			flow = flow->next;
+		} while (flow->tenant != tenant && flow != queue->last);
+		if (flow->tenant != tenant) {
+			flow = NULL;
+		}
+	}
+	if (flow == NULL) {
+		/* A new flow joins at the end of the round */
+		flow = calloc(1, sizeof(struct sched_flow));
+		flow->tenant = tenant;
+		if (queue->last != NULL) {
+			flow->next = queue->last->next;
+			queue->last->next = flow;
+		} else {
+			flow->next = flow;
+		}
+		queue->last = flow;
+	}
+	if (flow->tail != NULL) {
+		flow->tail->next = task;
+	} else {
+		flow->head = task;
+	}
+	flow->tail = task;
+	queue->submitted++;
+	queue->pending++;
+	pthread_cond_signal(&sched->work);
+	pthread_mutex_unlock(&sched->lock);
+}
+
+void sched_throttle(scheduler sched, enum sched_class class, uint64_t bytes) {
+	pthread_mutex_lock(&sched->lock);
+	double delay = tb_take(&sched->queues[class].bandwidth, bytes);
+	pthread_mutex_unlock(&sched->lock);
+	if (delay > 0) {
+		usleep(delay * 1e6);
+	}
+}
+
+void sched_wait_idle(scheduler sched) {
+	pthread_mutex_lock(&sched->lock);
+	while (1) {
+		unsigned long pending = 0;
+		for (int i = 0; i < SCHED_NUM_CLASSES; i++) {
+			pending += sched->queues[i].pending;
+		}
+		if (pending == 0 && sched->num_running == 0) {
+			break;
+		}
+		pthread_cond_wait(&sched->idle, &sched->lock);
+	}
+	pthread_mutex_unlock(&sched->lock);
+}
+
+void sched_get_stats(scheduler sched, enum sched_class class, struct sched_class_stats *stats) {
+	pthread_mutex_lock(&sched->lock);
+	struct sched_queue *queue = &sched->queues[class];
+	stats->submitted = queue->submitted;
+	stats->completed = queue->completed;
+	stats->pending = queue->pending;
+	stats->latency_p50 = hist_percentile(&queue->latency, 50);
+	stats->latency_p90 = hist_percentile(&queue->latency, 90);
+	stats->latency_p99 = hist_percentile(&queue->latency, 99);
+	stats->latency_max = queue->latency.max;
+	pthread_mutex_unlock(&sched->lock);
+}
+
+static void *worker_thread(void *arg) {
+	scheduler sched = arg;
+	pthread_mutex_lock(&sched->lock);
+	while (1) {
+		enum sched_class class;
+		double delay;
+		struct sched_task *task = take_task(sched, &class, &delay);
+		if (task == NULL) {
+			if (delay < 0 && sched->stopping) {
+				break;
+			}
+			if (delay < 0) {
+				pthread_cond_wait(&sched->work, &sched->lock);
+			} else {
+				/* Held back by the limits, till the tokens accrue */
+				struct timespec deadline;
+				clock_gettime(CLOCK_MONOTONIC, &deadline);
+				long nsec = deadline.tv_nsec + (long) ((delay - (long) delay) * 1e9);
+				deadline.tv_sec += (long) delay + nsec / 1000000000;
+				deadline.tv_nsec = nsec % 1000000000;
+				pthread_cond_timedwait(&sched->work, &sched->lock, &deadline);
+			}
+			continue;
+		}
+
+		sched->num_running++;
+		pthread_mutex_unlock(&sched->lock);
+		task->run(task->arg);
+		uint64_t latency = elapsed_us(&task->submitted);
+		free(task);
+		pthread_mutex_lock(&sched->lock);
+		sched->num_running--;
+
+		struct sched_queue *queue = &sched->queues[class];
+		queue->completed++;
+		hist_record(&queue->latency, latency);
+		pthread_cond_broadcast(&sched->idle);
+	}
+	pthread_mutex_unlock(&sched->lock);
+	return NULL;
+}
+
+static struct sched_task *take_task(scheduler sched, enum sched_class *class, double *delay) {
+	*delay = -1;
+	double api_delay = tb_delay(&sched->api_rate, 1);
+	for (int i = 0; i < SCHED_NUM_CLASSES; i++) {
+		struct sched_queue *queue = &sched->queues[i];
+		if (queue->last == NULL) {
+			continue;
+		}
+		double class_delay = tb_delay(&queue->rate, 1);
+		double task_delay = (class_delay > api_delay) ? class_delay : api_delay;
+		if (task_delay > 0) {
+			/* Let a less urgent class run, if its limit allows */
+			if (*delay < 0 || task_delay < *delay) {
+				*delay = task_delay;
+			}
+			continue;
+		}
+
+		struct sched_task *task = take_flow_task(queue);
+		queue->pending--;
+		tb_take(&queue->rate, 1);
+		tb_take(&sched->api_rate, 1);
+		*class = i;
+		return task;
+	}
+	return NULL;
+}
+
+static struct sched_task *take_flow_task(struct sched_queue *queue) {
+	struct sched_flow *flow = queue->last->next;
+	struct sched_task *task = flow->head;
+	flow->head = task->next;
+	if (flow->head != NULL) {
+		queue->last = flow;
+		return task;
+	}
+
+	/* The flow is drained, and leaves the round */
+	if (flow->next == flow) {
+		queue->last = NULL;
+	} else {
+		queue->last->next = flow->next;
+	}
+	free(flow);
+	return task;
+}
+
+static uint64_t elapsed_us(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000;
+}
@@ -0,0 +1,142 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_SCHEDULER_H
+#define GOODRV_SCHEDULER_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Priority classes of the sync work, from the most urgent
+ */
+enum sched_class {
+	/* Files the user has pinned */
+	SCHED_PINNED,
+	/* Small files changed recently, that the user is likely waiting on */
+	SCHED_INTERACTIVE,
+	SCHED_NORMAL,
+	/* Large files */
+	SCHED_BULK,
+	SCHED_NUM_CLASSES
+};
+
+/*
+ * How the work is classified and limited
+ * small_size, recent_sec - Files up to small_size bytes, changed within the
+ * 							last recent_sec seconds, are interactive.
+ * bulk_size - Files of at least bulk_size bytes are bulk work.
+ * class_rate, class_burst - Tasks per second started for each class, and the
+ * 							 burst allowed above that rate. 0 for no limit.
+ * class_bandwidth - Bytes per second for each class, through sched_throttle.
+ * 					 0 for no limit. The burst is a second's worth.
+ * api_rate, api_burst - Tasks per second started in all, as for the API quota.
+ */
+struct sched_policy {
+	uint64_t small_size;
+	unsigned int recent_sec;
+	uint64_t bulk_size;
+	double class_rate[SCHED_NUM_CLASSES];
+	double class_burst[SCHED_NUM_CLASSES];
+	double class_bandwidth[SCHED_NUM_CLASSES];
+	double api_rate;
+	double api_burst;
+};
+
+/*
+ * Statistics of a class. The latencies are from the submission of a task to
+ * its completion, in microseconds.
+ */
+struct sched_class_stats {
+	unsigned long submitted;
+	unsigned long completed;
+	unsigned long pending;
+	uint64_t latency_p50;
+	uint64_t latency_p90;
+	uint64_t latency_p99;
+	uint64_t latency_max;
+};
+
+/*
+ * Scheduler of the sync work. The tasks from the change detection are run by
+ * a set of worker threads, the most urgent class first, within the limits of
+ * each class. A class that is held back by its limit does not hold back the
+ * others.
+ */
+typedef struct scheduler *scheduler;
+
+/*
+ * Fill the policy with the defaults: no limits, files up to 1 MB changed in
+ * the last 5 minutes are interactive, and files from 64 MB are bulk work.
+ */
+void sched_default_policy(struct sched_policy *policy);
+
+/*
+ * Create a scheduler with the worker threads. Returns NULL if no worker could
+ * be started.
+ *
+ * policy - NULL for the defaults.
+ */
+scheduler sched_create(unsigned int num_workers, struct sched_policy *policy);
+
+/*
+ * Run the remaining tasks, stop the workers, and free the scheduler.
+ */
+void sched_destroy(scheduler sched);
+
+/*
+ * Get the class of the work on a file.
+ */
+enum sched_class sched_classify(scheduler sched, uint64_t size, time_t mtime, int pinned);
+
+/*
+ * Queue a task. run is called with arg by a worker thread.
+ */
+void sched_submit(scheduler sched, enum sched_class class, void (*run)(void *arg), void *arg);
+
+/*
+ * Queue a task on behalf of a tenant, such as an account. Within a class, the
+ * tenants with pending tasks take turns, so that one with a long queue does
+ * not hold up the others. sched_submit is the same as tenant 0.
+ */
+void sched_submit_tenant(scheduler sched, enum sched_class class, unsigned int tenant,
+		void (*run)(void *arg), void *arg);
+
+/*
+ * Account for bytes transferred on behalf of a class, waiting as needed to
+ * keep within the class's bandwidth. Called by the tasks as they transfer.
+ */
+void sched_throttle(scheduler sched, enum sched_class class, uint64_t bytes);
+
+/*
+ * Wait till no task is pending or running.
+ */
+void sched_wait_idle(scheduler sched);
+
+/*
+ * Get the statistics of the class.
+ */
+void sched_get_stats(scheduler sched, enum sched_class class, struct sched_class_stats *stats);
+
+#endif /* GOODRV_SCHEDULER_H */
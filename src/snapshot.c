@@ -0,0 +1,573 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <openssl/md5.h>
+
+#include "linux-api.h"
+#include "metrics.h"
+#include "snapshot.h"
+#include "spill.h"
+
+/* Identifies a snapshot file, and its format version */
+#define SNAP_FILE_MAGIC "GDRVSNAP"
+#define SNAP_FILE_VERSION 1
+/* Bytes of a file read by one task of snap_hash_contents */
+#define HASH_CHUNK_SIZE (256 * 1024)
+/* Files being hashed at once by snap_hash_contents */
+#define HASH_FILES_IN_FLIGHT 16
+
+/*
+ * Snapshot
+ */
+struct snapshot {
+	pathstore paths;
+	/* Metadata, indexed by path_id */
+	struct snap_entry *entries;
+	unsigned int entries_cap;
+};
+
+/*
+ * Header of a snapshot file. It is followed by num_records records, and then
+ * by names_size bytes of null terminated names.
+ */
+struct snap_file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_records;
+	uint64_t names_size;
+};
+
+/*
+ * A record in the snapshot file. Records are in pre-order, so the parent of a
+ * record is always an earlier record. The first record is the root.
+ */
+struct snap_file_record {
+	uint32_t parent;
+	uint32_t name_len;
+	uint64_t name_off;
+	struct snap_entry entry;
+};
+
+/*
+ * The information passed onto the scan handler
+ */
+struct snap_scan_handle_info {
+	snapshot snap;
+	size_t root_len;
+	int hash_contents;
+	/* The parent path of the last entry, and its id */
+	char *parent_path;
+	path_id parent_id;
+};
+
+/*
+ * The information passed onto the save visitor
+ */
+struct snap_save_info {
+	snapshot snap;
+	FILE *file;
+	/* Record number for each path_id */
+	uint32_t *record_nums;
+	uint32_t num_records;
+	uint64_t names_size;
+	int failed;
+	/* Whether the visitor writes the records, or the names */
+	int write_names;
+};
+
+/*
+ * State of snap_hash_contents
+ */
+struct snap_hash_ctx {
+	snapshot snap;
+	pool_group group;
+	/* Regular files to be hashed */
+	char **paths;
+	path_id *ids;
+	unsigned int num_files;
+	unsigned int files_cap;
+	/* Index of the next file to start on */
+	unsigned int next_file;
+};
+
+/*
+ * A file being hashed. Its read and hash tasks take turns, so only one of
+ * them uses the job at a time.
+ */
+struct snap_hash_job {
+	struct snap_hash_ctx *ctx;
+	path_id id;
+	int fd;
+	uint64_t start;
+	uint64_t total_bytes;
+	MD5_CTX md5_ctxt;
+	/* Bytes of the last chunk read */
+	ssize_t len;
+	char buf[HASH_CHUNK_SIZE];
+};
+
+/* Make sure there is an entry slot for every id in the path store */
+static void ensure_entries(snapshot snap);
+/* Add the FTSENT to the snapshot being scanned */
+static void scan_handle(FTSENT *ftsent, void *handle_info);
+/* Copy the digests of the children of the directory, and of their subtrees */
+static void copy_dir_digests(snapshot from, path_id from_id, snapshot to, path_id to_id);
+/* Write the record (or the name) of an entry to the snapshot file */
+static void save_visit(pathstore ps, path_id id, void *visit_info);
+/* Add the entry to the files to be hashed, if it is a regular file without a digest */
+static void hash_collect_visit(pathstore ps, path_id id, void *visit_info);
+/* Start hashing the next file that can be opened, if any is left */
+static void hash_start_next(struct snap_hash_ctx *ctx);
+/* Read the next chunk of the file (I/O lane) */
+static void hash_read_task(void *arg);
+/* Hash the chunk read, and queue the read of the next one (compute lane) */
+static void hash_update_task(void *arg);
+/* Record the digest once the whole file is read, and move on to the next file */
+static void hash_finish(struct snap_hash_job *job, int complete);
+/* Release the job of a file whose hashing is dropped */
+static void hash_discard(void *arg);
+
+snapshot snap_create(const char *root_path) {
+	snapshot snap = malloc(sizeof(struct snapshot));
+	snap->paths = ps_create(root_path);
+	snap->entries = NULL;
+	snap->entries_cap = 0;
+	ensure_entries(snap);
+	return snap;
+}
+
+void snap_destroy(snapshot snap) {
+	if (snap != NULL) {
+		ps_destroy(snap->paths);
+		spill_free(snap->entries);
+		free(snap);
+	}
+}
+
+pathstore snap_paths(snapshot snap) {
+	return snap->paths;
+}
+
+size_t snap_memory_usage(snapshot snap) {
+	return sizeof(struct snapshot) + snap->entries_cap * sizeof(struct snap_entry)
+			+ ps_memory_usage(snap->paths);
+}
+
+path_id snap_add(snapshot snap, path_id parent, const char *name, size_t name_len,
+		struct stat *file_stat, const unsigned char *digest) {
+	path_id id = ps_intern(snap->paths, parent, name, name_len);
+	if (id == PATH_ID_NONE) {
+		return id;
+	}
+	ensure_entries(snap);
+
+	struct snap_entry *entry = &snap->entries[id];
+	memset(entry, 0, sizeof(struct snap_entry));
+	if (file_stat != NULL) {
+		snap_entry_set_stat(entry, file_stat);
+	}
+	if (digest != NULL) {
+		memcpy(entry->digest, digest, sizeof(entry->digest));
+		entry->flags |= SNAP_HAS_DIGEST;
+	}
+	return id;
+}
+
+struct snap_entry *snap_get(snapshot snap, path_id id) {
+	if (!ps_is_valid(snap->paths, id)) {
+		return NULL;
+	}
+	return &snap->entries[id];
+}
+
+void snap_entry_set_stat(struct snap_entry *entry, struct stat *file_stat) {
+	entry->dev = file_stat->st_dev;
+	entry->ino = file_stat->st_ino;
+	entry->size = file_stat->st_size;
+	entry->mode = file_stat->st_mode;
+	entry->uid = file_stat->st_uid;
+	entry->gid = file_stat->st_gid;
+	entry->mtime_sec = file_stat->st_mtim.tv_sec;
+	entry->mtime_nsec = file_stat->st_mtim.tv_nsec;
+	entry->ctime_sec = file_stat->st_ctim.tv_sec;
+	entry->ctime_nsec = file_stat->st_ctim.tv_nsec;
+}
+
+snapshot snap_scan(char *dir_path, int hash_contents) {
+	return snap_scan_filtered(dir_path, hash_contents, NULL);
+}
+
+snapshot snap_scan_filtered(char *dir_path, int hash_contents, path_matcher matcher) {
+	struct stat dir_stat;
+	if ((stat(dir_path, &dir_stat) != 0) || !S_ISDIR(dir_stat.st_mode)) {
+		return NULL;
+	}
+
+	snapshot snap = snap_create(dir_path);
+	snap_entry_set_stat(snap_get(snap, PATH_ID_ROOT), &dir_stat);
+
+	struct snap_scan_handle_info handle_info;
+	handle_info.snap = snap;
+	handle_info.root_len = strlen(dir_path);
+	handle_info.hash_contents = hash_contents;
+	handle_info.parent_path = NULL;
+	handle_info.parent_id = PATH_ID_NONE;
+
+	traverse_fsh_filtered(dir_path, matcher, &scan_handle, &handle_info);
+	free(handle_info.parent_path);
+	return snap;
+}
+
+void snap_copy_digests(snapshot from, snapshot to) {
+	copy_dir_digests(from, PATH_ID_ROOT, to, PATH_ID_ROOT);
+}
+
+int snap_hash_contents(snapshot snap, pool_group group) {
+	struct snap_hash_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.snap = snap;
+	ctx.group = group;
+	ps_walk_subtree(snap->paths, PATH_ID_ROOT, &hash_collect_visit, &ctx);
+
+	for (int i = 0; i < HASH_FILES_IN_FLIGHT; i++) {
+		hash_start_next(&ctx);
+	}
+	int result = pool_group_wait(group);
+
+	for (unsigned int i = 0; i < ctx.num_files; i++) {
+		free(ctx.paths[i]);
+	}
+	free(ctx.paths);
+	free(ctx.ids);
+	return result;
+}
+
+int snap_save(snapshot snap, const char *file_path) {
+	char *tmp_path = malloc(strlen(file_path) + 5);
+	strcpy(tmp_path, file_path);
+	strcat(tmp_path, ".tmp");
+
+	FILE *file = fopen(tmp_path, "w");
+	if (file == NULL) {
+		free(tmp_path);
+		return -1;
+	}
+
+	struct snap_save_info save_info;
+	save_info.snap = snap;
+	save_info.file = file;
+	save_info.record_nums = spill_calloc(ps_id_limit(snap->paths), sizeof(uint32_t));
+	save_info.num_records = 0;
+	save_info.names_size = 0;
+	save_info.failed = 0;
+	save_info.write_names = 0;
+
+	/* The header is rewritten once the counts are known */
+	struct snap_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAP_FILE_MAGIC, sizeof(header.magic));
+	header.version = SNAP_FILE_VERSION;
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		save_info.failed = 1;
+	}
+
+	ps_walk_subtree(snap->paths, PATH_ID_ROOT, &save_visit, &save_info);
+	save_info.write_names = 1;
+	ps_walk_subtree(snap->paths, PATH_ID_ROOT, &save_visit, &save_info);
+
+	header.num_records = save_info.num_records;
+	header.names_size = save_info.names_size;
+	if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) {
+		save_info.failed = 1;
+	}
+	if (fclose(file) != 0) {
+		save_info.failed = 1;
+	}
+	spill_free(save_info.record_nums);
+
+	if (save_info.failed || rename(tmp_path, file_path) != 0) {
+		unlink(tmp_path);
+		free(tmp_path);
+		return -1;
+	}
+	free(tmp_path);
+	return 0;
+}
+
+snapshot snap_load(const char *file_path) {
+	int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) {
+		return NULL;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0 || (uint64_t) file_stat.st_size < sizeof(struct snap_file_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 * The records are added straight from the mapping, in the order of the
+	 * file, so the file is never copied into memory as a whole.
+	 */
+	size_t file_size = file_stat.st_size;
+	char *file = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		return NULL;
+	}
+	madvise(file, file_size, MADV_SEQUENTIAL);
+
+	struct snap_file_header header;
+	memcpy(&header, file, sizeof(header));
+	uint64_t records_size = (uint64_t) header.num_records * sizeof(struct snap_file_record);
+	if (memcmp(header.magic, SNAP_FILE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != SNAP_FILE_VERSION || header.num_records == 0
+			|| header.names_size > file_size
+			|| sizeof(header) + records_size > file_size - header.names_size) {
+		munmap(file, file_size);
+		return NULL;
+	}
+	const struct snap_file_record *records = (const struct snap_file_record *) (file + sizeof(header));
+	const char *names = file + sizeof(header) + records_size;
+
+	path_id *ids = spill_calloc(header.num_records, sizeof(path_id));
+	snapshot snap = NULL;
+	for (uint32_t i = 0; i < header.num_records; i++) {
+		const struct snap_file_record *record = &records[i];
+		if (record->name_off >= header.names_size
+				|| record->name_len >= header.names_size - record->name_off
+				|| names[record->name_off + record->name_len] != 0
+				|| (i > 0 && record->parent >= i)) {
+			snap_destroy(snap);
+			snap = NULL;
+			break;
+		}
+
+		if (i == 0) {
+			snap = snap_create(names + record->name_off);
+			ids[i] = PATH_ID_ROOT;
+		} else {
+			ids[i] = snap_add(snap, ids[record->parent], names + record->name_off,
+					record->name_len, NULL, NULL);
+		}
+		if (ids[i] != PATH_ID_NONE) {
+			snap->entries[ids[i]] = record->entry;
+		}
+	}
+
+	munmap(file, file_size);
+	spill_free(ids);
+	return snap;
+}
+
+static void ensure_entries(snapshot snap) {
+	unsigned int limit = ps_id_limit(snap->paths);
+	if (limit <= snap->entries_cap) {
+		return;
+	}
+
+	unsigned int new_cap = snap->entries_cap ? snap->entries_cap : 64;
+	while (new_cap < limit) {
+		new_cap <<= 1;
+	}
+	snap->entries = spill_realloc(snap->entries, new_cap * sizeof(struct snap_entry));
+	memset(snap->entries + snap->entries_cap, 0,
+			(new_cap - snap->entries_cap) * sizeof(struct snap_entry));
+	snap->entries_cap = new_cap;
+}
+
+static void scan_handle(FTSENT *ftsent, void *handle_info) {
+	struct snap_scan_handle_info *hinfo = handle_info;
+
+	/* All the children of a directory share the parent path, so resolve it once */
+	if (hinfo->parent_path == NULL || strcmp(hinfo->parent_path, ftsent->fts_path) != 0) {
+		free(hinfo->parent_path);
+		hinfo->parent_path = strdup(ftsent->fts_path);
+		size_t path_len = strlen(ftsent->fts_path);
+		const char *rel_path = ftsent->fts_path + (path_len < hinfo->root_len ? path_len : hinfo->root_len);
+		hinfo->parent_id = ps_lookup_path(hinfo->snap->paths, PATH_ID_ROOT, rel_path);
+	}
+	if (hinfo->parent_id == PATH_ID_NONE) {
+		return;
+	}
+
+	unsigned char digest[16];
+	unsigned char *digest_ptr = NULL;
+	if (hinfo->hash_contents && S_ISREG(ftsent->fts_statp->st_mode)) {
+		char *full_path = get_full_path(ftsent);
+		if (md5sum_file_bytes(full_path, digest) == 0) {
+			digest_ptr = digest;
+		}
+		free(full_path);
+	}
+
+	snap_add(hinfo->snap, hinfo->parent_id, ftsent->fts_name, ftsent->fts_namelen,
+			ftsent->fts_statp, digest_ptr);
+}
+
+static void copy_dir_digests(snapshot from, path_id from_id, snapshot to, path_id to_id) {
+	for (path_id to_child = ps_first_child(to->paths, to_id); to_child != PATH_ID_NONE;
+			to_child = ps_next_sibling(to->paths, to_child)) {
+		size_t name_len;
+		const char *name = ps_name(to->paths, to_child, &name_len);
+		path_id from_child = ps_lookup_child(from->paths, from_id, name, name_len);
+		if (from_child == PATH_ID_NONE) {
+			continue;
+		}
+		struct snap_entry *from_entry = &from->entries[from_child];
+		struct snap_entry *to_entry = &to->entries[to_child];
+		if (S_ISDIR(to_entry->mode) && S_ISDIR(from_entry->mode)) {
+			copy_dir_digests(from, from_child, to, to_child);
+		} else if ((from_entry->flags & SNAP_HAS_DIGEST) && from_entry->mode == to_entry->mode
+				&& from_entry->ino == to_entry->ino && from_entry->dev == to_entry->dev
+				&& from_entry->size == to_entry->size
+				&& from_entry->mtime_sec == to_entry->mtime_sec
+				&& from_entry->mtime_nsec == to_entry->mtime_nsec
+				&& from_entry->ctime_sec == to_entry->ctime_sec
+				&& from_entry->ctime_nsec == to_entry->ctime_nsec) {
+			memcpy(to_entry->digest, from_entry->digest, sizeof(to_entry->digest));
+			to_entry->flags |= SNAP_HAS_DIGEST;
+		}
+	}
+}
+
+static void save_visit(pathstore ps, path_id id, void *visit_info) {
+	struct snap_save_info *sinfo = visit_info;
+	size_t name_len;
+	const char *name = ps_name(ps, id, &name_len);
+
+	if (sinfo->write_names) {
+		if (fwrite(name, 1, name_len + 1, sinfo->file) != name_len + 1) {
+			sinfo->failed = 1;
+		}
+		return;
+	}
+
+	struct snap_file_record record;
+	memset(&record, 0, sizeof(record));
+	record.parent = (id == PATH_ID_ROOT) ? 0 : sinfo->record_nums[ps_parent(ps, id)];
+	record.name_len = name_len;
+	record.name_off = sinfo->names_size;
+	record.entry = sinfo->snap->entries[id];
+
+	sinfo->record_nums[id] = sinfo->num_records++;
+	sinfo->names_size += name_len + 1;
+	if (fwrite(&record, sizeof(record), 1, sinfo->file) != 1) {
+		sinfo->failed = 1;
+	}
+}
+
+static void hash_collect_visit(pathstore ps, path_id id, void *visit_info) {
+	struct snap_hash_ctx *ctx = visit_info;
+	struct snap_entry *entry = &ctx->snap->entries[id];
+	if (!S_ISREG(entry->mode) || (entry->flags & SNAP_HAS_DIGEST)) {
+		return;
+	}
+	if (ctx->num_files == ctx->files_cap) {
+		ctx->files_cap = ctx->files_cap ? 2 * ctx->files_cap : 64;
+		ctx->paths = realloc(ctx->paths, ctx->files_cap * sizeof(char *));
+		ctx->ids = realloc(ctx->ids, ctx->files_cap * sizeof(path_id));
+	}
+	/* ps_path returns a buffer that the next call overwrites */
+	ctx->paths[ctx->num_files] = strdup(ps_path(ps, id));
+	ctx->ids[ctx->num_files] = id;
+	ctx->num_files++;
+}
+
+static void hash_start_next(struct snap_hash_ctx *ctx) {
+	while (!pool_group_cancelled(ctx->group)) {
+		unsigned int file = __atomic_fetch_add(&ctx->next_file, 1, __ATOMIC_RELAXED);
+		if (file >= ctx->num_files) {
+			return;
+		}
+		int fd = open(ctx->paths[file], O_RDONLY | O_CLOEXEC);
+		if (fd == -1) {
+			continue;
+		}
+
+		struct snap_hash_job *job = malloc(sizeof(struct snap_hash_job));
+		job->ctx = ctx;
+		job->id = ctx->ids[file];
+		job->fd = fd;
+		job->start = metrics_now();
+		job->total_bytes = 0;
+		MD5_Init(&job->md5_ctxt);
+		if (pool_submit(ctx->group, POOL_IO, &hash_read_task, &hash_discard, job) != 0) {
+			hash_discard(job);
+		}
+		return;
+	}
+}
+
+static void hash_read_task(void *arg) {
+	struct snap_hash_job *job = arg;
+	do {
+		job->len = read(job->fd, job->buf, HASH_CHUNK_SIZE);
+	} while (job->len == -1 && errno == EINTR);
+
+	if (job->len <= 0) {
+		hash_finish(job, job->len == 0);
+	} else if (pool_submit(job->ctx->group, POOL_COMPUTE, &hash_update_task, &hash_discard, job) != 0) {
+		hash_discard(job);
+	}
+}
+
+static void hash_update_task(void *arg) {
+	struct snap_hash_job *job = arg;
+	MD5_Update(&job->md5_ctxt, job->buf, job->len);
+	job->total_bytes += job->len;
+	if (pool_submit(job->ctx->group, POOL_IO, &hash_read_task, &hash_discard, job) != 0) {
+		hash_discard(job);
+	}
+}
+
+static void hash_finish(struct snap_hash_job *job, int complete) {
+	struct snap_hash_ctx *ctx = job->ctx;
+	if (complete) {
+		/* Every file has an entry of its own, so no two jobs write the same one */
+		struct snap_entry *entry = &ctx->snap->entries[job->id];
+		MD5_Final(entry->digest, &job->md5_ctxt);
+		entry->flags |= SNAP_HAS_DIGEST;
+		metrics_add(METRIC_FILES_HASHED, 1);
+		metrics_add(METRIC_BYTES_HASHED, job->total_bytes);
+		metrics_record_since(METRIC_FILE_HASH, job->start);
+	}
+	hash_discard(job);
+	hash_start_next(ctx);
+}
+
+static void hash_discard(void *arg) {
+	struct snap_hash_job *job = arg;
+	close(job->fd);
+	free(job);
+}
@@ -0,0 +1,154 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_SNAPSHOT_H
+#define GOODRV_SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "pathmatch.h"
+#include "pathstore.h"
+#include "pool.h"
+
+/* The entry has a valid content digest */
+#define SNAP_HAS_DIGEST 01
+
+/*
+ * Metadata of an entry in a snapshot.
+ */
+struct snap_entry {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	int64_t ctime_sec;
+	int64_t ctime_nsec;
+	uint32_t mode;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t flags;
+	/* MD5 of the contents, valid only with SNAP_HAS_DIGEST */
+	unsigned char digest[16];
+};
+
+/*
+ * Snapshot of a File System Hierarchy: the paths of the entries in a path
+ * store, along with the metadata of each entry.
+ */
+typedef struct snapshot *snapshot;
+
+/*
+ * Create an empty snapshot, with only the root entry.
+ */
+snapshot snap_create(const char *root_path);
+
+/*
+ * Free the snapshot.
+ */
+void snap_destroy(snapshot snap);
+
+/*
+ * Get the path store holding the paths of the snapshot.
+ */
+pathstore snap_paths(snapshot snap);
+
+/*
+ * Get the number of bytes held by the snapshot.
+ */
+size_t snap_memory_usage(snapshot snap);
+
+/*
+ * Add (or update) a child entry in the snapshot.
+ *
+ * parent - Parent entry.
+ * name, name_len - Name of the child.
+ * file_stat - Metadata of the child. May be NULL, if it is filled later.
+ * digest - MD5 of the contents of the child. May be NULL.
+ *
+ * Returns the id of the child, or PATH_ID_NONE if the parent is invalid.
+ */
+path_id snap_add(snapshot snap, path_id parent, const char *name, size_t name_len,
+		struct stat *file_stat, const unsigned char *digest);
+
+/*
+ * Get the metadata of an entry. Returns NULL for an invalid entry.
+ */
+struct snap_entry *snap_get(snapshot snap, path_id id);
+
+/*
+ * Fill the metadata of the entry from struct stat.
+ */
+void snap_entry_set_stat(struct snap_entry *entry, struct stat *file_stat);
+
+/*
+ * Scan the File System Hierarchy within the directory into a new snapshot.
+ *
+ * hash_contents - If non zero, the MD5 sum of every regular file is recorded.
+ *
+ * Returns NULL if the directory cannot be accessed.
+ */
+snapshot snap_scan(char *dir_path, int hash_contents);
+
+/*
+ * Same as snap_scan, but leaves out the entries excluded by the matcher,
+ * along with everything inside the excluded directories.
+ */
+snapshot snap_scan_filtered(char *dir_path, int hash_contents, path_matcher matcher);
+
+/*
+ * Copy the digests of the entries of from onto the entries at the same paths
+ * in to, as long as their metadata (inode, size, modification and change
+ * times) is the same, so that only the files that changed are hashed again.
+ */
+void snap_copy_digests(snapshot from, snapshot to);
+
+/*
+ * Record the MD5 sum of every regular file in the snapshot that has none yet,
+ * on the pool of the group. Files are read in chunks by tasks on the I/O lane, and each
+ * chunk is hashed by a task on the compute lane, so that a few files are
+ * read and hashed at once. Files that cannot be read keep their entries.
+ *
+ * The whole hashing is stopped by cancelling the group, from any thread.
+ *
+ * Returns 0 once every file is hashed, and -1 if the group was cancelled.
+ */
+int snap_hash_contents(snapshot snap, pool_group group);
+
+/*
+ * Save the snapshot to a file. The entries are written in pre-order as fixed
+ * size records, followed by their names.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int snap_save(snapshot snap, const char *file_path);
+
+/*
+ * Load a snapshot saved with snap_save. Returns NULL if the file is missing or
+ * is not a valid snapshot.
+ */
+snapshot snap_load(const char *file_path);
+
+#endif /* GOODRV_SNAPSHOT_H */
@@ -0,0 +1,267 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "spill.h"
+
+/*
+ * Header in front of every array, so that the array alone tells where it
+ * lives. Its size keeps the array aligned for any type.
+ */
+union spill_header {
+	struct {
+		/* Bytes of the array */
+		size_t size;
+		/* Bytes mapped, header included; 0 for a heap array */
+		size_t mapped_len;
+		/* File backing the mapping, -1 for a heap array */
+		int fd;
+	} info;
+	char pad[32];
+};
+
+/* Guards the configuration */
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t budget;
+static char *spill_dir;
+
+/* Create an unlinked file in the spill directory. Returns -1 on failure */
+static int create_spill_file(const char *dir);
+/* Allocate a zeroed array in a spill file. Returns NULL on failure */
+static union spill_header *map_array(size_t size);
+/* Grow or shrink an array in a spill file. Returns NULL on failure */
+static union spill_header *remap_array(union spill_header *header, size_t size);
+/* Release an array in a spill file */
+static void unmap_array(union spill_header *header);
+/* Check whether an array of the size goes to a spill file now */
+static int should_map(size_t size);
+/* Get the header of an array */
+static union spill_header *header_of(void *ptr);
+
+int spill_configure(uint64_t new_budget, const char *dir) {
+	char *new_dir = NULL;
+	if (new_budget > 0) {
+		int fd = create_spill_file(dir);
+		if (fd == -1) {
+			return -1;
+		}
+		close(fd);
+		new_dir = strdup(dir);
+	}
+
+	pthread_mutex_lock(&config_lock);
+	free(spill_dir);
+	spill_dir = new_dir;
+	__atomic_store_n(&budget, new_budget, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&config_lock);
+	metrics_gauge_set(METRIC_MEM_BUDGET, new_budget);
+	return 0;
+}
+
+uint64_t spill_budget() {
+	return __atomic_load_n(&budget, __ATOMIC_RELAXED);
+}
+
+uint64_t spill_parse_size(const char *text) {
+	if (text == NULL) {
+		return 0;
+	}
+	char *end;
+	errno = 0;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (errno != 0 || end == text || text[0] == '-') {
+		return 0;
+	}
+	int shift = 0;
+	switch (*end) {
+	case 'k': case 'K':
+		shift = 10;
+		break;
+	case 'm': case 'M':
+		shift = 20;
+		break;
+	case 'g': case 'G':
+		shift = 30;
+		break;
+	case 0:
+		break;
+	default:
+		return 0;
+	}
+	if (*end != 0 && end[1] != 0) {
+		return 0;
+	}
+	if (value > (UINT64_MAX >> shift)) {
+		return 0;
+	}
+	return (uint64_t) value << shift;
+}
+
+void *spill_calloc(size_t nmemb, size_t size) {
+	if (size != 0 && nmemb > (SIZE_MAX - sizeof(union spill_header)) / size) {
+		return NULL;
+	}
+	size_t total = nmemb * size;
+	union spill_header *header = should_map(total) ? map_array(total) : NULL;
+	if (header == NULL) {
+		header = calloc(1, sizeof(union spill_header) + total);
+		if (header == NULL) {
+			return NULL;
+		}
+		header->info.mapped_len = 0;
+		header->info.fd = -1;
+	}
+	header->info.size = total;
+	return header + 1;
+}
+
+void *spill_realloc(void *ptr, size_t size) {
+	if (ptr == NULL) {
+		return spill_calloc(1, size);
+	}
+	if (size > SIZE_MAX - sizeof(union spill_header)) {
+		return NULL;
+	}
+	union spill_header *header = header_of(ptr);
+	int mapped = (header->info.fd != -1);
+	union spill_header *new_header = NULL;
+
+	if (mapped && should_map(size)) {
+		new_header = remap_array(header, size);
+	} else if (!mapped && !should_map(size)) {
+		new_header = realloc(header, sizeof(union spill_header) + size);
+	} else {
+		/* Moving between the heap and a file */
+		void *new_ptr = spill_calloc(1, size);
+		if (new_ptr != NULL) {
+			memcpy(new_ptr, ptr, (size < header->info.size) ? size : header->info.size);
+			spill_free(ptr);
+			return new_ptr;
+		}
+	}
+	if (new_header == NULL) {
+		return NULL;
+	}
+	new_header->info.size = size;
+	return new_header + 1;
+}
+
+void spill_free(void *ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+	union spill_header *header = header_of(ptr);
+	if (header->info.fd != -1) {
+		unmap_array(header);
+	} else {
+		free(header);
+	}
+}
+
+int spill_is_mapped(void *ptr) {
+	return ptr != NULL && header_of(ptr)->info.fd != -1;
+}
+
+static int create_spill_file(const char *dir) {
+	int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+	if (fd != -1 || (errno != EOPNOTSUPP && errno != EISDIR)) {
+		return fd;
+	}
+
+	/* The file system has no O_TMPFILE */
+	size_t len = strlen(dir) + sizeof("/spill.XXXXXX");
+	char *path = malloc(len);
+	snprintf(path, len, "%s/spill.XXXXXX", dir);
+	fd = mkostemp(path, O_CLOEXEC);
+	if (fd != -1) {
+		unlink(path);
+	}
+	free(path);
+	return fd;
+}
+
+static union spill_header *map_array(size_t size) {
+	pthread_mutex_lock(&config_lock);
+	int fd = (spill_dir != NULL) ? create_spill_file(spill_dir) : -1;
+	pthread_mutex_unlock(&config_lock);
+	if (fd == -1) {
+		return NULL;
+	}
+
+	size_t len = sizeof(union spill_header) + size;
+	union spill_header *header = MAP_FAILED;
+	if (ftruncate(fd, len) == 0) {
+		header = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (header == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	header->info.mapped_len = len;
+	header->info.fd = fd;
+	metrics_gauge_add(METRIC_SPILLED_BYTES, len);
+	return header;
+}
+
+static union spill_header *remap_array(union spill_header *header, size_t size) {
+	size_t old_len = header->info.mapped_len;
+	size_t len = sizeof(union spill_header) + size;
+	/* A file is not shrunk with its array; its blocks go when the array is freed */
+	if (len > old_len && ftruncate(header->info.fd, len) != 0) {
+		return NULL;
+	}
+	union spill_header *new_header = mremap(header, old_len, len, MREMAP_MAYMOVE);
+	if (new_header == MAP_FAILED) {
+		return NULL;
+	}
+	new_header->info.mapped_len = len;
+	metrics_gauge_add(METRIC_SPILLED_BYTES, (int64_t) len - (int64_t) old_len);
+	return new_header;
+}
+
+static void unmap_array(union spill_header *header) {
+	int fd = header->info.fd;
+	size_t len = header->info.mapped_len;
+	munmap(header, len);
+	close(fd);
+	metrics_gauge_add(METRIC_SPILLED_BYTES, -(int64_t) len);
+}
+
+static int should_map(size_t size) {
+	return size >= SPILL_MIN_SIZE && spill_budget() > 0;
+}
+
+static union spill_header *header_of(void *ptr) {
+	return (union spill_header *) ptr - 1;
+}
@@ -0,0 +1,85 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_SPILL_H
+#define GOODRV_SPILL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Arrays smaller than this always stay on the heap */
+#define SPILL_MIN_SIZE (256 * 1024)
+/* Environment variable with the memory budget of the daemon, e.g. "512M" */
+#define SPILL_BUDGET_ENV "GOODRV_MEM_BUDGET"
+
+/*
+ * Bounded memory mode, for huge trees on small machines.
+ *
+ * The big growable arrays of the path stores, snapshots and tree diffs are
+ * allocated through spill_calloc and spill_realloc. Without a budget, they
+ * are plain heap arrays. With a budget, the arrays of at least SPILL_MIN_SIZE
+ * bytes live in unlinked files of the spill directory, mapped shared: under
+ * memory pressure the kernel writes their cold pages back and drops them,
+ * the way it does with the page cache, so they do not count against the
+ * budget the way heap memory does, and no swap is needed. The budget also
+ * bounds what the sync engine keeps in memory between syncs.
+ */
+
+/*
+ * Set the memory budget in bytes, and the directory for the spill files.
+ * A budget of 0 turns the bounded mode off. Arrays allocated before keep
+ * their place till they are reallocated.
+ *
+ * Returns 0 on success, and -1 if files cannot be created in the directory,
+ * in which case the mode is left unchanged.
+ */
+int spill_configure(uint64_t budget, const char *spill_dir);
+
+/*
+ * Get the memory budget, 0 if the memory is not bounded.
+ */
+uint64_t spill_budget();
+
+/*
+ * Parse a size in bytes, with an optional K, M or G suffix (powers of 1024).
+ * Returns 0 if the text is not a valid size.
+ */
+uint64_t spill_parse_size(const char *text);
+
+/*
+ * Same as calloc, realloc and free, for arrays that may be spilled. The
+ * pointers from these are only passed to these. spill_realloc keeps the
+ * contents, moving the array between the heap and a file as its size crosses
+ * SPILL_MIN_SIZE.
+ */
+void *spill_calloc(size_t nmemb, size_t size);
+void *spill_realloc(void *ptr, size_t size);
+void spill_free(void *ptr);
+
+/*
+ * Check whether the array is in a spill file.
+ */
+int spill_is_mapped(void *ptr);
+
+#endif /* GOODRV_SPILL_H */
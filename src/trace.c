@@ -0,0 +1,273 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Size of a cache line, so that the buffers of two threads never share one */
+#define TRACE_ALIGN 64
+
+/*
+ * Ring of the spans recorded by a thread. Only the owning thread writes to
+ * it, like a sequence lock: it marks the span it is writing, writes the
+ * fields with release stores, then moves the head. A reader copies the spans
+ * below the head with acquire loads, and then drops the ones that the owner
+ * has started to overwrite meanwhile.
+ */
+struct trace_buffer {
+	struct trace_event events[TRACE_RING_SIZE];
+	/* Number of spans ever recorded */
+	uint64_t head;
+	/* Number of spans ever started to be written */
+	uint64_t writing;
+	/* Thread id of the owner */
+	uint32_t tid;
+	/* Non zero while a thread owns the buffer */
+	int in_use;
+	struct trace_buffer *next;
+};
+
+int trace_active = 0;
+
+static const char *span_names[TRACE_NUM_SPANS] = {
+	"sync", "scan", "dir_list", "file_hash", "tree_diff", "watch_events", "jwt_build", "upload"
+};
+
+/* Buffer of the calling thread, NULL till it records something */
+static __thread struct trace_buffer *thread_buffer;
+/* Hands the buffer back when its thread exits */
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+/* All the buffers, guarded by buffers_lock */
+static struct trace_buffer *buffers;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Take a free buffer (or a new one) for the calling thread */
+static struct trace_buffer *claim_buffer();
+/* Release the buffer of a thread that exits */
+static void release_buffer(void *buffer);
+/* Create the key for the buffers */
+static void create_buffer_key();
+/* Copy the spans of a buffer that are still valid, returns the number copied */
+static size_t copy_buffer(struct trace_buffer *buffer, struct trace_event *events);
+/* Order the spans by their start */
+static int compare_events(const void *event1, const void *event2);
+/* Format the spans as JSON, into memory to be freed by the caller */
+static char *format_trace(size_t *len);
+
+void trace_enable(int enable) {
+	__atomic_store_n(&trace_active, enable != 0, __ATOMIC_RELAXED);
+}
+
+uint64_t trace_now() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void trace_record(enum trace_span span, uint64_t start) {
+	uint64_t end = trace_now();
+	struct trace_buffer *buffer = thread_buffer;
+	if (buffer == NULL) {
+		buffer = claim_buffer();
+	}
+	uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_RELAXED);
+	struct trace_event *event = &buffer->events[head % TRACE_RING_SIZE];
+	__atomic_store_n(&buffer->writing, head + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&event->start, start, __ATOMIC_RELEASE);
+	__atomic_store_n(&event->end, end, __ATOMIC_RELEASE);
+	__atomic_store_n(&event->span, span, __ATOMIC_RELEASE);
+	__atomic_store_n(&event->tid, buffer->tid, __ATOMIC_RELEASE);
+	__atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+size_t trace_collect(struct trace_event **events) {
+	pthread_mutex_lock(&buffers_lock);
+	size_t max_events = 0;
+	for (struct trace_buffer *buffer = buffers; buffer != NULL; buffer = buffer->next) {
+		max_events += TRACE_RING_SIZE;
+	}
+	*events = malloc((max_events > 0 ? max_events : 1) * sizeof(struct trace_event));
+	size_t num_events = 0;
+	for (struct trace_buffer *buffer = buffers; buffer != NULL; buffer = buffer->next) {
+		num_events += copy_buffer(buffer, *events + num_events);
+	}
+	pthread_mutex_unlock(&buffers_lock);
+
+	qsort(*events, num_events, sizeof(struct trace_event), &compare_events);
+	return num_events;
+}
+
+const char *trace_span_name(enum trace_span span) {
+	return span_names[span];
+}
+
+int trace_write(int fd) {
+	size_t len;
+	char *text = format_trace(&len);
+	if (text == NULL) {
+		return -1;
+	}
+	const char *buf = text;
+	int result = 0;
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written == -1 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			result = -1;
+			break;
+		}
+		buf += written;
+		len -= written;
+	}
+	free(text);
+	return result;
+}
+
+int trace_dump(const char *file_path) {
+	size_t len = strlen(file_path) + sizeof(".tmp");
+	char *tmp_path = malloc(len);
+	snprintf(tmp_path, len, "%s.tmp", file_path);
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1) {
+		free(tmp_path);
+		return -1;
+	}
+	int result = trace_write(fd);
+	if (close(fd) != 0 || result != 0 || rename(tmp_path, file_path) != 0) {
+		unlink(tmp_path);
+		result = -1;
+	}
+	free(tmp_path);
+	return result;
+}
+
+static struct trace_buffer *claim_buffer() {
+	pthread_once(&buffer_key_once, &create_buffer_key);
+	pthread_mutex_lock(&buffers_lock);
+	struct trace_buffer *buffer = buffers;
+	while (buffer != NULL && buffer->in_use) {
+		buffer = buffer->next;
+	}
+	if (buffer == NULL) {
+		void *memory;
+		if (posix_memalign(&memory, TRACE_ALIGN, sizeof(struct trace_buffer)) != 0) {
+			abort();
+		}
+		buffer = memory;
+		buffer->head = 0;
+		buffer->writing = 0;
+		buffer->next = buffers;
+		buffers = buffer;
+	}
+	/* The spans of the previous owner keep their own thread id */
+	buffer->tid = syscall(SYS_gettid);
+	buffer->in_use = 1;
+	pthread_mutex_unlock(&buffers_lock);
+
+	pthread_setspecific(buffer_key, buffer);
+	thread_buffer = buffer;
+	return buffer;
+}
+
+static void release_buffer(void *buffer) {
+	pthread_mutex_lock(&buffers_lock);
+	((struct trace_buffer *) buffer)->in_use = 0;
+	pthread_mutex_unlock(&buffers_lock);
+}
+
+static void create_buffer_key() {
+	pthread_key_create(&buffer_key, &release_buffer);
+}
+
+static size_t copy_buffer(struct trace_buffer *buffer, struct trace_event *events) {
+	uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+	uint64_t first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+	for (uint64_t i = first; i < head; i++) {
+		struct trace_event *event = &buffer->events[i % TRACE_RING_SIZE];
+		struct trace_event *copy = &events[i - first];
+		copy->start = __atomic_load_n(&event->start, __ATOMIC_ACQUIRE);
+		copy->end = __atomic_load_n(&event->end, __ATOMIC_ACQUIRE);
+		copy->span = __atomic_load_n(&event->span, __ATOMIC_ACQUIRE);
+		copy->tid = __atomic_load_n(&event->tid, __ATOMIC_ACQUIRE);
+	}
+
+	/* The owner may have gone around the ring while the spans were copied */
+	uint64_t writing = __atomic_load_n(&buffer->writing, __ATOMIC_RELAXED);
+	uint64_t valid = (writing > TRACE_RING_SIZE) ? writing - TRACE_RING_SIZE : 0;
+	if (valid <= first) {
+		return head - first;
+	}
+	if (valid >= head) {
+		return 0;
+	}
+	memmove(events, events + (valid - first), (head - valid) * sizeof(struct trace_event));
+	return head - valid;
+}
+
+static int compare_events(const void *event1, const void *event2) {
+	uint64_t start1 = ((const struct trace_event *) event1)->start;
+	uint64_t start2 = ((const struct trace_event *) event2)->start;
+	return (start1 > start2) - (start1 < start2);
+}
+
+static char *format_trace(size_t *len) {
+	struct trace_event *events;
+	size_t num_events = trace_collect(&events);
+
+	char *text = NULL;
+	FILE *out = open_memstream(&text, len);
+	if (out == NULL) {
+		free(events);
+		return NULL;
+	}
+	/* Times are in microseconds, with the nanoseconds as the fraction */
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	long pid = getpid();
+	for (size_t i = 0; i < num_events; i++) {
+		struct trace_event *event = &events[i];
+		uint64_t duration = event->end - event->start;
+		fprintf(out, "%s\n{\"name\":\"%s\",\"cat\":\"goodrive\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%u,"
+				"\"ts\":%llu.%03llu,\"dur\":%llu.%03llu}", (i > 0) ? "," : "", span_names[event->span],
+				pid, event->tid, (unsigned long long) (event->start / 1000),
+				(unsigned long long) (event->start % 1000), (unsigned long long) (duration / 1000),
+				(unsigned long long) (duration % 1000));
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	free(events);
+	return text;
+}
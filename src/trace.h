@@ -0,0 +1,136 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_TRACE_H
+#define GOODRV_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Spans kept by each thread; older ones are overwritten */
+#define TRACE_RING_SIZE 4096
+
+/* Environment variable that turns the tracing on in the daemon */
+#define TRACE_ENV "GOODRV_TRACE"
+
+/*
+ * Stages of the sync pipeline
+ */
+enum trace_span {
+	/* A whole sync of an account */
+	TRACE_SYNC,
+	/* Scanning the tree into a snapshot */
+	TRACE_SCAN,
+	/* Listing a directory in traverse_fsh */
+	TRACE_DIR_LIST,
+	/* Hashing a file in md5sum_file_bytes */
+	TRACE_FILE_HASH,
+	/* Coalescing the changes since the last sync, in tdiff_compare */
+	TRACE_TREE_DIFF,
+	/* Draining the inotify events, which the debounce coalesces into a sync */
+	TRACE_WATCH_EVENTS,
+	/* Building a JWT, including the RSA signature */
+	TRACE_JWT_BUILD,
+	/* Uploading a file */
+	TRACE_UPLOAD,
+	TRACE_NUM_SPANS
+};
+
+/*
+ * A span recorded by a thread, in nanoseconds of the monotonic clock.
+ */
+struct trace_event {
+	uint64_t start;
+	uint64_t end;
+	uint32_t span;
+	uint32_t tid;
+};
+
+/*
+ * Non zero while the spans are recorded. Read through trace_begin.
+ */
+extern int trace_active;
+
+/*
+ * Turn the recording of the spans on or off. The spans already recorded are
+ * kept.
+ */
+void trace_enable(int enable);
+
+/*
+ * Get the monotonic time in nanoseconds.
+ */
+uint64_t trace_now();
+
+/*
+ * Record a span that started at start, a time from trace_now, and ends now.
+ */
+void trace_record(enum trace_span span, uint64_t start);
+
+/*
+ * Start a span. When the tracing is off, this is a single branch, and the
+ * span is not recorded by trace_end.
+ */
+static inline uint64_t trace_begin() {
+	return __builtin_expect(__atomic_load_n(&trace_active, __ATOMIC_RELAXED), 0) ? trace_now() : 0;
+}
+
+/*
+ * End a span started by trace_begin.
+ */
+static inline void trace_end(enum trace_span span, uint64_t start) {
+	if (__builtin_expect(start != 0, 0)) {
+		trace_record(span, start);
+	}
+}
+
+/*
+ * Copy the spans of all the threads, ordered by their start, into memory to be
+ * freed by the caller.
+ *
+ * Returns the number of spans.
+ */
+size_t trace_collect(struct trace_event **events);
+
+/*
+ * Get the name of a span.
+ */
+const char *trace_span_name(enum trace_span span);
+
+/*
+ * Write the spans in the Chrome trace event format, as complete ("X") events,
+ * which Perfetto and chrome://tracing can open.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int trace_write(int fd);
+
+/*
+ * Write the spans to the file, replacing it atomically.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int trace_dump(const char *file_path);
+
+#endif /* GOODRV_TRACE_H */
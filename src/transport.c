@@ -0,0 +1,45 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "transport.h"
+
+/* The retry delay stops doubling after these many attempts */
+#define MAX_BACKOFF_SHIFT 6
+
+int transport_retry_wait(unsigned int attempt, unsigned int max_retries, unsigned int backoff_us,
+		unsigned int *seed) {
+	if (attempt >= max_retries) {
+		return 0;
+	}
+	unsigned long delay = (unsigned long) backoff_us
+			<< (attempt < MAX_BACKOFF_SHIFT ? attempt : MAX_BACKOFF_SHIFT);
+	if (delay > 0) {
+		usleep(delay / 2 + rand_r(seed) % (delay / 2 + 1));
+	}
+	return 1;
+}
@@ -0,0 +1,144 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_TRANSPORT_H
+#define GOODRV_TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The request succeeded */
+#define TRANSPORT_OK 0
+/* The request failed for a transient reason, and may be repeated */
+#define TRANSPORT_ERR_RETRY -1
+/* The request cannot succeed, e.g. the session has expired */
+#define TRANSPORT_ERR_FATAL -2
+
+/* Buffer size for the identifier of an upload session */
+#define TRANSPORT_SESSION_ID_LEN 64
+
+/*
+ * Interface to the remote store. The transfer engines only talk to the store
+ * through these functions, so that the Drive API, and the local stand-ins used
+ * by the tests and the benchmarks, are interchangeable.
+ *
+ * An upload goes through a resumable session. The chunks of a session may be
+ * sent concurrently and in any order. The store reports the length of the
+ * contiguous prefix it has received, which is where an interrupted upload
+ * resumes from.
+ *
+ * A download reads byte ranges of a completed object, again in any order.
+ *
+ * Unless noted otherwise, the functions return TRANSPORT_OK or one of the
+ * TRANSPORT_ERR_* codes. All of them may be called from several threads.
+ */
+struct transport {
+	/* Data of the implementation */
+	void *impl;
+
+	/*
+	 * Start an upload session for an object of the given size, and copy the
+	 * session identifier into session_id.
+	 */
+	int (*begin_session)(struct transport *transport, const char *name, uint64_t size,
+			char *session_id);
+
+	/*
+	 * Get the number of bytes from the start of the object that the store has
+	 * received, or one of the TRANSPORT_ERR_* codes.
+	 */
+	int64_t (*query_offset)(struct transport *transport, const char *session_id);
+
+	/*
+	 * Send the bytes at offset of the object.
+	 */
+	int (*send_chunk)(struct transport *transport, const char *session_id, uint64_t offset,
+			const void *data, size_t len);
+
+	/*
+	 * Complete the session once all the bytes are sent. The store checks the
+	 * contents against the MD5 digest.
+	 */
+	int (*finish_session)(struct transport *transport, const char *session_id,
+			const unsigned char *digest);
+
+	/*
+	 * Get the size and the MD5 digest of the object with the name.
+	 */
+	int (*stat_object)(struct transport *transport, const char *name, uint64_t *size,
+			unsigned char *digest);
+
+	/*
+	 * Read len bytes at offset of the object into buf. Returns the number of
+	 * bytes read, which is less than len only at the end of the object, or one
+	 * of the TRANSPORT_ERR_* codes.
+	 */
+	int64_t (*fetch_range)(struct transport *transport, const char *name, uint64_t offset,
+			void *buf, size_t len);
+
+	/*
+	 * Make the object with the name dest_name a copy of the object with the
+	 * name src_name, within the store, without sending the contents. NULL if
+	 * the store cannot.
+	 */
+	int (*copy_object)(struct transport *transport, const char *src_name, const char *dest_name);
+
+	/*
+	 * Rename the object with the name src_name to dest_name within the
+	 * store, along with every object whose name is below src_name/, as a
+	 * rename of a directory does. Objects already at the new names are
+	 * replaced. Returns TRANSPORT_ERR_FATAL if there is no object to move.
+	 * NULL if the store cannot.
+	 */
+	int (*move_object)(struct transport *transport, const char *src_name, const char *dest_name);
+
+	/*
+	 * Remove the object with the name from the store, along with every object
+	 * whose name is below name/, as a removal of a directory does. Returns
+	 * TRANSPORT_ERR_FATAL if there is no object to remove. NULL if the store
+	 * cannot.
+	 */
+	int (*delete_object)(struct transport *transport, const char *name);
+
+	/*
+	 * Free the transport.
+	 */
+	void (*destroy)(struct transport *transport);
+};
+
+/*
+ * Wait before repeating a failed request. Half of the delay is fixed, and the
+ * other half is random. The delay starts at backoff_us, and doubles with every
+ * attempt, up to 64 times backoff_us.
+ *
+ * attempt - Number of attempts that have failed, minus one.
+ * seed - Seed for the random part, as for rand_r.
+ *
+ * Returns 1 after waiting, or 0 without waiting when there are no more
+ * attempts left.
+ */
+int transport_retry_wait(unsigned int attempt, unsigned int max_retries, unsigned int backoff_us,
+		unsigned int *seed);
+
+#endif /* GOODRV_TRANSPORT_H */
@@ -0,0 +1,525 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+#include "spill.h"
+#include "treediff.h"
+#include "typed_hashtable.h"
+
+/* Marks an old entry which has already been reported as deleted */
+#define TDIFF_REMOVED ((path_id) -1)
+
+/*
+ * State of a comparison
+ */
+struct tdiff_ctx {
+	snapshot old_snap;
+	snapshot new_snap;
+	pathstore old_ps;
+	pathstore new_ps;
+	/* The matching entry of the other snapshot, indexed by path_id */
+	path_id *old_to_new;
+	path_id *new_to_old;
+	/*
+	 * Old directories by ino, with the dev checked on lookup. Of two entries
+	 * with the same ino on different devices only the last is found, which
+	 * at worst turns a move into a delete and a create.
+	 */
+	inode_map old_dirs;
+	/* New directories by ino, to tell whether an old directory went elsewhere */
+	inode_map new_dirs;
+	/* New files whose matching is decided after all the directories are matched */
+	path_id *deferred;
+	unsigned int num_deferred;
+	unsigned int deferred_cap;
+	/*
+	 * New directories, in pre-order, whose create or move is reported after the
+	 * renames of the files, because their name is still taken by an old entry
+	 * or their parent is postponed too. Flagged by path_id, allocated on demand.
+	 */
+	path_id *postponed;
+	unsigned int num_postponed;
+	unsigned int postponed_cap;
+	unsigned char *postponed_flags;
+	void (*change_handle)(struct tdiff_change*, void*);
+	void *handle_info;
+	long num_changes;
+};
+
+/* Hash code of an entry by its content digest */
+static int hash_fn_digest(void *key);
+/* Check whether two entries have the same content digest and size */
+static int equals_digest(void *value1, void *value2);
+/* Create a hashtable with the given hash and equals functions */
+static hashtable create_index(int (*hash_fn)(void*), int (*equals)(void*, void*));
+/* Index the old directories by their (dev, ino) */
+static void index_old_dir_visit(pathstore ps, path_id id, void *visit_info);
+/* Index the new directories by their (dev, ino) */
+static void index_new_dir_visit(pathstore ps, path_id id, void *visit_info);
+/* Append an id to a growing array */
+static void append_id(path_id **ids, unsigned int *num_ids, unsigned int *ids_cap, path_id id);
+
+/* Match an entry of the new snapshot, in pre-order */
+static void match_new_visit(pathstore ps, path_id id, void *visit_info);
+/* Match the deferred files, and report the ones left as created */
+static void match_deferred(struct tdiff_ctx *ctx);
+/* Match the deferred files renamed by inode, but those in postponed directories unless asked for */
+static void match_renames(struct tdiff_ctx *ctx, inode_map old_files, int in_postponed);
+/* Report the postponed directories as created or moved */
+static void emit_postponed(struct tdiff_ctx *ctx);
+/* Hold back the create or move of a new directory */
+static void postpone(struct tdiff_ctx *ctx, path_id new_id);
+/* Check whether the report of a new entry is held back */
+static int is_postponed(struct tdiff_ctx *ctx, path_id new_id);
+/* Report the unmatched old entries as deleted */
+static void report_deletes(struct tdiff_ctx *ctx);
+
+/* Find the unmatched old entry of the same type at the same path as the new entry */
+static path_id find_old_by_path(struct tdiff_ctx *ctx, path_id new_id);
+/* Report the unmatched old entry at the path of the new entry as deleted */
+static void free_name(struct tdiff_ctx *ctx, path_id new_id);
+/* Check whether the old directory is found in the new snapshot by inode, at another path */
+static int moved_elsewhere(struct tdiff_ctx *ctx, path_id old_id, path_id new_id);
+/* Find the old entry that occupies the path of the new entry (matched or not) */
+static path_id find_old_occupant(struct tdiff_ctx *ctx, path_id new_id);
+/* Look up an unmatched old entry of the same type and (dev, ino) in the index */
+static path_id find_old_by_inode(struct tdiff_ctx *ctx, inode_map index, path_id new_id);
+/* Look up an unmatched old entry of the same type and contents in the index */
+static path_id find_old_in_index(struct tdiff_ctx *ctx, hashtable index, path_id new_id);
+/* Check that the old entry is unmatched and of the type of the new entry */
+static path_id unmatched_of_type(struct tdiff_ctx *ctx, path_id old_id, struct snap_entry *new_entry);
+/* Record that the old and new entries are the same */
+static void pair(struct tdiff_ctx *ctx, path_id old_id, path_id new_id);
+/* Check whether the two entries are of the same file type */
+static int same_type(struct snap_entry *old_entry, struct snap_entry *new_entry);
+/* Check whether the contents of the file changed */
+static int file_changed(struct snap_entry *old_entry, struct snap_entry *new_entry);
+/* Report a change to the handler */
+static void emit(struct tdiff_ctx *ctx, enum tdiff_op op, path_id old_id, path_id new_id);
+/* Report a move of a matched entry, and its modification if any */
+static void emit_move(struct tdiff_ctx *ctx, path_id old_id, path_id new_id);
+
+long tdiff_compare(snapshot old_snap, snapshot new_snap,
+		void (*change_handle)(struct tdiff_change*, void*), void *handle_info) {
+	struct tdiff_ctx ctx;
+	ctx.old_snap = old_snap;
+	ctx.new_snap = new_snap;
+	ctx.old_ps = snap_paths(old_snap);
+	ctx.new_ps = snap_paths(new_snap);
+	ctx.old_to_new = spill_calloc(ps_id_limit(ctx.old_ps), sizeof(path_id));
+	ctx.new_to_old = spill_calloc(ps_id_limit(ctx.new_ps), sizeof(path_id));
+	ctx.deferred = NULL;
+	ctx.num_deferred = 0;
+	ctx.deferred_cap = 0;
+	ctx.postponed = NULL;
+	ctx.num_postponed = 0;
+	ctx.postponed_cap = 0;
+	ctx.postponed_flags = NULL;
+	ctx.change_handle = change_handle;
+	ctx.handle_info = handle_info;
+	ctx.num_changes = 0;
+
+	ctx.old_dirs = inode_map_create(1024);
+	ps_walk_subtree(ctx.old_ps, PATH_ID_ROOT, &index_old_dir_visit, &ctx);
+	ctx.new_dirs = inode_map_create(1024);
+	ps_walk_subtree(ctx.new_ps, PATH_ID_ROOT, &index_new_dir_visit, &ctx);
+
+	/*
+	 * Directories are matched during the pre-order walk, so that the children
+	 * of a moved directory can be matched by their names under the old one.
+	 */
+	ps_walk_subtree(ctx.new_ps, PATH_ID_ROOT, &match_new_visit, &ctx);
+	match_deferred(&ctx);
+	report_deletes(&ctx);
+
+	inode_map_destroy(ctx.old_dirs);
+	inode_map_destroy(ctx.new_dirs);
+	spill_free(ctx.old_to_new);
+	spill_free(ctx.new_to_old);
+	spill_free(ctx.deferred);
+	spill_free(ctx.postponed);
+	spill_free(ctx.postponed_flags);
+	return ctx.num_changes;
+}
+
+static int hash_fn_digest(void *key) {
+	struct snap_entry *entry = key;
+	int hash;
+	memcpy(&hash, entry->digest, sizeof(hash));
+	return hash;
+}
+
+static int equals_digest(void *value1, void *value2) {
+	struct snap_entry *entry1 = value1;
+	struct snap_entry *entry2 = value2;
+	return entry1->size == entry2->size
+			&& memcmp(entry1->digest, entry2->digest, sizeof(entry1->digest)) == 0;
+}
+
+static hashtable create_index(int (*hash_fn)(void*), int (*equals)(void*, void*)) {
+	ht_options options = default_ht_options();
+	options->table_size = 1024;
+	options->hash_fn = hash_fn;
+	options->equals = equals;
+	hashtable index = ht_create(options);
+	free(options);
+	return index;
+}
+
+static void index_old_dir_visit(pathstore ps, path_id id, void *visit_info) {
+	struct tdiff_ctx *ctx = visit_info;
+	struct snap_entry *entry = snap_get(ctx->old_snap, id);
+	if (id != PATH_ID_ROOT && S_ISDIR(entry->mode)) {
+		inode_map_put(ctx->old_dirs, entry->ino, id);
+	}
+}
+
+static void index_new_dir_visit(pathstore ps, path_id id, void *visit_info) {
+	struct tdiff_ctx *ctx = visit_info;
+	struct snap_entry *entry = snap_get(ctx->new_snap, id);
+	if (id != PATH_ID_ROOT && S_ISDIR(entry->mode)) {
+		inode_map_put(ctx->new_dirs, entry->ino, id);
+	}
+}
+
+static void append_id(path_id **ids, unsigned int *num_ids, unsigned int *ids_cap, path_id id) {
+	if (*num_ids == *ids_cap) {
+		*ids_cap = *ids_cap ? *ids_cap << 1 : 64;
+		*ids = spill_realloc(*ids, *ids_cap * sizeof(path_id));
+	}
+	(*ids)[(*num_ids)++] = id;
+}
+
+static void match_new_visit(pathstore ps, path_id id, void *visit_info) {
+	struct tdiff_ctx *ctx = visit_info;
+	if (id == PATH_ID_ROOT) {
+		pair(ctx, PATH_ID_ROOT, PATH_ID_ROOT);
+		return;
+	}
+
+	struct snap_entry *new_entry = snap_get(ctx->new_snap, id);
+	path_id old_id = find_old_by_path(ctx, id);
+
+	if (!S_ISDIR(new_entry->mode)) {
+		struct snap_entry *old_entry = snap_get(ctx->old_snap, old_id);
+		if (old_id != PATH_ID_NONE && old_entry->ino == new_entry->ino
+				&& old_entry->dev == new_entry->dev && !is_postponed(ctx, ps_parent(ps, id))) {
+			pair(ctx, old_id, id);
+			if (file_changed(old_entry, new_entry)) {
+				emit(ctx, TDIFF_MODIFY, old_id, id);
+			}
+		} else {
+			/* Could be a rename, decide once every unmatched old entry is known */
+			append_id(&ctx->deferred, &ctx->num_deferred, &ctx->deferred_cap, id);
+		}
+		return;
+	}
+
+	/* The directory at the same path, unless that one went elsewhere (mv a b; mkdir a) */
+	if (old_id != PATH_ID_NONE && !moved_elsewhere(ctx, old_id, id)) {
+		pair(ctx, old_id, id);
+		return;
+	}
+
+	old_id = find_old_by_inode(ctx, ctx->old_dirs, id);
+	if (old_id != PATH_ID_NONE) {
+		pair(ctx, old_id, id);
+	}
+	path_id occupant = find_old_occupant(ctx, id);
+	if (is_postponed(ctx, ps_parent(ps, id))
+			|| (occupant != PATH_ID_NONE && ctx->old_to_new[occupant] == PATH_ID_NONE)) {
+		/* The name is free only once the old entry is renamed or deleted */
+		postpone(ctx, id);
+	} else if (old_id != PATH_ID_NONE) {
+		emit(ctx, TDIFF_MOVE, old_id, id);
+	} else {
+		emit(ctx, TDIFF_CREATE, PATH_ID_NONE, id);
+	}
+}
+
+static void match_deferred(struct tdiff_ctx *ctx) {
+	if (ctx->num_deferred == 0) {
+		emit_postponed(ctx);
+		return;
+	}
+
+	/* Index the old files which are still unmatched */
+	inode_map old_files = inode_map_create(ctx->num_deferred);
+	hashtable old_digests = create_index(&hash_fn_digest, &equals_digest);
+	path_id limit = ps_id_limit(ctx->old_ps);
+	for (path_id id = PATH_ID_ROOT + 1; id < limit; id++) {
+		struct snap_entry *entry = snap_get(ctx->old_snap, id);
+		if (entry != NULL && ctx->old_to_new[id] == PATH_ID_NONE && !S_ISDIR(entry->mode)) {
+			inode_map_put(old_files, entry->ino, id);
+			if (entry->flags & SNAP_HAS_DIGEST) {
+				ht_put(old_digests, entry, (void *) (uintptr_t) id);
+			}
+		}
+	}
+
+	/*
+	 * The files renamed out of the names of the postponed directories free
+	 * them, and the files renamed into those directories wait for them.
+	 */
+	match_renames(ctx, old_files, 0);
+	emit_postponed(ctx);
+	match_renames(ctx, old_files, 1);
+
+	/* Replaced at the same path, or renamed with the same contents, or created */
+	for (unsigned int i = 0; i < ctx->num_deferred; i++) {
+		path_id new_id = ctx->deferred[i];
+		if (ctx->new_to_old[new_id] != PATH_ID_NONE) {
+			continue;
+		}
+
+		path_id old_id = find_old_by_path(ctx, new_id);
+		if (old_id != PATH_ID_NONE) {
+			pair(ctx, old_id, new_id);
+			if (file_changed(snap_get(ctx->old_snap, old_id), snap_get(ctx->new_snap, new_id))) {
+				emit(ctx, TDIFF_MODIFY, old_id, new_id);
+			}
+			continue;
+		}
+
+		if (snap_get(ctx->new_snap, new_id)->flags & SNAP_HAS_DIGEST) {
+			old_id = find_old_in_index(ctx, old_digests, new_id);
+		}
+		free_name(ctx, new_id);
+		if (old_id != PATH_ID_NONE) {
+			pair(ctx, old_id, new_id);
+			emit(ctx, TDIFF_MOVE, old_id, new_id);
+		} else {
+			emit(ctx, TDIFF_CREATE, PATH_ID_NONE, new_id);
+		}
+	}
+
+	inode_map_destroy(old_files);
+	ht_destroy(old_digests);
+}
+
+static void match_renames(struct tdiff_ctx *ctx, inode_map old_files, int in_postponed) {
+	/*
+	 * Renames by inode. Renames onto a free name go first, so that a chain of
+	 * renames (b -> c, a -> b) does not need to delete anything.
+	 */
+	for (int pass = 0; pass < 2; pass++) {
+		for (unsigned int i = 0; i < ctx->num_deferred; i++) {
+			path_id new_id = ctx->deferred[i];
+			if (ctx->new_to_old[new_id] != PATH_ID_NONE
+					|| (!in_postponed && is_postponed(ctx, ps_parent(ctx->new_ps, new_id)))) {
+				continue;
+			}
+			path_id old_id = find_old_by_inode(ctx, old_files, new_id);
+			if (old_id == PATH_ID_NONE) {
+				continue;
+			}
+
+			path_id occupant = find_old_occupant(ctx, new_id);
+			if (occupant == old_id) {
+				/* Kept its name, in a directory reported after the walk */
+				pair(ctx, old_id, new_id);
+				if (file_changed(snap_get(ctx->old_snap, old_id), snap_get(ctx->new_snap, new_id))) {
+					emit(ctx, TDIFF_MODIFY, old_id, new_id);
+				}
+				continue;
+			}
+			int occupied = occupant != PATH_ID_NONE && occupant != old_id
+					&& ctx->old_to_new[occupant] == PATH_ID_NONE;
+			if (occupied && pass == 0) {
+				continue;
+			}
+			if (occupied) {
+				free_name(ctx, new_id);
+			}
+			pair(ctx, old_id, new_id);
+			emit_move(ctx, old_id, new_id);
+		}
+	}
+}
+
+static void emit_postponed(struct tdiff_ctx *ctx) {
+	for (unsigned int i = 0; i < ctx->num_postponed; i++) {
+		path_id new_id = ctx->postponed[i];
+		free_name(ctx, new_id);
+		if (ctx->new_to_old[new_id] != PATH_ID_NONE) {
+			emit(ctx, TDIFF_MOVE, ctx->new_to_old[new_id], new_id);
+		} else {
+			emit(ctx, TDIFF_CREATE, PATH_ID_NONE, new_id);
+		}
+	}
+}
+
+static void postpone(struct tdiff_ctx *ctx, path_id new_id) {
+	if (ctx->postponed_flags == NULL) {
+		ctx->postponed_flags = spill_calloc(ps_id_limit(ctx->new_ps), 1);
+	}
+	ctx->postponed_flags[new_id] = 1;
+	append_id(&ctx->postponed, &ctx->num_postponed, &ctx->postponed_cap, new_id);
+}
+
+static int is_postponed(struct tdiff_ctx *ctx, path_id new_id) {
+	return ctx->postponed_flags != NULL && ctx->postponed_flags[new_id];
+}
+
+static void report_deletes(struct tdiff_ctx *ctx) {
+	/*
+	 * Pre-order walk of the old snapshot. The subtree of a deleted entry is not
+	 * descended into, since its entries are either deleted along with it, or
+	 * have already been moved out.
+	 */
+	pathstore ps = ctx->old_ps;
+	path_id curr = PATH_ID_ROOT;
+	while (curr != PATH_ID_NONE) {
+		int descend = 1;
+		if (ctx->old_to_new[curr] == PATH_ID_NONE) {
+			emit(ctx, TDIFF_DELETE, curr, PATH_ID_NONE);
+			descend = 0;
+		} else if (ctx->old_to_new[curr] == TDIFF_REMOVED) {
+			descend = 0;
+		}
+
+		if (descend && ps_first_child(ps, curr) != PATH_ID_NONE) {
+			curr = ps_first_child(ps, curr);
+			continue;
+		}
+		while (curr != PATH_ID_ROOT && ps_next_sibling(ps, curr) == PATH_ID_NONE) {
+			curr = ps_parent(ps, curr);
+		}
+		curr = (curr == PATH_ID_ROOT) ? PATH_ID_NONE : ps_next_sibling(ps, curr);
+	}
+}
+
+static path_id find_old_by_path(struct tdiff_ctx *ctx, path_id new_id) {
+	path_id old_id = find_old_occupant(ctx, new_id);
+	if (old_id == PATH_ID_NONE || ctx->old_to_new[old_id] != PATH_ID_NONE) {
+		return PATH_ID_NONE;
+	}
+
+	if (!same_type(snap_get(ctx->old_snap, old_id), snap_get(ctx->new_snap, new_id))) {
+		/* The name is reused for a different kind of entry, freed once the renames are known */
+		return PATH_ID_NONE;
+	}
+	return old_id;
+}
+
+static void free_name(struct tdiff_ctx *ctx, path_id new_id) {
+	path_id occupant = find_old_occupant(ctx, new_id);
+	if (occupant != PATH_ID_NONE && ctx->old_to_new[occupant] == PATH_ID_NONE) {
+		emit(ctx, TDIFF_DELETE, occupant, PATH_ID_NONE);
+		ctx->old_to_new[occupant] = TDIFF_REMOVED;
+	}
+}
+
+static int moved_elsewhere(struct tdiff_ctx *ctx, path_id old_id, path_id new_id) {
+	struct snap_entry *old_entry = snap_get(ctx->old_snap, old_id);
+	struct snap_entry *new_entry = snap_get(ctx->new_snap, new_id);
+	if (old_entry->ino == new_entry->ino && old_entry->dev == new_entry->dev) {
+		return 0;
+	}
+	path_id *other = inode_map_get(ctx->new_dirs, old_entry->ino);
+	return other != NULL && snap_get(ctx->new_snap, *other)->dev == old_entry->dev;
+}
+
+static path_id find_old_occupant(struct tdiff_ctx *ctx, path_id new_id) {
+	path_id old_parent = ctx->new_to_old[ps_parent(ctx->new_ps, new_id)];
+	if (old_parent == PATH_ID_NONE) {
+		return PATH_ID_NONE;
+	}
+
+	size_t name_len;
+	const char *name = ps_name(ctx->new_ps, new_id, &name_len);
+	return ps_lookup_child(ctx->old_ps, old_parent, name, name_len);
+}
+
+static path_id find_old_by_inode(struct tdiff_ctx *ctx, inode_map index, path_id new_id) {
+	struct snap_entry *new_entry = snap_get(ctx->new_snap, new_id);
+	path_id *old_id = inode_map_get(index, new_entry->ino);
+	if (old_id == NULL || snap_get(ctx->old_snap, *old_id)->dev != new_entry->dev) {
+		return PATH_ID_NONE;
+	}
+	return unmatched_of_type(ctx, *old_id, new_entry);
+}
+
+static path_id find_old_in_index(struct tdiff_ctx *ctx, hashtable index, path_id new_id) {
+	struct snap_entry *new_entry = snap_get(ctx->new_snap, new_id);
+	path_id old_id = (path_id) (uintptr_t) ht_get(index, new_entry);
+	return unmatched_of_type(ctx, old_id, new_entry);
+}
+
+static path_id unmatched_of_type(struct tdiff_ctx *ctx, path_id old_id, struct snap_entry *new_entry) {
+	if (old_id == PATH_ID_NONE || ctx->old_to_new[old_id] != PATH_ID_NONE
+			|| !same_type(snap_get(ctx->old_snap, old_id), new_entry)) {
+		return PATH_ID_NONE;
+	}
+	return old_id;
+}
+
+static void pair(struct tdiff_ctx *ctx, path_id old_id, path_id new_id) {
+	ctx->old_to_new[old_id] = new_id;
+	ctx->new_to_old[new_id] = old_id;
+}
+
+static int same_type(struct snap_entry *old_entry, struct snap_entry *new_entry) {
+	return (old_entry->mode & S_IFMT) == (new_entry->mode & S_IFMT);
+}
+
+static int file_changed(struct snap_entry *old_entry, struct snap_entry *new_entry) {
+	if (old_entry->size != new_entry->size) {
+		return 1;
+	}
+	if ((old_entry->flags & SNAP_HAS_DIGEST) && (new_entry->flags & SNAP_HAS_DIGEST)) {
+		return memcmp(old_entry->digest, new_entry->digest, sizeof(old_entry->digest)) != 0;
+	}
+	return old_entry->mtime_sec != new_entry->mtime_sec
+			|| old_entry->mtime_nsec != new_entry->mtime_nsec
+			|| old_entry->ino != new_entry->ino;
+}
+
+static void emit(struct tdiff_ctx *ctx, enum tdiff_op op, path_id old_id, path_id new_id) {
+	struct tdiff_change change;
+	change.op = op;
+	change.old_id = old_id;
+	change.new_id = new_id;
+	change.old_path = (old_id != PATH_ID_NONE) ? ps_path(ctx->old_ps, old_id) : NULL;
+	change.new_path = (new_id != PATH_ID_NONE) ? ps_path(ctx->new_ps, new_id) : NULL;
+	change.old_entry = (old_id != PATH_ID_NONE) ? snap_get(ctx->old_snap, old_id) : NULL;
+	change.new_entry = (new_id != PATH_ID_NONE) ? snap_get(ctx->new_snap, new_id) : NULL;
+
+	ctx->num_changes++;
+	if (ctx->change_handle != NULL) {
+		ctx->change_handle(&change, ctx->handle_info);
+	}
+}
+
+static void emit_move(struct tdiff_ctx *ctx, path_id old_id, path_id new_id) {
+	emit(ctx, TDIFF_MOVE, old_id, new_id);
+	if (file_changed(snap_get(ctx->old_snap, old_id), snap_get(ctx->new_snap, new_id))) {
+		emit(ctx, TDIFF_MODIFY, old_id, new_id);
+	}
+}
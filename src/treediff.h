@@ -0,0 +1,80 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_TREEDIFF_H
+#define GOODRV_TREEDIFF_H
+
+#include "snapshot.h"
+
+/*
+ * Kinds of changes between two snapshots.
+ */
+enum tdiff_op {
+	/* A new entry. new_* fields are valid. */
+	TDIFF_CREATE,
+	/* The contents of a file changed. Both old_* and new_* fields are valid. */
+	TDIFF_MODIFY,
+	/* The entry (with its subtree) was moved or renamed. Both old_* and new_* fields are valid. */
+	TDIFF_MOVE,
+	/* The entry (with its subtree) was removed. old_* fields are valid. */
+	TDIFF_DELETE
+};
+
+/*
+ * A single change. The paths are valid only during the change handler.
+ */
+struct tdiff_change {
+	enum tdiff_op op;
+	path_id old_id;
+	path_id new_id;
+	const char *old_path;
+	const char *new_path;
+	struct snap_entry *old_entry;
+	struct snap_entry *new_entry;
+};
+
+/*
+ * Find the changes that turn the old snapshot into the new one, and call the
+ * handle for each change as soon as it is known.
+ *
+ * The change list is minimal: an entry under a created, moved or deleted
+ * directory is reported only if it changed relative to that directory. Entries
+ * are matched by path first, unless the old entry is of another type, or has
+ * another (device, inode) and is found at another path; an unmatched entry is
+ * matched with an unmatched entry of the old snapshot having the same (device,
+ * inode), and failing that, a file is matched by its content digest and size.
+ * Matched entries at a different path are reported as moves.
+ *
+ * The changes are ordered, so that they can be replayed one after the other:
+ * a directory is created or moved before any change within it, a replaced
+ * entry is deleted before its name is reused, and the remaining deletes come
+ * last.
+ *
+ * Runs in time linear to the number of entries in both snapshots.
+ * Returns the number of changes.
+ */
+long tdiff_compare(snapshot old_snap, snapshot new_snap,
+		void (*change_handle)(struct tdiff_change*, void*), void *handle_info);
+
+#endif /* GOODRV_TREEDIFF_H */
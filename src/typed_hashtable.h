@@ -0,0 +1,230 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GOODRV_TYPED_HASHTABLE_H
+#define GOODRV_TYPED_HASHTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "pathstore.h"
+
+/* Slots of the smallest map, a power of 2 */
+#define TYPED_HT_MIN_SLOTS 16
+/* Largest fraction of the slots in use, TYPED_HT_LOAD_NUM / TYPED_HT_LOAD_DEN */
+#define TYPED_HT_LOAD_NUM 1
+#define TYPED_HT_LOAD_DEN 2
+
+/*
+ * Hashtables specialized at compile time for integer keys.
+ *
+ * TYPED_HT_DEFINE generates a map type and its functions, all static inline,
+ * so that the hashing and the key comparisons are inlined at every call
+ * instead of going through the function pointers of hashtable.h. The keys
+ * and values are stored in the slots themselves, with open addressing and
+ * linear probing, and removals shift the following entries back rather than
+ * leaving tombstones.
+ *
+ * The keys are compared with ==. One key value, empty_key, marks the free
+ * slots and cannot be stored. hashtable.h stays the table for the other keys.
+ *
+ * For a map called name, the generated functions are:
+ *
+ * name name_create(size_t size) - Create a map sized for about size entries.
+ * 		Returns NULL on failure.
+ * void name_destroy(name map) - Free the map.
+ * size_t name_num_entries(name map) - Get the number of entries.
+ * value_type *name_get(name map, key_type key) - Get the slot of the value of
+ * 		the key, valid until the map is next changed. Returns NULL if absent.
+ * int name_put(name map, key_type key, value_type value) - Insert or update
+ * 		the key. Returns 1 if it was present, 0 if not, and -1 on failure or
+ * 		for the empty key.
+ * int name_remove(name map, key_type key, value_type *value) - Remove the
+ * 		key, setting value, if not NULL, to its value. Returns 0 on success,
+ * 		-1 if absent.
+ */
+#define TYPED_HT_DEFINE(name, key_type, value_type, empty_key, hash_fn) \
+	struct name##_slot { \
+		key_type key; \
+		value_type value; \
+	}; \
+	\
+	typedef struct name { \
+		struct name##_slot *slots; \
+		size_t mask; \
+		size_t num_entries; \
+	} *name; \
+	\
+	static inline int name##_alloc(name map, size_t capacity) { \
+		map->slots = malloc(capacity * sizeof(struct name##_slot)); \
+		if (map->slots == NULL) { \
+			return -1; \
+		} \
+		for (size_t i = 0; i < capacity; i++) { \
+			map->slots[i].key = (empty_key); \
+		} \
+		map->mask = capacity - 1; \
+		return 0; \
+	} \
+	\
+	static inline name name##_create(size_t size) { \
+		name map = malloc(sizeof(struct name)); \
+		if (map == NULL) { \
+			return NULL; \
+		} \
+		size_t capacity = TYPED_HT_MIN_SLOTS; \
+		while (capacity * TYPED_HT_LOAD_NUM < size * TYPED_HT_LOAD_DEN) { \
+			capacity <<= 1; \
+		} \
+		map->num_entries = 0; \
+		if (name##_alloc(map, capacity) == -1) { \
+			free(map); \
+			return NULL; \
+		} \
+		return map; \
+	} \
+	\
+	static inline void name##_destroy(name map) { \
+		if (map != NULL) { \
+			free(map->slots); \
+			free(map); \
+		} \
+	} \
+	\
+	static inline size_t name##_num_entries(name map) { \
+		return map->num_entries; \
+	} \
+	\
+	/* Slot of the key, or the free slot ending its probe sequence */ \
+	static inline size_t name##_probe(name map, key_type key) { \
+		size_t i = (size_t) (hash_fn(key)) & map->mask; \
+		while (map->slots[i].key != key && map->slots[i].key != (empty_key)) { \
+			i = (i + 1) & map->mask; \
+		} \
+		return i; \
+	} \
+	\
+	static inline value_type *name##_get(name map, key_type key) { \
+		size_t i = name##_probe(map, key); \
+		return (map->slots[i].key == (empty_key)) ? NULL : &map->slots[i].value; \
+	} \
+	\
+	static inline int name##_grow(name map) { \
+		struct name##_slot *old_slots = map->slots; \
+		size_t old_capacity = map->mask + 1; \
+		if (name##_alloc(map, old_capacity << 1) == -1) { \
+			map->slots = old_slots; \
+			return -1; \
+		} \
+		for (size_t i = 0; i < old_capacity; i++) { \
+			if (old_slots[i].key != (empty_key)) { \
+				map->slots[name##_probe(map, old_slots[i].key)] = old_slots[i]; \
+			} \
+		} \
+		free(old_slots); \
+		return 0; \
+	} \
+	\
+	static inline int name##_put(name map, key_type key, value_type value) { \
+		if (key == (empty_key)) { \
+			return -1; \
+		} \
+		size_t i = name##_probe(map, key); \
+		if (map->slots[i].key == key) { \
+			map->slots[i].value = value; \
+			return 1; \
+		} \
+		if ((map->num_entries + 1) * TYPED_HT_LOAD_DEN > (map->mask + 1) * TYPED_HT_LOAD_NUM) { \
+			if (name##_grow(map) == -1) { \
+				return -1; \
+			} \
+			i = name##_probe(map, key); \
+		} \
+		map->slots[i].key = key; \
+		map->slots[i].value = value; \
+		map->num_entries++; \
+		return 0; \
+	} \
+	\
+	static inline int name##_remove(name map, key_type key, value_type *value) { \
+		size_t i = name##_probe(map, key); \
+		if (map->slots[i].key == (empty_key)) { \
+			return -1; \
+		} \
+		if (value != NULL) { \
+			*value = map->slots[i].value; \
+		} \
+		/* Shift back the entries that would no longer be reached from their home slot */ \
+		size_t j = i; \
+		for (;;) { \
+			j = (j + 1) & map->mask; \
+			if (map->slots[j].key == (empty_key)) { \
+				break; \
+			} \
+			size_t home = (size_t) (hash_fn(map->slots[j].key)) & map->mask; \
+			if (((j - home) & map->mask) >= ((j - i) & map->mask)) { \
+				map->slots[i] = map->slots[j]; \
+				i = j; \
+			} \
+		} \
+		map->slots[i].key = (empty_key); \
+		map->num_entries--; \
+		return 0; \
+	} \
+	\
+	/* Takes the semicolon after the macro */ \
+	typedef int name##_defined_t
+
+/*
+ * Mix all the bits of the integer into the low ones, which pick the slot.
+ * The finalizer of MurmurHash3.
+ */
+static inline uint64_t typed_ht_hash_u64(uint64_t key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ULL;
+	key ^= key >> 33;
+	return key;
+}
+
+/*
+ * Inode number to the entry of a snapshot. 0 is never an inode number.
+ */
+TYPED_HT_DEFINE(inode_map, uint64_t, path_id, 0, typed_ht_hash_u64);
+
+/*
+ * Entry of a path store to another, like the entry of an older tree.
+ */
+TYPED_HT_DEFINE(path_map, path_id, path_id, PATH_ID_NONE, typed_ht_hash_u64);
+
+/*
+ * Inotify watch descriptor to the watched directory. Descriptors are never
+ * negative.
+ */
+TYPED_HT_DEFINE(wd_map, int, path_id, -1, typed_ht_hash_u64);
+
+#endif /* GOODRV_TYPED_HASHTABLE_H */
@@ -0,0 +1,701 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/md5.h>
+
+#include "bqueue.h"
+#include "linux-api.h"
+#include "upload.h"
+
+/*
+ * State shared by the stages of the pipeline
+ */
+struct upload_ctx {
+	struct transport *transport;
+	struct upload_options options;
+	char *state_dir;
+	/* Chunks read, waiting for a sender. NULL when they are sent by the reader. */
+	bqueue chunk_queue;
+	/* Guards the stats, the list of jobs in flight, and the pending and failed fields of the jobs */
+	pthread_mutex_t lock;
+	struct upload_stats stats;
+	/* Jobs with a file digest that are still being sent, for the dedup index */
+	struct upload_job *in_flight;
+	/* Signalled when a job in flight is done */
+	pthread_cond_t job_done;
+};
+
+/*
+ * Upload of a single file
+ */
+struct upload_job {
+	/* Path of the file, and its metadata when it was opened */
+	char *path;
+	struct stat file_stat;
+	/* Name of the object */
+	char *name;
+	/* File that records the session, while the upload is incomplete */
+	char *record_path;
+	/* Compressed copy of the file that is sent instead, NULL if there is none */
+	char *spool_path;
+	char session_id[TRANSPORT_SESSION_ID_LEN];
+	/* MD5 of the object */
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	/* MD5 of the file, hashed up front for the dedup index */
+	unsigned char file_digest[MD5_DIGEST_LENGTH];
+	int has_file_digest;
+	/* Chunks not yet sent, plus one while the file is being read */
+	unsigned int pending;
+	int failed;
+	/* Next job in flight */
+	struct upload_job *next;
+};
+
+/*
+ * A piece of a file, on its way from the reader to a sender
+ */
+struct upload_chunk {
+	struct upload_job *job;
+	uint64_t offset;
+	size_t len;
+	/* Bytes to be sent, within buffer */
+	unsigned char *data;
+	unsigned char buffer[];
+};
+
+/* Read, hash and chunk the file, handing the chunks to the senders */
+static void read_file(struct upload_ctx *ctx, char *file_path, unsigned int *seed);
+/* Resume the recorded session of the file, or begin a new one. Returns the offset to send from, or -1 */
+static int64_t open_session(struct upload_ctx *ctx, struct upload_job *job, struct stat *file_stat,
+		uint64_t size, unsigned int *seed);
+/*
+ * Check whether the session record is for the file as it is now, and get the
+ * size of the object being uploaded.
+ */
+static int record_matches(struct upload_job *job, struct stat *file_stat, uint64_t *object_size);
+/*
+ * Compress the file into the spool, or reuse the spool of an interrupted
+ * upload. Returns the spool opened for reading, or -1 to send the file as it is.
+ */
+static int spool_compressed(struct upload_ctx *ctx, struct upload_job *job, char *file_path, int fd,
+		struct stat *file_stat);
+/*
+ * Wait till no other job in flight has the same contents, so that the file can
+ * be copied from its object rather than being sent again.
+ */
+static void wait_duplicates(struct upload_ctx *ctx, struct upload_job *job);
+/*
+ * Make the object a copy of one in the store with the same contents, as per
+ * the dedup index. Returns 0 on success, -1 if the file has to be sent.
+ */
+static int copy_duplicate(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed);
+/* Get the name of the store in the dedup index */
+static const char *dedup_store(struct upload_ctx *ctx);
+/*
+ * Delete the object of the file under its other name, left by an earlier
+ * upload that was compressed when this one is not, or the other way round.
+ */
+static void delete_other_form(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed);
+/* Free the job */
+static void free_job(struct upload_job *job);
+/* Drop a reference to the job, and complete the upload when it was the last one */
+static void release_job(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed);
+/* Mark the job as failed */
+static void fail_job(struct upload_ctx *ctx, struct upload_job *job);
+/* Check whether the job has failed */
+static int job_failed(struct upload_ctx *ctx, struct upload_job *job);
+/* Send the chunks in the queue, till it is closed */
+static void *sender_thread(void *arg);
+/* Send the chunk, and drop its reference to the job */
+static void send_chunk(struct upload_ctx *ctx, struct upload_chunk *chunk, unsigned int *seed);
+/* Wait before the next attempt of a request. Returns 0 when there are no more attempts left */
+static int retry_wait(struct upload_ctx *ctx, unsigned int attempt, unsigned int *seed);
+/* Read up to len bytes, unless the end of file is reached */
+static ssize_t read_full(int fd, unsigned char *buf, size_t len);
+
+void upload_default_options(struct upload_options *options) {
+	options->num_senders = 4;
+	options->chunk_size = 256 * 1024;
+	options->queue_size = 16;
+	options->max_retries = 5;
+	options->backoff_us = 100000;
+	options->state_dir = NULL;
+	options->compress = NULL;
+	options->dedup = NULL;
+	options->dedup_store = NULL;
+}
+
+int upload_files(struct transport *transport, char **file_paths, int num_files,
+		struct upload_options *options, struct upload_stats *stats) {
+	if (transport == NULL || (file_paths == NULL && num_files > 0)) {
+		return -1;
+	}
+
+	struct upload_ctx ctx;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.transport = transport;
+	if (options != NULL) {
+		ctx.options = *options;
+	} else {
+		upload_default_options(&ctx.options);
+	}
+	if (ctx.options.chunk_size == 0) {
+		return -1;
+	}
+
+	if (ctx.options.state_dir != NULL) {
+		ctx.state_dir = strdup(ctx.options.state_dir);
+	} else if ((ctx.state_dir = get_config_dir_curruser()) != NULL) {
+		ctx.state_dir = strdup(ctx.state_dir);
+	} else {
+		return -1;
+	}
+	mkdir(ctx.state_dir, 0700);
+
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.job_done, NULL);
+	pthread_t *senders = NULL;
+	unsigned int num_senders = 0;
+	if (ctx.options.num_senders > 0) {
+		ctx.chunk_queue = bq_create(ctx.options.queue_size);
+		senders = malloc(ctx.options.num_senders * sizeof(pthread_t));
+		while (num_senders < ctx.options.num_senders
+				&& pthread_create(&senders[num_senders], NULL, &sender_thread, &ctx) == 0) {
+			num_senders++;
+		}
+	}
+
+	int started = ctx.options.num_senders == 0 || num_senders > 0;
+	if (started) {
+		unsigned int seed = (unsigned int) time(NULL) ^ (unsigned int) pthread_self();
+		for (int i = 0; i < num_files; i++) {
+			read_file(&ctx, file_paths[i], &seed);
+		}
+	}
+
+	if (ctx.chunk_queue != NULL) {
+		bq_close(ctx.chunk_queue);
+		for (unsigned int i = 0; i < num_senders; i++) {
+			pthread_join(senders[i], NULL);
+		}
+		bq_destroy(ctx.chunk_queue);
+	}
+	pthread_cond_destroy(&ctx.job_done);
+	pthread_mutex_destroy(&ctx.lock);
+	free(senders);
+	free(ctx.state_dir);
+
+	if (!started) {
+		return -1;
+	}
+	if (stats != NULL) {
+		*stats = ctx.stats;
+	}
+	return ctx.stats.files_failed;
+}
+
+static void read_file(struct upload_ctx *ctx, char *file_path, unsigned int *seed) {
+	struct stat file_stat;
+	int fd = open(file_path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &file_stat) != 0) {
+		if (fd != -1) {
+			close(fd);
+		}
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stats.files_failed++;
+		pthread_mutex_unlock(&ctx->lock);
+		return;
+	}
+
+	struct upload_job *job = calloc(1, sizeof(struct upload_job));
+	job->path = strdup(file_path);
+	job->file_stat = file_stat;
+	job->name = strdup(file_path);
+	char *path_md5sum = md5sum_str(file_path);
+	char *file_name = malloc(strlen(path_md5sum) + strlen(".upload") + 1);
+	strcpy(file_name, path_md5sum);
+	strcat(file_name, ".upload");
+	job->record_path = get_abs_path(ctx->state_dir, file_name);
+	free(path_md5sum);
+	free(file_name);
+
+	if (ctx->options.dedup != NULL && S_ISREG(file_stat.st_mode)
+			&& md5sum_file_bytes(file_path, job->file_digest) == 0) {
+		job->has_file_digest = 1;
+		wait_duplicates(ctx, job);
+		if (copy_duplicate(ctx, job, seed) == 0) {
+			close(fd);
+			pthread_mutex_lock(&ctx->lock);
+			ctx->stats.files_done++;
+			ctx->stats.files_deduplicated++;
+			ctx->stats.bytes_deduplicated += file_stat.st_size;
+			pthread_mutex_unlock(&ctx->lock);
+			free_job(job);
+			return;
+		}
+	}
+
+	uint64_t size = file_stat.st_size;
+	int spool_fd = spool_compressed(ctx, job, file_path, fd, &file_stat);
+	if (spool_fd != -1) {
+		close(fd);
+		fd = spool_fd;
+		struct stat spool_stat;
+		fstat(fd, &spool_stat);
+		size = spool_stat.st_size;
+
+		job->name = realloc(job->name,
+				strlen(job->name) + strlen(compress_suffix(ctx->options.compress->codec)) + 1);
+		strcat(job->name, compress_suffix(ctx->options.compress->codec));
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stats.files_compressed++;
+		ctx->stats.bytes_uncompressed += file_stat.st_size;
+		ctx->stats.bytes_compressed += size;
+		pthread_mutex_unlock(&ctx->lock);
+	}
+
+	int64_t resume_offset = open_session(ctx, job, &file_stat, size, seed);
+	if (resume_offset < 0) {
+		close(fd);
+		pthread_mutex_lock(&ctx->lock);
+		ctx->stats.files_failed++;
+		pthread_mutex_unlock(&ctx->lock);
+		free_job(job);
+		return;
+	}
+	pthread_mutex_lock(&ctx->lock);
+	ctx->stats.bytes_resumed += resume_offset;
+	job->pending = 1;
+	if (job->has_file_digest) {
+		job->next = ctx->in_flight;
+		ctx->in_flight = job;
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	/*
+	 * The whole file is hashed, but the bytes the store already has are
+	 * not sent again.
+	 */
+	MD5_CTX md5_ctxt;
+	MD5_Init(&md5_ctxt);
+	uint64_t offset = 0;
+	while (1) {
+		struct upload_chunk *chunk = malloc(sizeof(struct upload_chunk) + ctx->options.chunk_size);
+		ssize_t len = read_full(fd, chunk->buffer, ctx->options.chunk_size);
+		if (len <= 0) {
+			if (len == -1) {
+				fail_job(ctx, job);
+			}
+			free(chunk);
+			break;
+		}
+		MD5_Update(&md5_ctxt, chunk->buffer, len);
+
+		uint64_t end = offset + len;
+		if (end <= (uint64_t) resume_offset || job_failed(ctx, job)) {
+			free(chunk);
+		} else {
+			size_t skip = ((uint64_t) resume_offset > offset) ? resume_offset - offset : 0;
+			chunk->job = job;
+			chunk->offset = offset + skip;
+			chunk->len = len - skip;
+			chunk->data = chunk->buffer + skip;
+
+			pthread_mutex_lock(&ctx->lock);
+			job->pending++;
+			pthread_mutex_unlock(&ctx->lock);
+			if (ctx->chunk_queue != NULL) {
+				bq_push(ctx->chunk_queue, chunk);
+			} else {
+				send_chunk(ctx, chunk, seed);
+			}
+		}
+		offset = end;
+	}
+	MD5_Final(job->digest, &md5_ctxt);
+	close(fd);
+
+	release_job(ctx, job, seed);
+}
+
+static int64_t open_session(struct upload_ctx *ctx, struct upload_job *job, struct stat *file_stat,
+		uint64_t size, unsigned int *seed) {
+	struct transport *transport = ctx->transport;
+	unsigned int attempt;
+
+	uint64_t object_size;
+	if (record_matches(job, file_stat, &object_size) && object_size == size) {
+		int64_t offset;
+		attempt = 0;
+		do {
+			offset = transport->query_offset(transport, job->session_id);
+		} while (offset == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+		if (offset >= 0) {
+			return offset;
+		}
+		if (offset == TRANSPORT_ERR_RETRY) {
+			return -1;
+		}
+	}
+
+	int status;
+	attempt = 0;
+	do {
+		status = transport->begin_session(transport, job->name, size, job->session_id);
+	} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+	if (status != TRANSPORT_OK) {
+		return -1;
+	}
+
+	FILE *record = fopen(job->record_path, "w");
+	if (record != NULL) {
+		fprintf(record, "%s %llu %lld %lld %llu\n", job->session_id,
+				(unsigned long long) file_stat->st_size, (long long) file_stat->st_mtim.tv_sec,
+				(long long) file_stat->st_mtim.tv_nsec, (unsigned long long) size);
+		fclose(record);
+	}
+	return 0;
+}
+
+static void release_job(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed) {
+	pthread_mutex_lock(&ctx->lock);
+	int done = (--job->pending == 0);
+	int failed = job->failed;
+	pthread_mutex_unlock(&ctx->lock);
+	if (!done) {
+		return;
+	}
+
+	if (!failed) {
+		/* Every chunk is sent, and the reader has finished the digest */
+		struct transport *transport = ctx->transport;
+		int status;
+		unsigned int attempt = 0;
+		do {
+			status = transport->finish_session(transport, job->session_id, job->digest);
+		} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+
+		if (status != TRANSPORT_ERR_RETRY) {
+			/* The session is over, either way */
+			unlink(job->record_path);
+			if (job->spool_path != NULL) {
+				unlink(job->spool_path);
+			}
+		}
+		failed = (status != TRANSPORT_OK);
+		if (!failed) {
+			delete_other_form(ctx, job, seed);
+		}
+	}
+
+	if (!failed && job->has_file_digest) {
+		dedup_add_local(ctx->options.dedup, job->file_digest, job->file_stat.st_size, job->path,
+				&job->file_stat);
+		if (job->spool_path == NULL) {
+			dedup_add_remote(ctx->options.dedup, job->file_digest, job->file_stat.st_size,
+					dedup_store(ctx), job->name);
+		}
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	if (failed) {
+		ctx->stats.files_failed++;
+	} else {
+		ctx->stats.files_done++;
+	}
+	for (struct upload_job **link = &ctx->in_flight; *link != NULL; link = &(*link)->next) {
+		if (*link == job) {
+			*link = job->next;
+			pthread_cond_broadcast(&ctx->job_done);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	free_job(job);
+}
+
+static int record_matches(struct upload_job *job, struct stat *file_stat, uint64_t *object_size) {
+	FILE *record = fopen(job->record_path, "r");
+	if (record == NULL) {
+		return 0;
+	}
+	unsigned long long size, recorded_object_size;
+	long long mtime_sec, mtime_nsec;
+	/* The width is TRANSPORT_SESSION_ID_LEN - 1 */
+	int fields = fscanf(record, "%63s %llu %lld %lld %llu", job->session_id, &size, &mtime_sec,
+			&mtime_nsec, &recorded_object_size);
+	fclose(record);
+	*object_size = recorded_object_size;
+
+	/* The session can only be resumed if the file has not changed since */
+	return fields == 5 && size == (unsigned long long) file_stat->st_size
+			&& mtime_sec == file_stat->st_mtim.tv_sec && mtime_nsec == file_stat->st_mtim.tv_nsec;
+}
+
+static int spool_compressed(struct upload_ctx *ctx, struct upload_job *job, char *file_path, int fd,
+		struct stat *file_stat) {
+	struct compress_options *compress = ctx->options.compress;
+	/* Named after the record, as <md5 of the path>.spool<suffix of the codec> */
+	const char *suffix = compress_suffix(compress != NULL ? compress->codec : COMPRESS_NONE);
+	size_t prefix_len = strlen(job->record_path) - strlen(".upload");
+	char *spool_path = malloc(prefix_len + strlen(".spool") + strlen(suffix) + 1);
+	memcpy(spool_path, job->record_path, prefix_len);
+	strcpy(spool_path + prefix_len, ".spool");
+	strcat(spool_path, suffix);
+
+	if (compress == NULL || !S_ISREG(file_stat->st_mode)
+			|| !compress_worthwhile(compress, file_path, fd, file_stat->st_size)) {
+		if (compress != NULL) {
+			unlink(spool_path);
+		}
+		free(spool_path);
+		return -1;
+	}
+
+	int spool_fd;
+	uint64_t object_size;
+	if (record_matches(job, file_stat, &object_size) && (spool_fd = open(spool_path, O_RDONLY)) != -1) {
+		/* The interrupted upload could be of this spool, which open_session checks */
+		job->spool_path = spool_path;
+		return spool_fd;
+	}
+
+	/* Compressed under another name, so that the spool is never left incomplete */
+	char *part_path = malloc(strlen(spool_path) + strlen(".part") + 1);
+	strcpy(part_path, spool_path);
+	strcat(part_path, ".part");
+	uint64_t compressed_size;
+	spool_fd = open(part_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (spool_fd != -1 && compress_stream(compress->codec, compress->level, fd, spool_fd,
+			&compressed_size) == 0 && compressed_size < (uint64_t) file_stat->st_size
+			&& rename(part_path, spool_path) == 0) {
+		lseek(spool_fd, 0, SEEK_SET);
+		free(part_path);
+		job->spool_path = spool_path;
+		return spool_fd;
+	}
+
+	/* Not worth it after all */
+	if (spool_fd != -1) {
+		close(spool_fd);
+		unlink(part_path);
+	}
+	free(part_path);
+	free(spool_path);
+	lseek(fd, 0, SEEK_SET);
+	return -1;
+}
+
+static void wait_duplicates(struct upload_ctx *ctx, struct upload_job *job) {
+	pthread_mutex_lock(&ctx->lock);
+	struct upload_job *other = ctx->in_flight;
+	while (other != NULL) {
+		if (other->file_stat.st_size == job->file_stat.st_size
+				&& memcmp(other->file_digest, job->file_digest, MD5_DIGEST_LENGTH) == 0) {
+			pthread_cond_wait(&ctx->job_done, &ctx->lock);
+			/* The list may have changed */
+			other = ctx->in_flight;
+		} else {
+			other = other->next;
+		}
+	}
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static int copy_duplicate(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed) {
+	struct transport *transport = ctx->transport;
+	uint64_t size = job->file_stat.st_size;
+	char *src_name;
+	while ((src_name = dedup_find_remote(ctx->options.dedup, job->file_digest, size,
+			dedup_store(ctx))) != NULL) {
+		/* The index may be out of date, so the store has the final say */
+		uint64_t object_size;
+		unsigned char object_digest[MD5_DIGEST_LENGTH];
+		int status;
+		unsigned int attempt = 0;
+		do {
+			status = transport->stat_object(transport, src_name, &object_size, object_digest);
+		} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+
+		if (status == TRANSPORT_OK && object_size == size
+				&& memcmp(object_digest, job->file_digest, MD5_DIGEST_LENGTH) == 0) {
+			if (strcmp(src_name, job->name) == 0) {
+				/* The object is already up to date */
+			} else if (transport->copy_object == NULL) {
+				status = TRANSPORT_ERR_RETRY;
+			} else {
+				attempt = 0;
+				do {
+					status = transport->copy_object(transport, src_name, job->name);
+				} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+			}
+			if (status == TRANSPORT_OK) {
+				free(src_name);
+				delete_other_form(ctx, job, seed);
+				/* A session left behind for the object is of no use now */
+				unlink(job->record_path);
+				dedup_add_local(ctx->options.dedup, job->file_digest, size, job->path, &job->file_stat);
+				dedup_add_remote(ctx->options.dedup, job->file_digest, size, dedup_store(ctx), job->name);
+				return 0;
+			}
+		} else if (status == TRANSPORT_OK) {
+			status = TRANSPORT_ERR_FATAL;
+		}
+
+		if (status == TRANSPORT_ERR_RETRY) {
+			/* Unsure, so the file is sent */
+			free(src_name);
+			return -1;
+		}
+		/* The object is gone, or holds something else now */
+		dedup_remove_remote(ctx->options.dedup, dedup_store(ctx), src_name);
+		free(src_name);
+	}
+	return -1;
+}
+
+static const char *dedup_store(struct upload_ctx *ctx) {
+	return (ctx->options.dedup_store != NULL) ? ctx->options.dedup_store : "default";
+}
+
+static void delete_other_form(struct upload_ctx *ctx, struct upload_job *job, unsigned int *seed) {
+	struct transport *transport = ctx->transport;
+	if (ctx->options.compress == NULL || transport->delete_object == NULL) {
+		/* Without compression, every object has the name of its file */
+		return;
+	}
+	const char *suffix = compress_suffix(ctx->options.compress->codec);
+	char *other_name;
+	if (strcmp(job->name, job->path) != 0) {
+		other_name = strdup(job->path);
+	} else {
+		other_name = malloc(strlen(job->path) + strlen(suffix) + 1);
+		strcpy(other_name, job->path);
+		strcat(other_name, suffix);
+	}
+	int status;
+	unsigned int attempt = 0;
+	do {
+		status = transport->delete_object(transport, other_name);
+	} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+	if (status == TRANSPORT_OK && ctx->options.dedup != NULL) {
+		dedup_remove_remote(ctx->options.dedup, dedup_store(ctx), other_name);
+	}
+	free(other_name);
+}
+
+static void free_job(struct upload_job *job) {
+	free(job->path);
+	free(job->name);
+	free(job->record_path);
+	free(job->spool_path);
+	free(job);
+}
+
+static void fail_job(struct upload_ctx *ctx, struct upload_job *job) {
+	pthread_mutex_lock(&ctx->lock);
+	job->failed = 1;
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static int job_failed(struct upload_ctx *ctx, struct upload_job *job) {
+	pthread_mutex_lock(&ctx->lock);
+	int failed = job->failed;
+	pthread_mutex_unlock(&ctx->lock);
+	return failed;
+}
+
+static void *sender_thread(void *arg) {
+	struct upload_ctx *ctx = arg;
+	unsigned int seed = (unsigned int) time(NULL) ^ (unsigned int) pthread_self();
+
+	void *item;
+	while (bq_pop(ctx->chunk_queue, &item) == 0) {
+		send_chunk(ctx, item, &seed);
+	}
+	return NULL;
+}
+
+static void send_chunk(struct upload_ctx *ctx, struct upload_chunk *chunk, unsigned int *seed) {
+	struct transport *transport = ctx->transport;
+	struct upload_job *job = chunk->job;
+	if (!job_failed(ctx, job)) {
+		int status;
+		unsigned int attempt = 0;
+		do {
+			status = transport->send_chunk(transport, job->session_id, chunk->offset, chunk->data,
+					chunk->len);
+		} while (status == TRANSPORT_ERR_RETRY && retry_wait(ctx, attempt++, seed));
+
+		if (status == TRANSPORT_OK) {
+			pthread_mutex_lock(&ctx->lock);
+			ctx->stats.chunks_sent++;
+			ctx->stats.bytes_sent += chunk->len;
+			pthread_mutex_unlock(&ctx->lock);
+		} else {
+			fail_job(ctx, job);
+		}
+	}
+	free(chunk);
+	release_job(ctx, job, seed);
+}
+
+static int retry_wait(struct upload_ctx *ctx, unsigned int attempt, unsigned int *seed) {
+	if (attempt >= ctx->options.max_retries) {
+		return 0;
+	}
+	pthread_mutex_lock(&ctx->lock);
+	ctx->stats.retries++;
+	pthread_mutex_unlock(&ctx->lock);
+	return transport_retry_wait(attempt, ctx->options.max_retries, ctx->options.backoff_us, seed);
+}
+
+static ssize_t read_full(int fd, unsigned char *buf, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		ssize_t count = read(fd, buf + total, len - total);
+		if (count == 0) {
+			break;
+		} else if (count == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		total += count;
+	}
+	return total;
+}
@@ -0,0 +1,117 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef GOODRV_UPLOAD_H
+#define GOODRV_UPLOAD_H
+
+#include <stddef.h>
+
+#include "compress.h"
+#include "dedup.h"
+#include "transport.h"
+
+/*
+ * Options for the upload pipeline
+ * num_senders - Number of chunks that are transferred concurrently. 0 to
+ * 				 send them one at a time from the calling thread, without
+ * 				 starting any thread.
+ * chunk_size - Size of the chunks the files are split into.
+ * queue_size - Number of chunks that can wait between reading and sending.
+ * 				At most (queue_size + num_senders + 1) chunks are in memory.
+ * max_retries - Number of times a failed request is repeated.
+ * backoff_us - Delay before the first retry, in microseconds. See
+ * 				transport_retry_wait.
+ * state_dir - Directory for the records of the upload sessions, so that
+ * 			   interrupted uploads can be resumed. NULL for the user's config
+ * 			   directory.
+ * compress - Files that compress_worthwhile picks are compressed into the
+ * 			  state directory, and the compressed file is sent instead, as an
+ * 			  object with the suffix of the codec. Once a file is sent, the
+ * 			  object of its other form, if an earlier upload left one, is
+ * 			  deleted when the transport can. NULL to send the files as they
+ * 			  are.
+ * dedup - Index of the contents already in the store. A file whose contents
+ * 		   are there under another name is copied within the store instead
+ * 		   of being sent, and the files that are sent are added. NULL to send
+ * 		   every file.
+ * dedup_store - Name of the store in the index, e.g. the account. NULL for
+ * 				 "default".
+ */
+struct upload_options {
+	unsigned int num_senders;
+	size_t chunk_size;
+	unsigned int queue_size;
+	unsigned int max_retries;
+	unsigned int backoff_us;
+	const char *state_dir;
+	struct compress_options *compress;
+	dedup_index dedup;
+	const char *dedup_store;
+};
+
+/*
+ * What the upload pipeline did.
+ */
+struct upload_stats {
+	unsigned long files_done;
+	unsigned long files_failed;
+	unsigned long chunks_sent;
+	unsigned long long bytes_sent;
+	/* Bytes that were not sent again, since the store already had them */
+	unsigned long long bytes_resumed;
+	unsigned long retries;
+	/* Files sent compressed, with their sizes before and after */
+	unsigned long files_compressed;
+	unsigned long long bytes_uncompressed;
+	unsigned long long bytes_compressed;
+	/* Files that were already in the store, and were not sent */
+	unsigned long files_deduplicated;
+	unsigned long long bytes_deduplicated;
+};
+
+/*
+ * Fill the options with the defaults.
+ */
+void upload_default_options(struct upload_options *options);
+
+/*
+ * Upload the files through the transport. Every file becomes an object named
+ * after its path, plus the suffix of the codec if it is sent compressed.
+ *
+ * The files are read and hashed in the calling thread, and split into chunks,
+ * which are sent by num_senders threads, or by the calling thread itself if
+ * num_senders is 0. An upload that is interrupted keeps
+ * its session record in the state directory, and the next upload of the same
+ * unchanged file resumes from where the store left off.
+ *
+ * options - NULL for the defaults.
+ * stats - If not NULL, filled with what was done.
+ *
+ * Returns the number of files that could not be uploaded, or -1 if the
+ * pipeline could not be started.
+ */
+int upload_files(struct transport *transport, char **file_paths, int num_files,
+		struct upload_options *options, struct upload_stats *stats);
+
+#endif /* GOODRV_UPLOAD_H */
@@ -0,0 +1,318 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <batcher.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_CLIENTS 8
+#define OPS_PER_CLIENT 10
+
+/*
+ * The stand-in server. It answers every operation with
+ * "<method> <path> <JSON body>", in the reverse order, and counts the requests.
+ */
+struct stand_in {
+	pthread_mutex_t lock;
+	unsigned long requests;
+	unsigned long ops;
+	unsigned int max_ops;
+	int fail;
+};
+
+/*
+ * Results gathered by the callbacks
+ */
+struct results {
+	pthread_mutex_t lock;
+	int done;
+	int ok;
+};
+
+/* Helper functions for the test cases */
+/* Send function of the stand-in */
+int stand_in_send(void *ctx, const char *content_type, const char *body, size_t body_len,
+		char **response_content_type, char **response_body, size_t *response_len);
+/* Check the result of a rename of file<index> */
+void check_rename(struct meta_result *result, void *arg);
+/* Submit a rename of file<index> to name<index> */
+void rename_async(batcher batcher, long index);
+/* Clear the counters */
+void reset();
+/* Rename files through the blocking submit */
+void *client_thread(void *arg);
+
+/* Test Cases */
+/* Test that batches are sent once full */
+void test_batcher_size();
+/* Test that a partial batch is sent at its deadline */
+void test_batcher_deadline();
+/* Test the requests built for each kind of operation */
+void test_batcher_ops();
+/* Test concurrent callers waiting for their results */
+void test_batcher_blocking();
+/* Test failed operations and batches */
+void test_batcher_errors();
+
+/* Batcher Test suite */
+void test_batcher();
+
+struct stand_in stand_in = { PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0 };
+struct batch_sink sink = { &stand_in, &stand_in_send };
+struct results results = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+batcher shared_batcher;
+
+int main() {
+	test_batcher();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_batcher() {
+	test_batcher_size();
+	test_batcher_deadline();
+	test_batcher_ops();
+	test_batcher_blocking();
+	test_batcher_errors();
+}
+
+int stand_in_send(void *ctx, const char *content_type, const char *body, size_t body_len,
+		char **response_content_type, char **response_body, size_t *response_len) {
+	struct stand_in *server = ctx;
+	const char *boundary = strstr(content_type, "boundary=");
+	assert(strncmp(content_type, "multipart/mixed", 15) == 0 && boundary != NULL);
+	boundary += strlen("boundary=");
+	assert(strstr(body, boundary) == body + 2);
+
+	pthread_mutex_lock(&server->lock);
+	server->requests++;
+	int fail = server->fail;
+	pthread_mutex_unlock(&server->lock);
+	if (fail) {
+		return -1;
+	}
+
+	size_t capacity = body_len * 2 + 1024;
+	char *response = malloc(capacity);
+	size_t len = 0;
+	unsigned int num_ops = 0;
+	const char *part = strstr(body, "Content-ID: <item-");
+	const char *last = NULL;
+	while (part != NULL) {
+		last = part;
+		num_ops++;
+		part = strstr(part + 1, "Content-ID: <item-");
+	}
+
+	/* Answer the parts from the last one */
+	for (part = last; num_ops > 0 && part != NULL; ) {
+		unsigned int index;
+		char method[16], path[256];
+		assert(sscanf(part, "Content-ID: <item-%u>", &index) == 1);
+		const char *request = strstr(part, "\r\n\r\n") + 4;
+		assert(sscanf(request, "%15s %255s HTTP/1.1", method, path) == 2);
+		const char *json = strstr(request, "\r\n\r\n") + 4;
+		int json_len = strstr(json, "\r\n--") - json;
+		int status = (strstr(path, "missing") != NULL) ? 404 : 200;
+		len += snprintf(response + len, capacity - len, "--reply\r\nContent-Type: application/http\r\n"
+				"Content-ID: <response-item-%u>\r\n\r\nHTTP/1.1 %d Status\r\n"
+				"Content-Type: application/json\r\n\r\n%s %s %.*s\r\n", index, status, method, path,
+				json_len, json);
+
+		/* The previous part */
+		const char *prev = NULL;
+		for (const char *p = strstr(body, "Content-ID: <item-"); p != NULL && p < part;
+				p = strstr(p + 1, "Content-ID: <item-")) {
+			prev = p;
+		}
+		part = prev;
+	}
+	len += snprintf(response + len, capacity - len, "--reply--\r\n");
+
+	pthread_mutex_lock(&server->lock);
+	server->ops += num_ops;
+	if (num_ops > server->max_ops) {
+		server->max_ops = num_ops;
+	}
+	pthread_mutex_unlock(&server->lock);
+
+	*response_content_type = strdup("multipart/mixed; boundary=\"reply\"");
+	*response_body = response;
+	*response_len = len;
+	return 0;
+}
+
+void check_rename(struct meta_result *result, void *arg) {
+	char expected[128];
+	long index = (long) arg;
+	snprintf(expected, sizeof(expected), "PATCH /drive/v3/files/file%ld {\"name\":\"name%ld\"}", index, index);
+
+	pthread_mutex_lock(&results.lock);
+	results.done++;
+	if (result->status == 200 && strcmp(result->body, expected) == 0) {
+		results.ok++;
+	}
+	pthread_mutex_unlock(&results.lock);
+	free(result->body);
+}
+
+void rename_async(batcher batcher, long index) {
+	char file_id[32], name[32];
+	snprintf(file_id, sizeof(file_id), "file%ld", index);
+	snprintf(name, sizeof(name), "name%ld", index);
+	struct meta_op op = { META_RENAME, file_id, NULL, name, NULL };
+	batcher_submit_async(batcher, &op, &check_rename, (void *) index);
+}
+
+void reset() {
+	pthread_mutex_lock(&stand_in.lock);
+	stand_in.requests = stand_in.ops = stand_in.max_ops = 0;
+	pthread_mutex_unlock(&stand_in.lock);
+	pthread_mutex_lock(&results.lock);
+	results.done = results.ok = 0;
+	pthread_mutex_unlock(&results.lock);
+}
+
+void test_batcher_size() {
+	reset();
+	batcher batcher = batcher_create(&sink, 100, 60000);
+	assert(batcher != NULL);
+	for (long i = 0; i < 250; i++) {
+		rename_async(batcher, i);
+	}
+	batcher_flush(batcher);
+	assert(results.done == 250);
+	assert(results.ok == 250);
+	assert(stand_in.requests == 3);
+	assert(stand_in.max_ops == 100);
+	assert(batcher_num_requests(batcher) == 3);
+	batcher_destroy(batcher);
+}
+
+void test_batcher_deadline() {
+	reset();
+	batcher batcher = batcher_create(&sink, 100, 20);
+	for (long i = 0; i < 3; i++) {
+		rename_async(batcher, i);
+	}
+	/* No flush: the deadline sends the batch */
+	for (int i = 0; i < 2000 && batcher_num_requests(batcher) == 0; i++) {
+		usleep(1000);
+	}
+	assert(batcher_num_requests(batcher) == 1);
+	pthread_mutex_lock(&results.lock);
+	assert(results.ok == 3);
+	pthread_mutex_unlock(&results.lock);
+
+	/* Pending operations are sent when the batcher is destroyed */
+	rename_async(batcher, 3);
+	batcher_destroy(batcher);
+	assert(results.ok == 4);
+}
+
+void test_batcher_ops() {
+	reset();
+	batcher batcher = batcher_create(&sink, 100, 10);
+	struct meta_result result;
+
+	struct meta_op op = { META_CREATE_FOLDER, NULL, "root", "My \"docs\"\n", NULL };
+	batcher_submit(batcher, &op, &result);
+	assert(result.status == 200);
+	assert(strcmp(result.body, "POST /drive/v3/files {\"name\":\"My \\\"docs\\\"\\u000a\","
+			"\"mimeType\":\"application/vnd.google-apps.folder\",\"parents\":[\"root\"]}") == 0);
+	free(result.body);
+
+	struct meta_op trash = { META_TRASH, "id1", NULL, NULL, NULL };
+	batcher_submit(batcher, &trash, &result);
+	assert(strcmp(result.body, "PATCH /drive/v3/files/id1 {\"trashed\":true}") == 0);
+	free(result.body);
+
+	struct meta_op update = { META_UPDATE_PROPERTIES, "id2", NULL, NULL, "{\"md5\":\"abc\"}" };
+	batcher_submit(batcher, &update, &result);
+	assert(strcmp(result.body, "PATCH /drive/v3/files/id2 {\"properties\":{\"md5\":\"abc\"}}") == 0);
+	free(result.body);
+
+	batcher_destroy(batcher);
+}
+
+void *client_thread(void *arg) {
+	long client = (long) arg;
+	for (long i = 0; i < OPS_PER_CLIENT; i++) {
+		long index = client * OPS_PER_CLIENT + i;
+		char file_id[32], name[32];
+		snprintf(file_id, sizeof(file_id), "file%ld", index);
+		snprintf(name, sizeof(name), "name%ld", index);
+		struct meta_op op = { META_RENAME, file_id, NULL, name, NULL };
+		struct meta_result result;
+		batcher_submit(shared_batcher, &op, &result);
+		check_rename(&result, (void *) index);
+	}
+	return NULL;
+}
+
+void test_batcher_blocking() {
+	reset();
+	shared_batcher = batcher_create(&sink, 100, 20);
+	pthread_t clients[NUM_CLIENTS];
+	for (long i = 0; i < NUM_CLIENTS; i++) {
+		assert(pthread_create(&clients[i], NULL, &client_thread, (void *) i) == 0);
+	}
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		pthread_join(clients[i], NULL);
+	}
+	assert(results.ok == NUM_CLIENTS * OPS_PER_CLIENT);
+	/* The waiting callers share the batches */
+	assert(stand_in.requests < NUM_CLIENTS * OPS_PER_CLIENT);
+	batcher_destroy(shared_batcher);
+}
+
+void test_batcher_errors() {
+	reset();
+	batcher batcher = batcher_create(&sink, 100, 10);
+	struct meta_result result;
+
+	struct meta_op op = { META_TRASH, "missing", NULL, NULL, NULL };
+	batcher_submit(batcher, &op, &result);
+	assert(result.status == 404);
+	free(result.body);
+
+	pthread_mutex_lock(&stand_in.lock);
+	stand_in.fail = 1;
+	pthread_mutex_unlock(&stand_in.lock);
+	for (long i = 0; i < 5; i++) {
+		rename_async(batcher, i);
+	}
+	batcher_flush(batcher);
+	assert(results.done == 5);
+	assert(results.ok == 0);
+	pthread_mutex_lock(&stand_in.lock);
+	stand_in.fail = 0;
+	pthread_mutex_unlock(&stand_in.lock);
+	batcher_destroy(batcher);
+}
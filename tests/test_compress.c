@@ -0,0 +1,239 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <compress.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE (64 * 1024)
+
+/* Helper functions for the test cases */
+/* Fill the buffer with lines of text */
+void fill_text(unsigned char *buf, size_t len);
+/* Fill the buffer with pseudo random bytes */
+void fill_random(unsigned char *buf, size_t len);
+/* Create a file with the contents, and open it for reading */
+int make_file(const char *name, const unsigned char *data, size_t len);
+/* Compress and decompress the contents, and return the compressed size */
+uint64_t round_trip(enum compress_codec codec, const unsigned char *data, size_t len);
+
+/* Test Cases */
+/* Test the entropy estimates */
+void test_compress_entropy();
+/* Test recognising the compressed formats */
+void test_compress_formats();
+/* Test deciding which files are worth compressing */
+void test_compress_worthwhile();
+/* Test compressing and decompressing with the built-in codecs */
+void test_compress_round_trip();
+
+/* Compress Test suite */
+void test_compress();
+
+char test_dir[] = "/tmp/goodrive_compress_XXXXXX";
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_compress();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_compress() {
+	test_compress_entropy();
+	test_compress_formats();
+	test_compress_worthwhile();
+	test_compress_round_trip();
+}
+
+void fill_text(unsigned char *buf, size_t len) {
+	const char *words[] = { "sync ", "drive ", "folder ", "upload ", "the ", "a ", "file\n" };
+	size_t pos = 0;
+	for (unsigned int i = 0; pos < len; i++) {
+		const char *word = words[(i * 5 + i / 7) % 7];
+		for (size_t j = 0; word[j] != '\0' && pos < len; j++) {
+			buf[pos++] = word[j];
+		}
+	}
+}
+
+void fill_random(unsigned char *buf, size_t len) {
+	unsigned int seed = 1;
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = rand_r(&seed) >> 7;
+	}
+}
+
+int make_file(const char *name, const unsigned char *data, size_t len) {
+	char path[128];
+	snprintf(path, sizeof(path), "%s/%s", test_dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	assert(fwrite(data, 1, len, file) == len);
+	fclose(file);
+	int fd = open(path, O_RDONLY);
+	assert(fd != -1);
+	return fd;
+}
+
+uint64_t round_trip(enum compress_codec codec, const unsigned char *data, size_t len) {
+	int src_fd = make_file("original", data, len);
+	char path[128];
+	snprintf(path, sizeof(path), "%s/compressed", test_dir);
+	int compressed_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	snprintf(path, sizeof(path), "%s/decompressed", test_dir);
+	int dst_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+	uint64_t compressed_size;
+	assert(compress_stream(codec, 1, src_fd, compressed_fd, &compressed_size) == 0);
+	assert(lseek(compressed_fd, 0, SEEK_END) == (off_t) compressed_size);
+	lseek(compressed_fd, 0, SEEK_SET);
+	assert(decompress_stream(codec, compressed_fd, dst_fd) == 0);
+
+	unsigned char *result = malloc(len + 1);
+	assert(pread(dst_fd, result, len + 1, 0) == (ssize_t) len);
+	assert(memcmp(result, data, len) == 0);
+	free(result);
+
+	/* Truncated input is an error */
+	if (compressed_size > 1) {
+		assert(ftruncate(compressed_fd, compressed_size - 1) == 0);
+		lseek(compressed_fd, 0, SEEK_SET);
+		lseek(dst_fd, 0, SEEK_SET);
+		assert(decompress_stream(codec, compressed_fd, dst_fd) == -1);
+	}
+	close(src_fd);
+	close(compressed_fd);
+	close(dst_fd);
+	return compressed_size;
+}
+
+void test_compress_entropy() {
+	unsigned char *buf = malloc(BUFFER_SIZE);
+	memset(buf, 'a', BUFFER_SIZE);
+	assert(compress_entropy(buf, 0) == 0);
+	assert(compress_entropy(buf, BUFFER_SIZE) == 0);
+	for (int i = 0; i < 256; i++) {
+		buf[i] = i;
+	}
+	assert(compress_entropy(buf, 256) == 8);
+
+	fill_random(buf, BUFFER_SIZE);
+	assert(compress_entropy(buf, BUFFER_SIZE) > 7.9);
+	fill_text(buf, BUFFER_SIZE);
+	double entropy = compress_entropy(buf, BUFFER_SIZE);
+	assert(entropy > 2 && entropy < 5);
+	free(buf);
+}
+
+void test_compress_formats() {
+	const unsigned char gzip[] = { 0x1f, 0x8b, 0x08, 0x00 };
+	const unsigned char mp4[] = { 0, 0, 0, 0x18, 'f', 't', 'y', 'p', 'm', 'p', '4', '2' };
+	const unsigned char text[] = "hello world";
+	assert(compress_is_compressed_format("notes", gzip, sizeof(gzip)));
+	assert(compress_is_compressed_format("clip", mp4, sizeof(mp4)));
+	assert(!compress_is_compressed_format("notes.txt", text, sizeof(text)));
+
+	/* The extension is enough */
+	assert(compress_is_compressed_format("/home/user/Photo.JPG", NULL, 0));
+	assert(compress_is_compressed_format("archive.tar.gz", text, sizeof(text)));
+	assert(!compress_is_compressed_format("/home/user.zip/notes", NULL, 0));
+	assert(!compress_is_compressed_format(".zip", NULL, 0));
+}
+
+void test_compress_worthwhile() {
+	struct compress_options options;
+	compress_default_options(&options);
+	if (options.codec == COMPRESS_NONE) {
+		/* No codec is built in */
+		return;
+	}
+	unsigned char *buf = malloc(BUFFER_SIZE);
+
+	fill_text(buf, BUFFER_SIZE);
+	int fd = make_file("text", buf, BUFFER_SIZE);
+	assert(compress_worthwhile(&options, "text", fd, BUFFER_SIZE));
+	/* Too small */
+	assert(!compress_worthwhile(&options, "text", fd, options.min_size - 1));
+	/* Compressed in name */
+	assert(!compress_worthwhile(&options, "text.zip", fd, BUFFER_SIZE));
+	/* No codec */
+	enum compress_codec codec = options.codec;
+	options.codec = COMPRESS_NONE;
+	assert(!compress_worthwhile(&options, "text", fd, BUFFER_SIZE));
+	options.codec = codec;
+	close(fd);
+
+	fill_random(buf, BUFFER_SIZE);
+	fd = make_file("random", buf, BUFFER_SIZE);
+	assert(!compress_worthwhile(&options, "random", fd, BUFFER_SIZE));
+	close(fd);
+
+	/* Text in the samples, though the magic number is of a compressed format */
+	fill_text(buf, BUFFER_SIZE);
+	buf[0] = 0x1f;
+	buf[1] = 0x8b;
+	fd = make_file("gzip", buf, BUFFER_SIZE);
+	assert(!compress_worthwhile(&options, "gzip", fd, BUFFER_SIZE));
+	close(fd);
+	free(buf);
+}
+
+void test_compress_round_trip() {
+	unsigned char *text = malloc(3 * BUFFER_SIZE);
+	fill_text(text, 3 * BUFFER_SIZE);
+	unsigned char *random = malloc(3 * BUFFER_SIZE);
+	fill_random(random, 3 * BUFFER_SIZE);
+
+	enum compress_codec codecs[] = { COMPRESS_ZSTD, COMPRESS_GZIP };
+	for (int i = 0; i < 2; i++) {
+		if (!compress_codec_available(codecs[i])) {
+			continue;
+		}
+
+		assert(round_trip(codecs[i], text, 3 * BUFFER_SIZE) < BUFFER_SIZE / 4);
+		assert(round_trip(codecs[i], random, 3 * BUFFER_SIZE) > 3 * BUFFER_SIZE);
+		/* Across the boundaries of the buffers */
+		round_trip(codecs[i], text, 128 * 1024);
+		round_trip(codecs[i], text, 128 * 1024 + 1);
+		round_trip(codecs[i], text, 0);
+	}
+
+	assert(!compress_codec_available(COMPRESS_NONE));
+	int fd = make_file("empty", text, 0);
+	assert(compress_stream(COMPRESS_NONE, 1, fd, fd, NULL) == -1);
+	close(fd);
+	free(text);
+	free(random);
+}
@@ -0,0 +1,262 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <dedup.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Helper functions for the test cases */
+/* Create a file with the contents, and get its metadata */
+void make_file(const char *path, const char *contents, struct stat *file_stat);
+/* Check that the file holds exactly the contents */
+void check_file(const char *path, const char *contents);
+
+/* Test Cases */
+/* Test finding local files */
+void test_dedup_local();
+/* Test finding remote objects */
+void test_dedup_remote();
+/* Test renaming files and objects, alone and with their directories */
+void test_dedup_rename();
+/* Test saving and loading the index */
+void test_dedup_save_load();
+/* Test cloning files */
+void test_dedup_clone();
+
+/* Dedup Test suite */
+void test_dedup();
+
+char test_dir[] = "/tmp/goodrive_dedup_XXXXXX";
+unsigned char digest1[16] = { 1, 2, 3 };
+unsigned char digest2[16] = { 4, 5, 6 };
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_dedup();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_dedup() {
+	test_dedup_local();
+	test_dedup_remote();
+	test_dedup_rename();
+	test_dedup_save_load();
+	test_dedup_clone();
+}
+
+void make_file(const char *path, const char *contents, struct stat *file_stat) {
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	fputs(contents, file);
+	fclose(file);
+	assert(stat(path, file_stat) == 0);
+}
+
+void check_file(const char *path, const char *contents) {
+	char buf[256];
+	FILE *file = fopen(path, "r");
+	assert(file != NULL);
+	size_t len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
+	assert(len == strlen(contents) && memcmp(buf, contents, len) == 0);
+}
+
+void test_dedup_local() {
+	char path1[64], path2[64];
+	snprintf(path1, sizeof(path1), "%s/one", test_dir);
+	snprintf(path2, sizeof(path2), "%s/two", test_dir);
+	struct stat stat1, stat2;
+	make_file(path1, "hello", &stat1);
+	make_file(path2, "hello", &stat2);
+
+	dedup_index index = dedup_create();
+	assert(dedup_find_local(index, digest1, 5) == NULL);
+	dedup_add_local(index, digest1, 5, path1, &stat1);
+	dedup_add_local(index, digest1, 5, path2, &stat2);
+	/* The size is part of the key */
+	assert(dedup_find_local(index, digest1, 6) == NULL);
+
+	char *path = dedup_find_local(index, digest1, 5);
+	assert(path != NULL && strcmp(path, path1) == 0);
+	free(path);
+
+	/* A file that changed is skipped, and forgotten */
+	make_file(path1, "hello, world", &stat1);
+	path = dedup_find_local(index, digest1, 5);
+	assert(path != NULL && strcmp(path, path2) == 0);
+	free(path);
+
+	/* A path added again moves to its new contents */
+	dedup_add_local(index, digest2, 12, path1, &stat1);
+	dedup_add_local(index, digest2, 5, path2, &stat2);
+	assert(dedup_find_local(index, digest1, 5) == NULL);
+	path = dedup_find_local(index, digest2, 12);
+	assert(path != NULL && strcmp(path, path1) == 0);
+	free(path);
+
+	dedup_remove_local(index, path1);
+	assert(dedup_find_local(index, digest2, 12) == NULL);
+	unlink(path2);
+	assert(dedup_find_local(index, digest2, 5) == NULL);
+	dedup_destroy(index);
+	unlink(path1);
+}
+
+void test_dedup_remote() {
+	dedup_index index = dedup_create();
+	dedup_add_remote(index, digest1, 5, "a@example.com", "/home/a/one");
+	dedup_add_remote(index, digest1, 5, "b@example.com", "/home/b/one");
+	/* Not valid names of stores */
+	dedup_add_remote(index, digest2, 5, "a b", "/home/a/two");
+	dedup_add_remote(index, digest2, 5, "", "/home/a/two");
+
+	char *name = dedup_find_remote(index, digest1, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/home/a/one") == 0);
+	free(name);
+	name = dedup_find_remote(index, digest1, 5, "b@example.com");
+	assert(name != NULL && strcmp(name, "/home/b/one") == 0);
+	free(name);
+	assert(dedup_find_remote(index, digest1, 5, "a@example") == NULL);
+	assert(dedup_find_remote(index, digest2, 5, "a b") == NULL);
+	assert(dedup_find_remote(index, digest2, 5, "") == NULL);
+
+	/* An object that is replaced moves to its new contents */
+	dedup_add_remote(index, digest2, 5, "a@example.com", "/home/a/one");
+	assert(dedup_find_remote(index, digest1, 5, "a@example.com") == NULL);
+	name = dedup_find_remote(index, digest2, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/home/a/one") == 0);
+	free(name);
+
+	dedup_remove_remote(index, "b@example.com", "/home/b/one");
+	assert(dedup_find_remote(index, digest1, 5, "b@example.com") == NULL);
+	dedup_destroy(index);
+}
+
+void test_dedup_rename() {
+	unsigned char digest3[16] = { 7, 8, 9 };
+	dedup_index index = dedup_create();
+	dedup_add_remote(index, digest1, 5, "a@example.com", "/r/dir/one");
+	dedup_add_remote(index, digest2, 5, "a@example.com", "/r/dir/sub/two");
+	dedup_add_remote(index, digest3, 5, "a@example.com", "/r/dirx");
+	dedup_add_remote(index, digest1, 5, "b@example.com", "/r/dir/one");
+
+	/* Only the names below the directory move, and only in the store */
+	dedup_rename_remote(index, "a@example.com", "/r/dir", "/r/new", 1);
+	char *name = dedup_find_remote(index, digest1, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/r/new/one") == 0);
+	free(name);
+	name = dedup_find_remote(index, digest2, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/r/new/sub/two") == 0);
+	free(name);
+	name = dedup_find_remote(index, digest3, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/r/dirx") == 0);
+	free(name);
+	name = dedup_find_remote(index, digest1, 5, "b@example.com");
+	assert(name != NULL && strcmp(name, "/r/dir/one") == 0);
+	free(name);
+
+	/* A single object, onto the name of another */
+	dedup_rename_remote(index, "a@example.com", "/r/dirx", "/r/new/one", 0);
+	assert(dedup_find_remote(index, digest1, 5, "a@example.com") == NULL);
+	name = dedup_find_remote(index, digest3, 5, "a@example.com");
+	assert(name != NULL && strcmp(name, "/r/new/one") == 0);
+	free(name);
+
+	/* Local files keep their records when renamed on the disk */
+	char dir[96], path[128], new_dir[96], new_path[128];
+	snprintf(dir, sizeof(dir), "%s/rename", test_dir);
+	snprintf(path, sizeof(path), "%s/file", dir);
+	snprintf(new_dir, sizeof(new_dir), "%s/renamed", test_dir);
+	snprintf(new_path, sizeof(new_path), "%s/file", new_dir);
+	assert(mkdir(dir, 0755) == 0);
+	struct stat file_stat;
+	make_file(path, "hello", &file_stat);
+	dedup_add_local(index, digest1, 5, path, &file_stat);
+	assert(rename(dir, new_dir) == 0);
+	dedup_rename_local(index, dir, new_dir, 1);
+	name = dedup_find_local(index, digest1, 5);
+	assert(name != NULL && strcmp(name, new_path) == 0);
+	free(name);
+	dedup_destroy(index);
+}
+
+void test_dedup_save_load() {
+	char path[64], index_path[64];
+	snprintf(path, sizeof(path), "%s/with space", test_dir);
+	snprintf(index_path, sizeof(index_path), "%s/index", test_dir);
+	struct stat file_stat;
+	make_file(path, "hello", &file_stat);
+
+	assert(dedup_load(index_path) == NULL);
+	dedup_index index = dedup_create();
+	dedup_add_local(index, digest1, 5, path, &file_stat);
+	dedup_add_remote(index, digest1, 5, "a@example.com", "/home/a/with space");
+	assert(dedup_save(index, index_path) == 0);
+	dedup_destroy(index);
+
+	index = dedup_load(index_path);
+	assert(index != NULL);
+	char *found = dedup_find_local(index, digest1, 5);
+	assert(found != NULL && strcmp(found, path) == 0);
+	free(found);
+	found = dedup_find_remote(index, digest1, 5, "a@example.com");
+	assert(found != NULL && strcmp(found, "/home/a/with space") == 0);
+	free(found);
+	dedup_destroy(index);
+
+	/* Not an index */
+	make_file(index_path, "hello\n", &file_stat);
+	assert(dedup_load(index_path) == NULL);
+	unlink(index_path);
+	unlink(path);
+}
+
+void test_dedup_clone() {
+	char src_path[64], dest_path[64];
+	snprintf(src_path, sizeof(src_path), "%s/src", test_dir);
+	snprintf(dest_path, sizeof(dest_path), "%s/dest", test_dir);
+	struct stat file_stat;
+	make_file(src_path, "contents to be cloned", &file_stat);
+	make_file(dest_path, "some longer contents to be replaced", &file_stat);
+
+	assert(dedup_clone_file(src_path, dest_path) == 0);
+	check_file(dest_path, "contents to be cloned");
+	make_file(src_path, "", &file_stat);
+	assert(dedup_clone_file(src_path, dest_path) == 0);
+	check_file(dest_path, "");
+
+	unlink(src_path);
+	assert(dedup_clone_file(src_path, dest_path) == -1);
+	unlink(dest_path);
+}
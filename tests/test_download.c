@@ -0,0 +1,196 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <download.h>
+#include <fcntl.h>
+#include <loopback.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RANGE_SIZE 4096
+#define OBJECT_SIZE (10 * RANGE_SIZE + 77)
+
+/* Helper functions for the test cases */
+/* Check that the file holds exactly the given contents */
+void check_file(char *path, const unsigned char *data, size_t size);
+/* Options used by the test cases */
+void test_options(struct download_options *options);
+
+/* Test Cases */
+/* Test downloading without any faults */
+void test_download_file();
+/* Test downloading with lost requests */
+void test_download_loss();
+/* Test that a failed download leaves the destination alone */
+void test_download_failure();
+/* Test cloning local files with the same contents */
+void test_download_dedup();
+
+/* Download Test suite */
+void test_download();
+
+char test_dir[] = "/tmp/goodrive_download_XXXXXX";
+char dest_path[64];
+char part_path[80];
+unsigned char object[OBJECT_SIZE];
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+	snprintf(dest_path, sizeof(dest_path), "%s/file", test_dir);
+	snprintf(part_path, sizeof(part_path), "%s.goodrive-part", dest_path);
+	for (size_t i = 0; i < OBJECT_SIZE; i++) {
+		object[i] = (i * 7 + i / 251) & 0xff;
+	}
+
+	test_download();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_download() {
+	test_download_file();
+	test_download_loss();
+	test_download_failure();
+	test_download_dedup();
+}
+
+void check_file(char *path, const unsigned char *data, size_t size) {
+	FILE *file = fopen(path, "r");
+	assert(file != NULL);
+	for (size_t i = 0; i < size; i++) {
+		assert(fgetc(file) == data[i]);
+	}
+	assert(fgetc(file) == EOF);
+	fclose(file);
+}
+
+void test_options(struct download_options *options) {
+	download_default_options(options);
+	options->range_size = RANGE_SIZE;
+	options->window = 4;
+	options->backoff_us = 10;
+}
+
+void test_download_file() {
+	struct transport *transport = loopback_create(NULL);
+	loopback_put_object(transport, "object", object, OBJECT_SIZE);
+	loopback_put_object(transport, "empty", object, 0);
+	struct download_options options;
+	test_options(&options);
+
+	struct download_stats stats;
+	assert(download_file(transport, "object", dest_path, &options, &stats) == 0);
+	assert(stats.ranges_fetched == 11);
+	assert(stats.bytes_fetched == OBJECT_SIZE);
+	assert(stats.retries == 0);
+	check_file(dest_path, object, OBJECT_SIZE);
+	assert(access(part_path, F_OK) != 0);
+
+	assert(download_file(transport, "empty", dest_path, &options, &stats) == 0);
+	assert(stats.ranges_fetched == 0);
+	check_file(dest_path, object, 0);
+	transport->destroy(transport);
+}
+
+void test_download_loss() {
+	struct loopback_options lb_options = { 0, 30, -1, 1 };
+	struct transport *transport = loopback_create(NULL);
+	loopback_put_object(transport, "object", object, OBJECT_SIZE);
+	loopback_set_options(transport, &lb_options);
+	struct download_options options;
+	test_options(&options);
+	options.max_retries = 50;
+
+	struct download_stats stats;
+	assert(download_file(transport, "object", dest_path, &options, &stats) == 0);
+	assert(stats.retries > 0);
+	check_file(dest_path, object, OBJECT_SIZE);
+	transport->destroy(transport);
+}
+
+void test_download_failure() {
+	struct transport *transport = loopback_create(NULL);
+	loopback_put_object(transport, "object", object, OBJECT_SIZE);
+	struct download_options options;
+	test_options(&options);
+	options.max_retries = 2;
+
+	/* A missing object */
+	assert(download_file(transport, "missing", dest_path, &options, NULL) == -1);
+	check_file(dest_path, object, OBJECT_SIZE);
+
+	/* Every request fails */
+	struct loopback_options lb_options = { 0, 0, 0, 0 };
+	loopback_set_options(transport, &lb_options);
+	assert(download_file(transport, "object", dest_path, &options, NULL) == -1);
+	check_file(dest_path, object, OBJECT_SIZE);
+	assert(access(part_path, F_OK) != 0);
+	transport->destroy(transport);
+}
+
+void test_download_dedup() {
+	struct transport *transport = loopback_create(NULL);
+	loopback_put_object(transport, "object", object, OBJECT_SIZE);
+	struct download_options options;
+	test_options(&options);
+	options.dedup = dedup_create();
+
+	/* The first copy is fetched, and the second one is cloned from it */
+	struct download_stats stats;
+	assert(download_file(transport, "object", dest_path, &options, &stats) == 0);
+	assert(stats.bytes_fetched == OBJECT_SIZE);
+	assert(stats.bytes_cloned == 0);
+	char copy_path[80];
+	snprintf(copy_path, sizeof(copy_path), "%s/copy", test_dir);
+	assert(download_file(transport, "object", copy_path, &options, &stats) == 0);
+	assert(stats.bytes_fetched == 0);
+	assert(stats.bytes_cloned == OBJECT_SIZE);
+	check_file(copy_path, object, OBJECT_SIZE);
+	struct loopback_stats lb_stats;
+	loopback_get_stats(transport, &lb_stats);
+	assert(lb_stats.bytes_out == OBJECT_SIZE);
+
+	/* Changed copies are not cloned */
+	unlink(copy_path);
+	FILE *file = fopen(dest_path, "r+");
+	fputc(object[0] + 1, file);
+	fclose(file);
+	struct timespec times[2] = { { 0, UTIME_NOW }, { 1, 0 } };
+	assert(utimensat(AT_FDCWD, dest_path, times, 0) == 0);
+	assert(download_file(transport, "object", copy_path, &options, &stats) == 0);
+	assert(stats.bytes_fetched == OBJECT_SIZE);
+	check_file(copy_path, object, OBJECT_SIZE);
+
+	dedup_destroy(options.dedup);
+	transport->destroy(transport);
+}
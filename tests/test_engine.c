@@ -0,0 +1,762 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <engine.h>
+#include <linux-api.h>
+#include <loopback.h>
+#include <metrics.h>
+#include <pathmatch.h>
+#include <poll.h>
+#include <spill.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define NUM_ACCOUNTS 2
+#define NUM_FILES 4
+
+/*
+ * Token source of the test cases, counting its calls
+ */
+struct test_token {
+	int lifetime;
+	int calls;
+};
+
+/* Helper functions for the test cases */
+/* Create a file of the given size, with contents that depend on the seed */
+void make_file(const char *path, size_t size, int seed);
+/* Token source that issues tokens with the lifetime in the arg */
+int test_get_token(void *arg, char **token, time_t *expiry);
+/* Upload handler that counts the uploads in the arg */
+void count_upload(void *arg, const char *file_path, int failed);
+/* Sync handler that keeps the number of uploads queued in the arg */
+void keep_queued(void *arg, long queued);
+/*
+ * Add an account with a loopback transport, for the directory of index i.
+ * transport - If not NULL, set to the transport of the account.
+ */
+sync_account add_test_account(sync_host host, int i, struct test_token *token,
+		struct transport **transport);
+
+/* Test Cases */
+/* Test that the uploads of each account go to its own store */
+void test_engine_uploads();
+/* Test the token cache */
+void test_engine_tokens();
+/* Test the watches of an account */
+void test_engine_scan();
+/* Test finding the files to be uploaded */
+void test_engine_sync();
+/* Test dropping the trees kept between syncs, under a memory budget */
+void test_engine_budget();
+/* Test leaving out the paths excluded by the rules of an account */
+void test_engine_rules();
+/* Test replaying the renames of files and directories as moves in the store */
+void test_engine_moves();
+/* Test sending again the files whose uploads failed, within a run and in the next one */
+void test_engine_retries();
+/* Test listing only the directories with changes noted by the watches */
+void test_engine_rescan();
+
+/* Engine Test suite */
+void test_engine();
+
+char test_dir[] = "/tmp/goodrive_engine_XXXXXX";
+char root_dirs[NUM_ACCOUNTS][64];
+char state_dirs[NUM_ACCOUNTS][64];
+char file_paths[NUM_ACCOUNTS][NUM_FILES][96];
+const char *emails[NUM_ACCOUNTS] = { "one@example.com", "two@example.com" };
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		snprintf(root_dirs[i], sizeof(root_dirs[i]), "%s/root%d", test_dir, i);
+		snprintf(state_dirs[i], sizeof(state_dirs[i]), "%s/state%d", test_dir, i);
+		assert(mkdir(root_dirs[i], 0755) == 0);
+		for (int j = 0; j < NUM_FILES; j++) {
+			snprintf(file_paths[i][j], sizeof(file_paths[i][j]), "%s/file%d", root_dirs[i], j);
+			make_file(file_paths[i][j], 1000 * j + 10, i * NUM_FILES + j);
+		}
+	}
+
+	test_engine();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_engine() {
+	test_engine_uploads();
+	test_engine_tokens();
+	test_engine_scan();
+	test_engine_sync();
+	test_engine_budget();
+	test_engine_rules();
+	test_engine_moves();
+	test_engine_retries();
+	test_engine_rescan();
+}
+
+void make_file(const char *path, size_t size, int seed) {
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	for (size_t i = 0; i < size; i++) {
+		fputc((i * 7 + seed) & 0xff, file);
+	}
+	fclose(file);
+}
+
+int test_get_token(void *arg, char **token, time_t *expiry) {
+	struct test_token *test_token = arg;
+	test_token->calls++;
+	char buf[32];
+	snprintf(buf, sizeof(buf), "token-%d", test_token->calls);
+	*token = strdup(buf);
+	*expiry = time(NULL) + test_token->lifetime;
+	return 0;
+}
+
+void count_upload(void *arg, const char *file_path, int failed) {
+	assert(!failed);
+	__atomic_add_fetch((int *) arg, 1, __ATOMIC_RELAXED);
+}
+
+void keep_queued(void *arg, long queued) {
+	*(long *) arg = queued;
+}
+
+sync_account add_test_account(sync_host host, int i, struct test_token *token,
+		struct transport **transport) {
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[i];
+	options.root_dir = root_dirs[i];
+	options.state_dir = state_dirs[i];
+	options.transport = loopback_create(NULL);
+	options.get_token = &test_get_token;
+	options.token_arg = token;
+	sync_account account = sync_account_add(host, &options);
+	assert(account != NULL);
+	if (transport != NULL) {
+		*transport = options.transport;
+	}
+	return account;
+}
+
+void test_engine_uploads() {
+	sync_host host = sync_host_create(2, NULL);
+	assert(host != NULL);
+	struct test_token token = { 3600, 0 };
+	sync_account accounts[NUM_ACCOUNTS];
+	struct transport *transports[NUM_ACCOUNTS];
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		accounts[i] = add_test_account(host, i, &token, &transports[i]);
+	}
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	assert(sync_account_add(host, &options) == NULL);
+
+	for (int j = 0; j < NUM_FILES; j++) {
+		for (int i = 0; i < NUM_ACCOUNTS; i++) {
+			assert(sync_account_queue_upload(accounts[i], file_paths[i][j], j == 0) == 0);
+		}
+	}
+	assert(sync_account_queue_upload(accounts[0], "/nonexistent", 0) == -1);
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		sync_account_wait(accounts[i]);
+		struct sync_account_stats stats;
+		sync_account_get_stats(accounts[i], &stats);
+		assert(stats.files_queued == NUM_FILES);
+		assert(stats.files_done == NUM_FILES);
+		assert(stats.files_failed == 0);
+		assert(stats.upload.files_done == NUM_FILES);
+	}
+	sched_wait_idle(sync_host_scheduler(host));
+
+	/* Each account's files are in its own store only */
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		for (int j = 0; j < NUM_FILES; j++) {
+			size_t size;
+			assert(loopback_get_object(transports[i], file_paths[i][j], &size) != NULL);
+			assert(size == (size_t) 1000 * j + 10);
+			assert(loopback_get_object(transports[i], file_paths[1 - i][j], &size) == NULL);
+		}
+	}
+	sync_account_remove(accounts[0]);
+	char index_path[96];
+	snprintf(index_path, sizeof(index_path), "%s/dedup.index", state_dirs[0]);
+	assert(access(index_path, R_OK) == 0);
+	snprintf(index_path, sizeof(index_path), "%s/dedup.index", state_dirs[1]);
+	assert(access(index_path, R_OK) != 0);
+	/* The host removes the remaining account */
+	sync_host_destroy(host);
+	assert(access(index_path, R_OK) == 0);
+}
+
+void test_engine_tokens() {
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token long_token = { 3600, 0 };
+	struct test_token short_token = { ENGINE_TOKEN_MARGIN / 2, 0 };
+	sync_account long_account = add_test_account(host, 0, &long_token, NULL);
+	sync_account short_account = add_test_account(host, 1, &short_token, NULL);
+
+	char *token;
+	for (int i = 0; i < 3; i++) {
+		assert(sync_account_token(long_account, &token) == 0);
+		assert(strcmp(token, "token-1") == 0);
+		free(token);
+		assert(sync_account_token(short_account, &token) == 0);
+		free(token);
+	}
+	/* A token that expires within the margin is never reused */
+	assert(long_token.calls == 1);
+	assert(short_token.calls == 3);
+
+	/* Refreshed from a worker */
+	long status = -1;
+	sync_account_queue_token(short_account, &keep_queued, &status);
+	sync_account_wait(short_account);
+	assert(status == 0);
+	assert(short_token.calls == 4);
+
+	struct sync_account_stats stats;
+	sync_account_get_stats(long_account, &stats);
+	assert(stats.token_fetches == 1);
+	sync_host_destroy(host);
+}
+
+void test_engine_scan() {
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	sync_account accounts[NUM_ACCOUNTS];
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		accounts[i] = add_test_account(host, i, &token, NULL);
+		assert(strcmp(sync_account_email(accounts[i]), emails[i]) == 0);
+	}
+	char subdir[96];
+	snprintf(subdir, sizeof(subdir), "%s/sub", root_dirs[0]);
+	assert(mkdir(subdir, 0755) == 0);
+
+	char *md5sum;
+	assert(sync_account_scan(accounts[0], &md5sum) == 0);
+	char *expected = md5sum_fsh(root_dirs[0]);
+	assert(strcmp(md5sum, expected) == 0);
+	free(expected);
+	free(md5sum);
+
+	/* A change in the first account's tree is seen only by its instance */
+	char path[128];
+	snprintf(path, sizeof(path), "%s/new", subdir);
+	make_file(path, 10, 0);
+	struct pollfd fds[NUM_ACCOUNTS];
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		fds[i].fd = sync_account_watch_fd(accounts[i]);
+		fds[i].events = POLLIN;
+	}
+	assert(poll(fds, NUM_ACCOUNTS, 1000) == 1);
+	assert(fds[0].revents & POLLIN);
+	assert(fds[1].revents == 0);
+	sync_host_destroy(host);
+}
+
+void test_engine_sync() {
+	sync_host host = sync_host_create(2, NULL);
+	struct test_token token = { 3600, 0 };
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[1];
+	options.root_dir = root_dirs[1];
+	options.state_dir = state_dirs[1];
+	options.transport = loopback_create(NULL);
+	options.get_token = &test_get_token;
+	options.token_arg = &token;
+	int uploads = 0;
+	options.on_upload = &count_upload;
+	options.upload_arg = &uploads;
+	sync_account account = sync_account_add(host, &options);
+
+	/* Everything is uploaded the first time */
+	long queued = -1;
+	sync_account_queue_sync(account, &keep_queued, &queued);
+	sync_account_wait(account);
+	assert(queued == NUM_FILES);
+	assert(uploads == NUM_FILES);
+	assert(sync_account_sync(account) == 0);
+
+	/* A changed file, and a new directory with a file in it */
+	make_file(file_paths[1][0], 20, 5);
+	char path[128];
+	snprintf(path, sizeof(path), "%s/dir", root_dirs[1]);
+	assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/dir/file", root_dirs[1]);
+	make_file(path, 30, 6);
+	assert(sync_account_sync(account) == 2);
+	sync_account_wait(account);
+	assert(uploads == NUM_FILES + 2);
+	size_t size;
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 30);
+
+	/* The files of a renamed directory are moved in the store */
+	char new_path[128];
+	snprintf(path, sizeof(path), "%s/dir", root_dirs[1]);
+	snprintf(new_path, sizeof(new_path), "%s/renamed", root_dirs[1]);
+	assert(rename(path, new_path) == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_wait(account);
+
+	/* Deleted files and directories are deleted in the store */
+	snprintf(path, sizeof(path), "%s/renamed/file", root_dirs[1]);
+	assert(loopback_get_object(options.transport, path, &size) != NULL);
+	assert(unlink(path) == 0);
+	assert(rmdir(new_path) == 0);
+	assert(unlink(file_paths[1][1]) == 0);
+	assert(sync_account_sync(account) == 0);
+	assert(loopback_get_object(options.transport, path, &size) == NULL);
+	assert(loopback_get_object(options.transport, file_paths[1][1], &size) == NULL);
+	assert(loopback_get_object(options.transport, file_paths[1][2], &size) != NULL);
+	struct sync_account_stats stats;
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_deleted == 2);
+	sync_host_destroy(host);
+
+	/* The tree is kept across runs */
+	host = sync_host_create(1, NULL);
+	options.transport = loopback_create(NULL);
+	account = sync_account_add(host, &options);
+	assert(sync_account_sync(account) == 0);
+	sync_host_destroy(host);
+}
+
+void test_engine_budget() {
+	char spill_dir[96];
+	snprintf(spill_dir, sizeof(spill_dir), "%s/spill", test_dir);
+	assert(mkdir(spill_dir, 0700) == 0);
+	struct metrics_snapshot metrics;
+
+	/* Room for the trees of both accounts */
+	assert(spill_configure(1 << 30, spill_dir) == 0);
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	sync_account accounts[NUM_ACCOUNTS];
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		accounts[i] = add_test_account(host, i, &token, NULL);
+		assert(sync_account_sync(accounts[i]) >= 0);
+		sync_account_wait(accounts[i]);
+	}
+	struct sync_account_stats stats;
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		sync_account_get_stats(accounts[i], &stats);
+		assert(stats.trees_evicted == 0);
+	}
+	metrics_read(&metrics);
+	assert(metrics.gauges[METRIC_MEM_BUDGET] == 1 << 30);
+	assert(metrics.gauges[METRIC_TREE_BYTES] > 0);
+	assert(metrics.peak_rss >= metrics.rss && metrics.rss > 0);
+
+	/*
+	 * No room at all: every tree is dropped after its sync, and loaded back
+	 * by the next. The colder tree of the second account goes first.
+	 */
+	assert(spill_configure(ENGINE_TREE_BUDGET_SHARE, spill_dir) == 0);
+	assert(sync_account_sync(accounts[0]) == 0);
+	sync_account_get_stats(accounts[1], &stats);
+	assert(stats.trees_evicted == 1);
+	assert(sync_account_sync(accounts[1]) == 0);
+	metrics_read(&metrics);
+	assert(metrics.gauges[METRIC_TREE_BYTES] == 0);
+
+	make_file(file_paths[0][1], 40, 7);
+	assert(sync_account_sync(accounts[0]) == 1);
+	assert(sync_account_sync(accounts[1]) == 0);
+	for (int i = 0; i < NUM_ACCOUNTS; i++) {
+		sync_account_wait(accounts[i]);
+		sync_account_get_stats(accounts[i], &stats);
+		assert(stats.trees_evicted == 2 + i);
+	}
+	sync_host_destroy(host);
+	assert(spill_configure(0, NULL) == 0);
+}
+
+void test_engine_rules() {
+	char root_dir[96], state_dir[96], rules_path[128], path[128];
+	snprintf(root_dir, sizeof(root_dir), "%s/rules_root", test_dir);
+	snprintf(state_dir, sizeof(state_dir), "%s/rules_state", test_dir);
+	snprintf(rules_path, sizeof(rules_path), "%s/%s", root_dir, PM_RULES_FILE);
+	assert(mkdir(root_dir, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/build", root_dir);
+	assert(mkdir(path, 0755) == 0);
+	for (int i = 0; i < 2; i++) {
+		snprintf(path, sizeof(path), "%s/build/out%d", root_dir, i);
+		make_file(path, 50, i);
+	}
+	snprintf(path, sizeof(path), "%s/scratch.tmp", root_dir);
+	make_file(path, 60, 2);
+	snprintf(path, sizeof(path), "%s/kept", root_dir);
+	make_file(path, 70, 3);
+	FILE *rules = fopen(rules_path, "w");
+	assert(rules != NULL);
+	fputs("build/\n*.tmp\n", rules);
+	fclose(rules);
+
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[0];
+	options.root_dir = root_dir;
+	options.state_dir = state_dir;
+	options.transport = loopback_create(NULL);
+	options.get_token = &test_get_token;
+	options.token_arg = &token;
+	sync_account account = sync_account_add(host, &options);
+
+	/* Only kept and the rules file itself */
+	assert(sync_account_sync(account) == 2);
+	sync_account_wait(account);
+	size_t size;
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 70);
+	snprintf(path, sizeof(path), "%s/build/out0", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) == NULL);
+
+	/* Changes in an excluded directory are not seen */
+	make_file(path, 80, 4);
+	assert(sync_account_sync(account) == 0);
+
+	/* Files that the rules include again are found as created, along with the changed rules */
+	rules = fopen(rules_path, "w");
+	assert(rules != NULL);
+	fputs("*.tmp\n", rules);
+	fclose(rules);
+	assert(sync_account_sync(account) == 3);
+	sync_account_wait(account);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 80);
+
+	/* Without the rules, nothing is excluded */
+	assert(unlink(rules_path) == 0);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	snprintf(path, sizeof(path), "%s/scratch.tmp", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 60);
+	sync_host_destroy(host);
+}
+
+void test_engine_moves() {
+	char root_dir[96], state_dir[96], outside[96], path[128], new_path[128];
+	snprintf(root_dir, sizeof(root_dir), "%s/moves_root", test_dir);
+	snprintf(state_dir, sizeof(state_dir), "%s/moves_state", test_dir);
+	snprintf(outside, sizeof(outside), "%s/moves_outside", test_dir);
+	assert(mkdir(root_dir, 0755) == 0);
+	assert(mkdir(outside, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/dir", root_dir);
+	assert(mkdir(path, 0755) == 0);
+	for (int i = 0; i < NUM_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/dir/file%d", root_dir, i);
+		make_file(path, 100 + i, 10 + i);
+	}
+
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[0];
+	options.root_dir = root_dir;
+	options.state_dir = state_dir;
+	options.transport = loopback_create(NULL);
+	options.get_token = &test_get_token;
+	options.token_arg = &token;
+	sync_account account = sync_account_add(host, &options);
+	assert(sync_account_sync(account) == NUM_FILES);
+	sync_account_wait(account);
+
+	/* A renamed directory is a single move of all its objects */
+	snprintf(path, sizeof(path), "%s/dir", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/moved", root_dir);
+	assert(rename(path, new_path) == 0);
+	assert(sync_account_sync(account) == 0);
+	struct sync_account_stats stats;
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 1);
+	struct loopback_stats lb_stats;
+	loopback_get_stats(options.transport, &lb_stats);
+	assert(lb_stats.moves == NUM_FILES);
+	size_t size;
+	for (int i = 0; i < NUM_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/moved/file%d", root_dir, i);
+		assert(loopback_get_object(options.transport, path, &size) != NULL && size == 100 + i);
+		snprintf(path, sizeof(path), "%s/dir/file%d", root_dir, i);
+		assert(loopback_get_object(options.transport, path, &size) == NULL);
+	}
+
+	/* A renamed file */
+	snprintf(path, sizeof(path), "%s/moved/file0", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/file", root_dir);
+	assert(rename(path, new_path) == 0);
+	assert(sync_account_sync(account) == 0);
+	assert(loopback_get_object(options.transport, new_path, &size) != NULL && size == 100);
+
+	/* A file copied under a new inode, with the original deleted, is found by its digest */
+	snprintf(path, sizeof(path), "%s/copied", root_dir);
+	make_file(path, 100, 10);
+	assert(unlink(new_path) == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 3);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 100);
+	assert(loopback_get_object(options.transport, new_path, &size) == NULL);
+
+	/* A file written again with the same contents is not sent */
+	make_file(path, 100, 10);
+	assert(sync_account_sync(account) == 0);
+
+	/* Moved out and back in under another name, between two syncs */
+	snprintf(path, sizeof(path), "%s/moved", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/moved", outside);
+	assert(rename(path, new_path) == 0);
+	snprintf(path, sizeof(path), "%s/back", root_dir);
+	assert(rename(new_path, path) == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 4);
+	snprintf(path, sizeof(path), "%s/back/file1", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 101);
+
+	/* A renamed directory whose name is created again is still a single move */
+	loopback_get_stats(options.transport, &lb_stats);
+	unsigned long moves = lb_stats.moves;
+	snprintf(path, sizeof(path), "%s/back", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/back.old", root_dir);
+	assert(rename(path, new_path) == 0);
+	assert(mkdir(path, 0755) == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 5);
+	loopback_get_stats(options.transport, &lb_stats);
+	assert(lb_stats.moves == moves + NUM_FILES - 1);
+	snprintf(path, sizeof(path), "%s/back.old/file1", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 101);
+	snprintf(path, sizeof(path), "%s/back/file1", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) == NULL);
+
+	/* Without moves in the store, the files are sent again */
+	options.transport->move_object = NULL;
+	snprintf(path, sizeof(path), "%s/back.old", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/again", root_dir);
+	assert(rename(path, new_path) == 0);
+	assert(sync_account_sync(account) == NUM_FILES - 1);
+	sync_account_wait(account);
+	snprintf(path, sizeof(path), "%s/again/file2", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 102);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 5);
+	sync_host_destroy(host);
+}
+
+void test_engine_retries() {
+	char root_dir[96], state_dir[96], path[128];
+	snprintf(root_dir, sizeof(root_dir), "%s/retries_root", test_dir);
+	snprintf(state_dir, sizeof(state_dir), "%s/retries_state", test_dir);
+	assert(mkdir(root_dir, 0755) == 0);
+	for (int i = 0; i < NUM_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/file%d", root_dir, i);
+		make_file(path, 100 + i, 20 + i);
+	}
+
+	/* A store that fails every request */
+	struct loopback_options lb_options;
+	memset(&lb_options, 0, sizeof(lb_options));
+	lb_options.max_chunks = 0;
+	struct upload_options upload;
+	upload_default_options(&upload);
+	upload.max_retries = 1;
+	upload.backoff_us = 100;
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[0];
+	options.root_dir = root_dir;
+	options.state_dir = state_dir;
+	options.transport = loopback_create(&lb_options);
+	options.get_token = &test_get_token;
+	options.token_arg = &token;
+	options.upload = &upload;
+	sync_account account = sync_account_add(host, &options);
+	assert(sync_account_sync(account) == NUM_FILES);
+	sync_account_wait(account);
+	struct sync_account_stats stats;
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_failed == NUM_FILES);
+
+	/* Nothing changed, but the failed files are sent by the next sync */
+	lb_options.max_chunks = -1;
+	loopback_set_options(options.transport, &lb_options);
+	assert(sync_account_sync(account) == NUM_FILES);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_done == NUM_FILES);
+	size_t size;
+	snprintf(path, sizeof(path), "%s/file1", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 101);
+	assert(sync_account_sync(account) == 0);
+
+	/* A file that failed in the last run, and a deleted one, which is not sent */
+	struct loopback_stats lb_stats;
+	loopback_get_stats(options.transport, &lb_stats);
+	lb_options.max_chunks = lb_stats.chunks;
+	loopback_set_options(options.transport, &lb_options);
+	snprintf(path, sizeof(path), "%s/file0", root_dir);
+	make_file(path, 50, 1);
+	snprintf(path, sizeof(path), "%s/file1", root_dir);
+	make_file(path, 60, 1);
+	assert(sync_account_sync(account) == 2);
+	sync_account_wait(account);
+	sync_host_destroy(host);
+	assert(unlink(path) == 0);
+
+	host = sync_host_create(1, NULL);
+	options.transport = loopback_create(NULL);
+	account = sync_account_add(host, &options);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	snprintf(path, sizeof(path), "%s/file0", root_dir);
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 50);
+	assert(sync_account_sync(account) == 0);
+	sync_host_destroy(host);
+}
+
+void test_engine_rescan() {
+	char root_dir[96], state_dir[96], path[128], new_path[128];
+	snprintf(root_dir, sizeof(root_dir), "%s/rescan_root", test_dir);
+	snprintf(state_dir, sizeof(state_dir), "%s/rescan_state", test_dir);
+	const char *dirs[] = { "", "/a", "/a/b", "/c" };
+	for (int i = 0; i < 4; i++) {
+		snprintf(path, sizeof(path), "%s%s", root_dir, dirs[i]);
+		assert(mkdir(path, 0755) == 0);
+		snprintf(path, sizeof(path), "%s%s/file", root_dir, dirs[i]);
+		make_file(path, 100 + i, 30 + i);
+	}
+
+	sync_host host = sync_host_create(1, NULL);
+	struct test_token token = { 3600, 0 };
+	struct sync_account_options options;
+	memset(&options, 0, sizeof(options));
+	options.email = emails[0];
+	options.root_dir = root_dir;
+	options.state_dir = state_dir;
+	options.transport = loopback_create(NULL);
+	options.get_token = &test_get_token;
+	options.token_arg = &token;
+	sync_account account = sync_account_add(host, &options);
+	assert(sync_account_sync(account) == 4);
+	sync_account_wait(account);
+	struct sync_account_stats stats;
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 4);
+
+	/* Reading the files, like the uploads did, is not a change */
+	int fd = sync_account_watch_fd(account);
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	snprintf(path, sizeof(path), "%s/a/file", root_dir);
+	FILE *file = fopen(path, "r");
+	assert(file != NULL && fgetc(file) != EOF);
+	fclose(file);
+	ssize_t len;
+	int changes = 0;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		changes += sync_account_note_events(account, buf, len);
+	}
+	assert(changes == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 4);
+
+	/* A changed file, with its events noted by the caller */
+	snprintf(path, sizeof(path), "%s/a/b/file", root_dir);
+	make_file(path, 200, 1);
+	changes = 0;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		changes += sync_account_note_events(account, buf, len);
+	}
+	assert(changes > 0);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 5);
+
+	/* A new directory is listed and watched, with the events left for the sync */
+	snprintf(path, sizeof(path), "%s/c/new", root_dir);
+	assert(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/c/new/file", root_dir);
+	make_file(path, 10, 2);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 7);
+	make_file(path, 20, 3);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 8);
+
+	/* A directory moved within the tree keeps its watch */
+	snprintf(path, sizeof(path), "%s/c/new", root_dir);
+	snprintf(new_path, sizeof(new_path), "%s/a/moved", root_dir);
+	assert(rename(path, new_path) == 0);
+	assert(sync_account_sync(account) == 0);
+	sync_account_get_stats(account, &stats);
+	assert(stats.files_moved == 1);
+	assert(stats.dirs_listed == 11);
+	snprintf(path, sizeof(path), "%s/a/moved/file", root_dir);
+	make_file(path, 30, 4);
+	assert(sync_account_sync(account) == 1);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 12);
+	size_t size;
+	assert(loopback_get_object(options.transport, path, &size) != NULL && size == 30);
+
+	/* New rules list the whole tree again */
+	snprintf(path, sizeof(path), "%s/%s", root_dir, PM_RULES_FILE);
+	file = fopen(path, "w");
+	assert(file != NULL);
+	fputs("/c/\n", file);
+	fclose(file);
+	assert(sync_account_sync(account) >= 0);
+	sync_account_wait(account);
+	sync_account_get_stats(account, &stats);
+	assert(stats.dirs_listed == 16);
+	snprintf(path, sizeof(path), "%s/c/file", root_dir);
+	make_file(path, 40, 5);
+	assert(sync_account_sync(account) == 0);
+	sync_host_destroy(host);
+}
@@ -0,0 +1,219 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <faststart.h>
+#include <linux-api.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* Helper functions for the test cases */
+/* Create an empty file */
+void touch(const char *dir, const char *name);
+/* Create a directory */
+void make_dir(const char *dir, const char *name);
+/* Check that the fast start agrees with watch_md5sum_fsh_filtered, and return its stats */
+struct fast_start_stats check_fast_start(char *dir, char *state_path, path_matcher matcher);
+/* Check that creating the file, at a path relative to dir, gives an event on the inotify instance */
+void check_watched(int fd, const char *dir, const char *name);
+
+/* Test Cases */
+/* Test the start without any saved records */
+void test_faststart_cold();
+/* Test the start with saved records, and changes in between */
+void test_faststart_warm();
+/* Test that every directory, including the root, is watched */
+void test_faststart_watches();
+/* Test the start with include/exclude rules, and with the rules changed */
+void test_faststart_rules();
+
+/* Fast Start Test suite */
+void test_faststart();
+
+char test_dir[] = "/tmp/goodrive_faststart_XXXXXX";
+char state_path[64];
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+	snprintf(state_path, sizeof(state_path), "%s.dirs", test_dir);
+
+	make_dir(test_dir, "a");
+	make_dir(test_dir, "a/b");
+	make_dir(test_dir, "c");
+	touch(test_dir, "a/one");
+	touch(test_dir, "a/b/two");
+	touch(test_dir, "c/three");
+	touch(test_dir, "four");
+
+	test_faststart();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s %s", test_dir, state_path);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_faststart() {
+	test_faststart_cold();
+	test_faststart_warm();
+	test_faststart_watches();
+	test_faststart_rules();
+}
+
+void touch(const char *dir, const char *name) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	fclose(file);
+}
+
+void make_dir(const char *dir, const char *name) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	assert(mkdir(path, 0755) == 0);
+}
+
+struct fast_start_stats check_fast_start(char *dir, char *state_path, path_matcher matcher) {
+	char *expected;
+	int fd = watch_md5sum_fsh_filtered(-1, &expected, dir, matcher);
+	assert(fd != -1);
+	close(fd);
+
+	char *md5sum;
+	struct fast_start_stats stats;
+	fd = watch_md5sum_fsh_fast(-1, &md5sum, dir, state_path, matcher, &stats);
+	assert(fd != -1);
+	close(fd);
+
+	assert(strcmp(md5sum, expected) == 0);
+	free(expected);
+	if (matcher == NULL) {
+		expected = md5sum_fsh(dir);
+		assert(strcmp(md5sum, expected) == 0);
+		free(expected);
+	}
+	free(md5sum);
+	return stats;
+}
+
+void check_watched(int fd, const char *dir, const char *name) {
+	char buf[4096];
+	/* Drop the events of the traversal itself */
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	touch(dir, name);
+	const char *base_name = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+	int found = 0;
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			struct inotify_event *event = (struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+			found |= (event->len > 0 && strcmp(event->name, base_name) == 0);
+		}
+	}
+	assert(found);
+}
+
+void test_faststart_cold() {
+	struct fast_start_stats stats = check_fast_start(test_dir, state_path, NULL);
+	assert(stats.dirs_listed == 4);
+	assert(stats.dirs_reused == 0);
+	assert(stats.entries == 7);
+	assert(access(state_path, R_OK) == 0);
+}
+
+void test_faststart_warm() {
+	/* Nothing changed: no directory is read */
+	struct fast_start_stats stats = check_fast_start(test_dir, state_path, NULL);
+	assert(stats.dirs_listed == 0);
+	assert(stats.dirs_reused == 4);
+	assert(stats.entries == 7);
+
+	/* A new file deep in the tree: only its directory is read */
+	touch(test_dir, "a/b/five");
+	stats = check_fast_start(test_dir, state_path, NULL);
+	assert(stats.dirs_listed == 1);
+	assert(stats.dirs_reused == 3);
+	assert(stats.entries == 8);
+
+	/* A new directory: its parent and itself are read */
+	make_dir(test_dir, "c/d");
+	touch(test_dir, "c/d/six");
+	stats = check_fast_start(test_dir, state_path, NULL);
+	assert(stats.dirs_listed == 2);
+	assert(stats.dirs_reused == 3);
+	assert(stats.entries == 10);
+}
+
+void test_faststart_watches() {
+	char *md5sum;
+	int fd = watch_md5sum_fsh(inotify_init1(IN_NONBLOCK), &md5sum, test_dir);
+	assert(fd != -1);
+	free(md5sum);
+	check_watched(fd, test_dir, "seven");
+	check_watched(fd, test_dir, "a/b/eight");
+	close(fd);
+
+	fd = watch_md5sum_fsh_fast(inotify_init1(IN_NONBLOCK), &md5sum, test_dir, state_path, NULL, NULL);
+	assert(fd != -1);
+	free(md5sum);
+	check_watched(fd, test_dir, "nine");
+	check_watched(fd, test_dir, "c/d/ten");
+	close(fd);
+}
+
+void test_faststart_rules() {
+	path_matcher matcher = pm_create();
+	assert(pm_add_rule(matcher, "b/") == 0);
+	assert(pm_add_rule(matcher, "four") == 0);
+
+	/* The records were made without rules, so none of them is reused */
+	struct fast_start_stats stats = check_fast_start(test_dir, state_path, matcher);
+	assert(stats.dirs_listed == 4);
+	assert(stats.dirs_reused == 0);
+
+	/* Same rules: everything is reused, and a/b is still left out */
+	stats = check_fast_start(test_dir, state_path, matcher);
+	assert(stats.dirs_listed == 0);
+	assert(stats.dirs_reused == 4);
+
+	/* Other rules: the records are made again */
+	assert(pm_add_rule(matcher, "!four") == 0);
+	stats = check_fast_start(test_dir, state_path, matcher);
+	assert(stats.dirs_listed == 4);
+	assert(stats.dirs_reused == 0);
+	pm_destroy(matcher);
+
+	/* No rules at all: back to the whole hierarchy */
+	stats = check_fast_start(test_dir, state_path, NULL);
+	assert(stats.dirs_listed == 5);
+	assert(stats.dirs_reused == 0);
+}
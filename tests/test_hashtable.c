@@ -26,6 +26,7 @@
 #include <assert.h>
 #include <hashtable.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /* Helper functions for the test cases */
@@ -80,6 +81,7 @@ void test_default_htoptions() {
 	assert(default_options->hash_fn("goodrive") == 2123187555);
 	assert(default_options->equals("foobar", "foobar") == 1);
 	assert(default_options->equals("foo", "bar") == 0);
+	free(default_options);
 }
 
 void test_hashtable_insertion() {
@@ -95,6 +97,7 @@ void test_hashtable_insertion() {
 	assert(strcmp(exp_value1, "value1") == 0);
 	assert(strcmp(exp_value2, "value2") == 0);
 	assert(strcmp(exp_value3, "value3") == 0);
+	ht_destroy(hashtable);
 }
 
 void test_hashtable_insertion_terrible_hashfn() {
@@ -112,6 +115,8 @@ void test_hashtable_insertion_terrible_hashfn() {
 	assert(strcmp(exp_value1, "value1") == 0);
 	assert(strcmp(exp_value2, "value2") == 0);
 	assert(strcmp(exp_value3, "value3") == 0);
+	ht_destroy(hashtable);
+	free(options);
 }
 
 void test_hashtable_insert_existing_key() {
@@ -126,6 +131,7 @@ void test_hashtable_insert_existing_key() {
 	assert(ht_num_entries(hashtable) == 1);
 	char* exp_value = ht_get(hashtable, "foo");
 	assert(strcmp(exp_value, "bar2") == 0);
+	ht_destroy(hashtable);
 }
 
 void test_hashtable_insert_existing_key_terrible_hashfn() {
@@ -139,6 +145,8 @@ void test_hashtable_insert_existing_key_terrible_hashfn() {
 	assert(ht_num_entries(hashtable) == 2);
 	char* exp_value = ht_get(hashtable, "foo1");
 	assert(strcmp(exp_value, "bar3") == 0);
+	ht_destroy(hashtable);
+	free(options);
 }
 
 ht_options ht_options_terrible_hashfn() {
@@ -173,6 +181,8 @@ void test_hashtable_growth() {
 	assert(strcmp(ht_get(hashtable, "foo6"), "bar6") == 0);
 	assert(strcmp(ht_get(hashtable, "foo7"), "bar7") == 0);
 	assert(strcmp(ht_get(hashtable, "foo8"), "bar8") == 0);
+	ht_destroy(hashtable);
+	free(default_options);
 }
 
 void test_hashtable_removal() {
@@ -183,6 +193,7 @@ void test_hashtable_removal() {
 	assert(ht_exists(hashtable, "foo1") == 1);
 	ht_remove(hashtable, "foo1");
 	assert(ht_exists(hashtable, "foo1") == 0);
+	ht_destroy(hashtable);
 }
 
 void test_hashtable_removal_terrible_hashfn() {
@@ -206,4 +217,6 @@ void test_hashtable_removal_terrible_hashfn() {
 	assert(strcmp(ht_get(hashtable, "foo8"), "bar8") == 0);
 
 	assert(ht_exists(hashtable, "foo4") == 0);
+	ht_destroy(hashtable);
+	free(options);
 }
@@ -0,0 +1,103 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <histogram.h>
+
+/* Test Cases */
+/* Test values that are counted exactly */
+void test_hist_small_values();
+/* Test the error of the percentiles of large values */
+void test_hist_percentiles();
+/* Test merging histograms */
+void test_hist_merge();
+
+/* Histogram Test suite */
+void test_histogram();
+
+int main() {
+	test_histogram();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_histogram() {
+	test_hist_small_values();
+	test_hist_percentiles();
+	test_hist_merge();
+}
+
+void test_hist_small_values() {
+	struct histogram hist;
+	hist_init(&hist);
+	assert(hist_percentile(&hist, 50) == 0);
+	assert(hist_mean(&hist) == 0);
+
+	for (uint64_t i = 1; i <= 10; i++) {
+		hist_record(&hist, i);
+	}
+	assert(hist.count == 10);
+	assert(hist.min == 1);
+	assert(hist.max == 10);
+	assert(hist_percentile(&hist, 50) == 5);
+	assert(hist_percentile(&hist, 90) == 9);
+	assert(hist_percentile(&hist, 100) == 10);
+	assert(hist_mean(&hist) == 5.5);
+}
+
+void test_hist_percentiles() {
+	struct histogram hist;
+	hist_init(&hist);
+	for (uint64_t i = 1; i <= 100000; i++) {
+		hist_record(&hist, i);
+	}
+	uint64_t percentiles[] = { 50, 90, 99 };
+	for (int i = 0; i < 3; i++) {
+		uint64_t expected = percentiles[i] * 1000;
+		uint64_t value = hist_percentile(&hist, percentiles[i]);
+		/* Rounded up to the bucket, within 12.5% */
+		assert(value >= expected);
+		assert(value <= expected + expected / 8);
+	}
+	assert(hist_percentile(&hist, 100) == 100000);
+
+	/* The largest values */
+	hist_record(&hist, UINT64_MAX);
+	assert(hist_percentile(&hist, 100) == UINT64_MAX);
+}
+
+void test_hist_merge() {
+	struct histogram hist1, hist2;
+	hist_init(&hist1);
+	hist_init(&hist2);
+	for (uint64_t i = 0; i < 100; i++) {
+		hist_record(i % 2 ? &hist1 : &hist2, 1000 + i);
+	}
+	hist_merge(&hist1, &hist2);
+	assert(hist1.count == 100);
+	assert(hist1.min == 1000);
+	assert(hist1.max == 1099);
+	assert(hist_percentile(&hist1, 100) == 1099);
+}
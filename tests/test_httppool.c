@@ -0,0 +1,439 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <httppool.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+
+#define NUM_CLIENTS 4
+
+/*
+ * The loopback HTTPS server. Every response body is
+ * "<connection number> <method> <path> <request body>".
+ */
+struct test_server {
+	int listen_fd;
+	unsigned short port;
+	SSL_CTX *ssl_ctx;
+	pthread_mutex_t lock;
+	int num_conns;
+	int open_conns;
+	int max_open_conns;
+};
+
+/* Helper functions for the test cases */
+/* Create a self signed certificate for localhost, and start the server with it */
+void start_server(struct test_server *server, const char *cert_path);
+/* Wait till the server has no open connections */
+void wait_server_idle(struct test_server *server);
+/* Accept the connections, and serve each in a thread of its own */
+void *accept_thread(void *arg);
+/* Serve the requests on a connection, till it is closed */
+void *serve_thread(void *arg);
+/* Options used by the test cases */
+void test_options(struct http_pool_options *options);
+/* Send a GET request, and check that the body has the path */
+int get(http_pool pool, const char *path);
+/* Keep sending requests */
+void *client_thread(void *arg);
+
+/* Test Cases */
+/* Test that a connection serves several requests */
+void test_http_keep_alive();
+/* Test that a new connection resumes the TLS session */
+void test_http_session_resumption();
+/* Test sending requests back to back on a connection */
+void test_http_pipelined();
+/* Test request bodies, and chunked response bodies */
+void test_http_bodies();
+/* Test the limit on the connections to a host */
+void test_http_host_limit();
+
+/* HTTP Connection Pool Test suite */
+void test_httppool();
+
+char test_dir[] = "/tmp/goodrive_httppool_XXXXXX";
+char cert_path[64];
+struct test_server server;
+
+int main() {
+	/* As the daemon does, for the connections closed by the server */
+	signal(SIGPIPE, SIG_IGN);
+	assert(mkdtemp(test_dir) != NULL);
+	snprintf(cert_path, sizeof(cert_path), "%s/cert.pem", test_dir);
+	start_server(&server, cert_path);
+
+	test_httppool();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_httppool() {
+	test_http_keep_alive();
+	test_http_session_resumption();
+	test_http_pipelined();
+	test_http_bodies();
+	test_http_host_limit();
+}
+
+void start_server(struct test_server *server, const char *cert_path) {
+	EVP_PKEY *pkey = EVP_EC_gen("P-256");
+	assert(pkey != NULL);
+	X509 *cert = X509_new();
+	X509_set_version(cert, 2);
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), -60);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, pkey);
+	X509_NAME *name = X509_get_subject_name(cert);
+	X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (unsigned char *) "localhost", -1, -1, 0);
+	X509_set_issuer_name(cert, name);
+	X509V3_CTX v3_ctx;
+	X509V3_set_ctx_nodb(&v3_ctx);
+	X509V3_set_ctx(&v3_ctx, cert, cert, NULL, NULL, 0);
+	X509_EXTENSION *ext = X509V3_EXT_conf_nid(NULL, &v3_ctx, NID_subject_alt_name, "DNS:localhost");
+	X509_add_ext(cert, ext, -1);
+	X509_EXTENSION_free(ext);
+	assert(X509_sign(cert, pkey, EVP_sha256()) > 0);
+
+	FILE *file = fopen(cert_path, "w");
+	assert(file != NULL);
+	PEM_write_X509(file, cert);
+	fclose(file);
+
+	server->ssl_ctx = SSL_CTX_new(TLS_server_method());
+	assert(SSL_CTX_use_certificate(server->ssl_ctx, cert) == 1);
+	assert(SSL_CTX_use_PrivateKey(server->ssl_ctx, pkey) == 1);
+	X509_free(cert);
+	EVP_PKEY_free(pkey);
+
+	server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(bind(server->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	assert(listen(server->listen_fd, 16) == 0);
+	socklen_t addr_len = sizeof(addr);
+	getsockname(server->listen_fd, (struct sockaddr *) &addr, &addr_len);
+	server->port = ntohs(addr.sin_port);
+
+	pthread_mutex_init(&server->lock, NULL);
+	server->num_conns = server->open_conns = server->max_open_conns = 0;
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, &accept_thread, server) == 0);
+	pthread_detach(thread);
+}
+
+void wait_server_idle(struct test_server *server) {
+	while (1) {
+		pthread_mutex_lock(&server->lock);
+		int open_conns = server->open_conns;
+		server->max_open_conns = 0;
+		pthread_mutex_unlock(&server->lock);
+		if (open_conns == 0) {
+			return;
+		}
+		usleep(1000);
+	}
+}
+
+void *accept_thread(void *arg) {
+	struct test_server *server = arg;
+	int fd;
+	while ((fd = accept(server->listen_fd, NULL, NULL)) != -1) {
+		pthread_mutex_lock(&server->lock);
+		server->num_conns++;
+		server->open_conns++;
+		if (server->open_conns > server->max_open_conns) {
+			server->max_open_conns = server->open_conns;
+		}
+		pthread_mutex_unlock(&server->lock);
+
+		pthread_t thread;
+		assert(pthread_create(&thread, NULL, &serve_thread, (void *) (long) fd) == 0);
+		pthread_detach(thread);
+	}
+	return NULL;
+}
+
+void *serve_thread(void *arg) {
+	int fd = (int) (long) arg;
+	pthread_mutex_lock(&server.lock);
+	int conn_num = server.num_conns;
+	pthread_mutex_unlock(&server.lock);
+
+	SSL *ssl = SSL_new(server.ssl_ctx);
+	SSL_set_fd(ssl, fd);
+	char buf[8192];
+	size_t len = 0;
+	int closing = 0;
+	if (SSL_accept(ssl) == 1) {
+		while (!closing) {
+			/* Parse the requests in the buffer */
+			char *end = memmem(buf, len, "\r\n\r\n", 4);
+			if (end == NULL) {
+				size_t count;
+				if (len == sizeof(buf) || SSL_read_ex(ssl, buf + len, sizeof(buf) - len, &count) != 1) {
+					break;
+				}
+				len += count;
+				continue;
+			}
+			size_t head_len = end + 4 - buf;
+			char *length = strstr(buf, "Content-Length: ");
+			size_t body_len = (length != NULL && length < end) ? strtoul(length + 16, NULL, 10) : 0;
+			if (len < head_len + body_len) {
+				size_t count;
+				if (SSL_read_ex(ssl, buf + len, sizeof(buf) - len, &count) != 1) {
+					break;
+				}
+				len += count;
+				continue;
+			}
+
+			char method[16], path[256];
+			sscanf(buf, "%15s %255s", method, path);
+			char body[512];
+			int body_size = snprintf(body, sizeof(body), "%d %s %s %.*s", conn_num, method, path,
+					(int) body_len, buf + head_len);
+			memmove(buf, buf + head_len + body_len, len - head_len - body_len);
+			len -= head_len + body_len;
+
+			char response[1024];
+			int response_size;
+			if (strcmp(path, "/chunked") == 0) {
+				response_size = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\n"
+						"Transfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n5;ext=1\r\ndefgh\r\n0\r\n\r\n");
+			} else {
+				closing = (strcmp(path, "/close") == 0);
+				if (strcmp(path, "/slow") == 0) {
+					usleep(20000);
+				}
+				response_size = snprintf(response, sizeof(response), "HTTP/1.1 200 OK\r\n"
+						"Content-Length: %d\r\n%s\r\n%s", body_size,
+						closing ? "Connection: close\r\n" : "", body);
+			}
+			size_t written;
+			if (SSL_write_ex(ssl, response, response_size, &written) != 1) {
+				break;
+			}
+		}
+	}
+	SSL_shutdown(ssl);
+	SSL_free(ssl);
+	/*
+	 * Closing with unread requests would reset the connection, and the client
+	 * could lose the responses already sent. Wait for the client to close.
+	 */
+	shutdown(fd, SHUT_WR);
+	while (read(fd, buf, sizeof(buf)) > 0) {
+	}
+	close(fd);
+
+	pthread_mutex_lock(&server.lock);
+	server.open_conns--;
+	pthread_mutex_unlock(&server.lock);
+	return NULL;
+}
+
+void test_options(struct http_pool_options *options) {
+	http_pool_default_options(options);
+	options->ca_file = cert_path;
+	options->io_timeout_sec = 10;
+}
+
+int get(http_pool pool, const char *path) {
+	struct http_request request = { "GET", path, NULL, NULL, 0 };
+	struct http_response response;
+	assert(http_send(pool, "localhost", server.port, &request, &response) == 0);
+	assert(response.status == 200);
+	int conn_num;
+	char method[16], response_path[256];
+	assert(sscanf((char *) response.body, "%d %15s %255s", &conn_num, method, response_path) == 3);
+	assert(strcmp(method, "GET") == 0);
+	assert(strcmp(response_path, path) == 0);
+	http_response_free(&response);
+	return conn_num;
+}
+
+void *client_thread(void *arg) {
+	http_pool pool = arg;
+	for (int i = 0; i < 3; i++) {
+		get(pool, "/slow");
+	}
+	return NULL;
+}
+
+void test_http_keep_alive() {
+	struct http_pool_options options;
+	test_options(&options);
+	http_pool pool = http_pool_create(&options);
+	assert(pool != NULL);
+
+	int conn_num = get(pool, "/one");
+	for (int i = 0; i < 4; i++) {
+		assert(get(pool, "/two") == conn_num);
+	}
+	struct http_pool_stats stats;
+	http_pool_get_stats(pool, &stats);
+	assert(stats.requests == 5);
+	assert(stats.connections_opened == 1);
+	assert(stats.connections_reused == 4);
+
+	/* Untrusted server */
+	options.ca_file = "/dev/null";
+	http_pool untrusting_pool = http_pool_create(&options);
+	if (untrusting_pool != NULL) {
+		struct http_request request = { "GET", "/", NULL, NULL, 0 };
+		struct http_response response;
+		assert(http_send(untrusting_pool, "localhost", server.port, &request, &response) == -1);
+		http_pool_destroy(untrusting_pool);
+	}
+
+	http_pool_destroy(pool);
+	wait_server_idle(&server);
+}
+
+void test_http_session_resumption() {
+	struct http_pool_options options;
+	test_options(&options);
+	http_pool pool = http_pool_create(&options);
+
+	int conn_num = get(pool, "/close");
+	assert(get(pool, "/after") != conn_num);
+	struct http_pool_stats stats;
+	http_pool_get_stats(pool, &stats);
+	assert(stats.connections_opened == 2);
+	assert(stats.sessions_resumed == 1);
+
+	http_pool_destroy(pool);
+	wait_server_idle(&server);
+}
+
+void test_http_pipelined() {
+	struct http_pool_options options;
+	test_options(&options);
+	http_pool pool = http_pool_create(&options);
+
+	struct http_request requests[10];
+	struct http_response responses[10];
+	char paths[10][16];
+	for (int i = 0; i < 10; i++) {
+		snprintf(paths[i], sizeof(paths[i]), "/file%d", i);
+		requests[i].method = "GET";
+		requests[i].path = paths[i];
+		requests[i].headers = "Accept: */*\r\n";
+		requests[i].body = NULL;
+		requests[i].body_len = 0;
+	}
+	assert(http_send_pipelined(pool, "localhost", server.port, requests, responses, 10) == 10);
+	for (int i = 0; i < 10; i++) {
+		char path[16];
+		assert(responses[i].status == 200);
+		assert(sscanf((char *) responses[i].body, "%*d GET %15s", path) == 1);
+		assert(strcmp(path, paths[i]) == 0);
+		http_response_free(&responses[i]);
+	}
+
+	/* The connection is closed half way, and the rest goes over a new one */
+	requests[4].path = "/close";
+	assert(http_send_pipelined(pool, "localhost", server.port, requests, responses, 10) == 10);
+	for (int i = 0; i < 10; i++) {
+		http_response_free(&responses[i]);
+	}
+	struct http_pool_stats stats;
+	http_pool_get_stats(pool, &stats);
+	assert(stats.requests == 20);
+	assert(stats.connections_opened == 2);
+
+	http_pool_destroy(pool);
+	wait_server_idle(&server);
+}
+
+void test_http_bodies() {
+	struct http_pool_options options;
+	test_options(&options);
+	http_pool pool = http_pool_create(&options);
+
+	struct http_request request = { "POST", "/echo", "Content-Type: text/plain\r\n", "hello", 5 };
+	struct http_response response;
+	assert(http_send(pool, "localhost", server.port, &request, &response) == 0);
+	assert(strstr((char *) response.body, " POST /echo hello") != NULL);
+	assert(strstr(response.headers, "Content-Length: ") != NULL);
+	http_response_free(&response);
+
+	request.method = "GET";
+	request.path = "/chunked";
+	request.body = NULL;
+	request.body_len = 0;
+	assert(http_send(pool, "localhost", server.port, &request, &response) == 0);
+	assert(response.body_len == 8);
+	assert(strcmp((char *) response.body, "abcdefgh") == 0);
+	http_response_free(&response);
+
+	http_pool_destroy(pool);
+	wait_server_idle(&server);
+}
+
+void test_http_host_limit() {
+	struct http_pool_options options;
+	test_options(&options);
+	options.max_per_host = 2;
+	http_pool pool = http_pool_create(&options);
+
+	pthread_t clients[NUM_CLIENTS];
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		assert(pthread_create(&clients[i], NULL, &client_thread, pool) == 0);
+	}
+	for (int i = 0; i < NUM_CLIENTS; i++) {
+		pthread_join(clients[i], NULL);
+	}
+	struct http_pool_stats stats;
+	http_pool_get_stats(pool, &stats);
+	assert(stats.requests == NUM_CLIENTS * 3);
+	assert(stats.connections_opened <= 2);
+	pthread_mutex_lock(&server.lock);
+	assert(server.max_open_conns <= 2);
+	pthread_mutex_unlock(&server.lock);
+
+	http_pool_destroy(pool);
+	wait_server_idle(&server);
+}
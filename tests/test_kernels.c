@@ -0,0 +1,142 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <kernels.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Longest input of the random cases */
+#define MAX_LEN 4096
+
+/* Helper functions for the test cases */
+/* Get the scalar reference, the last variant of the kernel */
+const struct cpu_kernel *reference_kernel(const struct cpu_kernel *variants);
+/* Fill the buffer with random bytes, including the negative chars */
+void fill_random(unsigned char *buf, size_t len);
+
+/* Test Cases */
+/* Test that GOODRV_CPU_FEATURES limits the variants to the scalar code */
+void test_kernels_override();
+/* Test the dispatched kernels against known values */
+void test_kernels_known_values();
+/* Test every base64url variant the CPU supports against the reference */
+void test_kernels_base64url_variants();
+/* Test every string hash variant the CPU supports against the reference */
+void test_kernels_hash_variants();
+
+/* Kernels Test suite */
+void test_kernels();
+
+int main() {
+	/* Before anything reads the features */
+	setenv(CPU_FEATURES_ENV, "none", 1);
+	srand(42);
+	test_kernels();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_kernels() {
+	test_kernels_override();
+	test_kernels_known_values();
+	test_kernels_base64url_variants();
+	test_kernels_hash_variants();
+}
+
+const struct cpu_kernel *reference_kernel(const struct cpu_kernel *variants) {
+	while (variants->features != 0) {
+		variants++;
+	}
+	assert(strcmp(variants->name, "scalar") == 0);
+	return variants;
+}
+
+void fill_random(unsigned char *buf, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = rand() & 0xff;
+	}
+}
+
+void test_kernels_override() {
+	assert(cpu_features() == 0);
+	assert(strcmp(cpu_select(base64url_encode_kernels)->name, "scalar") == 0);
+	assert(strcmp(cpu_select(hash_string_kernels)->name, "scalar") == 0);
+	assert(strcmp(cpu_feature_name(CPU_FEATURE_AVX2), "avx2") == 0);
+}
+
+void test_kernels_known_values() {
+	assert(kernel_hash_string("goodrive", 8) == 2123187555U);
+	assert(kernel_hash_string("", 0) == 0);
+
+	char output[9] = { 0 };
+	kernel_base64url_encode((const unsigned char *) "\xfb\xff\xbf" "abc", 2, output);
+	assert(strcmp(output, "-_-_YWJj") == 0);
+}
+
+void test_kernels_base64url_variants() {
+	const struct cpu_kernel *reference = reference_kernel(base64url_encode_kernels);
+	base64url_encode_fn reference_fn = (base64url_encode_fn) reference->fn;
+	unsigned char *input = malloc(MAX_LEN);
+	char *expected = malloc(MAX_LEN / 3 * 4);
+	char *output = malloc(MAX_LEN / 3 * 4);
+
+	unsigned int detected = cpu_detect();
+	for (const struct cpu_kernel *variant = base64url_encode_kernels; variant != reference; variant++) {
+		if ((variant->features & detected) != variant->features) {
+			continue;
+		}
+		base64url_encode_fn fn = (base64url_encode_fn) variant->fn;
+		for (size_t len = 0; len <= MAX_LEN; len = (len < 300) ? len + 1 : len * 2) {
+			size_t triplets = len / 3;
+			fill_random(input, len);
+			reference_fn(input, triplets, expected);
+			fn(input, triplets, output);
+			assert(memcmp(output, expected, 4 * triplets) == 0);
+		}
+	}
+	free(input);
+	free(expected);
+	free(output);
+}
+
+void test_kernels_hash_variants() {
+	const struct cpu_kernel *reference = reference_kernel(hash_string_kernels);
+	hash_string_fn reference_fn = (hash_string_fn) reference->fn;
+	unsigned char *input = malloc(MAX_LEN);
+
+	unsigned int detected = cpu_detect();
+	for (const struct cpu_kernel *variant = hash_string_kernels; variant != reference; variant++) {
+		if ((variant->features & detected) != variant->features) {
+			continue;
+		}
+		hash_string_fn fn = (hash_string_fn) variant->fn;
+		for (size_t len = 0; len <= MAX_LEN; len = (len < 300) ? len + 1 : len * 2) {
+			fill_random(input, len);
+			assert(fn((const char *) input, len) == reference_fn((const char *) input, len));
+		}
+	}
+	free(input);
+}
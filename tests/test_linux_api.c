@@ -24,19 +24,147 @@
  */
 
 #include <assert.h>
+#include <grp.h>
 #include <linux-api.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
 
 void test_md5sum_str(void);
+void test_is_group_member(void);
+void test_has_file_permission(void);
+void test_watch_moves(void);
 
 int main() {
 	test_md5sum_str();
+	test_is_group_member();
+	test_has_file_permission();
+	test_watch_moves();
 	return 0;
 }
 
 void test_md5sum_str(void) {
 	/* MD5Sum for 'blah' */
 	const char *expected = "6f1ed002ab5595859014ebf0951522d9";
-	const char *retval = md5sum_str("blah");
+	char *retval = md5sum_str("blah");
 	assert(strcmp(expected, retval) == 0);
+	free(retval);
+}
+
+void test_is_group_member(void) {
+	uid_t uid = geteuid();
+	struct passwd *passwd_entry = getpwuid(uid);
+	if (passwd_entry == NULL) {
+		/* Without an entry for the user, no group is known */
+		assert(!is_group_member(uid, getegid()));
+		return;
+	}
+	/* The primary group is not listed among the members of the group */
+	gid_t primary_gid = passwd_entry->pw_gid;
+	assert(is_group_member(uid, primary_gid));
+
+	/* The groups of the user, as the system databases have them, not as the process does */
+	gid_t groups[1024];
+	int num_groups = 1024;
+	assert(getgrouplist(passwd_entry->pw_name, primary_gid, groups, &num_groups) != -1);
+	for (int i = 0; i < num_groups; i++) {
+		assert(is_group_member(uid, groups[i]));
+	}
+
+	/* Unknown users are not a member of any group */
+	assert(!is_group_member((uid_t) -2, primary_gid));
+
+	/* The groups are resolved again for the user, after invalidation */
+	invalidate_cred_cache();
+	assert(is_group_member(uid, primary_gid));
+}
+
+void test_has_file_permission(void) {
+	uid_t uid = geteuid();
+	struct stat file_stat;
+	memset(&file_stat, 0, sizeof(file_stat));
+
+	/* Owner */
+	file_stat.st_uid = uid;
+	file_stat.st_gid = getegid();
+	file_stat.st_mode = S_IFDIR | 0700;
+	assert(has_file_permission(uid, READ_ACCESS | EXECUTE_ACCESS, &file_stat));
+
+	/* Group */
+	file_stat.st_uid = uid + 1;
+	file_stat.st_mode = S_IFDIR | 0050;
+	assert(has_file_permission(uid, READ_ACCESS | EXECUTE_ACCESS, &file_stat));
+	assert(!has_file_permission(uid, WRITE_ACCESS, &file_stat));
+
+	/* Others */
+	file_stat.st_gid = (gid_t) -2;
+	assert(!has_file_permission(uid, READ_ACCESS, &file_stat));
+	file_stat.st_mode = S_IFDIR | 0004;
+	assert(has_file_permission(uid, READ_ACCESS, &file_stat));
+}
+
+void test_watch_moves(void) {
+	char dir[] = "/tmp/goodrive_moves_XXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	char watched[64], outside[64], path[96], new_path[96];
+	snprintf(watched, sizeof(watched), "%s/watched", dir);
+	snprintf(outside, sizeof(outside), "%s/outside", dir);
+	assert(mkdir(watched, 0755) == 0);
+	assert(mkdir(outside, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/one", watched);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	fclose(file);
+
+	int fd = inotify_init1(IN_NONBLOCK);
+	assert(inotify_add_watch(fd, watched, IN_ALL_EVENTS) != -1);
+	struct watch_moves moves;
+	memset(&moves, 0, sizeof(moves));
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	/* A rename within the watch is paired */
+	snprintf(new_path, sizeof(new_path), "%s/two", watched);
+	assert(rename(path, new_path) == 0);
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		watch_moves_add(&moves, buf, len);
+	}
+	assert(moves.paired == 1 && moves.num_pending == 0 && moves.moved_in == 0);
+
+	/* Moved out: pending, and moved back in: a move in of its own */
+	snprintf(path, sizeof(path), "%s/two", outside);
+	assert(rename(new_path, path) == 0);
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		watch_moves_add(&moves, buf, len);
+	}
+	assert(moves.paired == 1 && moves.num_pending == 1);
+	assert(rename(path, new_path) == 0);
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		watch_moves_add(&moves, buf, len);
+	}
+	assert(moves.paired == 1 && moves.num_pending == 1 && moves.moved_in == 1);
+
+	/* The oldest pending moves are dropped when there are too many */
+	struct inotify_event event;
+	memset(&event, 0, sizeof(event));
+	event.mask = IN_MOVED_FROM;
+	for (unsigned int i = 0; i < WATCH_MAX_PENDING_MOVES + 5; i++) {
+		event.cookie = 1000 + i;
+		watch_moves_add(&moves, (const char *) &event, sizeof(event));
+	}
+	assert(moves.num_pending == WATCH_MAX_PENDING_MOVES);
+	assert(moves.pending[0] == 1005);
+	event.mask = IN_MOVED_TO;
+	event.cookie = 1010;
+	watch_moves_add(&moves, (const char *) &event, sizeof(event));
+	assert(moves.paired == 2 && moves.num_pending == WATCH_MAX_PENDING_MOVES - 1);
+	assert(moves.pending[5] == 1011);
+
+	close(fd);
+	char command[64];
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	assert(system(command) == 0);
 }
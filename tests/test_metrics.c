@@ -0,0 +1,221 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <hashtable.h>
+#include <linux-api.h>
+#include <metrics.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NUM_THREADS 4
+#define NUM_EVENTS 1000
+
+/* Helper functions for the test cases */
+/* Thread that records NUM_EVENTS events */
+void *record_thread(void *arg);
+/* Handler for traverse_fsh that does nothing */
+void ignore_entry(FTSENT *ftsent, void *handle_info);
+/* Read the whole file into buf, and return it */
+char *read_all(int fd, char *buf, size_t len);
+
+/* Test Cases */
+/* Test merging the metrics of several threads */
+void test_metrics_threads();
+/* Test the instrumented hot paths */
+void test_metrics_hot_paths();
+/* Test the dump file */
+void test_metrics_dump();
+/* Test the stats endpoint */
+void test_metrics_endpoint();
+
+/* Metrics Test suite */
+void test_metrics();
+
+char test_dir[] = "/tmp/goodrive_metrics_XXXXXX";
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_metrics();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_metrics() {
+	test_metrics_threads();
+	test_metrics_hot_paths();
+	test_metrics_dump();
+	test_metrics_endpoint();
+}
+
+void *record_thread(void *arg) {
+	for (int i = 1; i <= NUM_EVENTS; i++) {
+		metrics_add(METRIC_JWTS_SIGNED, 1);
+		metrics_record(METRIC_JWT_SIGN, i);
+	}
+	return NULL;
+}
+
+void ignore_entry(FTSENT *ftsent, void *handle_info) {
+}
+
+char *read_all(int fd, char *buf, size_t len) {
+	size_t total = 0;
+	ssize_t bytes;
+	while (total < len - 1 && (bytes = read(fd, buf + total, len - 1 - total)) > 0) {
+		total += bytes;
+	}
+	buf[total] = 0;
+	return buf;
+}
+
+void test_metrics_threads() {
+	struct metrics_snapshot before, after;
+	metrics_read(&before);
+
+	/* Two rounds, so that the second one reuses the blocks of the first */
+	for (int round = 0; round < 2; round++) {
+		pthread_t threads[NUM_THREADS];
+		for (int i = 0; i < NUM_THREADS; i++) {
+			assert(pthread_create(&threads[i], NULL, &record_thread, NULL) == 0);
+		}
+		for (int i = 0; i < NUM_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+		}
+	}
+
+	metrics_read(&after);
+	assert(after.counters[METRIC_JWTS_SIGNED] - before.counters[METRIC_JWTS_SIGNED]
+			== 2 * NUM_THREADS * NUM_EVENTS);
+	struct histogram *hist = &after.timers[METRIC_JWT_SIGN];
+	assert(hist->count - before.timers[METRIC_JWT_SIGN].count == 2 * NUM_THREADS * NUM_EVENTS);
+	assert(hist->min == 1);
+	assert(hist->max == NUM_EVENTS);
+	/* Within the 12.5% of the buckets */
+	uint64_t median = hist_percentile(hist, 50);
+	assert(median >= NUM_EVENTS / 2 && median <= NUM_EVENTS / 2 * 1.125);
+	assert(strcmp(metrics_counter_name(METRIC_JWTS_SIGNED), "jwts_signed") == 0);
+	assert(strcmp(metrics_timer_name(METRIC_JWT_SIGN), "jwt_sign_ns") == 0);
+}
+
+void test_metrics_hot_paths() {
+	struct metrics_snapshot before, after;
+	metrics_read(&before);
+
+	char path[64];
+	snprintf(path, sizeof(path), "%s/file", test_dir);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	for (int i = 0; i < 1000; i++) {
+		fputc(i & 0xff, file);
+	}
+	fclose(file);
+	unsigned char digest[16];
+	assert(md5sum_file_bytes(path, digest) == 0);
+
+	snprintf(path, sizeof(path), "%s/dir", test_dir);
+	assert(mkdir(path, 0755) == 0);
+	traverse_fsh(test_dir, &ignore_entry, NULL);
+
+	/* The default table grows past 12 entries */
+	ht_options options = default_ht_options();
+	hashtable table = ht_create(options);
+	free(options);
+	static char keys[32][8];
+	for (int i = 0; i < 32; i++) {
+		snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+		ht_put(table, keys[i], keys[i]);
+	}
+	ht_destroy(table);
+
+	metrics_read(&after);
+	assert(after.counters[METRIC_FILES_HASHED] - before.counters[METRIC_FILES_HASHED] == 1);
+	assert(after.counters[METRIC_BYTES_HASHED] - before.counters[METRIC_BYTES_HASHED] == 1000);
+	assert(after.timers[METRIC_FILE_HASH].count - before.timers[METRIC_FILE_HASH].count == 1);
+	assert(after.counters[METRIC_ENTRIES_SCANNED] - before.counters[METRIC_ENTRIES_SCANNED] == 2);
+	assert(after.timers[METRIC_DIR_LIST].count - before.timers[METRIC_DIR_LIST].count == 2);
+	assert(after.counters[METRIC_HT_RESIZES] - before.counters[METRIC_HT_RESIZES] >= 2);
+	assert(after.timers[METRIC_HT_RESIZE].count - before.timers[METRIC_HT_RESIZE].count >= 2);
+}
+
+void test_metrics_dump() {
+	char path[64];
+	snprintf(path, sizeof(path), "%s/metrics", test_dir);
+	assert(metrics_dump(path) == 0);
+	assert(metrics_dump(path) == 0);
+
+	char buf[4096];
+	FILE *file = fopen(path, "r");
+	assert(file != NULL);
+	size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+	buf[len] = 0;
+	fclose(file);
+	assert(strstr(buf, "files_hashed 1\n") != NULL);
+	assert(strstr(buf, "bytes_hashed 1000\n") != NULL);
+	assert(strstr(buf, "jwt_sign_ns count=8000 ") != NULL);
+
+	snprintf(path, sizeof(path), "%s/no/such/dir/metrics", test_dir);
+	assert(metrics_dump(path) == -1);
+}
+
+void test_metrics_endpoint() {
+	char path[64];
+	snprintf(path, sizeof(path), "%s/metrics.sock", test_dir);
+	int listen_fd = metrics_listen(path);
+	assert(listen_fd != -1);
+	/* Nothing pending */
+	metrics_serve(listen_fd);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	metrics_serve(listen_fd);
+
+	char buf[4096];
+	read_all(fd, buf, sizeof(buf));
+	close(fd);
+	assert(strncmp(buf, "entries_scanned ", strlen("entries_scanned ")) == 0);
+	assert(strstr(buf, "files_hashed 1\n") != NULL);
+	close(listen_fd);
+
+	/* A stale socket is replaced */
+	listen_fd = metrics_listen(path);
+	assert(listen_fd != -1);
+	close(listen_fd);
+}
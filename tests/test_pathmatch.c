@@ -0,0 +1,311 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <linux-api.h>
+#include <pathmatch.h>
+#include <snapshot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/* Helper functions for the test cases */
+/* Create an empty file */
+void touch(const char *dir, const char *name);
+/* Create a directory */
+void make_dir(const char *dir, const char *name);
+/* Handler for traverse_fsh_filtered that counts the entries, and checks that none is under node_modules */
+void count_entry(FTSENT *ftsent, void *handle_info);
+/* Create the file, at a path relative to dir, and check whether it gives an event on the inotify instance */
+int gives_event(int fd, const char *dir, const char *name);
+
+/* Test Cases */
+/* Test the rules without wildcards */
+void test_pathmatch_literals();
+/* Test the rules with wildcards */
+void test_pathmatch_globs();
+/* Test that the last matching rule decides */
+void test_pathmatch_negation();
+/* Test reading the rules from a file, and their digest */
+void test_pathmatch_load();
+/* Test that the traversals and watches skip the excluded directories */
+void test_pathmatch_traverse();
+
+/* Path Matcher Test suite */
+void test_pathmatch();
+
+char test_dir[] = "/tmp/goodrive_pathmatch_XXXXXX";
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_pathmatch();
+
+	char command[64];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_pathmatch() {
+	test_pathmatch_literals();
+	test_pathmatch_globs();
+	test_pathmatch_negation();
+	test_pathmatch_load();
+	test_pathmatch_traverse();
+}
+
+void touch(const char *dir, const char *name) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	fclose(file);
+}
+
+void make_dir(const char *dir, const char *name) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	assert(mkdir(path, 0755) == 0);
+}
+
+void count_entry(FTSENT *ftsent, void *handle_info) {
+	char *path = get_full_path(ftsent);
+	assert(strstr(path, "node_modules") == NULL);
+	assert(strstr(path, ".o") == NULL || strstr(path, "keep.o") != NULL);
+	free(path);
+	(*(int *) handle_info)++;
+}
+
+int gives_event(int fd, const char *dir, const char *name) {
+	char buf[4096];
+	/* Drop the events of the traversal itself */
+	while (read(fd, buf, sizeof(buf)) > 0);
+
+	touch(dir, name);
+	const char *base_name = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+	int found = 0;
+	ssize_t len;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (char *ptr = buf; ptr < buf + len;) {
+			struct inotify_event *event = (struct inotify_event *) ptr;
+			ptr += sizeof(struct inotify_event) + event->len;
+			found |= (event->len > 0 && strcmp(event->name, base_name) == 0);
+		}
+	}
+	return found;
+}
+
+void test_pathmatch_literals() {
+	path_matcher pm = pm_create();
+	assert(pm_excluded(pm, "anything", 0) == 0);
+	assert(pm_add_rule(pm, "build") == 0);
+	assert(pm_add_rule(pm, "node_modules/") == 0);
+	assert(pm_add_rule(pm, "/top") == 0);
+	assert(pm_add_rule(pm, "docs/private/") == 0);
+	assert(pm_num_rules(pm) == 4);
+
+	/* A name matches at any depth, as a file or a directory */
+	assert(pm_excluded(pm, "build", 0) == 1);
+	assert(pm_excluded(pm, "a/b/build", 1) == 1);
+	assert(pm_excluded(pm, "builder", 0) == 0);
+	assert(pm_excluded(pm, "build/x", 0) == 0);
+
+	/* A trailing '/' matches only directories */
+	assert(pm_excluded(pm, "node_modules", 1) == 1);
+	assert(pm_excluded(pm, "web/node_modules", 1) == 1);
+	assert(pm_excluded(pm, "web/node_modules", 0) == 0);
+
+	/* A '/' at the start or the middle matches from the root only */
+	assert(pm_excluded(pm, "top", 0) == 1);
+	assert(pm_excluded(pm, "a/top", 0) == 0);
+	assert(pm_excluded(pm, "docs/private", 1) == 1);
+	assert(pm_excluded(pm, "docs/private", 0) == 0);
+	assert(pm_excluded(pm, "x/docs/private", 1) == 0);
+	pm_destroy(pm);
+}
+
+void test_pathmatch_globs() {
+	path_matcher pm = pm_create();
+	assert(pm_add_rule(pm, "*.o") == 0);
+	assert(pm_add_rule(pm, "temp?") == 0);
+	assert(pm_add_rule(pm, "[abc]x") == 0);
+	assert(pm_add_rule(pm, "[!0-9]y") == 0);
+	assert(pm_add_rule(pm, "\\*star") == 0);
+	assert(pm_add_rule(pm, "**/logs/") == 0);
+	assert(pm_add_rule(pm, "src/**/gen") == 0);
+	assert(pm_add_rule(pm, "/cache/**") == 0);
+	assert(pm_add_rule(pm, "lib/*.a") == 0);
+
+	assert(pm_excluded(pm, "main.o", 0) == 1);
+	assert(pm_excluded(pm, "a/b/main.o", 0) == 1);
+	assert(pm_excluded(pm, ".o", 0) == 1);
+	assert(pm_excluded(pm, "main.oo", 0) == 0);
+	assert(pm_excluded(pm, "temp1", 0) == 1);
+	assert(pm_excluded(pm, "temp", 0) == 0);
+	assert(pm_excluded(pm, "temp12", 0) == 0);
+	assert(pm_excluded(pm, "bx", 0) == 1);
+	assert(pm_excluded(pm, "dx", 0) == 0);
+	assert(pm_excluded(pm, "zy", 0) == 1);
+	assert(pm_excluded(pm, "5y", 0) == 0);
+	assert(pm_excluded(pm, "*star", 0) == 1);
+	assert(pm_excluded(pm, "astar", 0) == 0);
+
+	assert(pm_excluded(pm, "logs", 1) == 1);
+	assert(pm_excluded(pm, "a/b/logs", 1) == 1);
+	assert(pm_excluded(pm, "a/b/logs", 0) == 0);
+	assert(pm_excluded(pm, "src/gen", 0) == 1);
+	assert(pm_excluded(pm, "src/a/b/gen", 1) == 1);
+	assert(pm_excluded(pm, "x/src/gen", 0) == 0);
+	assert(pm_excluded(pm, "cache", 1) == 0);
+	assert(pm_excluded(pm, "cache/x", 0) == 1);
+	assert(pm_excluded(pm, "cache/x/y", 0) == 1);
+	assert(pm_excluded(pm, "lib/libz.a", 0) == 1);
+	assert(pm_excluded(pm, "lib/x/libz.a", 0) == 0);
+	assert(pm_excluded(pm, "a/lib/libz.a", 0) == 0);
+	pm_destroy(pm);
+}
+
+void test_pathmatch_negation() {
+	path_matcher pm = pm_create();
+	assert(pm_add_rule(pm, "*.log") == 0);
+	assert(pm_add_rule(pm, "!keep.log") == 0);
+	assert(pm_add_rule(pm, "!important.tmp") == 0);
+	assert(pm_add_rule(pm, "*.tmp") == 0);
+	assert(pm_add_rule(pm, "\\!bang") == 0);
+
+	assert(pm_excluded(pm, "debug.log", 0) == 1);
+	assert(pm_excluded(pm, "keep.log", 0) == 0);
+	assert(pm_excluded(pm, "a/keep.log", 0) == 0);
+	/* A later rule with wildcards overrides an earlier one without */
+	assert(pm_excluded(pm, "important.tmp", 0) == 1);
+	assert(pm_excluded(pm, "!bang", 0) == 1);
+	assert(pm_excluded(pm, "bang", 0) == 0);
+
+	/* A lone '!' or '/' is not a rule */
+	assert(pm_add_rule(pm, "!") == -1);
+	assert(pm_add_rule(pm, "/") == -1);
+	assert(pm_add_rule(pm, "# comment") == 0);
+	assert(pm_add_rule(pm, "   ") == 0);
+	assert(pm_num_rules(pm) == 5);
+	pm_destroy(pm);
+}
+
+void test_pathmatch_load() {
+	char rules_path[64];
+	snprintf(rules_path, sizeof(rules_path), "%s/rules", test_dir);
+	path_matcher pm = pm_create();
+	assert(pm_load(pm, rules_path) == -1);
+
+	FILE *file = fopen(rules_path, "w");
+	assert(file != NULL);
+	fputs("# Build outputs\n\n*.o  \nout/\r\n!keep.o\n", file);
+	fclose(file);
+	assert(pm_load(pm, rules_path) == 0);
+	assert(pm_num_rules(pm) == 3);
+	assert(pm_excluded(pm, "x.o", 0) == 1);
+	assert(pm_excluded(pm, "keep.o", 0) == 0);
+	assert(pm_excluded(pm, "out", 1) == 1);
+	assert(pm_excluded(pm, "out", 0) == 0);
+
+	/* The digest follows the rules */
+	unsigned char digest[16], other[16], zero[16];
+	memset(zero, 0, sizeof(zero));
+	path_matcher empty = pm_create();
+	pm_digest(empty, digest);
+	assert(memcmp(digest, zero, sizeof(zero)) == 0);
+	pm_digest(NULL, digest);
+	assert(memcmp(digest, zero, sizeof(zero)) == 0);
+	pm_destroy(empty);
+
+	path_matcher same = pm_create();
+	assert(pm_add_rule(same, "*.o") == 0);
+	assert(pm_add_rule(same, "out/") == 0);
+	assert(pm_add_rule(same, "!keep.o") == 0);
+	pm_digest(pm, digest);
+	pm_digest(same, other);
+	assert(memcmp(digest, zero, sizeof(zero)) != 0);
+	assert(memcmp(digest, other, sizeof(other)) == 0);
+	assert(pm_add_rule(same, "extra") == 0);
+	pm_digest(same, other);
+	assert(memcmp(digest, other, sizeof(other)) != 0);
+	pm_destroy(same);
+	pm_destroy(pm);
+	unlink(rules_path);
+}
+
+void test_pathmatch_traverse() {
+	make_dir(test_dir, "node_modules");
+	make_dir(test_dir, "node_modules/pkg");
+	touch(test_dir, "node_modules/pkg/index.js");
+	make_dir(test_dir, "src");
+	make_dir(test_dir, "src/node_modules");
+	touch(test_dir, "src/node_modules/dep.js");
+	touch(test_dir, "src/main.c");
+	touch(test_dir, "src/main.o");
+	touch(test_dir, "src/keep.o");
+
+	path_matcher pm = pm_create();
+	assert(pm_add_rule(pm, "node_modules/") == 0);
+	assert(pm_add_rule(pm, "*.o") == 0);
+	assert(pm_add_rule(pm, "!keep.o") == 0);
+
+	/* src, src/main.c and src/keep.o */
+	int num_entries = 0;
+	traverse_fsh_filtered(test_dir, pm, &count_entry, &num_entries);
+	assert(num_entries == 3);
+
+	/* A trailing '/' in the root path gives the same relative paths */
+	char root_slash[64];
+	snprintf(root_slash, sizeof(root_slash), "%s/", test_dir);
+	num_entries = 0;
+	traverse_fsh_filtered(root_slash, pm, &count_entry, &num_entries);
+	assert(num_entries == 3);
+
+	snapshot snap = snap_scan_filtered(test_dir, 0, pm);
+	assert(snap != NULL);
+	pathstore paths = snap_paths(snap);
+	path_id src = ps_lookup_child(paths, PATH_ID_ROOT, "src", 3);
+	assert(src != PATH_ID_NONE);
+	assert(ps_lookup_child(paths, PATH_ID_ROOT, "node_modules", 12) == PATH_ID_NONE);
+	assert(ps_lookup_child(paths, src, "node_modules", 12) == PATH_ID_NONE);
+	assert(ps_lookup_child(paths, src, "main.o", 6) == PATH_ID_NONE);
+	assert(ps_lookup_child(paths, src, "keep.o", 6) != PATH_ID_NONE);
+	snap_destroy(snap);
+
+	/* Excluded directories are not watched */
+	char *md5sum;
+	int fd = watch_md5sum_fsh_filtered(inotify_init1(IN_NONBLOCK), &md5sum, test_dir, pm);
+	assert(fd != -1);
+	free(md5sum);
+	assert(gives_event(fd, test_dir, "src/new.c"));
+	assert(!gives_event(fd, test_dir, "node_modules/pkg/new.js"));
+	assert(!gives_event(fd, test_dir, "src/node_modules/new.js"));
+	close(fd);
+	pm_destroy(pm);
+}
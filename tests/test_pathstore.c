@@ -0,0 +1,223 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pathstore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Helper functions for the test cases */
+/* Count the visited entries */
+void count_visit(pathstore ps, path_id id, void *count);
+
+/* Test Cases */
+/* Test interning and looking up the children */
+void test_pathstore_intern();
+/* Test building the full paths */
+void test_pathstore_build_path();
+/* Test building the full path into a small buffer */
+void test_pathstore_build_path_truncated();
+/* Test the path store growth */
+void test_pathstore_growth();
+/* Test the subtree walk */
+void test_pathstore_walk_subtree();
+/* Test moving a directory */
+void test_pathstore_move();
+/* Test removing a directory */
+void test_pathstore_remove();
+
+/* Path Store Test suite */
+void test_pathstore();
+
+int main() {
+	test_pathstore();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_pathstore() {
+	test_pathstore_intern();
+	test_pathstore_build_path();
+	test_pathstore_build_path_truncated();
+	test_pathstore_growth();
+	test_pathstore_walk_subtree();
+	test_pathstore_move();
+	test_pathstore_remove();
+}
+
+void test_pathstore_intern() {
+	pathstore ps = ps_create("/home/foo");
+	assert(ps_num_entries(ps) == 1);
+
+	path_id docs = ps_intern(ps, PATH_ID_ROOT, "docs", 4);
+	path_id music = ps_intern(ps, PATH_ID_ROOT, "music", 5);
+	assert(docs != PATH_ID_NONE && music != PATH_ID_NONE && docs != music);
+	assert(ps_intern(ps, PATH_ID_ROOT, "docs", 4) == docs);
+	assert(ps_lookup_child(ps, PATH_ID_ROOT, "docs", 4) == docs);
+	assert(ps_lookup_child(ps, PATH_ID_ROOT, "doc", 3) == PATH_ID_NONE);
+	assert(ps_lookup_child(ps, docs, "docs", 4) == PATH_ID_NONE);
+	assert(ps_num_entries(ps) == 3);
+
+	path_id file = ps_intern_path(ps, PATH_ID_ROOT, "docs/2018//report.txt");
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "docs/2018/report.txt") == file);
+	assert(ps_parent(ps, ps_parent(ps, file)) == docs);
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "docs/2017/report.txt") == PATH_ID_NONE);
+
+	size_t name_len;
+	assert(strcmp(ps_name(ps, file, &name_len), "report.txt") == 0);
+	assert(name_len == 10);
+
+	assert(ps_first_child(ps, PATH_ID_ROOT) == docs);
+	assert(ps_next_sibling(ps, docs) == music);
+	assert(ps_next_sibling(ps, music) == PATH_ID_NONE);
+	ps_destroy(ps);
+}
+
+void test_pathstore_build_path() {
+	pathstore ps = ps_create("/home/foo");
+	path_id file = ps_intern_path(ps, PATH_ID_ROOT, "docs/report.txt");
+	assert(strcmp(ps_path(ps, file), "/home/foo/docs/report.txt") == 0);
+	assert(strcmp(ps_path(ps, PATH_ID_ROOT), "/home/foo") == 0);
+
+	char *full_path = ps_full_path(ps, file);
+	assert(strcmp(full_path, "/home/foo/docs/report.txt") == 0);
+	free(full_path);
+	ps_destroy(ps);
+
+	/* Root ending with a '/' should not get another separator */
+	ps = ps_create("/");
+	file = ps_intern_path(ps, PATH_ID_ROOT, "etc/fstab");
+	assert(strcmp(ps_path(ps, file), "/etc/fstab") == 0);
+	ps_destroy(ps);
+
+	/* Empty root builds relative paths */
+	ps = ps_create(NULL);
+	file = ps_intern_path(ps, PATH_ID_ROOT, "etc/fstab");
+	assert(strcmp(ps_path(ps, file), "etc/fstab") == 0);
+	ps_destroy(ps);
+}
+
+void test_pathstore_build_path_truncated() {
+	pathstore ps = ps_create("/home/foo");
+	path_id file = ps_intern_path(ps, PATH_ID_ROOT, "docs/report.txt");
+
+	char buf[12];
+	size_t path_len = ps_build_path(ps, file, buf, sizeof(buf));
+	assert(path_len == strlen("/home/foo/docs/report.txt"));
+	assert(strcmp(buf, "/home/foo/d") == 0);
+	assert(ps_build_path(ps, file, NULL, 0) == path_len);
+	ps_destroy(ps);
+}
+
+void test_pathstore_growth() {
+	pathstore ps = ps_create("/data");
+	char name[32];
+	path_id dirs[100];
+	for (int i = 0; i < 100; i++) {
+		sprintf(name, "dir%d", i);
+		dirs[i] = ps_intern(ps, PATH_ID_ROOT, name, strlen(name));
+		for (int j = 0; j < 100; j++) {
+			sprintf(name, "file%d", j);
+			ps_intern(ps, dirs[i], name, strlen(name));
+		}
+	}
+	assert(ps_num_entries(ps) == 1 + 100 + 100 * 100);
+
+	for (int i = 0; i < 100; i++) {
+		sprintf(name, "dir%d", i);
+		assert(ps_lookup_child(ps, PATH_ID_ROOT, name, strlen(name)) == dirs[i]);
+	}
+	path_id file = ps_lookup_path(ps, PATH_ID_ROOT, "dir42/file99");
+	assert(strcmp(ps_path(ps, file), "/data/dir42/file99") == 0);
+	ps_destroy(ps);
+}
+
+void count_visit(pathstore ps, path_id id, void *count) {
+	(*(int *) count)++;
+}
+
+void test_pathstore_walk_subtree() {
+	pathstore ps = ps_create("/data");
+	ps_intern_path(ps, PATH_ID_ROOT, "a/b/c");
+	ps_intern_path(ps, PATH_ID_ROOT, "a/b/d");
+	ps_intern_path(ps, PATH_ID_ROOT, "a/e");
+	ps_intern_path(ps, PATH_ID_ROOT, "f/g");
+
+	int count = 0;
+	ps_walk_subtree(ps, PATH_ID_ROOT, &count_visit, &count);
+	assert(count == 8);
+
+	count = 0;
+	ps_walk_subtree(ps, ps_lookup_path(ps, PATH_ID_ROOT, "a"), &count_visit, &count);
+	assert(count == 5);
+
+	count = 0;
+	ps_walk_subtree(ps, ps_lookup_path(ps, PATH_ID_ROOT, "a/e"), &count_visit, &count);
+	assert(count == 1);
+	ps_destroy(ps);
+}
+
+void test_pathstore_move() {
+	pathstore ps = ps_create("/data");
+	path_id dir = ps_intern_path(ps, PATH_ID_ROOT, "a/b");
+	path_id file = ps_intern_path(ps, PATH_ID_ROOT, "a/b/c/file.txt");
+	path_id other = ps_intern_path(ps, PATH_ID_ROOT, "x");
+
+	assert(ps_move(ps, dir, other, "renamed", 7) == 0);
+	assert(strcmp(ps_path(ps, file), "/data/x/renamed/c/file.txt") == 0);
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "x/renamed/c/file.txt") == file);
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "a/b") == PATH_ID_NONE);
+	assert(ps_first_child(ps, ps_lookup_path(ps, PATH_ID_ROOT, "a")) == PATH_ID_NONE);
+
+	/* Cannot move a directory into itself, or over an existing entry */
+	assert(ps_move(ps, dir, file, "loop", 4) == -1);
+	ps_intern_path(ps, PATH_ID_ROOT, "x/taken");
+	assert(ps_move(ps, dir, other, "taken", 5) == -1);
+	assert(ps_move(ps, PATH_ID_ROOT, other, "root", 4) == -1);
+	ps_destroy(ps);
+}
+
+void test_pathstore_remove() {
+	pathstore ps = ps_create("/data");
+	ps_intern_path(ps, PATH_ID_ROOT, "a/b/c");
+	ps_intern_path(ps, PATH_ID_ROOT, "a/b/d");
+	path_id keep = ps_intern_path(ps, PATH_ID_ROOT, "a/e");
+	path_id dir = ps_lookup_path(ps, PATH_ID_ROOT, "a/b");
+	assert(ps_num_entries(ps) == 6);
+
+	ps_remove(ps, dir);
+	assert(ps_num_entries(ps) == 3);
+	assert(!ps_is_valid(ps, dir));
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "a/b/c") == PATH_ID_NONE);
+	assert(ps_lookup_path(ps, PATH_ID_ROOT, "a/e") == keep);
+	assert(ps_first_child(ps, ps_lookup_path(ps, PATH_ID_ROOT, "a")) == keep);
+
+	/* Removed ids are reused */
+	path_id reused = ps_intern_path(ps, PATH_ID_ROOT, "a/z");
+	assert(reused <= 6);
+	assert(strcmp(ps_path(ps, reused), "/data/a/z") == 0);
+	ps_destroy(ps);
+}
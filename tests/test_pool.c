@@ -0,0 +1,396 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <snapshot.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NUM_TASKS 10000
+/* Depth of the fork-join tree, for 2^depth leaves */
+#define TREE_DEPTH 10
+#define NUM_SLOW_TASKS 100
+#define NUM_STOLEN_TASKS 64
+
+/*
+ * A node of the fork-join tree
+ */
+struct tree_node {
+	pool pool;
+	int depth;
+	unsigned long *leaves;
+};
+
+/*
+ * Tasks of a cancelled group that ran, and that were dropped
+ */
+struct cancel_counts {
+	unsigned long ran;
+	unsigned long discarded;
+};
+
+/*
+ * The subtasks spawned by a single task, and the threads that ran them
+ */
+struct spawn_info {
+	pool_group group;
+	unsigned long ran;
+	pthread_t threads[NUM_STOLEN_TASKS];
+};
+
+/* Helper functions for the test cases */
+/* Task that counts itself */
+void count_task(void *arg);
+/* Task that sleeps for a millisecond, and counts itself as run */
+void slow_task(void *arg);
+/* Discard callback that counts the task as dropped */
+void count_discarded(void *arg);
+/* Task that runs its two children in a group of its own, and waits for them */
+void tree_task(void *arg);
+/* Task that spawns NUM_STOLEN_TASKS subtasks on its own deque, and waits for them */
+void spawn_task(void *arg);
+/* Subtask of spawn_task, which records the thread it ran on */
+void record_thread_task(void *arg);
+/* Task that checks that its worker runs on a single CPU */
+void check_pinned_task(void *arg);
+/* Create a file with size bytes of varying contents */
+void write_file(const char *dir, const char *name, size_t size);
+
+/* Test Cases */
+/* Test tasks on both lanes, submitted from outside the pool */
+void test_pool_lanes();
+/* Test tasks that wait for the tasks they submit */
+void test_pool_nested();
+/* Test cancelling a group, with tasks queued */
+void test_pool_cancel();
+/* Test that idle workers steal the tasks of a busy one */
+void test_pool_steal();
+/* Test pinning the compute workers */
+void test_pool_pinning();
+/* Test hashing the contents of a snapshot on the pool */
+void test_pool_hash_contents();
+
+/* Pool Test suite */
+void test_pool();
+
+char test_dir[] = "/tmp/goodrive_pool_XXXXXX";
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_pool();
+
+	char command[64];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_pool() {
+	test_pool_lanes();
+	test_pool_nested();
+	test_pool_cancel();
+	test_pool_steal();
+	test_pool_pinning();
+	test_pool_hash_contents();
+}
+
+void count_task(void *arg) {
+	__atomic_fetch_add((unsigned long *) arg, 1, __ATOMIC_RELAXED);
+}
+
+void slow_task(void *arg) {
+	struct cancel_counts *counts = arg;
+	usleep(1000);
+	count_task(&counts->ran);
+}
+
+void count_discarded(void *arg) {
+	struct cancel_counts *counts = arg;
+	count_task(&counts->discarded);
+}
+
+void tree_task(void *arg) {
+	struct tree_node *node = arg;
+	if (node->depth == 0) {
+		count_task(node->leaves);
+		return;
+	}
+
+	struct tree_node children[2];
+	pool_group group = pool_group_create(node->pool);
+	for (int i = 0; i < 2; i++) {
+		children[i] = *node;
+		children[i].depth--;
+		assert(pool_submit(group, POOL_COMPUTE, &tree_task, NULL, &children[i]) == 0);
+	}
+	assert(pool_group_wait(group) == 0);
+	pool_group_destroy(group);
+}
+
+void spawn_task(void *arg) {
+	struct spawn_info *info = arg;
+	for (int i = 0; i < NUM_STOLEN_TASKS; i++) {
+		assert(pool_submit(info->group, POOL_COMPUTE, &record_thread_task, NULL, info) == 0);
+	}
+	assert(pool_group_wait(info->group) == 0);
+}
+
+void record_thread_task(void *arg) {
+	struct spawn_info *info = arg;
+	usleep(1000);
+	unsigned long slot = __atomic_fetch_add(&info->ran, 1, __ATOMIC_RELAXED);
+	info->threads[slot] = pthread_self();
+}
+
+void check_pinned_task(void *arg) {
+	cpu_set_t cpus;
+	assert(pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0);
+	if (CPU_COUNT(&cpus) == 1) {
+		count_task(arg);
+	}
+}
+
+void write_file(const char *dir, const char *name, size_t size) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	for (size_t i = 0; i < size; i++) {
+		fputc((i * 7 + i / 251) & 0xff, file);
+	}
+	fclose(file);
+}
+
+void test_pool_lanes() {
+	struct pool_options options;
+	pool_default_options(&options);
+	options.compute_workers = 2;
+	options.io_workers = 3;
+	pool pool = pool_create(&options);
+	assert(pool != NULL);
+	assert(pool_num_workers(pool, POOL_COMPUTE) == 2);
+	assert(pool_num_workers(pool, POOL_IO) == 3);
+
+	unsigned long count = 0;
+	pool_group group = pool_group_create(pool);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		assert(pool_submit(group, i % 2 ? POOL_IO : POOL_COMPUTE, &count_task, NULL, &count) == 0);
+	}
+	assert(pool_group_wait(group) == 0);
+	assert(count == NUM_TASKS);
+
+	/* The group can be reused after the wait */
+	assert(pool_submit(group, POOL_IO, &count_task, NULL, &count) == 0);
+	pool_group_destroy(group);
+	assert(count == NUM_TASKS + 1);
+
+	/* Tasks still queued are run before the workers stop */
+	group = pool_group_create(pool);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		assert(pool_submit(group, POOL_COMPUTE, &count_task, NULL, &count) == 0);
+	}
+	pool_destroy(pool);
+	assert(count == 2 * NUM_TASKS + 1);
+	pool_group_destroy(group);
+
+	/* The defaults */
+	pool = pool_create(NULL);
+	assert(pool != NULL);
+	assert(pool_num_workers(pool, POOL_COMPUTE) >= 1);
+	assert(pool_num_workers(pool, POOL_IO) == POOL_DEFAULT_IO_WORKERS);
+	pool_destroy(pool);
+}
+
+void test_pool_nested() {
+	struct pool_options options;
+	pool_default_options(&options);
+	options.compute_workers = 2;
+	pool pool = pool_create(&options);
+
+	/* Every worker ends up waiting for a group, so only the helping keeps it going */
+	unsigned long leaves = 0;
+	struct tree_node root = { pool, TREE_DEPTH, &leaves };
+	pool_group group = pool_group_create(pool);
+	assert(pool_submit(group, POOL_COMPUTE, &tree_task, NULL, &root) == 0);
+	assert(pool_group_wait(group) == 0);
+	assert(leaves == (1UL << TREE_DEPTH));
+	pool_group_destroy(group);
+	pool_destroy(pool);
+}
+
+void test_pool_cancel() {
+	struct pool_options options;
+	pool_default_options(&options);
+	options.compute_workers = 1;
+	pool pool = pool_create(&options);
+
+	struct cancel_counts counts = { 0, 0 };
+	pool_group group = pool_group_create(pool);
+	for (int i = 0; i < NUM_SLOW_TASKS; i++) {
+		assert(pool_submit(group, POOL_COMPUTE, &slow_task, &count_discarded, &counts) == 0);
+	}
+	usleep(10000);
+	pool_group_cancel(group);
+	assert(pool_group_cancelled(group));
+	assert(pool_group_wait(group) == -1);
+
+	/* Each task either ran, or was dropped */
+	assert(counts.ran + counts.discarded == NUM_SLOW_TASKS);
+	assert(counts.discarded > 0);
+
+	/* Nothing more is queued */
+	unsigned long count = 0;
+	assert(pool_submit(group, POOL_COMPUTE, &count_task, NULL, &count) == -1);
+	assert(pool_group_wait(group) == -1);
+	assert(count == 0);
+	pool_group_destroy(group);
+
+	/* Other groups go on */
+	group = pool_group_create(pool);
+	assert(pool_submit(group, POOL_COMPUTE, &count_task, NULL, &count) == 0);
+	assert(pool_group_wait(group) == 0);
+	assert(count == 1);
+	pool_group_destroy(group);
+	pool_destroy(pool);
+}
+
+void test_pool_steal() {
+	struct pool_options options;
+	pool_default_options(&options);
+	options.compute_workers = 4;
+	pool pool = pool_create(&options);
+
+	/* All the subtasks go to the deque of the worker running spawn_task */
+	struct spawn_info info;
+	memset(&info, 0, sizeof(info));
+	info.group = pool_group_create(pool);
+	pool_group group = pool_group_create(pool);
+	assert(pool_submit(group, POOL_COMPUTE, &spawn_task, NULL, &info) == 0);
+	assert(pool_group_wait(group) == 0);
+	assert(info.ran == NUM_STOLEN_TASKS);
+
+	int other_threads = 0;
+	for (int i = 1; i < NUM_STOLEN_TASKS; i++) {
+		other_threads |= !pthread_equal(info.threads[i], info.threads[0]);
+	}
+	assert(other_threads);
+	pool_group_destroy(group);
+	pool_group_destroy(info.group);
+	pool_destroy(pool);
+}
+
+void test_pool_pinning() {
+	struct pool_options options;
+	pool_default_options(&options);
+	options.compute_workers = 2;
+	options.pin_compute = 1;
+	pool pool = pool_create(&options);
+	assert(pool != NULL);
+
+	unsigned long pinned = 0;
+	pool_group group = pool_group_create(pool);
+	for (int i = 0; i < 16; i++) {
+		assert(pool_submit(group, POOL_COMPUTE, &check_pinned_task, NULL, &pinned) == 0);
+	}
+	assert(pool_group_wait(group) == 0);
+	assert(pinned == 16);
+	pool_group_destroy(group);
+	pool_destroy(pool);
+}
+
+void test_pool_hash_contents() {
+	const char *names[] = { "empty", "small", "chunks", "sub/nested" };
+	/* The third spans a few read chunks */
+	size_t sizes[] = { 0, 100, 600 * 1024 + 3, 5000 };
+	char sub_dir[64];
+	snprintf(sub_dir, sizeof(sub_dir), "%s/sub", test_dir);
+	assert(mkdir(sub_dir, 0755) == 0);
+	for (int i = 0; i < 4; i++) {
+		write_file(test_dir, names[i], sizes[i]);
+	}
+
+	snapshot expected = snap_scan(test_dir, 1);
+	pool pool = pool_create(NULL);
+	pool_group group = pool_group_create(pool);
+	snapshot snap = snap_scan(test_dir, 0);
+	assert(snap_hash_contents(snap, group) == 0);
+	for (int i = 0; i < 4; i++) {
+		char rel_path[64];
+		snprintf(rel_path, sizeof(rel_path), "/%s", names[i]);
+		struct snap_entry *expected_entry = snap_get(expected,
+				ps_lookup_path(snap_paths(expected), PATH_ID_ROOT, rel_path));
+		struct snap_entry *entry = snap_get(snap, ps_lookup_path(snap_paths(snap), PATH_ID_ROOT, rel_path));
+		assert(expected_entry != NULL && entry != NULL);
+		assert(expected_entry->flags & SNAP_HAS_DIGEST);
+		assert(entry->flags & SNAP_HAS_DIGEST);
+		assert(memcmp(entry->digest, expected_entry->digest, 16) == 0);
+	}
+	/* Directories have no digest */
+	assert(!(snap_get(snap, ps_lookup_path(snap_paths(snap), PATH_ID_ROOT, "/sub"))->flags & SNAP_HAS_DIGEST));
+	pool_group_destroy(group);
+
+	/* Only the files that changed are hashed again */
+	write_file(test_dir, "small", 200);
+	snapshot rescanned = snap_scan(test_dir, 0);
+	snap_copy_digests(snap, rescanned);
+	struct snap_entry *small = snap_get(rescanned, ps_lookup_path(snap_paths(rescanned), PATH_ID_ROOT, "/small"));
+	struct snap_entry *nested = snap_get(rescanned,
+			ps_lookup_path(snap_paths(rescanned), PATH_ID_ROOT, "/sub/nested"));
+	assert(!(small->flags & SNAP_HAS_DIGEST));
+	assert(nested->flags & SNAP_HAS_DIGEST);
+	/* A digest that is there already is kept */
+	unsigned char zeros[16] = { 0 };
+	memset(nested->digest, 0, sizeof(nested->digest));
+	group = pool_group_create(pool);
+	assert(snap_hash_contents(rescanned, group) == 0);
+	pool_group_destroy(group);
+	assert(small->flags & SNAP_HAS_DIGEST);
+	assert(memcmp(nested->digest, zeros, sizeof(zeros)) == 0);
+	snap_destroy(rescanned);
+	snap_destroy(snap);
+
+	/* A cancelled group hashes nothing */
+	group = pool_group_create(pool);
+	pool_group_cancel(group);
+	snap = snap_scan(test_dir, 0);
+	assert(snap_hash_contents(snap, group) == -1);
+	for (int i = 0; i < 4; i++) {
+		char rel_path[64];
+		snprintf(rel_path, sizeof(rel_path), "/%s", names[i]);
+		assert(!(snap_get(snap, ps_lookup_path(snap_paths(snap), PATH_ID_ROOT, rel_path))->flags & SNAP_HAS_DIGEST));
+	}
+	snap_destroy(snap);
+	pool_group_destroy(group);
+
+	pool_destroy(pool);
+	snap_destroy(expected);
+}
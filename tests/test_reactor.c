@@ -0,0 +1,233 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <reactor.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_POSTS 100
+
+/*
+ * State shared by the handlers of a test case
+ */
+struct test_state {
+	reactor loop;
+	int pipe_fds[2];
+	int reads;
+	int timer_fires;
+	int posts;
+	pthread_t loop_thread;
+	pthread_t poster;
+};
+
+/* Helper functions for the test cases */
+/* Handler that reads a byte from the pipe, and stops the loop */
+void read_pipe(void *arg, uint32_t events);
+/* Handler that counts the timer expirations, and stops the loop at the third */
+void count_timer(void *arg, uint32_t events);
+/* Handler that stops the loop */
+void stop_loop(void *arg, uint32_t events);
+/* Handler that removes the pipe, which has an event pending too */
+void remove_pipe(void *arg, uint32_t events);
+/* Posted callback that counts, and checks that it runs on the loop thread */
+void count_post(void *arg);
+/* Thread that posts the callbacks, and then stops the loop */
+void *post_thread(void *arg);
+/* Milliseconds since the time */
+long elapsed_ms(struct timespec *since);
+
+/* Test Cases */
+/* Test the File Descriptor events */
+void test_reactor_fd();
+/* Test the periodic and the debounce timers */
+void test_reactor_timers();
+/* Test the callbacks posted by other threads */
+void test_reactor_post();
+/* Test removing a source with a pending event */
+void test_reactor_remove();
+
+/* Reactor Test suite */
+void test_reactor();
+
+int main() {
+	test_reactor();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_reactor() {
+	test_reactor_fd();
+	test_reactor_timers();
+	test_reactor_post();
+	test_reactor_remove();
+}
+
+void read_pipe(void *arg, uint32_t events) {
+	struct test_state *state = arg;
+	assert(events & EPOLLIN);
+	char byte;
+	assert(read(state->pipe_fds[0], &byte, 1) == 1);
+	state->reads++;
+	reactor_stop(state->loop);
+}
+
+void count_timer(void *arg, uint32_t events) {
+	struct test_state *state = arg;
+	if (++state->timer_fires == 3) {
+		reactor_stop(state->loop);
+	}
+}
+
+void stop_loop(void *arg, uint32_t events) {
+	struct test_state *state = arg;
+	state->timer_fires++;
+	reactor_stop(state->loop);
+}
+
+void remove_pipe(void *arg, uint32_t events) {
+	struct test_state *state = arg;
+	assert(reactor_remove(state->loop, state->pipe_fds[0]) == 0);
+	reactor_stop(state->loop);
+}
+
+void count_post(void *arg) {
+	struct test_state *state = arg;
+	assert(pthread_equal(pthread_self(), state->loop_thread));
+	state->posts++;
+}
+
+void *post_thread(void *arg) {
+	struct test_state *state = arg;
+	for (int i = 0; i < NUM_POSTS; i++) {
+		assert(reactor_post(state->loop, &count_post, state) == 0);
+	}
+	reactor_stop(state->loop);
+	return NULL;
+}
+
+long elapsed_ms(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+void test_reactor_fd() {
+	struct test_state state;
+	memset(&state, 0, sizeof(state));
+	state.loop = reactor_create();
+	assert(state.loop != NULL);
+	assert(pipe(state.pipe_fds) == 0);
+	assert(reactor_add(state.loop, state.pipe_fds[0], EPOLLIN, &read_pipe, &state) == 0);
+	assert(reactor_add(state.loop, state.pipe_fds[0], EPOLLIN, &read_pipe, &state) == -1);
+
+	for (int i = 1; i <= 3; i++) {
+		assert(write(state.pipe_fds[1], "x", 1) == 1);
+		assert(reactor_run(state.loop) == 0);
+		assert(state.reads == i);
+	}
+	assert(reactor_remove(state.loop, state.pipe_fds[0]) == 0);
+	assert(reactor_remove(state.loop, state.pipe_fds[0]) == -1);
+	reactor_destroy(state.loop);
+	close(state.pipe_fds[0]);
+	close(state.pipe_fds[1]);
+}
+
+void test_reactor_timers() {
+	struct test_state state;
+	memset(&state, 0, sizeof(state));
+	state.loop = reactor_create();
+
+	/* Periodic */
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int timer = reactor_add_timer(state.loop, &count_timer, &state);
+	assert(timer != -1);
+	assert(reactor_arm_timer(state.loop, timer, 10, 20) == 0);
+	assert(reactor_run(state.loop) == 0);
+	assert(state.timer_fires == 3);
+	assert(elapsed_ms(&start) >= 50);
+	reactor_remove_timer(state.loop, timer);
+
+	/* Rearmed before it expires, it fires once, after the last arming */
+	state.timer_fires = 0;
+	timer = reactor_add_timer(state.loop, &stop_loop, &state);
+	for (int i = 0; i < 5; i++) {
+		assert(reactor_arm_timer(state.loop, timer, 50, 0) == 0);
+		usleep(10000);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(reactor_run(state.loop) == 0);
+	assert(state.timer_fires == 1);
+	assert(elapsed_ms(&start) >= 5);
+
+	/* Disarmed, the loop only stops for the posted stop */
+	assert(reactor_arm_timer(state.loop, timer, 10, 0) == 0);
+	assert(reactor_arm_timer(state.loop, timer, 0, 0) == 0);
+	usleep(20000);
+	reactor_stop(state.loop);
+	assert(reactor_run(state.loop) == 0);
+	assert(state.timer_fires == 1);
+	reactor_destroy(state.loop);
+}
+
+void test_reactor_post() {
+	struct test_state state;
+	memset(&state, 0, sizeof(state));
+	state.loop = reactor_create();
+	state.loop_thread = pthread_self();
+	assert(pthread_create(&state.poster, NULL, &post_thread, &state) == 0);
+	/* The callbacks posted before the stop run before the loop returns */
+	assert(reactor_run(state.loop) == 0);
+	pthread_join(state.poster, NULL);
+	assert(state.posts == NUM_POSTS);
+	reactor_destroy(state.loop);
+}
+
+void test_reactor_remove() {
+	struct test_state state;
+	memset(&state, 0, sizeof(state));
+	state.loop = reactor_create();
+	assert(pipe(state.pipe_fds) == 0);
+	int other_fds[2];
+	assert(pipe(other_fds) == 0);
+
+	/* Both are ready: whichever runs first removes the pipe, whose handler must not run */
+	assert(reactor_add(state.loop, other_fds[0], EPOLLIN, &remove_pipe, &state) == 0);
+	assert(reactor_add(state.loop, state.pipe_fds[0], EPOLLIN, &read_pipe, &state) == 0);
+	assert(write(other_fds[1], "x", 1) == 1);
+	assert(write(state.pipe_fds[1], "x", 1) == 1);
+	assert(reactor_run(state.loop) == 0);
+	assert(state.reads <= 1);
+	reactor_destroy(state.loop);
+	close(state.pipe_fds[0]);
+	close(state.pipe_fds[1]);
+	close(other_fds[0]);
+	close(other_fds[1]);
+}
@@ -0,0 +1,332 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <reactor.h>
+#include <ring.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+/* Items handed over by each producer in the threaded cases */
+#define NUM_ITEMS 200000
+#define NUM_PRODUCERS 4
+/* Small rings, so that the producers often find them full */
+#define RING_CAPACITY 64
+#define BATCH_SIZE 16
+
+/*
+ * State shared by the producers and the consumer of a test case
+ */
+struct test_state {
+	spsc_ring spsc;
+	mpsc_ring mpsc;
+	reactor loop;
+	/* Next item expected from each producer */
+	uint64_t expected[NUM_PRODUCERS];
+	uint64_t received;
+};
+
+/*
+ * A producer thread, and the state it shares
+ */
+struct producer {
+	struct test_state *state;
+	uint64_t id;
+};
+
+/* Helper functions for the test cases */
+/* Item carrying the producer and its sequence number */
+void *make_item(uint64_t id, uint64_t seq);
+/* Check that an item is the next one of its producer */
+void check_item(struct test_state *state, void *item);
+/* Push the items of the producer to the SPSC ring, in batches of varying sizes */
+void *spsc_producer(void *arg);
+/* Push the items of the producer to the MPSC ring, single and in batches */
+void *mpsc_producer(void *arg);
+/* Reactor handler that drains the MPSC ring, and stops the loop after all the items */
+void drain_mpsc(void *arg, uint32_t events);
+
+/* Test Cases */
+/* Test the order, the capacity and the empty ring */
+void test_ring_order();
+/* Test the batches, across the wrap around of the indices */
+void test_ring_batch();
+/* Test closing the rings */
+void test_ring_close();
+/* Test the handoff from a producer thread to a waiting consumer */
+void test_ring_spsc_threads();
+/* Test the handoff from many producer threads to a waiting consumer */
+void test_ring_mpsc_threads();
+/* Test a consumer in a reactor, woken through the eventfd */
+void test_ring_reactor();
+
+/* Ring Test suite */
+void test_ring();
+
+int main() {
+	test_ring();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_ring() {
+	test_ring_order();
+	test_ring_batch();
+	test_ring_close();
+	test_ring_spsc_threads();
+	test_ring_mpsc_threads();
+	test_ring_reactor();
+}
+
+void *make_item(uint64_t id, uint64_t seq) {
+	return (void *) (uintptr_t) ((id << 32) | seq);
+}
+
+void check_item(struct test_state *state, void *item) {
+	uint64_t value = (uintptr_t) item;
+	uint64_t id = value >> 32;
+	assert(id < NUM_PRODUCERS);
+	assert((value & 0xffffffff) == state->expected[id]);
+	state->expected[id]++;
+	state->received++;
+}
+
+void *spsc_producer(void *arg) {
+	struct producer *producer = arg;
+	void *items[BATCH_SIZE];
+	uint64_t seq = 0;
+	while (seq < NUM_ITEMS) {
+		unsigned int count = 1 + seq % BATCH_SIZE;
+		if (count > NUM_ITEMS - seq) {
+			count = NUM_ITEMS - seq;
+		}
+		for (unsigned int i = 0; i < count; i++) {
+			items[i] = make_item(producer->id, seq + i);
+		}
+		unsigned int pushed = spsc_push_batch(producer->state->spsc, items, count);
+		if (pushed == 0) {
+			sched_yield();
+		}
+		seq += pushed;
+	}
+	return NULL;
+}
+
+void *mpsc_producer(void *arg) {
+	struct producer *producer = arg;
+	void *items[BATCH_SIZE];
+	uint64_t seq = 0;
+	while (seq < NUM_ITEMS) {
+		unsigned int pushed;
+		if (seq % 2 == 0) {
+			pushed = (mpsc_push(producer->state->mpsc, make_item(producer->id, seq)) == 0);
+		} else {
+			unsigned int count = (NUM_ITEMS - seq < BATCH_SIZE) ? NUM_ITEMS - seq : BATCH_SIZE;
+			for (unsigned int i = 0; i < count; i++) {
+				items[i] = make_item(producer->id, seq + i);
+			}
+			pushed = mpsc_push_batch(producer->state->mpsc, items, count);
+		}
+		if (pushed == 0) {
+			sched_yield();
+		}
+		seq += pushed;
+	}
+	return NULL;
+}
+
+void drain_mpsc(void *arg, uint32_t events) {
+	struct test_state *state = arg;
+	uint64_t count;
+	assert(read(mpsc_fd(state->mpsc), &count, sizeof(count)) == sizeof(count));
+	void *items[BATCH_SIZE];
+	do {
+		unsigned int n;
+		while ((n = mpsc_pop_batch(state->mpsc, items, BATCH_SIZE)) > 0) {
+			for (unsigned int i = 0; i < n; i++) {
+				check_item(state, items[i]);
+			}
+		}
+	} while (mpsc_arm(state->mpsc) != 0);
+	if (state->received == NUM_PRODUCERS * NUM_ITEMS) {
+		reactor_stop(state->loop);
+	}
+}
+
+void test_ring_order() {
+	/* Rounded up to 8 */
+	spsc_ring spsc = spsc_create(5);
+	mpsc_ring mpsc = mpsc_create(5);
+	void *item;
+	assert(spsc_pop(spsc, &item) == -1);
+	assert(mpsc_pop(mpsc, &item) == -1);
+	for (uint64_t i = 0; i < 8; i++) {
+		assert(spsc_push(spsc, make_item(0, i)) == 0);
+		assert(mpsc_push(mpsc, make_item(0, i)) == 0);
+	}
+	assert(spsc_push(spsc, make_item(0, 8)) == -1);
+	assert(mpsc_push(mpsc, make_item(0, 8)) == -1);
+	for (uint64_t i = 0; i < 8; i++) {
+		assert(spsc_pop(spsc, &item) == 0);
+		assert(item == make_item(0, i));
+		assert(mpsc_pop(mpsc, &item) == 0);
+		assert(item == make_item(0, i));
+	}
+	assert(spsc_pop(spsc, &item) == -1);
+	assert(mpsc_pop(mpsc, &item) == -1);
+	spsc_destroy(spsc);
+	mpsc_destroy(mpsc);
+}
+
+void test_ring_batch() {
+	spsc_ring spsc = spsc_create(16);
+	mpsc_ring mpsc = mpsc_create(16);
+	void *items[16];
+	void *popped[16];
+	uint64_t next_push = 0, next_pop = 0;
+	/* Enough rounds for the indices to wrap around the ring many times */
+	for (int round = 0; round < 1000; round++) {
+		unsigned int count = 1 + round % 16;
+		for (unsigned int i = 0; i < count; i++) {
+			items[i] = make_item(0, next_push + i);
+		}
+		unsigned int pushed = spsc_push_batch(spsc, items, count);
+		assert(mpsc_push_batch(mpsc, items, count) == pushed);
+		/* Only what fits in the ring is taken */
+		assert(pushed == count || next_push + pushed - next_pop == 16);
+		next_push += pushed;
+
+		unsigned int max = 1 + (round * 7) % 16;
+		unsigned int n = spsc_pop_batch(spsc, popped, max);
+		assert(n == ((next_push - next_pop < max) ? next_push - next_pop : max));
+		for (unsigned int i = 0; i < n; i++) {
+			assert(popped[i] == make_item(0, next_pop + i));
+		}
+		assert(mpsc_pop_batch(mpsc, popped, max) == n);
+		for (unsigned int i = 0; i < n; i++) {
+			assert(popped[i] == make_item(0, next_pop + i));
+		}
+		next_pop += n;
+	}
+	assert(next_pop > 16 * 100);
+	spsc_destroy(spsc);
+	mpsc_destroy(mpsc);
+}
+
+void test_ring_close() {
+	spsc_ring spsc = spsc_create(4);
+	mpsc_ring mpsc = mpsc_create(4);
+	assert(spsc_push(spsc, make_item(0, 1)) == 0);
+	assert(mpsc_push(mpsc, make_item(0, 1)) == 0);
+	spsc_close(spsc);
+	mpsc_close(mpsc);
+	assert(spsc_push(spsc, make_item(0, 2)) == -1);
+	assert(mpsc_push(mpsc, make_item(0, 2)) == -1);
+
+	/* The items before the close are drained */
+	void *item;
+	assert(spsc_wait(spsc) == 0);
+	assert(spsc_pop(spsc, &item) == 0 && item == make_item(0, 1));
+	assert(spsc_wait(spsc) == -1);
+	assert(mpsc_wait(mpsc) == 0);
+	assert(mpsc_pop(mpsc, &item) == 0 && item == make_item(0, 1));
+	assert(mpsc_wait(mpsc) == -1);
+	spsc_destroy(spsc);
+	mpsc_destroy(mpsc);
+}
+
+void test_ring_spsc_threads() {
+	struct test_state state = { 0 };
+	state.spsc = spsc_create(RING_CAPACITY);
+	struct producer producer = { &state, 0 };
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, &spsc_producer, &producer) == 0);
+
+	void *items[BATCH_SIZE];
+	while (state.received < NUM_ITEMS) {
+		assert(spsc_wait(state.spsc) == 0);
+		unsigned int n = spsc_pop_batch(state.spsc, items, BATCH_SIZE);
+		assert(n > 0);
+		for (unsigned int i = 0; i < n; i++) {
+			check_item(&state, items[i]);
+		}
+	}
+	pthread_join(thread, NULL);
+	spsc_close(state.spsc);
+	assert(spsc_wait(state.spsc) == -1);
+	spsc_destroy(state.spsc);
+}
+
+void test_ring_mpsc_threads() {
+	struct test_state state = { 0 };
+	state.mpsc = mpsc_create(RING_CAPACITY);
+	struct producer producers[NUM_PRODUCERS];
+	pthread_t threads[NUM_PRODUCERS];
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		producers[i].state = &state;
+		producers[i].id = i;
+		assert(pthread_create(&threads[i], NULL, &mpsc_producer, &producers[i]) == 0);
+	}
+
+	void *item;
+	while (state.received < NUM_PRODUCERS * NUM_ITEMS) {
+		assert(mpsc_wait(state.mpsc) == 0);
+		assert(mpsc_pop(state.mpsc, &item) == 0);
+		check_item(&state, item);
+	}
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert(state.expected[i] == NUM_ITEMS);
+	}
+	mpsc_close(state.mpsc);
+	assert(mpsc_wait(state.mpsc) == -1);
+	mpsc_destroy(state.mpsc);
+}
+
+void test_ring_reactor() {
+	struct test_state state = { 0 };
+	state.mpsc = mpsc_create(RING_CAPACITY);
+	state.loop = reactor_create();
+	assert(reactor_add(state.loop, mpsc_fd(state.mpsc), EPOLLIN, &drain_mpsc, &state) == 0);
+	assert(mpsc_arm(state.mpsc) == 0);
+
+	struct producer producers[NUM_PRODUCERS];
+	pthread_t threads[NUM_PRODUCERS];
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		producers[i].state = &state;
+		producers[i].id = i;
+		assert(pthread_create(&threads[i], NULL, &mpsc_producer, &producers[i]) == 0);
+	}
+	assert(reactor_run(state.loop) == 0);
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		assert(state.expected[i] == NUM_ITEMS);
+	}
+	reactor_destroy(state.loop);
+	mpsc_destroy(state.mpsc);
+}
@@ -0,0 +1,262 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <ratelimit.h>
+#include <scheduler.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_TASKS 10
+
+/*
+ * Order in which the tasks ran
+ */
+struct run_log {
+	pthread_mutex_t lock;
+	int order[2 * NUM_TASKS];
+	int num_runs;
+};
+
+/* Helper functions for the test cases */
+/* Task that logs its number */
+void log_task(void *arg);
+/* Task that waits till the gate opens */
+void gate_task(void *arg);
+/* Seconds since the time */
+double elapsed_sec(struct timespec *since);
+
+/* Test Cases */
+/* Test the classification of files */
+void test_sched_classify();
+/* Test that urgent work jumps ahead of bulk work */
+void test_sched_priority();
+/* Test that the tenants of a class take turns */
+void test_sched_tenants();
+/* Test the limit on the tasks of a class */
+void test_sched_rate_limit();
+/* Test the bandwidth limit */
+void test_sched_throttle();
+/* Test the token bucket */
+void test_token_bucket();
+
+/* Scheduler Test suite */
+void test_scheduler();
+
+struct run_log run_log = { PTHREAD_MUTEX_INITIALIZER, { 0 }, 0 };
+pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+int gate_open;
+
+int main() {
+	test_scheduler();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_scheduler() {
+	test_token_bucket();
+	test_sched_classify();
+	test_sched_priority();
+	test_sched_tenants();
+	test_sched_rate_limit();
+	test_sched_throttle();
+}
+
+void log_task(void *arg) {
+	pthread_mutex_lock(&run_log.lock);
+	run_log.order[run_log.num_runs++] = (int) (long) arg;
+	pthread_mutex_unlock(&run_log.lock);
+}
+
+void gate_task(void *arg) {
+	pthread_mutex_lock(&gate_lock);
+	while (!gate_open) {
+		pthread_cond_wait(&gate_cond, &gate_lock);
+	}
+	pthread_mutex_unlock(&gate_lock);
+}
+
+double elapsed_sec(struct timespec *since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+void test_token_bucket() {
+	struct token_bucket bucket;
+	tb_init(&bucket, 0, 0);
+	assert(tb_take(&bucket, 1e12) == 0);
+
+	tb_init(&bucket, 100, 10);
+	assert(tb_delay(&bucket, 10) == 0);
+	assert(tb_take(&bucket, 10) == 0);
+	/* Empty: a token takes 10 ms */
+	double delay = tb_delay(&bucket, 1);
+	assert(delay > 0.005 && delay <= 0.01);
+	/* In debt by 100 tokens: a second */
+	delay = tb_take(&bucket, 100);
+	assert(delay > 0.9 && delay <= 1);
+}
+
+void test_sched_classify() {
+	scheduler sched = sched_create(1, NULL);
+	assert(sched != NULL);
+	time_t now = time(NULL);
+	assert(sched_classify(sched, 100LL << 30, now, 1) == SCHED_PINNED);
+	assert(sched_classify(sched, 2048, now, 0) == SCHED_INTERACTIVE);
+	assert(sched_classify(sched, 2048, now - 3600, 0) == SCHED_NORMAL);
+	assert(sched_classify(sched, 10 << 20, now, 0) == SCHED_NORMAL);
+	assert(sched_classify(sched, 20LL << 30, now, 0) == SCHED_BULK);
+	sched_destroy(sched);
+}
+
+void test_sched_priority() {
+	scheduler sched = sched_create(1, NULL);
+	run_log.num_runs = 0;
+	gate_open = 0;
+
+	/* Keep the only worker busy, while the work piles up */
+	sched_submit(sched, SCHED_NORMAL, &gate_task, NULL);
+	for (long i = 0; i < NUM_TASKS; i++) {
+		sched_submit(sched, SCHED_BULK, &log_task, (void *) (100 + i));
+	}
+	for (long i = 0; i < NUM_TASKS; i++) {
+		sched_submit(sched, SCHED_INTERACTIVE, &log_task, (void *) i);
+	}
+	pthread_mutex_lock(&gate_lock);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+	sched_wait_idle(sched);
+
+	/* The interactive tasks ran first, each class in the order submitted */
+	assert(run_log.num_runs == 2 * NUM_TASKS);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		assert(run_log.order[i] == i);
+		assert(run_log.order[NUM_TASKS + i] == 100 + i);
+	}
+
+	struct sched_class_stats stats;
+	sched_get_stats(sched, SCHED_BULK, &stats);
+	assert(stats.submitted == NUM_TASKS);
+	assert(stats.completed == NUM_TASKS);
+	assert(stats.pending == 0);
+	assert(stats.latency_p50 <= stats.latency_p90);
+	assert(stats.latency_p90 <= stats.latency_p99);
+	assert(stats.latency_p99 <= stats.latency_max);
+	sched_get_stats(sched, SCHED_PINNED, &stats);
+	assert(stats.completed == 0);
+	sched_destroy(sched);
+}
+
+void test_sched_tenants() {
+	scheduler sched = sched_create(1, NULL);
+	run_log.num_runs = 0;
+	gate_open = 0;
+
+	/* Tenant 1 queues all its work before tenant 2 and 3 queue theirs */
+	sched_submit(sched, SCHED_NORMAL, &gate_task, NULL);
+	for (long i = 0; i < NUM_TASKS - 4; i++) {
+		sched_submit_tenant(sched, SCHED_NORMAL, 1, &log_task, (void *) (100 + i));
+	}
+	for (long i = 0; i < 2; i++) {
+		sched_submit_tenant(sched, SCHED_NORMAL, 2, &log_task, (void *) (200 + i));
+		sched_submit_tenant(sched, SCHED_NORMAL, 3, &log_task, (void *) (300 + i));
+	}
+	pthread_mutex_lock(&gate_lock);
+	gate_open = 1;
+	pthread_cond_broadcast(&gate_cond);
+	pthread_mutex_unlock(&gate_lock);
+	sched_wait_idle(sched);
+
+	/* Round robin while they all have work, then the rest of tenant 1's */
+	int expected[NUM_TASKS] = { 100, 200, 300, 101, 201, 301, 102, 103, 104, 105 };
+	assert(run_log.num_runs == NUM_TASKS);
+	for (int i = 0; i < NUM_TASKS; i++) {
+		assert(run_log.order[i] == expected[i]);
+	}
+
+	struct sched_class_stats stats;
+	sched_get_stats(sched, SCHED_NORMAL, &stats);
+	assert(stats.completed == NUM_TASKS + 1);
+	assert(stats.pending == 0);
+	sched_destroy(sched);
+}
+
+void test_sched_rate_limit() {
+	struct sched_policy policy;
+	sched_default_policy(&policy);
+	policy.class_rate[SCHED_INTERACTIVE] = 50;
+	policy.class_burst[SCHED_INTERACTIVE] = 1;
+	scheduler sched = sched_create(2, &policy);
+	run_log.num_runs = 0;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i = 0; i < NUM_TASKS; i++) {
+		sched_submit(sched, SCHED_INTERACTIVE, &log_task, (void *) i);
+	}
+	for (long i = 0; i < NUM_TASKS; i++) {
+		sched_submit(sched, SCHED_BULK, &log_task, (void *) (100 + i));
+	}
+	sched_wait_idle(sched);
+	/* A task every 20 ms, after the first */
+	assert(elapsed_sec(&start) >= 0.15);
+
+	/* The bulk work did not wait for the limited class */
+	int last_bulk = 0;
+	for (int i = 0; i < run_log.num_runs; i++) {
+		if (run_log.order[i] >= 100) {
+			last_bulk = i;
+		}
+	}
+	assert(last_bulk < 2 * NUM_TASKS - 1);
+	sched_destroy(sched);
+}
+
+void test_sched_throttle() {
+	struct sched_policy policy;
+	sched_default_policy(&policy);
+	policy.class_bandwidth[SCHED_BULK] = 1024 * 1024;
+	scheduler sched = sched_create(1, &policy);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	/* The first second's worth goes through at once */
+	sched_throttle(sched, SCHED_BULK, 1024 * 1024);
+	assert(elapsed_sec(&start) < 0.1);
+	for (int i = 0; i < 4; i++) {
+		sched_throttle(sched, SCHED_BULK, 64 * 1024);
+	}
+	assert(elapsed_sec(&start) >= 0.2);
+	/* Other classes are not limited */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sched_throttle(sched, SCHED_INTERACTIVE, 1LL << 30);
+	assert(elapsed_sec(&start) < 0.1);
+	sched_destroy(sched);
+}
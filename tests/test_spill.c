@@ -0,0 +1,230 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <metrics.h>
+#include <snapshot.h>
+#include <spill.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Entries of the snapshot in the test, enough for its arrays to be spilled */
+#define NUM_ENTRIES 20000
+
+/* Helper functions for the test cases */
+/* Get the bytes in spill files */
+uint64_t spilled_bytes();
+/* Fill the array with bytes that depend on their offsets */
+void fill(unsigned char *array, size_t size);
+/* Check the bytes written by fill */
+void check_filled(unsigned char *array, size_t size);
+
+/* Test Cases */
+/* Test parsing the sizes */
+void test_spill_parse();
+/* Test that the arrays stay on the heap without a budget */
+void test_spill_unbounded();
+/* Test moving arrays between the heap and spill files */
+void test_spill_bounded();
+/* Test a snapshot built, saved and loaded with its arrays spilled */
+void test_spill_snapshot();
+
+/* Spill Test suite */
+void test_spill();
+
+char test_dir[] = "/tmp/goodrive_spill_XXXXXX";
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+
+	test_spill();
+
+	char command[64];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_spill() {
+	test_spill_parse();
+	test_spill_unbounded();
+	test_spill_bounded();
+	test_spill_snapshot();
+}
+
+uint64_t spilled_bytes() {
+	struct metrics_snapshot metrics;
+	metrics_read(&metrics);
+	return metrics.gauges[METRIC_SPILLED_BYTES];
+}
+
+void fill(unsigned char *array, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		array[i] = (i * 31 + i / 4093) & 0xff;
+	}
+}
+
+void check_filled(unsigned char *array, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		assert(array[i] == ((i * 31 + i / 4093) & 0xff));
+	}
+}
+
+void test_spill_parse() {
+	assert(spill_parse_size("4096") == 4096);
+	assert(spill_parse_size("3k") == 3 * 1024);
+	assert(spill_parse_size("512M") == 512UL << 20);
+	assert(spill_parse_size("2G") == 2UL << 30);
+	assert(spill_parse_size(NULL) == 0);
+	assert(spill_parse_size("") == 0);
+	assert(spill_parse_size("M") == 0);
+	assert(spill_parse_size("12X") == 0);
+	assert(spill_parse_size("1MB") == 0);
+	assert(spill_parse_size("-1") == 0);
+	assert(spill_parse_size("99999999999999999999") == 0);
+	assert(spill_parse_size("17179869184G") == 0);
+}
+
+void test_spill_unbounded() {
+	assert(spill_budget() == 0);
+	/* Without a directory for the files, the mode cannot be turned on */
+	assert(spill_configure(1 << 20, "/nonexistent/goodrive") == -1);
+	assert(spill_budget() == 0);
+
+	unsigned char *array = spill_calloc(4, SPILL_MIN_SIZE);
+	assert(array != NULL && !spill_is_mapped(array));
+	assert(array[0] == 0 && array[4 * SPILL_MIN_SIZE - 1] == 0);
+	fill(array, 4 * SPILL_MIN_SIZE);
+	array = spill_realloc(array, 8 * SPILL_MIN_SIZE);
+	assert(!spill_is_mapped(array));
+	check_filled(array, 4 * SPILL_MIN_SIZE);
+	spill_free(array);
+	spill_free(NULL);
+
+	/* Overflows */
+	assert(spill_calloc(SIZE_MAX / 2, 4) == NULL);
+}
+
+void test_spill_bounded() {
+	assert(spill_configure(64 << 20, test_dir) == 0);
+	assert(spill_budget() == 64 << 20);
+	uint64_t spilled = spilled_bytes();
+
+	/* Small arrays stay on the heap */
+	unsigned char *array = spill_realloc(NULL, 1000);
+	assert(array != NULL && !spill_is_mapped(array));
+	fill(array, 1000);
+
+	/* Growing past the threshold moves it to a file, with its contents */
+	array = spill_realloc(array, 2 * SPILL_MIN_SIZE);
+	assert(spill_is_mapped(array));
+	check_filled(array, 1000);
+	assert(spilled_bytes() >= spilled + 2 * SPILL_MIN_SIZE);
+
+	/* Growing within the file */
+	fill(array, 2 * SPILL_MIN_SIZE);
+	array = spill_realloc(array, 16 * SPILL_MIN_SIZE);
+	assert(spill_is_mapped(array));
+	check_filled(array, 2 * SPILL_MIN_SIZE);
+	assert(spilled_bytes() >= spilled + 16 * SPILL_MIN_SIZE);
+
+	/* Shrinking below the threshold moves it back */
+	array = spill_realloc(array, 5000);
+	assert(!spill_is_mapped(array));
+	check_filled(array, 5000);
+	assert(spilled_bytes() == spilled);
+	spill_free(array);
+
+	/* A new big array is zeroed */
+	array = spill_calloc(SPILL_MIN_SIZE, 3);
+	assert(spill_is_mapped(array));
+	for (size_t i = 0; i < 3 * SPILL_MIN_SIZE; i += 4096) {
+		assert(array[i] == 0);
+	}
+	spill_free(array);
+	assert(spilled_bytes() == spilled);
+
+	/* Arrays from the bounded mode can still be resized after it ends */
+	array = spill_calloc(1, 2 * SPILL_MIN_SIZE);
+	fill(array, 2 * SPILL_MIN_SIZE);
+	assert(spill_configure(0, NULL) == 0);
+	array = spill_realloc(array, 3 * SPILL_MIN_SIZE);
+	assert(!spill_is_mapped(array));
+	check_filled(array, 2 * SPILL_MIN_SIZE);
+	spill_free(array);
+	assert(spilled_bytes() == spilled);
+}
+
+void test_spill_snapshot() {
+	assert(spill_configure(64 << 20, test_dir) == 0);
+	uint64_t spilled = spilled_bytes();
+
+	snapshot snap = snap_create("/root");
+	path_id dir = PATH_ID_ROOT;
+	struct stat file_stat;
+	memset(&file_stat, 0, sizeof(file_stat));
+	for (int i = 0; i < NUM_ENTRIES; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "entry%d", i);
+		file_stat.st_ino = i + 1;
+		file_stat.st_size = i;
+		file_stat.st_mode = (i % 100 == 0) ? S_IFDIR | 0755 : S_IFREG | 0644;
+		path_id id = snap_add(snap, dir, name, strlen(name), &file_stat, NULL);
+		assert(id != PATH_ID_NONE);
+		if (i % 100 == 0) {
+			dir = id;
+		}
+	}
+	assert(spilled_bytes() > spilled);
+	assert(snap_memory_usage(snap) > NUM_ENTRIES * sizeof(struct snap_entry));
+
+	char path[64];
+	snprintf(path, sizeof(path), "%s/tree.snap", test_dir);
+	assert(snap_save(snap, path) == 0);
+	snapshot loaded = snap_load(path);
+	assert(loaded != NULL);
+	pathstore ps = snap_paths(snap);
+	pathstore loaded_ps = snap_paths(loaded);
+	assert(ps_num_entries(loaded_ps) == ps_num_entries(ps));
+	for (path_id id = 1; id < ps_id_limit(ps); id++) {
+		path_id loaded_id = ps_lookup_path(loaded_ps, PATH_ID_ROOT, ps_path(ps, id) + strlen("/root"));
+		assert(loaded_id != PATH_ID_NONE);
+		assert(memcmp(snap_get(loaded, loaded_id), snap_get(snap, id), sizeof(struct snap_entry)) == 0);
+	}
+	snap_destroy(loaded);
+
+	/* A truncated file is not loaded */
+	assert(truncate(path, 1000) == 0);
+	assert(snap_load(path) == NULL);
+	assert(truncate(path, 10) == 0);
+	assert(snap_load(path) == NULL);
+
+	snap_destroy(snap);
+	assert(spilled_bytes() == spilled);
+	assert(spill_configure(0, NULL) == 0);
+}
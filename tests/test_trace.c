@@ -0,0 +1,189 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+#include <unistd.h>
+
+/* Threads recording at the same time */
+#define NUM_THREADS 4
+/* Spans recorded by each of them */
+#define SPANS_PER_THREAD 1000
+
+/* Helper functions for the test cases */
+/* Count the spans collected so far */
+size_t count_spans();
+/* Record the number of spans in arg, all of them file hashes */
+void *record_spans(void *arg);
+/* Count the occurrences of the needle in the string */
+size_t count_matches(const char *haystack, const char *needle);
+
+/* Test Cases */
+/* Test that nothing is recorded while the tracing is off */
+void test_trace_disabled();
+/* Test the recorded spans and their order */
+void test_trace_spans();
+/* Test recording from many threads at once */
+void test_trace_threads();
+/* Test that a full ring keeps the latest spans */
+void test_trace_ring();
+/* Test the Chrome trace dump */
+void test_trace_dump();
+
+/* Trace Test suite */
+void test_trace();
+
+int main() {
+	test_trace();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_trace() {
+	test_trace_disabled();
+	test_trace_spans();
+	test_trace_threads();
+	test_trace_ring();
+	test_trace_dump();
+}
+
+size_t count_spans() {
+	struct trace_event *events;
+	size_t num_events = trace_collect(&events);
+	free(events);
+	return num_events;
+}
+
+void *record_spans(void *arg) {
+	size_t num_spans = (size_t) arg;
+	for (size_t i = 0; i < num_spans; i++) {
+		uint64_t span = trace_begin();
+		assert(span != 0);
+		trace_end(TRACE_FILE_HASH, span);
+	}
+	return NULL;
+}
+
+size_t count_matches(const char *haystack, const char *needle) {
+	size_t count = 0;
+	for (const char *match = strstr(haystack, needle); match != NULL; match = strstr(match + 1, needle)) {
+		count++;
+	}
+	return count;
+}
+
+void test_trace_disabled() {
+	uint64_t span = trace_begin();
+	assert(span == 0);
+	trace_end(TRACE_SYNC, span);
+	assert(count_spans() == 0);
+}
+
+void test_trace_spans() {
+	trace_enable(1);
+	uint64_t outer = trace_begin();
+	uint64_t inner = trace_begin();
+	usleep(1000);
+	trace_end(TRACE_DIR_LIST, inner);
+	trace_end(TRACE_SCAN, outer);
+	trace_enable(0);
+	trace_end(TRACE_SYNC, trace_begin());
+
+	struct trace_event *events;
+	assert(trace_collect(&events) == 2);
+	/* Ordered by the start, so the outer span comes first */
+	assert(events[0].span == TRACE_SCAN);
+	assert(events[1].span == TRACE_DIR_LIST);
+	assert(events[0].start <= events[1].start);
+	assert(events[1].end <= events[0].end);
+	assert(events[1].end - events[1].start >= 1000000);
+	assert(events[0].tid == events[1].tid);
+	assert(strcmp(trace_span_name(events[1].span), "dir_list") == 0);
+	free(events);
+}
+
+void test_trace_threads() {
+	size_t before = count_spans();
+	trace_enable(1);
+	pthread_t threads[NUM_THREADS];
+	for (int i = 0; i < NUM_THREADS; i++) {
+		assert(pthread_create(&threads[i], NULL, &record_spans, (void *) (size_t) SPANS_PER_THREAD) == 0);
+	}
+	for (int i = 0; i < NUM_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	trace_enable(0);
+	assert(count_spans() == before + NUM_THREADS * SPANS_PER_THREAD);
+}
+
+void test_trace_ring() {
+	struct trace_event *events;
+	size_t before = trace_collect(&events);
+	uint64_t last_start = (before > 0) ? events[before - 1].start : 0;
+	free(events);
+
+	/* A new thread takes the buffer of a thread that exited, so recording beyond it overwrites */
+	trace_enable(1);
+	pthread_t thread;
+	assert(pthread_create(&thread, NULL, &record_spans, (void *) (size_t) (TRACE_RING_SIZE + 100)) == 0);
+	pthread_join(thread, NULL);
+	trace_enable(0);
+
+	size_t num_events = trace_collect(&events);
+	size_t num_new = 0;
+	for (size_t i = 0; i < num_events; i++) {
+		num_new += (events[i].start > last_start);
+	}
+	assert(num_new == TRACE_RING_SIZE);
+	/* The spans of the buffer's previous owner were overwritten */
+	assert(num_events - num_new < before);
+	free(events);
+}
+
+void test_trace_dump() {
+	char path[] = "/tmp/goodrive_trace_XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd != -1);
+	close(fd);
+	assert(trace_dump(path) == 0);
+
+	FILE *file = fopen(path, "r");
+	assert(file != NULL);
+	char *text = NULL;
+	size_t len = 0;
+	assert(getdelim(&text, &len, '\0', file) > 0);
+	fclose(file);
+	unlink(path);
+
+	assert(strncmp(text, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 39) == 0);
+	assert(count_matches(text, "\"ph\":\"X\"") == count_spans());
+	assert(count_matches(text, "\"name\":\"dir_list\"") == 1);
+	assert(strstr(text, "\n]}\n") != NULL);
+	free(text);
+}
@@ -0,0 +1,384 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <treediff.h>
+#include <unistd.h>
+
+/* Changes reported by tdiff_compare, as "<op> <old path> <new path>" lines */
+struct recorded_changes {
+	char text[4096];
+	int count;
+};
+
+/* Helper functions for the test cases */
+/* Add an entry to the snapshot */
+path_id add_entry(snapshot snap, const char *path, mode_t type, ino_t ino, off_t size, time_t mtime);
+/* Record a change */
+void record_change(struct tdiff_change *change, void *handle_info);
+/* Compare the snapshots, and return the recorded changes */
+struct recorded_changes *diff(snapshot old_snap, snapshot new_snap);
+/* Write a file with the given contents */
+void write_file(const char *dir, const char *name, const char *contents);
+
+/* Test Cases */
+/* Test identical snapshots */
+void test_treediff_no_changes();
+/* Test created, modified and deleted files */
+void test_treediff_create_modify_delete();
+/* Test renaming a directory */
+void test_treediff_move_dir();
+/* Test renaming a file, onto a name that is being freed */
+void test_treediff_rename_chain();
+/* Test renaming a file, detected by the content digest */
+void test_treediff_move_by_digest();
+/* Test replacing a file with a directory of the same name */
+void test_treediff_type_change();
+/* Test renaming a file, then reusing its name for a directory */
+void test_treediff_rename_reuse_name();
+/* Test renaming a directory, then recreating its name */
+void test_treediff_move_dir_recreate();
+/* Test scanning, saving and loading the snapshots */
+void test_treediff_scan_save_load();
+
+/* Tree Diff Test suite */
+void test_treediff();
+
+int main() {
+	test_treediff();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_treediff() {
+	test_treediff_no_changes();
+	test_treediff_create_modify_delete();
+	test_treediff_move_dir();
+	test_treediff_rename_chain();
+	test_treediff_move_by_digest();
+	test_treediff_type_change();
+	test_treediff_rename_reuse_name();
+	test_treediff_move_dir_recreate();
+	test_treediff_scan_save_load();
+}
+
+path_id add_entry(snapshot snap, const char *path, mode_t type, ino_t ino, off_t size, time_t mtime) {
+	struct stat file_stat;
+	memset(&file_stat, 0, sizeof(file_stat));
+	file_stat.st_mode = type | 0644;
+	file_stat.st_ino = ino;
+	file_stat.st_size = size;
+	file_stat.st_mtim.tv_sec = mtime;
+
+	pathstore ps = snap_paths(snap);
+	const char *name = strrchr(path, '/');
+	path_id parent = PATH_ID_ROOT;
+	if (name != NULL) {
+		char *parent_path = strndup(path, name - path);
+		parent = ps_lookup_path(ps, PATH_ID_ROOT, parent_path);
+		free(parent_path);
+		name++;
+	} else {
+		name = path;
+	}
+	return snap_add(snap, parent, name, strlen(name), &file_stat, NULL);
+}
+
+void record_change(struct tdiff_change *change, void *handle_info) {
+	static const char *op_names[] = { "create", "modify", "move", "delete" };
+	struct recorded_changes *changes = handle_info;
+	size_t len = strlen(changes->text);
+	snprintf(changes->text + len, sizeof(changes->text) - len, "%s %s %s\n", op_names[change->op],
+			change->old_path ? change->old_path : "-", change->new_path ? change->new_path : "-");
+	changes->count++;
+}
+
+struct recorded_changes *diff(snapshot old_snap, snapshot new_snap) {
+	struct recorded_changes *changes = calloc(1, sizeof(struct recorded_changes));
+	long num_changes = tdiff_compare(old_snap, new_snap, &record_change, changes);
+	assert(num_changes == changes->count);
+	return changes;
+}
+
+void test_treediff_no_changes() {
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "a", S_IFDIR, 2, 0, 1);
+	add_entry(old_snap, "a/f", S_IFREG, 3, 10, 1);
+	add_entry(new_snap, "a", S_IFDIR, 2, 0, 5);
+	add_entry(new_snap, "a/f", S_IFREG, 3, 10, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(changes->count == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_create_modify_delete() {
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "a", S_IFDIR, 2, 0, 1);
+	add_entry(old_snap, "a/f", S_IFREG, 3, 10, 1);
+	add_entry(old_snap, "a/g", S_IFREG, 4, 10, 1);
+	add_entry(old_snap, "old", S_IFDIR, 5, 0, 1);
+	add_entry(old_snap, "old/x", S_IFREG, 6, 10, 1);
+
+	add_entry(new_snap, "a", S_IFDIR, 2, 0, 1);
+	add_entry(new_snap, "a/f", S_IFREG, 3, 12, 2);
+	add_entry(new_snap, "new", S_IFDIR, 7, 0, 1);
+	add_entry(new_snap, "new/y", S_IFREG, 8, 10, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"modify /r/a/f /r/a/f\n"
+			"create - /r/new\n"
+			"create - /r/new/y\n"
+			"delete /r/a/g -\n"
+			"delete /r/old -\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_move_dir() {
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "photos", S_IFDIR, 2, 0, 1);
+	add_entry(old_snap, "photos/2017", S_IFDIR, 3, 0, 1);
+	add_entry(old_snap, "photos/2017/a.jpg", S_IFREG, 4, 100, 1);
+	add_entry(old_snap, "photos/2017/b.jpg", S_IFREG, 5, 100, 1);
+
+	add_entry(new_snap, "archive", S_IFDIR, 6, 0, 1);
+	add_entry(new_snap, "archive/2017-photos", S_IFDIR, 3, 0, 1);
+	add_entry(new_snap, "archive/2017-photos/a.jpg", S_IFREG, 4, 100, 1);
+	add_entry(new_snap, "archive/2017-photos/c.jpg", S_IFREG, 5, 100, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"create - /r/archive\n"
+			"move /r/photos/2017 /r/archive/2017-photos\n"
+			"move /r/photos/2017/b.jpg /r/archive/2017-photos/c.jpg\n"
+			"delete /r/photos -\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_rename_chain() {
+	/* mv b c; mv a b */
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "a", S_IFREG, 2, 10, 1);
+	add_entry(old_snap, "b", S_IFREG, 3, 20, 1);
+
+	add_entry(new_snap, "b", S_IFREG, 2, 10, 1);
+	add_entry(new_snap, "c", S_IFREG, 3, 20, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"move /r/b /r/c\n"
+			"move /r/a /r/b\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_move_by_digest() {
+	unsigned char digest[16];
+	memset(digest, 7, sizeof(digest));
+
+	/* A different inode, as when restored from elsewhere, with the same contents */
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	path_id id = add_entry(old_snap, "report.txt", S_IFREG, 2, 10, 1);
+	memcpy(snap_get(old_snap, id)->digest, digest, sizeof(digest));
+	snap_get(old_snap, id)->flags |= SNAP_HAS_DIGEST;
+
+	id = add_entry(new_snap, "report-final.txt", S_IFREG, 9, 10, 5);
+	memcpy(snap_get(new_snap, id)->digest, digest, sizeof(digest));
+	snap_get(new_snap, id)->flags |= SNAP_HAS_DIGEST;
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text, "move /r/report.txt /r/report-final.txt\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_type_change() {
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "x", S_IFREG, 2, 10, 1);
+	add_entry(new_snap, "x", S_IFDIR, 3, 0, 1);
+	add_entry(new_snap, "x/y", S_IFREG, 4, 10, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"delete /r/x -\n"
+			"create - /r/x\n"
+			"create - /r/x/y\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+
+	/* A directory moved onto the name of a deleted file, with a file changed in it */
+	old_snap = snap_create("/r");
+	new_snap = snap_create("/r");
+	add_entry(old_snap, "b", S_IFREG, 2, 10, 1);
+	add_entry(old_snap, "a", S_IFDIR, 3, 0, 1);
+	add_entry(old_snap, "a/f", S_IFREG, 4, 10, 1);
+	add_entry(new_snap, "b", S_IFDIR, 3, 0, 1);
+	add_entry(new_snap, "b/f", S_IFREG, 4, 12, 2);
+
+	changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"delete /r/b -\n"
+			"move /r/a /r/b\n"
+			"modify /r/a/f /r/b/f\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_rename_reuse_name() {
+	/* mv a b; mkdir a */
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "a", S_IFREG, 2, 10, 1);
+	add_entry(new_snap, "a", S_IFDIR, 3, 0, 1);
+	add_entry(new_snap, "b", S_IFREG, 2, 10, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"move /r/a /r/b\n"
+			"create - /r/a\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void test_treediff_move_dir_recreate() {
+	/* mv x y && mkdir x && mkdir x/sub, with x listed before y */
+	snapshot old_snap = snap_create("/r");
+	snapshot new_snap = snap_create("/r");
+	add_entry(old_snap, "x", S_IFDIR, 2, 0, 1);
+	add_entry(old_snap, "x/f", S_IFREG, 3, 10, 1);
+	add_entry(old_snap, "x/g", S_IFREG, 4, 10, 1);
+
+	add_entry(new_snap, "x", S_IFDIR, 5, 0, 1);
+	add_entry(new_snap, "x/sub", S_IFDIR, 6, 0, 1);
+	add_entry(new_snap, "y", S_IFDIR, 2, 0, 1);
+	add_entry(new_snap, "y/f", S_IFREG, 3, 10, 1);
+	add_entry(new_snap, "y/g", S_IFREG, 4, 10, 1);
+
+	struct recorded_changes *changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"move /r/x /r/y\n"
+			"create - /r/x\n"
+			"create - /r/x/sub\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+
+	/* The same, with y listed first */
+	old_snap = snap_create("/r");
+	new_snap = snap_create("/r");
+	add_entry(old_snap, "x", S_IFDIR, 2, 0, 1);
+	add_entry(old_snap, "x/f", S_IFREG, 3, 10, 1);
+	add_entry(new_snap, "y", S_IFDIR, 2, 0, 1);
+	add_entry(new_snap, "y/f", S_IFREG, 3, 10, 1);
+	add_entry(new_snap, "x", S_IFDIR, 5, 0, 1);
+
+	changes = diff(old_snap, new_snap);
+	assert(strcmp(changes->text,
+			"move /r/x /r/y\n"
+			"create - /r/x\n") == 0);
+	free(changes);
+	snap_destroy(old_snap);
+	snap_destroy(new_snap);
+}
+
+void write_file(const char *dir, const char *name, const char *contents) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	fputs(contents, file);
+	fclose(file);
+}
+
+void test_treediff_scan_save_load() {
+	char dir[] = "/tmp/goodrive_treediff_XXXXXX";
+	assert(mkdtemp(dir) != NULL);
+	char path[256], new_path[256], snap_path[256];
+
+	snprintf(path, sizeof(path), "%s/docs", dir);
+	assert(mkdir(path, 0755) == 0);
+	write_file(dir, "docs/a.txt", "alpha");
+	write_file(dir, "docs/b.txt", "beta");
+	write_file(dir, "top.txt", "top");
+
+	snapshot old_snap = snap_scan(dir, 1);
+	assert(old_snap != NULL);
+	assert(ps_num_entries(snap_paths(old_snap)) == 5);
+	path_id id = ps_lookup_path(snap_paths(old_snap), PATH_ID_ROOT, "docs/a.txt");
+	assert(snap_get(old_snap, id)->flags & SNAP_HAS_DIGEST);
+	assert(snap_get(old_snap, id)->size == 5);
+
+	/* Round trip through the snapshot file */
+	snprintf(snap_path, sizeof(snap_path), "%s.snap", dir);
+	assert(snap_save(old_snap, snap_path) == 0);
+	snapshot loaded = snap_load(snap_path);
+	assert(loaded != NULL);
+	struct recorded_changes *changes = diff(old_snap, loaded);
+	assert(changes->count == 0);
+	free(changes);
+	unlink(snap_path);
+
+	/* Rename the directory, and change a file in it */
+	snprintf(new_path, sizeof(new_path), "%s/documents", dir);
+	assert(rename(path, new_path) == 0);
+	write_file(dir, "documents/b.txt", "beta, revised");
+
+	snapshot new_snap = snap_scan(dir, 1);
+	changes = diff(loaded, new_snap);
+	char expected[1024];
+	snprintf(expected, sizeof(expected),
+			"move %s/docs %s/documents\n"
+			"modify %s/docs/b.txt %s/documents/b.txt\n", dir, dir, dir, dir);
+	assert(strcmp(changes->text, expected) == 0);
+	free(changes);
+
+	snap_destroy(old_snap);
+	snap_destroy(loaded);
+	snap_destroy(new_snap);
+
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	assert(system(path) == 0);
+}
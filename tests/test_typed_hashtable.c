@@ -0,0 +1,189 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typed_hashtable.h>
+
+#define REFERENCE_KEYS 200
+
+/* Helper functions for the test cases */
+/* Terrible Hash function, putting every key in the same probe sequence */
+size_t terrible_hash_fn(int key);
+
+/* Map whose keys all collide */
+TYPED_HT_DEFINE(clash_map, int, int, -1, terrible_hash_fn);
+
+/* Test Cases */
+/* Test the insertion, and the update of existing keys */
+void test_typed_ht_insertion();
+/* Test the growth of the maps */
+void test_typed_ht_growth();
+/* Test the removal */
+void test_typed_ht_removal();
+/* Test random insertions and removals with colliding keys, against an array */
+void test_typed_ht_removal_terrible_hashfn();
+/* Test the maps of watch descriptors, whose empty key is not 0 */
+void test_typed_ht_wd();
+
+/* Typed Hashtable Test suite */
+void test_typed_hashtable();
+
+int main() {
+	test_typed_hashtable();
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_typed_hashtable() {
+	test_typed_ht_insertion();
+	test_typed_ht_growth();
+	test_typed_ht_removal();
+	test_typed_ht_removal_terrible_hashfn();
+	test_typed_ht_wd();
+}
+
+size_t terrible_hash_fn(int key) {
+	return 5;
+}
+
+void test_typed_ht_insertion() {
+	inode_map map = inode_map_create(0);
+	assert(map != NULL);
+	assert(inode_map_num_entries(map) == 0);
+	assert(inode_map_get(map, 42) == NULL);
+	assert(inode_map_put(map, 42, 7) == 0);
+	assert(inode_map_put(map, 1ULL << 40, 8) == 0);
+	assert(*inode_map_get(map, 42) == 7);
+	assert(*inode_map_get(map, 1ULL << 40) == 8);
+	assert(inode_map_num_entries(map) == 2);
+
+	/* Existing keys are updated in place */
+	assert(inode_map_put(map, 42, 9) == 1);
+	assert(*inode_map_get(map, 42) == 9);
+	*inode_map_get(map, 42) = 10;
+	assert(*inode_map_get(map, 42) == 10);
+	assert(inode_map_num_entries(map) == 2);
+
+	/* The empty key cannot be stored */
+	assert(inode_map_put(map, 0, 1) == -1);
+	assert(inode_map_get(map, 0) == NULL);
+	inode_map_destroy(map);
+}
+
+void test_typed_ht_growth() {
+	inode_map map = inode_map_create(0);
+	for (uint64_t ino = 1; ino <= 100000; ino++) {
+		assert(inode_map_put(map, ino * 4096, (path_id) ino) == 0);
+	}
+	assert(inode_map_num_entries(map) == 100000);
+	for (uint64_t ino = 1; ino <= 100000; ino++) {
+		path_id *id = inode_map_get(map, ino * 4096);
+		assert(id != NULL && *id == ino);
+		assert(inode_map_get(map, ino * 4096 + 1) == NULL);
+	}
+	inode_map_destroy(map);
+
+	/* Sized up front, it does not need to grow */
+	map = inode_map_create(1000);
+	struct inode_map_slot *slots = map->slots;
+	for (uint64_t ino = 1; ino <= 1000; ino++) {
+		inode_map_put(map, ino, 0);
+	}
+	assert(map->slots == slots);
+	inode_map_destroy(map);
+}
+
+void test_typed_ht_removal() {
+	path_map map = path_map_create(0);
+	for (path_id id = 1; id <= 1000; id++) {
+		path_map_put(map, id, id + 1);
+	}
+	path_id value = 0;
+	for (path_id id = 1; id <= 1000; id += 2) {
+		assert(path_map_remove(map, id, &value) == 0);
+		assert(value == id + 1);
+	}
+	assert(path_map_remove(map, 1, &value) == -1);
+	assert(path_map_remove(map, 5000, NULL) == -1);
+	assert(path_map_num_entries(map) == 500);
+	for (path_id id = 1; id <= 1000; id++) {
+		path_id *found = path_map_get(map, id);
+		if (id % 2) {
+			assert(found == NULL);
+		} else {
+			assert(found != NULL && *found == id + 1);
+		}
+	}
+	path_map_destroy(map);
+}
+
+void test_typed_ht_removal_terrible_hashfn() {
+	/* Values of the keys present, -1 for the others */
+	int reference[REFERENCE_KEYS];
+	memset(reference, -1, sizeof(reference));
+	clash_map map = clash_map_create(0);
+	srand(1);
+	for (int op = 0; op < 20000; op++) {
+		int key = rand() % REFERENCE_KEYS;
+		int expected = reference[key];
+		if (rand() % 2) {
+			assert(clash_map_put(map, key, op) == (expected != -1));
+			reference[key] = op;
+		} else {
+			int value;
+			assert(clash_map_remove(map, key, &value) == ((expected != -1) ? 0 : -1));
+			assert(expected == -1 || value == expected);
+			reference[key] = -1;
+		}
+
+		if (op % 100 == 0) {
+			size_t num_entries = 0;
+			for (int i = 0; i < REFERENCE_KEYS; i++) {
+				int *value = clash_map_get(map, i);
+				assert((value == NULL) == (reference[i] == -1));
+				assert(value == NULL || *value == reference[i]);
+				num_entries += (value != NULL);
+			}
+			assert(clash_map_num_entries(map) == num_entries);
+		}
+	}
+	clash_map_destroy(map);
+}
+
+void test_typed_ht_wd() {
+	wd_map map = wd_map_create(4);
+	assert(wd_map_put(map, 0, 3) == 0);
+	assert(wd_map_put(map, 1, 4) == 0);
+	assert(wd_map_put(map, -1, 5) == -1);
+	assert(*wd_map_get(map, 0) == 3);
+	assert(wd_map_get(map, -1) == NULL);
+	assert(wd_map_remove(map, 0, NULL) == 0);
+	assert(wd_map_get(map, 0) == NULL);
+	assert(*wd_map_get(map, 1) == 4);
+	wd_map_destroy(map);
+}
@@ -0,0 +1,431 @@
+/*
+ *                ______            ____       _
+ *               / ____/___  ____  / __ \_____(_)   _____
+ *              / / __/ __ \/ __ \/ / / / ___/ / | / / _ \
+ * Project     / /_/ / /_/ / /_/ / /_/ / /  / /| |/ /  __/
+ *             \____/\____/\____/_____/_/  /_/ |___/\___/
+ *
+ * Copyright (C) 2017-2018 Pradeep Kumar <pradeep.tux@gmail.com>
+ *
+ * This file is part of project GooDrive.
+ *
+ * GooDrive is free software: You can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GooDrive is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GooDrive.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <compress.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <loopback.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <upload.h>
+
+#define NUM_FILES 3
+#define CHUNK_SIZE 4096
+
+/* Helper functions for the test cases */
+/* Create a file of the given size, with varying contents */
+void make_file(char *path, size_t size);
+/* Check that the store holds the same contents as the file */
+void check_object(struct transport *transport, char *path);
+/* Create a text file of the given number of lines */
+void make_text_file(char *path, int num_lines);
+/* Check that the store holds the file, compressed with the codec */
+void check_compressed_object(struct transport *transport, char *path, enum compress_codec codec);
+/* Count the files in the state directory with the string in their names */
+int count_state_files(const char *str);
+/* Count the session records in the state directory */
+int count_records();
+/* Options used by the test cases */
+void test_options(struct upload_options *options);
+
+/* Test Cases */
+/* Test uploading without any faults */
+void test_upload_files();
+/* Test uploading with lost requests */
+void test_upload_loss();
+/* Test resuming an interrupted upload */
+void test_upload_resume();
+/* Test compressing the files that are worth it */
+void test_upload_compressed();
+/* Test copying the files already in the store */
+void test_upload_dedup();
+/* Test sending the chunks from the calling thread, with lost requests */
+void test_upload_inline();
+
+/* Upload Test suite */
+void test_upload();
+
+char test_dir[] = "/tmp/goodrive_upload_XXXXXX";
+char state_dir[64];
+char file_paths[NUM_FILES][64];
+char *files[NUM_FILES];
+size_t file_sizes[NUM_FILES] = { 0, 100, 10 * CHUNK_SIZE + 123 };
+
+int main() {
+	assert(mkdtemp(test_dir) != NULL);
+	snprintf(state_dir, sizeof(state_dir), "%s/state", test_dir);
+	for (int i = 0; i < NUM_FILES; i++) {
+		snprintf(file_paths[i], sizeof(file_paths[i]), "%s/file%d", test_dir, i);
+		make_file(file_paths[i], file_sizes[i]);
+		files[i] = file_paths[i];
+	}
+
+	test_upload();
+
+	char command[128];
+	snprintf(command, sizeof(command), "rm -rf %s", test_dir);
+	assert(system(command) == 0);
+	return 0;
+}
+
+/* Register all the test functions here */
+void test_upload() {
+	test_upload_files();
+	test_upload_loss();
+	test_upload_resume();
+	test_upload_compressed();
+	test_upload_dedup();
+	test_upload_inline();
+}
+
+void make_file(char *path, size_t size) {
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	for (size_t i = 0; i < size; i++) {
+		fputc((i * 7 + i / 251) & 0xff, file);
+	}
+	fclose(file);
+}
+
+void check_object(struct transport *transport, char *path) {
+	struct stat file_stat;
+	assert(stat(path, &file_stat) == 0);
+	size_t size;
+	const unsigned char *data = loopback_get_object(transport, path, &size);
+	assert(data != NULL);
+	assert(size == (size_t) file_stat.st_size);
+
+	FILE *file = fopen(path, "r");
+	for (size_t i = 0; i < size; i++) {
+		assert(fgetc(file) == data[i]);
+	}
+	fclose(file);
+}
+
+void make_text_file(char *path, int num_lines) {
+	FILE *file = fopen(path, "w");
+	assert(file != NULL);
+	for (int i = 0; i < num_lines; i++) {
+		fprintf(file, "2018-03-01 10:%02d:%02d INFO watch added for /home/user/dir%d\n",
+				i / 60 % 60, i % 60, i % 97);
+	}
+	fclose(file);
+}
+
+void check_compressed_object(struct transport *transport, char *path, enum compress_codec codec) {
+	char name[128];
+	snprintf(name, sizeof(name), "%s%s", path, compress_suffix(codec));
+	size_t size;
+	const unsigned char *data = loopback_get_object(transport, name, &size);
+	assert(data != NULL);
+
+	char compressed_path[128], decompressed_path[128];
+	snprintf(compressed_path, sizeof(compressed_path), "%s/compressed", test_dir);
+	snprintf(decompressed_path, sizeof(decompressed_path), "%s/decompressed", test_dir);
+	FILE *file = fopen(compressed_path, "w");
+	assert(fwrite(data, 1, size, file) == size);
+	fclose(file);
+	int src_fd = open(compressed_path, O_RDONLY);
+	int dst_fd = open(decompressed_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	assert(decompress_stream(codec, src_fd, dst_fd) == 0);
+	close(src_fd);
+	close(dst_fd);
+
+	char command[512];
+	snprintf(command, sizeof(command), "cmp -s %s %s", path, decompressed_path);
+	assert(system(command) == 0);
+	unlink(compressed_path);
+	unlink(decompressed_path);
+}
+
+int count_state_files(const char *str) {
+	DIR *dir = opendir(state_dir);
+	assert(dir != NULL);
+	int count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strstr(entry->d_name, str) != NULL) {
+			count++;
+		}
+	}
+	closedir(dir);
+	return count;
+}
+
+int count_records() {
+	return count_state_files(".upload");
+}
+
+void test_options(struct upload_options *options) {
+	upload_default_options(options);
+	options->chunk_size = CHUNK_SIZE;
+	options->queue_size = 4;
+	options->backoff_us = 10;
+	options->state_dir = state_dir;
+}
+
+void test_upload_files() {
+	struct transport *transport = loopback_create(NULL);
+	struct upload_options options;
+	test_options(&options);
+
+	struct upload_stats stats;
+	assert(upload_files(transport, files, NUM_FILES, &options, &stats) == 0);
+	assert(stats.files_done == NUM_FILES);
+	assert(stats.files_failed == 0);
+	assert(stats.chunks_sent == 12);
+	assert(stats.bytes_sent == file_sizes[1] + file_sizes[2]);
+	assert(stats.retries == 0);
+	for (int i = 0; i < NUM_FILES; i++) {
+		check_object(transport, files[i]);
+	}
+	assert(count_records() == 0);
+
+	/* Missing files fail on their own */
+	char *missing[] = { "/nonexistent/goodrive", files[1] };
+	assert(upload_files(transport, missing, 2, &options, &stats) == 1);
+	assert(stats.files_done == 1);
+	transport->destroy(transport);
+}
+
+void test_upload_loss() {
+	struct loopback_options lb_options = { 0, 30, -1, 1 };
+	struct transport *transport = loopback_create(&lb_options);
+	struct upload_options options;
+	test_options(&options);
+	options.max_retries = 50;
+
+	struct upload_stats stats;
+	assert(upload_files(transport, files, NUM_FILES, &options, &stats) == 0);
+	assert(stats.files_done == NUM_FILES);
+	assert(stats.retries > 0);
+	for (int i = 0; i < NUM_FILES; i++) {
+		check_object(transport, files[i]);
+	}
+	assert(count_records() == 0);
+	transport->destroy(transport);
+}
+
+void test_upload_resume() {
+	/* The connection drops after 4 chunks */
+	struct loopback_options lb_options = { 0, 0, 4, 0 };
+	struct transport *transport = loopback_create(&lb_options);
+	struct upload_options options;
+	test_options(&options);
+	options.num_senders = 1;
+	options.max_retries = 2;
+
+	struct upload_stats stats;
+	assert(upload_files(transport, &files[2], 1, &options, &stats) == 1);
+	assert(stats.bytes_sent == 4 * CHUNK_SIZE);
+	assert(count_records() == 1);
+	size_t size;
+	assert(loopback_get_object(transport, files[2], &size) == NULL);
+
+	/* Only the rest of the file is sent */
+	lb_options.max_chunks = -1;
+	loopback_set_options(transport, &lb_options);
+	assert(upload_files(transport, &files[2], 1, &options, &stats) == 0);
+	assert(stats.bytes_resumed == 4 * CHUNK_SIZE);
+	assert(stats.bytes_sent == file_sizes[2] - 4 * CHUNK_SIZE);
+	check_object(transport, files[2]);
+	assert(count_records() == 0);
+
+	/* A file changed since the interruption is sent afresh */
+	lb_options.max_chunks = 6;
+	loopback_set_options(transport, &lb_options);
+	assert(upload_files(transport, &files[2], 1, &options, &stats) == 1);
+	make_file(files[2], file_sizes[2] + 1);
+	lb_options.max_chunks = -1;
+	loopback_set_options(transport, &lb_options);
+	assert(upload_files(transport, &files[2], 1, &options, &stats) == 0);
+	assert(stats.bytes_resumed == 0);
+	check_object(transport, files[2]);
+	transport->destroy(transport);
+}
+
+void test_upload_compressed() {
+	struct compress_options compress;
+	compress_default_options(&compress);
+	if (compress.codec == COMPRESS_NONE) {
+		/* No codec is built in */
+		return;
+	}
+
+	char text_path[64];
+	snprintf(text_path, sizeof(text_path), "%s/log.txt", test_dir);
+	make_text_file(text_path, 2000);
+	struct stat text_stat, random_stat;
+	assert(stat(text_path, &text_stat) == 0);
+	assert(stat(files[2], &random_stat) == 0);
+	/* The random looking file and the tiny one are sent as they are */
+	char *paths[] = { text_path, files[1], files[2] };
+
+	struct loopback_options lb_options = { 0, 0, -1, 0 };
+	struct transport *transport = loopback_create(&lb_options);
+	struct upload_options options;
+	test_options(&options);
+	options.compress = &compress;
+
+	struct upload_stats stats;
+	assert(upload_files(transport, paths, 3, &options, &stats) == 0);
+	assert(stats.files_done == 3);
+	assert(stats.files_compressed == 1);
+	assert(stats.bytes_uncompressed == (unsigned long long) text_stat.st_size);
+	assert(stats.bytes_compressed < stats.bytes_uncompressed / 4);
+	assert(stats.bytes_sent == stats.bytes_compressed + file_sizes[1] + random_stat.st_size);
+	check_compressed_object(transport, text_path, compress.codec);
+	check_object(transport, files[1]);
+	check_object(transport, files[2]);
+	assert(count_state_files(".spool") == 0);
+
+	/* An interrupted upload resumes from the same spool */
+	make_text_file(text_path, 20000);
+	options.num_senders = 1;
+	options.max_retries = 2;
+	struct loopback_stats lb_stats;
+	loopback_get_stats(transport, &lb_stats);
+	lb_options.max_chunks = lb_stats.chunks + 1;
+	loopback_set_options(transport, &lb_options);
+	assert(upload_files(transport, paths, 1, &options, &stats) == 1);
+	assert(count_records() == 1);
+	assert(count_state_files(".spool") == 1);
+	lb_options.max_chunks = -1;
+	loopback_set_options(transport, &lb_options);
+	assert(upload_files(transport, paths, 1, &options, &stats) == 0);
+	assert(stats.bytes_resumed == CHUNK_SIZE);
+	assert(stats.bytes_sent == stats.bytes_compressed - CHUNK_SIZE);
+	check_compressed_object(transport, text_path, compress.codec);
+	assert(count_records() == 0);
+	assert(count_state_files(".spool") == 0);
+
+	/* Not worth compressing any more, the file is sent as it is, and its compressed object goes */
+	FILE *file = fopen(text_path, "w");
+	assert(file != NULL);
+	unsigned int seed = 1;
+	for (int i = 0; i < 20000; i++) {
+		fputc(rand_r(&seed) & 0xff, file);
+	}
+	fclose(file);
+	assert(upload_files(transport, paths, 1, &options, &stats) == 0);
+	assert(stats.files_compressed == 0);
+	check_object(transport, text_path);
+	char name[128];
+	size_t size;
+	snprintf(name, sizeof(name), "%s%s", text_path, compress_suffix(compress.codec));
+	assert(loopback_get_object(transport, name, &size) == NULL);
+
+	/* Compressed again, the object sent as it is goes */
+	make_text_file(text_path, 2000);
+	assert(upload_files(transport, paths, 1, &options, &stats) == 0);
+	assert(stats.files_compressed == 1);
+	check_compressed_object(transport, text_path, compress.codec);
+	assert(loopback_get_object(transport, text_path, &size) == NULL);
+
+	/* Without compression, the same file is sent as it is */
+	options.compress = NULL;
+	assert(upload_files(transport, paths, 1, &options, &stats) == 0);
+	assert(stats.files_compressed == 0);
+	check_object(transport, text_path);
+	transport->destroy(transport);
+	unlink(text_path);
+}
+
+void test_upload_dedup() {
+	char copy_path[64];
+	snprintf(copy_path, sizeof(copy_path), "%s/copy", test_dir);
+	make_file(copy_path, file_sizes[2]);
+	make_file(files[2], file_sizes[2]);
+	char *paths[] = { files[2], copy_path };
+
+	struct transport *transport = loopback_create(NULL);
+	struct upload_options options;
+	test_options(&options);
+	options.dedup = dedup_create();
+
+	/* The second file is copied within the store */
+	struct upload_stats stats;
+	assert(upload_files(transport, paths, 2, &options, &stats) == 0);
+	assert(stats.files_done == 2);
+	assert(stats.files_deduplicated == 1);
+	assert(stats.bytes_deduplicated == file_sizes[2]);
+	assert(stats.bytes_sent == file_sizes[2]);
+	check_object(transport, files[2]);
+	check_object(transport, copy_path);
+	struct loopback_stats lb_stats;
+	loopback_get_stats(transport, &lb_stats);
+	assert(lb_stats.copies == 1);
+
+	/* Unchanged files are not sent again */
+	assert(upload_files(transport, paths, 2, &options, &stats) == 0);
+	assert(stats.files_deduplicated == 2);
+	assert(stats.bytes_sent == 0);
+
+	/* Another store has none of them */
+	options.dedup_store = "other@example.com";
+	struct transport *other = loopback_create(NULL);
+	assert(upload_files(other, paths, 2, &options, &stats) == 0);
+	assert(stats.files_deduplicated == 1);
+	assert(stats.bytes_sent == file_sizes[2]);
+	check_object(other, copy_path);
+	other->destroy(other);
+
+	/* Objects that no longer hold the contents are not copied */
+	options.dedup_store = NULL;
+	loopback_put_object(transport, files[2], "changed", 7);
+	loopback_put_object(transport, copy_path, "changed", 7);
+	assert(upload_files(transport, &paths[1], 1, &options, &stats) == 0);
+	assert(stats.files_deduplicated == 0);
+	assert(stats.bytes_sent == file_sizes[2]);
+	check_object(transport, copy_path);
+
+	dedup_destroy(options.dedup);
+	transport->destroy(transport);
+	unlink(copy_path);
+}
+
+void test_upload_inline() {
+	struct loopback_options lb_options = { 0, 30, -1, 1 };
+	struct transport *transport = loopback_create(&lb_options);
+	struct upload_options options;
+	test_options(&options);
+	options.num_senders = 0;
+	options.max_retries = 50;
+
+	struct upload_stats stats;
+	assert(upload_files(transport, files, NUM_FILES, &options, &stats) == 0);
+	assert(stats.files_done == NUM_FILES);
+	assert(stats.chunks_sent == 12);
+	assert(stats.retries > 0);
+	for (int i = 0; i < NUM_FILES; i++) {
+		check_object(transport, files[i]);
+	}
+	assert(count_records() == 0);
+	transport->destroy(transport);
+}